@@ -32,8 +32,7 @@ bool SerializeDB(Stream& stream, const Data& data)
     return true;
 }
 
-template <typename Data>
-bool SerializeFileDB(const std::string& prefix, const fs::path& path, const Data& data)
+bool WriteFileDB(const std::string& prefix, const fs::path& path, const CDataStream& stream)
 {
     // Generate random temporary filename
     unsigned short randv = 0;
@@ -47,8 +46,12 @@ bool SerializeFileDB(const std::string& prefix, const fs::path& path, const Data
     if (fileout.IsNull())
         return error("%s: Failed to open file %s", __func__, pathTmp.string());
 
-    // Serialize
-    if (!SerializeDB(fileout, data)) return false;
+    // Write
+    try {
+        fileout.write(&stream[0], stream.size());
+    } catch (const std::exception& e) {
+        return error("%s: I/O error - %s", __func__, e.what());
+    }
     FileCommit(fileout.Get());
     fileout.fclose();
 
@@ -59,6 +62,15 @@ bool SerializeFileDB(const std::string& prefix, const fs::path& path, const Data
     return true;
 }
 
+template <typename Data>
+bool SerializeFileDB(const std::string& prefix, const fs::path& path, const Data& data)
+{
+    // Serialize in memory, then write the file in one go
+    CDataStream stream(SER_DISK, CLIENT_VERSION);
+    if (!SerializeDB(stream, data)) return false;
+    return WriteFileDB(prefix, path, stream);
+}
+
 template <typename Stream, typename Data>
 bool DeserializeDB(Stream& stream, Data& data, bool fCheckSum = true)
 {
@@ -90,8 +102,7 @@ bool DeserializeDB(Stream& stream, Data& data, bool fCheckSum = true)
     return true;
 }
 
-template <typename Data>
-bool DeserializeFileDB(const fs::path& path, Data& data)
+bool ReadFileDB(const fs::path& path, CDataStream& stream)
 {
     // open input file, and associate with CAutoFile
     FILE *file = fsbridge::fopen(path, "rb");
@@ -99,7 +110,112 @@ bool DeserializeFileDB(const fs::path& path, Data& data)
     if (filein.IsNull())
         return error("%s: Failed to open file %s", __func__, path.string());
 
-    return DeserializeDB(filein, data);
+    // Read the whole file with a single call
+    try {
+        stream.resize(fs::file_size(path));
+        filein.read(stream.data(), stream.size());
+    } catch (const std::exception& e) {
+        return error("%s: I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+template <typename Data>
+bool DeserializeFileDB(const fs::path& path, Data& data, uint256* pHash = nullptr)
+{
+    CDataStream stream(SER_DISK, CLIENT_VERSION);
+    if (!ReadFileDB(path, stream))
+        return false;
+
+    // Verify the checksum over the whole buffer at once rather than while
+    // deserializing, then deserialize from memory.
+    if (stream.size() < sizeof(uint256))
+        return error("%s: File %s too short", __func__, path.string());
+    uint256 hashFile;
+    memcpy(hashFile.begin(), &stream[stream.size() - sizeof(uint256)], sizeof(uint256));
+    if (Hash(stream.begin(), stream.end() - sizeof(uint256)) != hashFile)
+        return error("%s: Checksum mismatch, data corrupted", __func__);
+    stream.resize(stream.size() - sizeof(uint256));
+    if (pHash)
+        *pHash = hashFile;
+
+    return DeserializeDB(stream, data, false);
+}
+
+// The peers.dat journal starts with the network magic and the checksum of the
+// peers.dat it applies to, followed by batches of changes to that file, each
+// a vector of CAddrJournalEntry and its checksum. Batches are only ever
+// appended; a torn final batch is truncated away on the next load.
+bool WriteJournalHeader(const fs::path& path, const uint256& hashPeers)
+{
+    CDataStream stream(SER_DISK, CLIENT_VERSION);
+    stream << FLATDATA(Params().MessageStart()) << hashPeers;
+    return WriteFileDB("peers.journal", path, stream);
+}
+
+bool AppendJournal(const fs::path& path, const CDataStream& stream)
+{
+    FILE *file = fsbridge::fopen(path, "ab");
+    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        return error("%s: Failed to open file %s", __func__, path.string());
+    try {
+        fileout.write(&stream[0], stream.size());
+    } catch (const std::exception& e) {
+        return error("%s: I/O error - %s", __func__, e.what());
+    }
+    FileCommit(fileout.Get());
+    return true;
+}
+
+bool ReplayJournal(const fs::path& path, const uint256& hashPeers, CAddrMan& addr)
+{
+    CDataStream stream(SER_DISK, CLIENT_VERSION);
+    if (!ReadFileDB(path, stream))
+        return false;
+    const size_t nFileSize = stream.size();
+
+    try {
+        unsigned char pchMsgTmp[4];
+        uint256 hashTmp;
+        stream >> FLATDATA(pchMsgTmp) >> hashTmp;
+        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)) || hashTmp != hashPeers)
+            return error("%s: Journal does not belong to peers.dat", __func__);
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize error - %s", __func__, e.what());
+    }
+
+    size_t nValidSize = nFileSize - stream.size();
+    int nBatches = 0;
+    while (!stream.empty()) {
+        std::vector<CAddrJournalEntry> vEntries;
+        try {
+            CHashVerifier<CDataStream> verifier(&stream);
+            verifier >> vEntries;
+            uint256 hashBatch;
+            stream >> hashBatch;
+            if (hashBatch != verifier.GetHash())
+                break;
+        } catch (const std::exception& e) {
+            break;
+        }
+        addr.ApplyJournal(vEntries);
+        nValidSize = nFileSize - stream.size();
+        nBatches++;
+    }
+
+    if (nValidSize != nFileSize) {
+        LogPrintf("%s: Truncating %u bytes of incomplete journal data\n", __func__, nFileSize - nValidSize);
+        FILE *file = fsbridge::fopen(path, "rb+");
+        if (!file || !TruncateFile(file, nValidSize)) {
+            if (file) fclose(file);
+            return error("%s: Failed to truncate %s", __func__, path.string());
+        }
+        FileCommit(file);
+        fclose(file);
+    }
+    LogPrint(BCLog::ADDRMAN, "Replayed %d batches from %s\n", nBatches, path.string());
+    return true;
 }
 
 }
@@ -122,16 +238,65 @@ bool CBanDB::Read(banmap_t& banSet)
 CAddrDB::CAddrDB()
 {
     pathAddr = GetDataDir() / "peers.dat";
+    pathJournal = GetDataDir() / "peers.journal";
 }
 
 bool CAddrDB::Write(const CAddrMan& addr)
 {
-    return SerializeFileDB("peers", pathAddr, addr);
+    CDataStream stream(SER_DISK, CLIENT_VERSION);
+    if (!SerializeDB(stream, addr))
+        return false;
+    if (!WriteFileDB("peers", pathAddr, stream))
+        return false;
+
+    // Start a new journal, tied to this peers.dat by its checksum
+    uint256 hashPeers;
+    memcpy(hashPeers.begin(), &stream[stream.size() - sizeof(uint256)], sizeof(uint256));
+    return WriteJournalHeader(pathJournal, hashPeers);
+}
+
+bool CAddrDB::WriteIncremental(CAddrMan& addr)
+{
+    std::vector<CAddrJournalEntry> vEntries;
+    bool fAppend = addr.GetJournal(vEntries) && fs::exists(pathAddr) && fs::exists(pathJournal);
+    if (fAppend && vEntries.empty())
+        return true;
+
+    bool ret = false;
+    if (fAppend) {
+        CDataStream stream(SER_DISK, CLIENT_VERSION);
+        stream << vEntries;
+        stream << Hash(stream.begin(), stream.end());
+        try {
+            // Compact once the journal would outgrow peers.dat itself
+            fAppend = fs::file_size(pathJournal) + stream.size() <= fs::file_size(pathAddr);
+            ret = !fAppend || AppendJournal(pathJournal, stream);
+        } catch (const fs::filesystem_error& e) {
+            ret = error("%s: %s", __func__, e.what());
+        }
+    }
+    if (!fAppend)
+        ret = Write(addr);
+
+    if (!ret) {
+        // Hand the changes back, so that they are part of the next save: a
+        // failed append is retried with them, a failed rewrite in full
+        addr.RestoreJournal(vEntries, fAppend);
+    }
+    return ret;
 }
 
 bool CAddrDB::Read(CAddrMan& addr)
 {
-    return DeserializeFileDB(pathAddr, addr);
+    uint256 hashPeers;
+    if (!DeserializeFileDB(pathAddr, addr, &hashPeers))
+        return false;
+
+    if (fs::exists(pathJournal) && !ReplayJournal(pathJournal, hashPeers, addr)) {
+        // The next save rewrites peers.dat and starts a new journal
+        fs::remove(pathJournal);
+    }
+    return true;
 }
 
 bool CAddrDB::Read(CAddrMan& addr, CDataStream& ssPeers)
@@ -81,9 +81,14 @@ class CAddrDB
 {
 private:
     fs::path pathAddr;
+    fs::path pathJournal;
 public:
     CAddrDB();
+    //! Write out all addresses and start a new, empty journal
     bool Write(const CAddrMan& addr);
+    //! Append the changes made since the last save to the journal, or call Write once the journal grows too large
+    bool WriteIncremental(CAddrMan& addr);
+    //! Read peers.dat and replay its journal
     bool Read(CAddrMan& addr);
     static bool Read(CAddrMan& addr, CDataStream& ssPeers);
 };
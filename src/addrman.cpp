@@ -65,29 +65,45 @@ double CAddrInfo::GetChance(int64_t nNow) const
     return fChance;
 }
 
+SaltedNetAddrHasher::SaltedNetAddrHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+size_t SaltedNetAddrHasher::operator()(const CNetAddr& addr) const
+{
+    unsigned char ip[16];
+    for (int n = 0; n < 16; n++)
+        ip[n] = addr.GetByte(15 - n);
+    return CSipHasher(k0, k1).Write(ip, sizeof(ip)).Finalize();
+}
+
 CAddrInfo* CAddrMan::Find(const CNetAddr& addr, int* pnId)
 {
-    std::map<CNetAddr, int>::iterator it = mapAddr.find(addr);
+    auto it = mapAddr.find(addr);
     if (it == mapAddr.end())
         return nullptr;
     if (pnId)
         *pnId = (*it).second;
-    std::map<int, CAddrInfo>::iterator it2 = mapInfo.find((*it).second);
-    if (it2 != mapInfo.end())
-        return &(*it2).second;
-    return nullptr;
+    return &vInfo[(*it).second];
 }
 
 CAddrInfo* CAddrMan::Create(const CAddress& addr, const CNetAddr& addrSource, int* pnId)
 {
-    int nId = nIdCount++;
-    mapInfo[nId] = CAddrInfo(addr, addrSource);
+    // Note that growing vInfo invalidates pointers to existing entries.
+    int nId;
+    if (!vFreeIds.empty()) {
+        nId = vFreeIds.back();
+        vFreeIds.pop_back();
+        vInfo[nId] = CAddrInfo(addr, addrSource);
+    } else {
+        nId = vInfo.size();
+        vInfo.emplace_back(addr, addrSource);
+    }
     mapAddr[addr] = nId;
-    mapInfo[nId].nRandomPos = vRandom.size();
+    vInfo[nId].nRandomPos = vRandom.size();
     vRandom.push_back(nId);
+    MarkDirty(nId);
     if (pnId)
         *pnId = nId;
-    return &mapInfo[nId];
+    return &vInfo[nId];
 }
 
 void CAddrMan::SwapRandom(unsigned int nRndPos1, unsigned int nRndPos2)
@@ -100,27 +116,48 @@ void CAddrMan::SwapRandom(unsigned int nRndPos1, unsigned int nRndPos2)
     int nId1 = vRandom[nRndPos1];
     int nId2 = vRandom[nRndPos2];
 
-    assert(mapInfo.count(nId1) == 1);
-    assert(mapInfo.count(nId2) == 1);
+    assert(vInfo[nId1].nRandomPos == (int)nRndPos1);
+    assert(vInfo[nId2].nRandomPos == (int)nRndPos2);
 
-    mapInfo[nId1].nRandomPos = nRndPos2;
-    mapInfo[nId2].nRandomPos = nRndPos1;
+    vInfo[nId1].nRandomPos = nRndPos2;
+    vInfo[nId2].nRandomPos = nRndPos1;
 
     vRandom[nRndPos1] = nId2;
     vRandom[nRndPos2] = nId1;
 }
 
+void CAddrMan::MarkDirty(int nId)
+{
+    CAddrInfo& info = vInfo[nId];
+    if (info.fDirty || fJournalOverflow)
+        return;
+    if (vDirty.size() + vDeleted.size() >= ADDRMAN_JOURNAL_MAX_ENTRIES) {
+        fJournalOverflow = true;
+        return;
+    }
+    info.fDirty = true;
+    vDirty.push_back(nId);
+}
+
 void CAddrMan::Delete(int nId)
 {
-    assert(mapInfo.count(nId) != 0);
-    CAddrInfo& info = mapInfo[nId];
+    assert(nId >= 0 && (size_t)nId < vInfo.size() && vInfo[nId].nRandomPos != -1);
+    CAddrInfo& info = vInfo[nId];
     assert(!info.fInTried);
     assert(info.nRefCount == 0);
 
     SwapRandom(info.nRandomPos, vRandom.size() - 1);
     vRandom.pop_back();
     mapAddr.erase(info);
-    mapInfo.erase(nId);
+    if (!fJournalOverflow) {
+        if (vDirty.size() + vDeleted.size() >= ADDRMAN_JOURNAL_MAX_ENTRIES) {
+            fJournalOverflow = true;
+        } else {
+            vDeleted.push_back(info);
+        }
+    }
+    info = CAddrInfo();
+    vFreeIds.push_back(nId);
     nNew--;
 }
 
@@ -129,7 +166,7 @@ void CAddrMan::ClearNew(int nUBucket, int nUBucketPos)
     // if there is an entry in the specified bucket, delete it.
     if (vvNew[nUBucket][nUBucketPos] != -1) {
         int nIdDelete = vvNew[nUBucket][nUBucketPos];
-        CAddrInfo& infoDelete = mapInfo[nIdDelete];
+        CAddrInfo& infoDelete = vInfo[nIdDelete];
         assert(infoDelete.nRefCount > 0);
         infoDelete.nRefCount--;
         vvNew[nUBucket][nUBucketPos] = -1;
@@ -161,8 +198,8 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId)
     if (vvTried[nKBucket][nKBucketPos] != -1) {
         // find an item to evict
         int nIdEvict = vvTried[nKBucket][nKBucketPos];
-        assert(mapInfo.count(nIdEvict) == 1);
-        CAddrInfo& infoOld = mapInfo[nIdEvict];
+        CAddrInfo& infoOld = vInfo[nIdEvict];
+        MarkDirty(nIdEvict);
 
         // Remove the to-be-evicted item from the tried set.
         infoOld.fInTried = false;
@@ -185,6 +222,7 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId)
     vvTried[nKBucket][nKBucketPos] = nId;
     nTried++;
     info.fInTried = true;
+    MarkDirty(nId);
 }
 
 void CAddrMan::Good_(const CService& addr, int64_t nTime)
@@ -209,6 +247,7 @@ void CAddrMan::Good_(const CService& addr, int64_t nTime)
     info.nLastSuccess = nTime;
     info.nLastTry = nTime;
     info.nAttempts = 0;
+    MarkDirty(nId);
     // nTime is not updated here, to avoid leaking information about
     // currently-connected peers.
 
@@ -257,11 +296,16 @@ bool CAddrMan::Add_(const CAddress& addr, const CNetAddr& source, int64_t nTimeP
         // periodically update nTime
         bool fCurrentlyOnline = (GetAdjustedTime() - addr.nTime < 24 * 60 * 60);
         int64_t nUpdateInterval = (fCurrentlyOnline ? 60 * 60 : 24 * 60 * 60);
-        if (addr.nTime && (!pinfo->nTime || pinfo->nTime < addr.nTime - nUpdateInterval - nTimePenalty))
+        if (addr.nTime && (!pinfo->nTime || pinfo->nTime < addr.nTime - nUpdateInterval - nTimePenalty)) {
             pinfo->nTime = std::max((int64_t)0, addr.nTime - nTimePenalty);
+            MarkDirty(nId);
+        }
 
         // add services
-        pinfo->nServices = ServiceFlags(pinfo->nServices | addr.nServices);
+        if ((pinfo->nServices | addr.nServices) != pinfo->nServices) {
+            pinfo->nServices = ServiceFlags(pinfo->nServices | addr.nServices);
+            MarkDirty(nId);
+        }
 
         // do not update if no new information is present
         if (!addr.nTime || (pinfo->nTime && addr.nTime <= pinfo->nTime))
@@ -293,7 +337,7 @@ bool CAddrMan::Add_(const CAddress& addr, const CNetAddr& source, int64_t nTimeP
     if (vvNew[nUBucket][nUBucketPos] != nId) {
         bool fInsert = vvNew[nUBucket][nUBucketPos] == -1;
         if (!fInsert) {
-            CAddrInfo& infoExisting = mapInfo[vvNew[nUBucket][nUBucketPos]];
+            CAddrInfo& infoExisting = vInfo[vvNew[nUBucket][nUBucketPos]];
             if (infoExisting.IsTerrible() || (infoExisting.nRefCount > 1 && pinfo->nRefCount == 0)) {
                 // Overwrite the existing new table entry.
                 fInsert = true;
@@ -314,7 +358,8 @@ bool CAddrMan::Add_(const CAddress& addr, const CNetAddr& source, int64_t nTimeP
 
 void CAddrMan::Attempt_(const CService& addr, bool fCountFailure, int64_t nTime)
 {
-    CAddrInfo* pinfo = Find(addr);
+    int nId;
+    CAddrInfo* pinfo = Find(addr, &nId);
 
     // if not found, bail out
     if (!pinfo)
@@ -331,6 +376,7 @@ void CAddrMan::Attempt_(const CService& addr, bool fCountFailure, int64_t nTime)
     if (fCountFailure && info.nLastCountAttempt < nLastGood) {
         info.nLastCountAttempt = nTime;
         info.nAttempts++;
+        MarkDirty(nId);
     }
 }
 
@@ -354,9 +400,7 @@ CAddrInfo CAddrMan::Select_(bool newOnly)
                 nKBucket = (nKBucket + insecure_rand.randbits(ADDRMAN_TRIED_BUCKET_COUNT_LOG2)) % ADDRMAN_TRIED_BUCKET_COUNT;
                 nKBucketPos = (nKBucketPos + insecure_rand.randbits(ADDRMAN_BUCKET_SIZE_LOG2)) % ADDRMAN_BUCKET_SIZE;
             }
-            int nId = vvTried[nKBucket][nKBucketPos];
-            assert(mapInfo.count(nId) == 1);
-            CAddrInfo& info = mapInfo[nId];
+            const CAddrInfo& info = vInfo[vvTried[nKBucket][nKBucketPos]];
             if (RandomInt(1 << 30) < fChanceFactor * info.GetChance() * (1 << 30))
                 return info;
             fChanceFactor *= 1.2;
@@ -371,9 +415,7 @@ CAddrInfo CAddrMan::Select_(bool newOnly)
                 nUBucket = (nUBucket + insecure_rand.randbits(ADDRMAN_NEW_BUCKET_COUNT_LOG2)) % ADDRMAN_NEW_BUCKET_COUNT;
                 nUBucketPos = (nUBucketPos + insecure_rand.randbits(ADDRMAN_BUCKET_SIZE_LOG2)) % ADDRMAN_BUCKET_SIZE;
             }
-            int nId = vvNew[nUBucket][nUBucketPos];
-            assert(mapInfo.count(nId) == 1);
-            CAddrInfo& info = mapInfo[nId];
+            const CAddrInfo& info = vInfo[vvNew[nUBucket][nUBucketPos]];
             if (RandomInt(1 << 30) < fChanceFactor * info.GetChance() * (1 << 30))
                 return info;
             fChanceFactor *= 1.2;
@@ -390,9 +432,10 @@ int CAddrMan::Check_()
     if (vRandom.size() != (size_t)(nTried + nNew))
         return -7;
 
-    for (const auto& entry : mapInfo) {
-        int n = entry.first;
-        const CAddrInfo& info = entry.second;
+    for (int n = 0; n < (int)vInfo.size(); n++) {
+        const CAddrInfo& info = vInfo[n];
+        if (info.nRandomPos == -1)
+            continue;
         if (info.fInTried) {
             if (!info.nLastSuccess)
                 return -1;
@@ -426,9 +469,9 @@ int CAddrMan::Check_()
              if (vvTried[n][i] != -1) {
                  if (!setTried.count(vvTried[n][i]))
                      return -11;
-                 if (mapInfo[vvTried[n][i]].GetTriedBucket(nKey) != n)
+                 if (vInfo[vvTried[n][i]].GetTriedBucket(nKey) != n)
                      return -17;
-                 if (mapInfo[vvTried[n][i]].GetBucketPosition(nKey, false, n) != i)
+                 if (vInfo[vvTried[n][i]].GetBucketPosition(nKey, false, n) != i)
                      return -18;
                  setTried.erase(vvTried[n][i]);
              }
@@ -440,7 +483,7 @@ int CAddrMan::Check_()
             if (vvNew[n][i] != -1) {
                 if (!mapNew.count(vvNew[n][i]))
                     return -12;
-                if (mapInfo[vvNew[n][i]].GetBucketPosition(nKey, true, n) != i)
+                if (vInfo[vvNew[n][i]].GetBucketPosition(nKey, true, n) != i)
                     return -19;
                 if (--mapNew[vvNew[n][i]] == 0)
                     mapNew.erase(vvNew[n][i]);
@@ -472,9 +515,8 @@ void CAddrMan::GetAddr_(std::vector<CAddress>& vAddr)
 
         int nRndPos = RandomInt(vRandom.size() - n) + n;
         SwapRandom(n, nRndPos);
-        assert(mapInfo.count(vRandom[n]) == 1);
 
-        const CAddrInfo& ai = mapInfo[vRandom[n]];
+        const CAddrInfo& ai = vInfo[vRandom[n]];
         if (!ai.IsTerrible())
             vAddr.push_back(ai);
     }
@@ -482,7 +524,8 @@ void CAddrMan::GetAddr_(std::vector<CAddress>& vAddr)
 
 void CAddrMan::Connected_(const CService& addr, int64_t nTime)
 {
-    CAddrInfo* pinfo = Find(addr);
+    int nId;
+    CAddrInfo* pinfo = Find(addr, &nId);
 
     // if not found, bail out
     if (!pinfo)
@@ -496,13 +539,16 @@ void CAddrMan::Connected_(const CService& addr, int64_t nTime)
 
     // update info
     int64_t nUpdateInterval = 20 * 60;
-    if (nTime - info.nTime > nUpdateInterval)
+    if (nTime - info.nTime > nUpdateInterval) {
         info.nTime = nTime;
+        MarkDirty(nId);
+    }
 }
 
 void CAddrMan::SetServices_(const CService& addr, ServiceFlags nServices)
 {
-    CAddrInfo* pinfo = Find(addr);
+    int nId;
+    CAddrInfo* pinfo = Find(addr, &nId);
 
     // if not found, bail out
     if (!pinfo)
@@ -516,6 +562,111 @@ void CAddrMan::SetServices_(const CService& addr, ServiceFlags nServices)
 
     // update info
     info.nServices = nServices;
+    MarkDirty(nId);
+}
+
+bool CAddrMan::GetJournal(std::vector<CAddrJournalEntry>& vEntries)
+{
+    LOCK(cs);
+    const bool fComplete = !fJournalOverflow;
+    if (fComplete) {
+        // Deletions go first, so an address that was deleted and then added
+        // again is present after the batch is replayed.
+        for (const CAddrInfo& info : vDeleted)
+            vEntries.emplace_back(ADDRMAN_JOURNAL_DELETE, info);
+    }
+    for (int nId : vDirty) {
+        CAddrInfo& info = vInfo[nId];
+        if (!info.fDirty)
+            continue; // deleted since, or a duplicate
+        info.fDirty = false;
+        if (fComplete)
+            vEntries.emplace_back(info.fInTried ? ADDRMAN_JOURNAL_TRIED : ADDRMAN_JOURNAL_NEW, info);
+    }
+    std::vector<int>().swap(vDirty);
+    std::vector<CAddrInfo>().swap(vDeleted);
+    fJournalOverflow = false;
+    return fComplete;
+}
+
+void CAddrMan::RestoreJournal_(const std::vector<CAddrJournalEntry>& vEntries, bool fComplete)
+{
+    if (!fComplete) {
+        fJournalOverflow = true;
+        return;
+    }
+    for (const CAddrJournalEntry& entry : vEntries) {
+        if (fJournalOverflow)
+            return;
+        if (entry.nType == ADDRMAN_JOURNAL_DELETE) {
+            // Deletions are written first, so one that is put back still
+            // precedes a later change of the same address
+            if (vDirty.size() + vDeleted.size() >= ADDRMAN_JOURNAL_MAX_ENTRIES)
+                fJournalOverflow = true;
+            else
+                vDeleted.push_back(entry.info);
+            continue;
+        }
+        // An entry deleted since is journaled as such already
+        int nId;
+        if (Find(entry.info, &nId))
+            MarkDirty(nId);
+    }
+}
+
+void CAddrMan::ApplyJournal_(const std::vector<CAddrJournalEntry>& vEntries)
+{
+    // Drop deleted entries from the new table in a single pass over it,
+    // rather than searching every bucket for each of them.
+    std::set<int> setDelete;
+    for (const CAddrJournalEntry& entry : vEntries) {
+        int nId;
+        if (entry.nType == ADDRMAN_JOURNAL_DELETE && Find(entry.info, &nId) && !vInfo[nId].fInTried)
+            setDelete.insert(nId);
+    }
+    if (!setDelete.empty()) {
+        for (int bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
+            for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
+                if (vvNew[bucket][i] != -1 && setDelete.count(vvNew[bucket][i])) {
+                    vInfo[vvNew[bucket][i]].nRefCount--;
+                    vvNew[bucket][i] = -1;
+                }
+            }
+        }
+        for (int nId : setDelete)
+            Delete(nId);
+    }
+
+    for (const CAddrJournalEntry& entry : vEntries) {
+        if (entry.nType == ADDRMAN_JOURNAL_DELETE)
+            continue;
+        const CAddrInfo& infoIn = entry.info;
+        int nId;
+        CAddrInfo* pinfo = Find(infoIn, &nId);
+        if (!pinfo) {
+            // Only the bucket of the original source is known; this is the
+            // same placement used when the stored new table can't be used.
+            int nUBucket = infoIn.GetNewBucket(nKey);
+            int nUBucketPos = infoIn.GetBucketPosition(nKey, true, nUBucket);
+            ClearNew(nUBucket, nUBucketPos);
+            pinfo = Create(infoIn, infoIn.source, &nId);
+            pinfo->nRefCount = 1;
+            vvNew[nUBucket][nUBucketPos] = nId;
+            nNew++;
+        }
+        static_cast<CAddress&>(*pinfo) = infoIn;
+        pinfo->nLastSuccess = infoIn.nLastSuccess;
+        pinfo->nAttempts = infoIn.nAttempts;
+        if (entry.nType == ADDRMAN_JOURNAL_TRIED && !pinfo->fInTried)
+            MakeTried(*pinfo, nId);
+    }
+
+    // Everything applied here is already on disk.
+    for (int nId : vDirty)
+        vInfo[nId].fDirty = false;
+    std::vector<int>().swap(vDirty);
+    std::vector<CAddrInfo>().swap(vDeleted);
+    fJournalOverflow = false;
 }
 
 int CAddrMan::RandomInt(int nMax){
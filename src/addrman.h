@@ -16,6 +16,7 @@
 #include <map>
 #include <set>
 #include <stdint.h>
+#include <unordered_map>
 #include <vector>
 
 /**
@@ -51,6 +52,9 @@ private:
     //! position in vRandom
     int nRandomPos;
 
+    //! changed since the last journal flush (memory only)
+    bool fDirty;
+
     friend class CAddrMan;
 
 public:
@@ -74,6 +78,7 @@ public:
         nRefCount = 0;
         fInTried = false;
         nRandomPos = -1;
+        fDirty = false;
     }
 
     CAddrInfo(const CAddress &addrIn, const CNetAddr &addrSource) : CAddress(addrIn), source(addrSource)
@@ -171,11 +176,53 @@ public:
 //! the maximum number of nodes to return in a getaddr call
 #define ADDRMAN_GETADDR_MAX 2500
 
+//! the maximum number of changes kept for the peers.dat journal before a full rewrite is needed
+#define ADDRMAN_JOURNAL_MAX_ENTRIES 8192
+
 //! Convenience
 #define ADDRMAN_TRIED_BUCKET_COUNT (1 << ADDRMAN_TRIED_BUCKET_COUNT_LOG2)
 #define ADDRMAN_NEW_BUCKET_COUNT (1 << ADDRMAN_NEW_BUCKET_COUNT_LOG2)
 #define ADDRMAN_BUCKET_SIZE (1 << ADDRMAN_BUCKET_SIZE_LOG2)
 
+/** Salted hasher for the address lookup table, so peers can't choose colliding addresses */
+class SaltedNetAddrHasher
+{
+private:
+    /** Salt */
+    const uint64_t k0, k1;
+
+public:
+    SaltedNetAddrHasher();
+
+    size_t operator()(const CNetAddr& addr) const;
+};
+
+/** Journal record types */
+enum AddrJournalType : uint8_t {
+    ADDRMAN_JOURNAL_NEW = 0,    //! entry added or updated in the new table
+    ADDRMAN_JOURNAL_TRIED = 1,  //! entry added or updated in the tried table
+    ADDRMAN_JOURNAL_DELETE = 2, //! entry deleted
+};
+
+/** A change to an address, as appended to the peers.dat journal */
+class CAddrJournalEntry
+{
+public:
+    uint8_t nType;
+    CAddrInfo info;
+
+    CAddrJournalEntry() : nType(ADDRMAN_JOURNAL_NEW) {}
+    CAddrJournalEntry(uint8_t nTypeIn, const CAddrInfo& infoIn) : nType(nTypeIn), info(infoIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nType);
+        READWRITE(info);
+    }
+};
+
 /** 
  * Stochastical (IP) address manager 
  */
@@ -185,14 +232,14 @@ private:
     //! critical section to protect the inner data structures
     mutable CCriticalSection cs;
 
-    //! last used nId
-    int nIdCount;
+    //! table with information about all nIds, indexed by nId; slots with nRandomPos == -1 are free
+    std::vector<CAddrInfo> vInfo;
 
-    //! table with information about all nIds
-    std::map<int, CAddrInfo> mapInfo;
+    //! free slots in vInfo, reused before the table grows
+    std::vector<int> vFreeIds;
 
     //! find an nId based on its network address
-    std::map<CNetAddr, int> mapAddr;
+    std::unordered_map<CNetAddr, int, SaltedNetAddrHasher> mapAddr;
 
     //! randomly-ordered vector of all nIds
     std::vector<int> vRandom;
@@ -212,6 +259,15 @@ private:
     //! last time Good was called (memory only)
     int64_t nLastGood;
 
+    //! nIds changed since the last call to GetJournal (may contain duplicates and freed slots)
+    std::vector<int> vDirty;
+
+    //! entries deleted since the last call to GetJournal
+    std::vector<CAddrInfo> vDeleted;
+
+    //! too many changes were made to keep a journal; the next save must rewrite peers.dat
+    bool fJournalOverflow;
+
 protected:
     //! secret key to randomize bucket select with
     uint256 nKey;
@@ -229,6 +285,15 @@ protected:
     //! Swap two elements in vRandom.
     void SwapRandom(unsigned int nRandomPos1, unsigned int nRandomPos2);
 
+    //! Record that an entry must be written to the next journal batch.
+    void MarkDirty(int nId);
+
+    //! Apply a batch of journal changes.
+    void ApplyJournal_(const std::vector<CAddrJournalEntry>& vEntries);
+
+    //! Journal again the changes of a batch that could not be saved.
+    void RestoreJournal_(const std::vector<CAddrJournalEntry>& vEntries, bool fComplete);
+
     //! Move an entry from the "new" table(s) to the "tried" table
     void MakeTried(CAddrInfo& info, int nId);
 
@@ -288,6 +353,9 @@ public:
      * Notice that vvTried, mapAddr and vVector are never encoded explicitly;
      * they are instead reconstructed from the other information.
      *
+     * Changes made after peers.dat was written are appended to a separate
+     * journal of CAddrJournalEntry records (see GetJournal and ApplyJournal).
+     *
      * vvNew is serialized, but only used if ADDRMAN_UNKNOWN_BUCKET_COUNT didn't change,
      * otherwise it is reconstructed as well.
      *
@@ -311,20 +379,19 @@ public:
 
         int nUBuckets = ADDRMAN_NEW_BUCKET_COUNT ^ (1 << 30);
         s << nUBuckets;
-        std::map<int, int> mapUnkIds;
+        std::vector<int> vUnkIds(vInfo.size(), -1);
         int nIds = 0;
-        for (const auto& entry : mapInfo) {
-            mapUnkIds[entry.first] = nIds;
-            const CAddrInfo &info = entry.second;
+        for (size_t nId = 0; nId < vInfo.size(); nId++) {
+            const CAddrInfo &info = vInfo[nId];
             if (info.nRefCount) {
                 assert(nIds != nNew); // this means nNew was wrong, oh ow
+                vUnkIds[nId] = nIds;
                 s << info;
                 nIds++;
             }
         }
         nIds = 0;
-        for (const auto& entry : mapInfo) {
-            const CAddrInfo &info = entry.second;
+        for (const CAddrInfo &info : vInfo) {
             if (info.fInTried) {
                 assert(nIds != nTried); // this means nTried was wrong, oh ow
                 s << info;
@@ -340,7 +407,7 @@ public:
             s << nSize;
             for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
                 if (vvNew[bucket][i] != -1) {
-                    int nIndex = mapUnkIds[vvNew[bucket][i]];
+                    int nIndex = vUnkIds[vvNew[bucket][i]];
                     s << nIndex;
                 }
             }
@@ -377,8 +444,10 @@ public:
         }
 
         // Deserialize entries from the new table.
+        vInfo.reserve(nNew + nTried);
         for (int n = 0; n < nNew; n++) {
-            CAddrInfo &info = mapInfo[n];
+            vInfo.emplace_back();
+            CAddrInfo &info = vInfo.back();
             s >> info;
             mapAddr[info] = n;
             info.nRandomPos = vRandom.size();
@@ -394,7 +463,6 @@ public:
                 }
             }
         }
-        nIdCount = nNew;
 
         // Deserialize entries from the tried table.
         int nLost = 0;
@@ -404,13 +472,13 @@ public:
             int nKBucket = info.GetTriedBucket(nKey);
             int nKBucketPos = info.GetBucketPosition(nKey, false, nKBucket);
             if (vvTried[nKBucket][nKBucketPos] == -1) {
+                int nId = vInfo.size();
                 info.nRandomPos = vRandom.size();
                 info.fInTried = true;
-                vRandom.push_back(nIdCount);
-                mapInfo[nIdCount] = info;
-                mapAddr[info] = nIdCount;
-                vvTried[nKBucket][nKBucketPos] = nIdCount;
-                nIdCount++;
+                vRandom.push_back(nId);
+                vInfo.push_back(info);
+                mapAddr[info] = nId;
+                vvTried[nKBucket][nKBucketPos] = nId;
             } else {
                 nLost++;
             }
@@ -425,7 +493,7 @@ public:
                 int nIndex = 0;
                 s >> nIndex;
                 if (nIndex >= 0 && nIndex < nNew) {
-                    CAddrInfo &info = mapInfo[nIndex];
+                    CAddrInfo &info = vInfo[nIndex];
                     int nUBucketPos = info.GetBucketPosition(nKey, true, bucket);
                     if (nVersion == 1 && nUBuckets == ADDRMAN_NEW_BUCKET_COUNT && vvNew[bucket][nUBucketPos] == -1 && info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS) {
                         info.nRefCount++;
@@ -437,15 +505,14 @@ public:
 
         // Prune new entries with refcount 0 (as a result of collisions).
         int nLostUnk = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); ) {
-            if (it->second.fInTried == false && it->second.nRefCount == 0) {
-                std::map<int, CAddrInfo>::const_iterator itCopy = it++;
-                Delete(itCopy->first);
+        const int nNewEntries = nNew;
+        for (int nId = 0; nId < nNewEntries; nId++) {
+            if (vInfo[nId].fInTried == false && vInfo[nId].nRefCount == 0) {
+                Delete(nId);
                 nLostUnk++;
-            } else {
-                it++;
             }
         }
+        std::vector<CAddrInfo>().swap(vDeleted);
         if (nLost + nLostUnk > 0) {
             LogPrint(BCLog::ADDRMAN, "addrman lost %i new and %i tried addresses due to collisions\n", nLostUnk, nLost);
         }
@@ -469,12 +536,15 @@ public:
             }
         }
 
-        nIdCount = 0;
         nTried = 0;
         nNew = 0;
         nLastGood = 1; //Initially at 1 so that "never" is strictly worse.
-        mapInfo.clear();
+        vInfo.clear();
+        vFreeIds.clear();
         mapAddr.clear();
+        vDirty.clear();
+        vDeleted.clear();
+        fJournalOverflow = false;
     }
 
     CAddrMan()
@@ -599,6 +669,33 @@ public:
         Check();
     }
 
+    /**
+     * Collect the changes made since the last call, for appending to the
+     * peers.dat journal. Returns false if too many changes were made to keep
+     * track of, in which case the whole table must be written out instead.
+     */
+    bool GetJournal(std::vector<CAddrJournalEntry>& vEntries);
+
+    /**
+     * Put back changes taken with GetJournal that failed to be saved, so the
+     * next save includes them. If fComplete is false, the next save rewrites
+     * the whole table instead.
+     */
+    void RestoreJournal(const std::vector<CAddrJournalEntry>& vEntries, bool fComplete)
+    {
+        LOCK(cs);
+        RestoreJournal_(vEntries, fComplete);
+    }
+
+    //! Replay changes read back from the peers.dat journal.
+    void ApplyJournal(const std::vector<CAddrJournalEntry>& vEntries)
+    {
+        LOCK(cs);
+        Check();
+        ApplyJournal_(vEntries);
+        Check();
+    }
+
 };
 
 #endif // BITCOIN_ADDRMAN_H
@@ -0,0 +1,80 @@
+// Copyright (c) 2018 The Sugarchain developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <addrman.h>
+#include <bench/bench.h>
+#include <random.h>
+
+#include <vector>
+
+// 100k addresses from 1k source groups: more than the new table holds, so
+// the table fills up and later additions contend for bucket slots.
+static const size_t NUM_SOURCES = 1000;
+static const size_t NUM_ADDRESSES_PER_SOURCE = 100;
+
+static std::vector<CNetAddr> g_sources;
+static std::vector<std::vector<CAddress>> g_addresses;
+
+static void CreateAddresses()
+{
+    if (!g_sources.empty()) {
+        return;
+    }
+
+    FastRandomContext rand(true);
+
+    auto randAddr = [&rand]() {
+        in_addr addr;
+        // 11.0.0.0 - 124.255.255.255 is routable
+        addr.s_addr = htonl(((11 + rand.randrange(114)) << 24) | rand.randbits(24));
+        return CNetAddr(addr);
+    };
+
+    for (size_t source_i = 0; source_i < NUM_SOURCES; ++source_i) {
+        g_sources.emplace_back(randAddr());
+        g_addresses.emplace_back();
+        for (size_t addr_i = 0; addr_i < NUM_ADDRESSES_PER_SOURCE; ++addr_i) {
+            CAddress addr(CService(randAddr(), 8333), NODE_NETWORK);
+            addr.nTime = GetTime() - rand.randrange(24 * 60 * 60);
+            g_addresses[source_i].emplace_back(addr);
+        }
+    }
+}
+
+static void AddAddressesToAddrMan(CAddrMan& addrman)
+{
+    for (size_t source_i = 0; source_i < NUM_SOURCES; ++source_i) {
+        addrman.Add(g_addresses[source_i], g_sources[source_i]);
+    }
+}
+
+static void AddrManAdd(benchmark::State& state)
+{
+    CreateAddresses();
+
+    while (state.KeepRunning()) {
+        CAddrMan addrman;
+        AddAddressesToAddrMan(addrman);
+    }
+}
+
+static void AddrManSelect(benchmark::State& state)
+{
+    CreateAddresses();
+
+    CAddrMan addrman;
+    AddAddressesToAddrMan(addrman);
+    // Move some addresses to the tried table too
+    for (size_t source_i = 0; source_i < NUM_SOURCES; ++source_i) {
+        addrman.Good(g_addresses[source_i][0]);
+    }
+
+    while (state.KeepRunning()) {
+        const CAddress& address = addrman.Select();
+        assert(address.GetPort() > 0);
+    }
+}
+
+BENCHMARK(AddrManAdd, 5);
+BENCHMARK(AddrManSelect, 100000);
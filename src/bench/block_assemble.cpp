@@ -0,0 +1,63 @@
+// Copyright (c) 2011-2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <bench/regtest_chain.h>
+#include <chainparams.h>
+#include <miner.h>
+#include <script/script.h>
+#include <sync.h>
+#include <validation.h>
+
+// Assemble a template from scratch, as getblocktemplate did on every call.
+static void BlockTemplateRebuild(benchmark::State& state)
+{
+    SetupRegtestMempoolChain();
+    while (state.KeepRunning()) {
+        std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(Params()).CreateNewBlock(CScript() << OP_TRUE);
+        assert(pblocktemplate->block.vtx.size() > 1);
+    }
+}
+
+// Serve a template from a warm BlockTemplateCache.
+static void BlockTemplateCached(benchmark::State& state)
+{
+    SetupRegtestMempoolChain();
+    BlockTemplateCache cache(Params());
+    LOCK(cs_main);
+    cache.GetTemplate(true);
+    while (state.KeepRunning()) {
+        std::unique_ptr<CBlockTemplate> pblocktemplate = cache.GetTemplate(true);
+        assert(pblocktemplate->block.vtx.size() > 1);
+    }
+}
+
+// Roll the extranonce of a full template, rehashing the whole merkle tree or
+// only the coinbase branch.
+static void ExtraNonceRoll(benchmark::State& state, bool fUseBranch)
+{
+    SetupRegtestMempoolChain();
+    BlockTemplateCache cache(Params());
+    LOCK(cs_main);
+    std::unique_ptr<CBlockTemplate> pblocktemplate = cache.GetTemplate(true);
+    unsigned int nExtraNonce = 0;
+    while (state.KeepRunning()) {
+        IncrementExtraNonce(&pblocktemplate->block, chainActive.Tip(), nExtraNonce, fUseBranch ? &pblocktemplate->vCoinbaseMerkleBranch : nullptr);
+    }
+}
+
+static void ExtraNonceFullMerkle(benchmark::State& state)
+{
+    ExtraNonceRoll(state, false);
+}
+
+static void ExtraNonceMerkleBranch(benchmark::State& state)
+{
+    ExtraNonceRoll(state, true);
+}
+
+BENCHMARK(BlockTemplateRebuild, 5);
+BENCHMARK(BlockTemplateCached, 1000);
+BENCHMARK(ExtraNonceFullMerkle, 50);
+BENCHMARK(ExtraNonceMerkleBranch, 50000);
@@ -0,0 +1,61 @@
+// Copyright (c) 2018 The Sugarchain developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <blockencodings.h>
+#include <consensus/merkle.h>
+#include <random.h>
+#include <txmempool.h>
+
+#include <vector>
+
+static void AddTx(const CTransactionRef& tx, CTxMemPool& pool)
+{
+    LockPoints lp;
+    pool.addUnchecked(tx->GetHash(), CTxMemPoolEntry(tx, 1000, 0, 1, false, 4, lp));
+}
+
+// Reconstruct a 2000 transaction compact block against a 100k entry mempool.
+// A handful of the block's transactions are not in the mempool, so every
+// iteration walks the whole mempool, as happens for most real blocks.
+static void CompactBlockInitData(benchmark::State& state)
+{
+    const size_t MEMPOOL_SIZE = 100000;
+    const size_t BLOCK_TXS = 2000;
+    const size_t BLOCK_TXS_MISSING = 10;
+
+    FastRandomContext rand(true);
+    CTxMemPool pool;
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 50 * COIN;
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+
+    for (size_t i = 0; i < MEMPOOL_SIZE + BLOCK_TXS_MISSING; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(rand.rand256(), 0);
+        tx.vin[0].scriptSig = CScript() << OP_1;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        tx.vout[0].nValue = COIN;
+        CTransactionRef txref = MakeTransactionRef(tx);
+        if (i < MEMPOOL_SIZE) AddTx(txref, pool);
+        if (i < BLOCK_TXS - BLOCK_TXS_MISSING || i >= MEMPOOL_SIZE) block.vtx.push_back(txref);
+    }
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    block.nBits = 0x207fffff;
+
+    const CBlockHeaderAndShortTxIDs cmpctblock(block, true);
+    const std::vector<std::pair<uint256, CTransactionRef>> extra_txn;
+    while (state.KeepRunning()) {
+        PartiallyDownloadedBlock partial_block(&pool);
+        bool ok = partial_block.InitData(cmpctblock, extra_txn) == READ_STATUS_OK;
+        assert(ok);
+    }
+}
+
+BENCHMARK(CompactBlockInitData, 100);
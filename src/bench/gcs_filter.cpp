@@ -0,0 +1,60 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <blockfilter.h>
+
+static GCSFilter::ElementSet MakeElements()
+{
+    GCSFilter::ElementSet elements;
+    for (int i = 0; i < 10000; ++i) {
+        GCSFilter::Element element(32);
+        element[0] = static_cast<unsigned char>(i);
+        element[1] = static_cast<unsigned char>(i >> 8);
+        elements.insert(std::move(element));
+    }
+    return elements;
+}
+
+static void ConstructGCSFilter(benchmark::State& state)
+{
+    const GCSFilter::ElementSet elements = MakeElements();
+
+    uint64_t siphash_k0 = 0;
+    while (state.KeepRunning()) {
+        GCSFilter filter({siphash_k0, 0, BASIC_FILTER_P, BASIC_FILTER_M}, elements);
+
+        siphash_k0++;
+    }
+}
+
+static void MatchGCSFilter(benchmark::State& state)
+{
+    GCSFilter filter({0, 0, BASIC_FILTER_P, BASIC_FILTER_M}, MakeElements());
+
+    while (state.KeepRunning()) {
+        filter.Match(GCSFilter::Element());
+    }
+}
+
+// A wallet scanning a filter checks all of its scripts at once
+static void MatchAnyGCSFilter(benchmark::State& state)
+{
+    GCSFilter filter({0, 0, BASIC_FILTER_P, BASIC_FILTER_M}, MakeElements());
+
+    GCSFilter::ElementSet queries;
+    for (int i = 0; i < 100; ++i) {
+        GCSFilter::Element element(25, 0xff);
+        element[0] = static_cast<unsigned char>(i);
+        queries.insert(std::move(element));
+    }
+
+    while (state.KeepRunning()) {
+        filter.MatchAny(queries);
+    }
+}
+
+BENCHMARK(ConstructGCSFilter, 100);
+BENCHMARK(MatchGCSFilter, 2 * 1000);
+BENCHMARK(MatchAnyGCSFilter, 2 * 1000);
@@ -0,0 +1,143 @@
+// Copyright (c) 2011-2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <bench/regtest_chain.h>
+#include <coins.h>
+#include <consensus/validation.h>
+#include <httpserver.h>
+#include <key.h>
+#include <random.h>
+#include <script/interpreter.h>
+#include <script/sigcache.h>
+#include <script/standard.h>
+#include <txmempool.h>
+#include <validation.h>
+
+#include <boost/thread.hpp>
+
+#include <atomic>
+#include <vector>
+
+static const int TX_FLOOD_COUNT = 100000;
+
+// Signed P2PKH spends of TX_FLOOD_COUNT coins added to the regtest chain's
+// UTXO cache, one coin per transaction.
+static std::vector<CTransactionRef> MakeFloodTxs()
+{
+    SetupRegtestMempoolChain();
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    const CAmount nValue = COIN;
+    const uint256 hashFunding = GetRandHash();
+
+    std::vector<CTransactionRef> vTxs;
+    LOCK(cs_main);
+    for (int i = 0; i < TX_FLOOD_COUNT; ++i) {
+        const COutPoint prevout(hashFunding, i);
+        pcoinsTip->AddCoin(prevout, Coin(CTxOut(nValue, scriptPubKey), 1, false), false);
+
+        CMutableTransaction tx;
+        tx.vin.emplace_back(prevout);
+        tx.vout.emplace_back(nValue - 1000 - i % 1000, scriptPubKey);
+        const uint256 hash = SignatureHash(scriptPubKey, tx, 0, SIGHASH_ALL, nValue, SIGVERSION_BASE);
+        std::vector<unsigned char> vchSig;
+        key.Sign(hash, vchSig);
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        tx.vin[0].scriptSig = CScript() << vchSig << ToByteVector(key.GetPubKey());
+        vTxs.push_back(MakeTransactionRef(std::move(tx)));
+    }
+    return vTxs;
+}
+
+static const std::vector<CTransactionRef>& FloodTxs()
+{
+    static const std::vector<CTransactionRef> vTxs = MakeFloodTxs();
+    return vTxs;
+}
+
+// Submit TX_FLOOD_COUNT transactions through AcceptToMemoryPool from
+// nThreads threads at once, each call holding cs_main throughout as the P2P
+// message handler and sendrawtransaction do.
+static void TxFlood(benchmark::State& state, int nThreads)
+{
+    const std::vector<CTransactionRef>& vTxs = FloodTxs();
+    while (state.KeepRunning()) {
+        // Verify every signature afresh on each run
+        InitSignatureCache();
+        InitScriptExecutionCache();
+
+        std::atomic<size_t> nNext(0);
+        auto submit = [&nNext, &vTxs] {
+            for (size_t i = nNext++; i < vTxs.size(); i = nNext++) {
+                LOCK(cs_main);
+                CValidationState stateDummy;
+                bool fAccepted = AcceptToMemoryPool(mempool, stateDummy, vTxs[i], nullptr /* pfMissingInputs */,
+                                                    nullptr /* plTxnReplaced */, false /* bypass_limits */, 0 /* nAbsurdFee */);
+                assert(fAccepted);
+            }
+        };
+        boost::thread_group threads;
+        for (int n = 1; n < nThreads; ++n) {
+            threads.create_thread(submit);
+        }
+        submit();
+        threads.join_all();
+
+        LOCK2(cs_main, mempool.cs);
+        for (const CTransactionRef& tx : vTxs) {
+            mempool.removeRecursive(*tx, MemPoolRemovalReason::CONFLICT);
+        }
+    }
+}
+
+static void TxFloodP2P(benchmark::State& state)
+{
+    TxFlood(state, 1);
+}
+
+static void TxFloodRPC(benchmark::State& state)
+{
+    TxFlood(state, DEFAULT_HTTP_THREADS);
+}
+
+// Reload TX_FLOOD_COUNT transactions from mempool.dat, as a restarting node
+// does. The regtest chain's own mempool transactions are dumped with them and
+// found already there.
+static void MempoolLoad(benchmark::State& state)
+{
+    const std::vector<CTransactionRef>& vTxs = FloodTxs();
+    for (const CTransactionRef& tx : vTxs) {
+        LOCK(cs_main);
+        CValidationState stateDummy;
+        bool fAccepted = AcceptToMemoryPool(mempool, stateDummy, tx, nullptr /* pfMissingInputs */,
+                                            nullptr /* plTxnReplaced */, false /* bypass_limits */, 0 /* nAbsurdFee */);
+        assert(fAccepted);
+    }
+    bool fDumped = DumpMempool();
+    assert(fDumped);
+    while (state.KeepRunning()) {
+        {
+            LOCK2(cs_main, mempool.cs);
+            for (const CTransactionRef& tx : vTxs) {
+                mempool.removeRecursive(*tx, MemPoolRemovalReason::CONFLICT);
+            }
+        }
+        // Verify every signature afresh on each run
+        InitSignatureCache();
+        InitScriptExecutionCache();
+
+        bool fLoaded = LoadMempool();
+        assert(fLoaded && mempool.exists(vTxs.back()->GetHash()));
+    }
+    LOCK2(cs_main, mempool.cs);
+    for (const CTransactionRef& tx : vTxs) {
+        mempool.removeRecursive(*tx, MemPoolRemovalReason::CONFLICT);
+    }
+}
+
+BENCHMARK(MempoolLoad, 1);
+BENCHMARK(TxFloodP2P, 1);
+BENCHMARK(TxFloodRPC, 1);
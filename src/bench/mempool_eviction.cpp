@@ -4,6 +4,7 @@
 
 #include <bench/bench.h>
 #include <policy/policy.h>
+#include <random.h>
 #include <txmempool.h>
 
 #include <list>
@@ -111,4 +112,49 @@ static void MempoolEviction(benchmark::State& state)
     }
 }
 
+// Fill a mempool with many small clusters (chains and fan-outs of up to
+// eight transactions with random fees) and trim it to half its size.
+static void MempoolEvictionLarge(benchmark::State& state)
+{
+    const int CLUSTER_COUNT = 5000;
+    FastRandomContext rand(true);
+    std::vector<std::pair<CTransactionRef, CAmount>> vTxs;
+    for (int i = 0; i < CLUSTER_COUNT; ++i) {
+        CMutableTransaction root;
+        root.vin.resize(1);
+        root.vin[0].scriptSig = CScript() << i;
+        root.vout.resize(8);
+        for (CTxOut& out : root.vout) {
+            out.scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+            out.nValue = 10 * COIN;
+        }
+        vTxs.emplace_back(MakeTransactionRef(root), 1000 + rand.randrange(20000));
+        const CTransactionRef rootRef = vTxs.back().first;
+        const int nChildren = rand.randrange(8);
+        for (int n = 0; n < nChildren; ++n) {
+            // Half of the children extend a chain, the others spend the root
+            CMutableTransaction child;
+            child.vin.resize(1);
+            const bool fChain = rand.randbool() && vTxs.back().first != rootRef;
+            child.vin[0].prevout = fChain ? COutPoint(vTxs.back().first->GetHash(), 0) : COutPoint(rootRef->GetHash(), n);
+            child.vin[0].scriptSig = CScript() << i << n;
+            child.vout.resize(1);
+            child.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+            child.vout[0].nValue = 10 * COIN;
+            vTxs.emplace_back(MakeTransactionRef(child), 1000 + rand.randrange(20000));
+        }
+    }
+
+    CTxMemPool pool;
+    LockPoints lp;
+    while (state.KeepRunning()) {
+        for (const auto& tx : vTxs) {
+            pool.addUnchecked(tx.first->GetHash(), CTxMemPoolEntry(tx.first, tx.second, 0, 1, false, 4, lp));
+        }
+        pool.TrimToSize(pool.DynamicMemoryUsage() / 2);
+        pool.clear();
+    }
+}
+
 BENCHMARK(MempoolEviction, 41000);
+BENCHMARK(MempoolEvictionLarge, 5);
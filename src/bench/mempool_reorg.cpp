@@ -0,0 +1,78 @@
+// Copyright (c) 2011-2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <txmempool.h>
+
+#include <vector>
+
+static const int BLOCK_ROOT_COUNT = 1000;
+static const int UNRELATED_TX_COUNT = 12000;
+
+static CTransactionRef MakeTx(const std::vector<COutPoint>& vPrevouts, int nOutputs, int nTag)
+{
+    CMutableTransaction tx;
+    for (const COutPoint& prevout : vPrevouts) {
+        tx.vin.emplace_back(prevout);
+        tx.vin.back().scriptSig = CScript() << nTag;
+    }
+    tx.vout.resize(nOutputs);
+    for (CTxOut& out : tx.vout) {
+        out.scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        out.nValue = COIN;
+    }
+    return MakeTransactionRef(std::move(tx));
+}
+
+static void AddTx(CTxMemPool& pool, const CTransactionRef& tx)
+{
+    LockPoints lp;
+    pool.addUnchecked(tx->GetHash(), CTxMemPoolEntry(tx, 1000, 0, 1, false, 4, lp));
+}
+
+// Disconnect and reconnect a block of 2000 transactions (1000 parent/child
+// pairs) under a 20000 transaction mempool. 8000 of the mempool transactions
+// spend outputs of the block, including diamonds that spend two of them.
+static void MempoolReorg(benchmark::State& state)
+{
+    std::vector<CTransactionRef> vBlock;
+    std::vector<CTransactionRef> vMempool;
+    int nTag = 0;
+    for (int i = 0; i < BLOCK_ROOT_COUNT; ++i) {
+        vBlock.push_back(MakeTx({COutPoint(uint256(), i)}, 4, ++nTag));
+        vBlock.push_back(MakeTx({COutPoint(vBlock.back()->GetHash(), 0)}, 4, ++nTag));
+    }
+    for (const CTransactionRef& blockTx : vBlock) {
+        std::vector<CTransactionRef> vChildren;
+        for (int n = 1; n < 4; ++n) {
+            vChildren.push_back(MakeTx({COutPoint(blockTx->GetHash(), n)}, 1, ++nTag));
+        }
+        vMempool.insert(vMempool.end(), vChildren.begin(), vChildren.end());
+        vMempool.push_back(MakeTx({COutPoint(vChildren[0]->GetHash(), 0), COutPoint(vChildren[1]->GetHash(), 0)}, 1, ++nTag));
+    }
+    for (int i = 0; i < UNRELATED_TX_COUNT; ++i) {
+        vMempool.push_back(MakeTx({COutPoint(uint256(), BLOCK_ROOT_COUNT + i)}, 1, ++nTag));
+    }
+
+    CTxMemPool pool;
+    for (const CTransactionRef& tx : vMempool) {
+        AddTx(pool, tx);
+    }
+    std::vector<uint256> vHashes;
+    for (const CTransactionRef& tx : vBlock) {
+        vHashes.push_back(tx->GetHash());
+    }
+
+    while (state.KeepRunning()) {
+        // What UpdateMempoolForReorg does after re-accepting the block
+        for (const CTransactionRef& tx : vBlock) {
+            AddTx(pool, tx);
+        }
+        pool.UpdateTransactionsFromBlock(vHashes);
+        assert(pool.size() == vBlock.size() + vMempool.size());
+        pool.removeForBlock(vBlock, 1);
+    }
+}
+
+BENCHMARK(MempoolReorg, 10);
@@ -0,0 +1,49 @@
+// Copyright (c) 2011-2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <chainparams.h>
+#include <policy/fees.h>
+#include <txmempool.h>
+
+#include <vector>
+
+// Feed the estimator blocks that each confirm the two transactions which
+// entered the mempool at the block before, as on a quiet chain of short
+// blocks where most of the buckets see nothing from one block to the next.
+static void BlockPolicyEstimatorBlocks(benchmark::State& state)
+{
+    std::vector<CTransactionRef> vTxs;
+    for (int i = 0; i < 20; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << OP_1;
+        tx.vin[0].prevout.n = i;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        tx.vout[0].nValue = 10 * COIN;
+        vTxs.push_back(MakeTransactionRef(tx));
+    }
+
+    CBlockPolicyEstimator feeEst(CreateChainParams(CBaseChainParams::MAIN)->GetConsensus().nPowTargetSpacing);
+    LockPoints lp;
+    unsigned int nHeight = 1;
+    while (state.KeepRunning()) {
+        for (int n = 0; n < 1000; n++, nHeight++) {
+            std::vector<CTxMemPoolEntry> entries;
+            for (int i = 0; i < 2; i++) {
+                const CTransactionRef& tx = vTxs[(2 * nHeight + i) % vTxs.size()];
+                entries.emplace_back(tx, 1000 * (1 + (2 * nHeight + i) % vTxs.size()), 0, nHeight - 1, false, 4, lp);
+                feeEst.processTransaction(entries.back(), true);
+            }
+            std::vector<const CTxMemPoolEntry*> block;
+            for (const CTxMemPoolEntry& entry : entries) {
+                block.push_back(&entry);
+            }
+            feeEst.processBlock(nHeight, block);
+        }
+    }
+}
+
+BENCHMARK(BlockPolicyEstimatorBlocks, 50);
@@ -0,0 +1,147 @@
+// Copyright (c) 2011-2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/regtest_chain.h>
+#include <chainparams.h>
+#include <coins.h>
+#include <consensus/consensus.h>
+#include <consensus/validation.h>
+#include <fs.h>
+#include <miner.h>
+#include <noui.h>
+#include <policy/fees.h>
+#include <pow.h>
+#include <random.h>
+#include <scheduler.h>
+#include <script/sigcache.h>
+#include <txdb.h>
+#include <txmempool.h>
+#include <util.h>
+#include <validation.h>
+#include <validationinterface.h>
+
+#include <boost/thread.hpp>
+
+#include <vector>
+
+static const int MEMPOOL_TX_COUNT = 50000;
+static const int FANOUT_TX_COUNT = 10;
+
+static void AddTx(const CTransactionRef& tx, const CAmount& nFee)
+{
+    LockPoints lp;
+    mempool.addUnchecked(tx->GetHash(), CTxMemPoolEntry(tx, nFee, GetTime(), 1, true, 4, lp));
+}
+
+static void MineBlock(const CChainParams& chainparams)
+{
+    std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(CScript() << OP_TRUE);
+    CBlock& block = pblocktemplate->block;
+    unsigned int nExtraNonce = 0;
+    {
+        LOCK(cs_main);
+        IncrementExtraNonce(&block, chainActive.Tip(), nExtraNonce);
+    }
+    while (!CheckProofOfWork(block.GetPoWHash(), block.nBits, chainparams.GetConsensus())) ++block.nNonce;
+    ProcessNewBlock(chainparams, std::make_shared<const CBlock>(block), true, nullptr);
+}
+
+class RegtestMempoolChain
+{
+public:
+    RegtestMempoolChain()
+    {
+        SelectParams(CBaseChainParams::REGTEST);
+        const CChainParams& chainparams = Params();
+        ::feeEstimator.SetBlockSpacing(chainparams.GetConsensus().nPowTargetSpacing);
+        InitSignatureCache();
+        InitScriptExecutionCache();
+        noui_connect();
+
+        ClearDatadirCache();
+        pathTemp = fs::temp_directory_path() / strprintf("bench_sugarchain_%lu_%i", (unsigned long)GetTime(), (int)GetRand(100000));
+        fs::create_directories(pathTemp);
+        gArgs.ForceSetArg("-datadir", pathTemp.string());
+
+        threadGroup.create_thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+        GetMainSignals().RegisterBackgroundSignalScheduler(scheduler);
+
+        pblocktree.reset(new CBlockTreeDB(1 << 20, true));
+        pcoinsdbview.reset(new CCoinsViewDB(1 << 23, true));
+        pcoinsTip.reset(new CCoinsViewCache(pcoinsdbview.get()));
+        CValidationState state;
+        if (!LoadGenesisBlock(chainparams) || !ActivateBestChain(state, chainparams)) {
+            throw std::runtime_error("genesis setup failed");
+        }
+
+        // Mature enough coinbases to fund the mempool transactions
+        std::vector<CTransactionRef> coinbases;
+        for (int i = 0; i < COINBASE_MATURITY + FANOUT_TX_COUNT; ++i) {
+            MineBlock(chainparams);
+            LOCK(cs_main);
+            CBlock block;
+            ReadBlockFromDisk(block, chainActive.Tip(), chainparams.GetConsensus());
+            coinbases.push_back(block.vtx[0]);
+        }
+
+        // Split them into one output per mempool transaction and confirm that
+        const int nOutputs = MEMPOOL_TX_COUNT / FANOUT_TX_COUNT;
+        std::vector<CTransactionRef> fanouts;
+        {
+            LOCK2(cs_main, mempool.cs);
+            for (int i = 0; i < FANOUT_TX_COUNT; ++i) {
+                CMutableTransaction tx;
+                tx.vin.emplace_back(COutPoint(coinbases[i]->GetHash(), 0));
+                const CAmount nFee = COIN / 100;
+                tx.vout.resize(nOutputs);
+                for (CTxOut& out : tx.vout) {
+                    out.scriptPubKey = CScript() << OP_TRUE;
+                    out.nValue = (coinbases[i]->vout[0].nValue - nFee) / nOutputs;
+                }
+                fanouts.push_back(MakeTransactionRef(std::move(tx)));
+                AddTx(fanouts.back(), nFee);
+            }
+        }
+        MineBlock(chainparams);
+
+        LOCK2(cs_main, mempool.cs);
+        if (mempool.size() != 0) {
+            throw std::runtime_error("fanout transactions not mined");
+        }
+        FastRandomContext rand(true);
+        for (const CTransactionRef& fanout : fanouts) {
+            for (int n = 0; n < nOutputs; ++n) {
+                CMutableTransaction tx;
+                tx.vin.emplace_back(COutPoint(fanout->GetHash(), n));
+                const CAmount nFee = 1000 + rand.randrange(10000);
+                tx.vout.emplace_back(fanout->vout[n].nValue - nFee, CScript() << OP_TRUE);
+                AddTx(MakeTransactionRef(std::move(tx)), nFee);
+            }
+        }
+    }
+
+    ~RegtestMempoolChain()
+    {
+        threadGroup.interrupt_all();
+        threadGroup.join_all();
+        GetMainSignals().FlushBackgroundCallbacks();
+        GetMainSignals().UnregisterBackgroundSignalScheduler();
+        mempool.clear();
+        UnloadBlockIndex();
+        pcoinsTip.reset();
+        pcoinsdbview.reset();
+        pblocktree.reset();
+        fs::remove_all(pathTemp);
+    }
+
+private:
+    fs::path pathTemp;
+    CScheduler scheduler;
+    boost::thread_group threadGroup;
+};
+
+void SetupRegtestMempoolChain()
+{
+    static RegtestMempoolChain chain;
+}
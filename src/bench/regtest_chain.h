@@ -0,0 +1,15 @@
+// Copyright (c) 2011-2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BENCH_REGTEST_CHAIN_H
+#define BITCOIN_BENCH_REGTEST_CHAIN_H
+
+/**
+ * Set up a regtest chain whose mempool holds 50000 independent transactions
+ * with varying fees, far more than fit in one block. The chain state is
+ * global, so it is built once and shared by every benchmark that calls this.
+ */
+void SetupRegtestMempoolChain();
+
+#endif // BITCOIN_BENCH_REGTEST_CHAIN_H
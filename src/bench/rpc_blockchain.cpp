@@ -0,0 +1,70 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+
+#include <chain.h>
+#include <chainparams.h>
+#include <rpc/blockchain.h>
+#include <rpc/jsonwriter.h>
+#include <streams.h>
+#include <validation.h>
+
+#include <univalue.h>
+
+namespace block_bench {
+#include <bench/data/block413567.raw.h>
+} // namespace block_bench
+
+// The JSON of a 1 MB block at getblock verbosity 2, built as a UniValue and
+// written out as one string, or written out in pieces while it is generated.
+
+struct TestBlockAndIndex {
+    CBlock block;
+    uint256 blockHash;
+    CBlockIndex blockindex;
+
+    TestBlockAndIndex()
+    {
+        // Output addresses are encoded for the selected chain
+        SelectParams(CBaseChainParams::REGTEST);
+
+        CDataStream stream((const char*)block_bench::block413567,
+                (const char*)&block_bench::block413567[sizeof(block_bench::block413567)],
+                SER_NETWORK, PROTOCOL_VERSION);
+        char a = '\0';
+        stream.write(&a, 1); // Prevent compaction
+
+        stream >> block;
+
+        blockHash = block.GetHash();
+        blockindex.phashBlock = &blockHash;
+        blockindex.nBits = 403014710;
+    }
+};
+
+static void BlockToJsonVerbose(benchmark::State& state)
+{
+    TestBlockAndIndex data;
+    LOCK(cs_main);
+    while (state.KeepRunning()) {
+        std::string json = blockToJSON(data.block, &data.blockindex, true).write();
+        assert(!json.empty());
+    }
+}
+
+static void BlockToJsonVerboseStream(benchmark::State& state)
+{
+    TestBlockAndIndex data;
+    size_t written = 0;
+    while (state.KeepRunning()) {
+        JSONWriter writer([&written](const std::string& chunk) { written += chunk.size(); });
+        blockToJSON(data.block, &data.blockindex, true, writer);
+        writer.Flush();
+    }
+    assert(written > 0);
+}
+
+BENCHMARK(BlockToJsonVerbose, 10);
+BENCHMARK(BlockToJsonVerboseStream, 10);
@@ -78,11 +78,21 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
     // of short IDs, any highly-uneven distribution of elements can be safely treated as a
     // READ_STATUS_FAILED.
     std::unordered_map<uint64_t, uint16_t> shorttxids(cmpctblock.shorttxids.size());
+    // Most of a large mempool is not in the block. A bitset over the low bits
+    // of the block's short IDs, at 16 bits per short ID, rejects all but ~1/16
+    // of those entries before they touch the hash map.
+    size_t shortid_filter_bits = 64;
+    while (shortid_filter_bits < cmpctblock.shorttxids.size() * 16)
+        shortid_filter_bits <<= 1;
+    const uint64_t shortid_filter_mask = shortid_filter_bits - 1;
+    std::vector<uint64_t> shortid_filter(shortid_filter_bits / 64);
     uint16_t index_offset = 0;
     for (size_t i = 0; i < cmpctblock.shorttxids.size(); i++) {
         while (txn_available[i + index_offset])
             index_offset++;
         shorttxids[cmpctblock.shorttxids[i]] = i + index_offset;
+        const uint64_t filter_bit = cmpctblock.shorttxids[i] & shortid_filter_mask;
+        shortid_filter[filter_bit >> 6] |= uint64_t{1} << (filter_bit & 63);
         // To determine the chance that the number of entries in a bucket exceeds N,
         // we use the fact that the number of elements in a single bucket is
         // binomially distributed (with n = the number of shorttxids S, and p =
@@ -101,12 +111,19 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
     if (shorttxids.size() != cmpctblock.shorttxids.size())
         return READ_STATUS_FAILED; // Short ID collision
 
+    auto maybe_in_block = [&](uint64_t shortid) {
+        const uint64_t filter_bit = shortid & shortid_filter_mask;
+        return (shortid_filter[filter_bit >> 6] >> (filter_bit & 63)) & 1;
+    };
+
     std::vector<bool> have_txn(txn_available.size());
     {
     LOCK(pool->cs);
     const std::vector<std::pair<uint256, CTxMemPool::txiter> >& vTxHashes = pool->vTxHashes;
     for (size_t i = 0; i < vTxHashes.size(); i++) {
         uint64_t shortid = cmpctblock.GetShortID(vTxHashes[i].first);
+        if (!maybe_in_block(shortid))
+            continue;
         std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
         if (idit != shorttxids.end()) {
             if (!have_txn[idit->second]) {
@@ -133,6 +150,8 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
 
     for (size_t i = 0; i < extra_txn.size(); i++) {
         uint64_t shortid = cmpctblock.GetShortID(extra_txn[i].first);
+        if (!maybe_in_block(shortid))
+            continue;
         std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
         if (idit != shorttxids.end()) {
             if (!have_txn[idit->second]) {
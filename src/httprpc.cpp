@@ -7,6 +7,7 @@
 #include <base58.h>
 #include <chainparams.h>
 #include <httpserver.h>
+#include <rpc/jsonwriter.h>
 #include <rpc/protocol.h>
 #include <rpc/server.h>
 #include <random.h>
@@ -24,6 +25,9 @@
 /** WWW-Authenticate to present with 401 Unauthorized response */
 static const char* WWW_AUTH_HEADER_DATA = "Basic realm=\"jsonrpc\"";
 
+/** Maximum number of threads executing the requests of one batch */
+static int nRPCBatchThreads = DEFAULT_RPC_BATCH_THREADS;
+
 /** Simple one-shot callback timer to be used by the RPC mechanism to e.g.
  * re-lock the wallet.
  */
@@ -144,6 +148,44 @@ static bool RPCAuthorized(const std::string& strAuth, std::string& strAuthUserna
     return multiUserAuthorized(strUserPass);
 }
 
+bool WriteJSONReply(HTTPRequest* req, const std::function<void(JSONWriter& writer)>& write_json)
+{
+    bool started = false;
+    JSONWriter writer([req, &started](const std::string& data) {
+        if (!started) {
+            req->WriteHeader("Content-Type", "application/json");
+            req->StartChunkedReply(HTTP_OK);
+            started = true;
+        }
+        if (!req->WriteReplyChunk(data))
+            throw std::runtime_error("client disconnected");
+    });
+
+    try {
+        write_json(writer);
+    } catch (const std::exception& e) {
+        if (!started) throw;
+        LogPrintf("%s: reply to %s cut short: %s\n", __func__, req->GetURI(), e.what());
+        req->EndChunkedReply();
+        return false;
+    } catch (const UniValue& objError) {
+        if (!started) throw;
+        LogPrintf("%s: reply to %s cut short: %s\n", __func__, req->GetURI(), objError.write());
+        req->EndChunkedReply();
+        return false;
+    }
+
+    std::string rest = writer.Release() + "\n";
+    if (started) {
+        req->WriteReplyChunk(rest);
+        req->EndChunkedReply();
+    } else {
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, rest);
+    }
+    return true;
+}
+
 static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
 {
     // JSONRPC handles only POST
@@ -182,24 +224,24 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         // Set the URI
         jreq.URI = req->GetURI();
 
-        std::string strReply;
         // singleton request
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
 
-            UniValue result = tableRPC.execute(jreq);
-
-            // Send reply
-            strReply = JSONRPCReply(result, NullUniValue, jreq.id);
+            // Send reply, the same as JSONRPCReply, while the result is written
+            return WriteJSONReply(req, [&jreq](JSONWriter& writer) {
+                writer.BeginObject().Key("result");
+                tableRPC.execute(jreq, writer);
+                writer.KV("error", NullUniValue).KV("id", jreq.id).EndObject();
+            });
 
         // array of requests
-        } else if (valRequest.isArray())
-            strReply = JSONRPCExecBatch(jreq, valRequest.get_array());
-        else
+        } else if (valRequest.isArray()) {
+            std::string strReply = JSONRPCExecBatch(jreq, valRequest.get_array(), QueueHTTPWork, nRPCBatchThreads);
+            req->WriteHeader("Content-Type", "application/json");
+            req->WriteReply(HTTP_OK, strReply);
+        } else
             throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
-
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strReply);
     } catch (const UniValue& objError) {
         JSONErrorReply(req, objError, jreq.id);
         return false;
@@ -234,6 +276,8 @@ bool StartHTTPRPC()
     if (!InitRPCAuthentication())
         return false;
 
+    nRPCBatchThreads = std::max((int)gArgs.GetArg("-rpcbatchthreads", DEFAULT_RPC_BATCH_THREADS), 1);
+
     RegisterHTTPHandler("/", true, HTTPReq_JSONRPC);
 #ifdef ENABLE_WALLET
     // ifdef can be removed once we switch to better endpoint support and API versioning
@@ -5,9 +5,16 @@
 #ifndef BITCOIN_HTTPRPC_H
 #define BITCOIN_HTTPRPC_H
 
+#include <functional>
 #include <string>
 #include <map>
 
+class HTTPRequest;
+class JSONWriter;
+
+/** Default for -rpcbatchthreads, the number of threads executing a single batch request */
+static const int DEFAULT_RPC_BATCH_THREADS = 4;
+
 /** Start HTTP RPC subsystem.
  * Precondition; HTTP and RPC has been started.
  */
@@ -20,6 +27,18 @@ void InterruptHTTPRPC();
  */
 void StopHTTPRPC();
 
+/**
+ * Reply to req with the JSON written by write_json, followed by a newline.
+ * The reply is sent as a whole if it is small, and otherwise in chunks while
+ * it is written. Writing waits for a slow client (see WriteReplyChunk), so
+ * at most about MAX_UNSENT_REPLY_SIZE bytes of a large result are held in
+ * memory at once.
+ * Exceptions thrown by write_json before the first chunk was sent are passed
+ * on, so an error reply can be sent instead. Later ones cut the reply short.
+ * @returns whether the whole reply was written.
+ */
+bool WriteJSONReply(HTTPRequest* req, const std::function<void(JSONWriter& writer)>& write_json);
+
 /** Start HTTP REST subsystem.
  * Precondition; HTTP and RPC has been started.
  */
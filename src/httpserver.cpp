@@ -21,13 +21,17 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <signal.h>
+#include <deque>
 #include <future>
+#include <map>
+#include <thread>
 
 #include <event2/thread.h>
 #include <event2/buffer.h>
 #include <event2/bufferevent.h>
 #include <event2/util.h>
 #include <event2/keyvalq_struct.h>
+#include <event2/listener.h>
 
 #include <support/events.h>
 
@@ -61,56 +65,179 @@ private:
     HTTPRequestHandler func;
 };
 
-/** Simple work queue for distributing work over multiple threads.
+/** Work item running a task that was queued by another work item */
+class HTTPTaskItem final : public HTTPClosure
+{
+public:
+    explicit HTTPTaskItem(std::function<void()> _task) : task(std::move(_task))
+    {
+    }
+    void operator()() override
+    {
+        task();
+    }
+
+private:
+    std::function<void()> task;
+};
+
+/** Number of buckets of a histogram counting 64-bit values by power of two */
+static const size_t HISTOGRAM_BUCKETS = 65;
+
+/** Add value to histogram: bucket 0 counts zeroes, bucket i > 0 counts the
+ * values from 2^(i-1) up to 2^i - 1. */
+static void AddToHistogram(std::vector<uint64_t>& histogram, uint64_t value)
+{
+    size_t bucket = 0;
+    while (value) {
+        ++bucket;
+        value >>= 1;
+    }
+    ++histogram[bucket];
+}
+
+/** Work queue for distributing work over multiple threads.
  * Work items are simply callable objects.
+ *
+ * Every client has its own queue of pending work items, and the clients
+ * with pending work take turns, so that a client sending many requests at
+ * once does not hold up the requests of others.
  */
 template <typename WorkItem>
 class WorkQueue
 {
 private:
+    struct QueuedItem {
+        std::unique_ptr<WorkItem> item;
+        int64_t time_queued;
+    };
+
     /** Mutex protects entire object */
     std::mutex cs;
     std::condition_variable cond;
-    std::deque<std::unique_ptr<WorkItem>> queue;
+    //! Pending work items of every client with pending work
+    std::map<CNetAddr, std::deque<QueuedItem>> client_queues;
+    //! Clients with pending work, in the order of their turns
+    std::deque<CNetAddr> turns;
+    //! Clients whose work items are being run, by worker thread
+    std::map<std::thread::id, CNetAddr> running_clients;
+    size_t depth;
     bool running;
     size_t maxDepth;
+    //! Whether the queue was full since the last call of onRoom
+    bool wasFull;
+    //! Called by a worker when there is room in the queue again after it was full
+    std::function<void()> onRoom;
+    HTTPWorkQueueStats stats;
+
+    /** Add item to the queue of client. Requires cs held. */
+    bool EnqueueLocked(WorkItem* item, const CNetAddr& client, bool force)
+    {
+        if (depth >= maxDepth && !force) {
+            ++stats.rejected;
+            return false;
+        }
+        std::deque<QueuedItem>& queue = client_queues[client];
+        if (queue.empty())
+            turns.push_back(client);
+        queue.push_back(QueuedItem{std::unique_ptr<WorkItem>(item), GetTimeMicros()});
+        ++stats.queued;
+        if (depth >= maxDepth)
+            ++stats.delayed;
+        ++depth;
+        if (depth >= maxDepth)
+            wasFull = true;
+        AddToHistogram(stats.depth_histogram, depth);
+        cond.notify_one();
+        return true;
+    }
 
 public:
-    explicit WorkQueue(size_t _maxDepth) : running(true),
-                                 maxDepth(_maxDepth)
+    WorkQueue(size_t _maxDepth, std::function<void()> _onRoom) : depth(0), running(true),
+                                 maxDepth(_maxDepth), wasFull(false), onRoom(std::move(_onRoom))
     {
+        stats.max_depth = maxDepth;
+        stats.depth_histogram.resize(HISTOGRAM_BUCKETS);
+        stats.wait_histogram.resize(HISTOGRAM_BUCKETS);
+        stats.latency_histogram.resize(HISTOGRAM_BUCKETS);
     }
     /** Precondition: worker threads have all stopped (they have been joined).
      */
     ~WorkQueue()
     {
     }
-    /** Enqueue a work item */
-    bool Enqueue(WorkItem* item)
+    /** Enqueue a work item for client. If force, it is queued even if the
+     * queue is full.
+     */
+    bool Enqueue(WorkItem* item, const CNetAddr& client, bool force = false)
+    {
+        std::unique_lock<std::mutex> lock(cs);
+        return EnqueueLocked(item, client, force);
+    }
+    /** Enqueue a work item from a worker thread, for the client of the work
+     * item that the worker is running.
+     */
+    bool EnqueueFromWorker(WorkItem* item)
     {
         std::unique_lock<std::mutex> lock(cs);
-        if (queue.size() >= maxDepth) {
-            return false;
-        }
-        queue.emplace_back(std::unique_ptr<WorkItem>(item));
-        cond.notify_one();
-        return true;
+        auto it = running_clients.find(std::this_thread::get_id());
+        return EnqueueLocked(item, it != running_clients.end() ? it->second : CNetAddr(), false);
+    }
+    /** Whether the queue holds as many work items as it should */
+    bool IsFull()
+    {
+        std::unique_lock<std::mutex> lock(cs);
+        return depth >= maxDepth;
+    }
+    HTTPWorkQueueStats GetStats()
+    {
+        std::unique_lock<std::mutex> lock(cs);
+        HTTPWorkQueueStats result = stats;
+        result.depth = depth;
+        result.clients = client_queues.size();
+        return result;
     }
     /** Thread function */
     void Run()
     {
         while (true) {
             std::unique_ptr<WorkItem> i;
+            int64_t time_queued;
+            bool room = false;
             {
                 std::unique_lock<std::mutex> lock(cs);
-                while (running && queue.empty())
+                while (running && depth == 0)
                     cond.wait(lock);
                 if (!running)
                     break;
-                i = std::move(queue.front());
-                queue.pop_front();
+                // Take the first work item of the client whose turn it is
+                CNetAddr client = turns.front();
+                turns.pop_front();
+                auto it = client_queues.find(client);
+                i = std::move(it->second.front().item);
+                time_queued = it->second.front().time_queued;
+                it->second.pop_front();
+                if (it->second.empty())
+                    client_queues.erase(it);
+                else
+                    turns.push_back(client);
+                --depth;
+                running_clients[std::this_thread::get_id()] = client;
+                AddToHistogram(stats.wait_histogram, GetTimeMicros() - time_queued);
+                if (wasFull && depth < maxDepth) {
+                    wasFull = false;
+                    room = true;
+                }
             }
+            if (room && onRoom)
+                onRoom();
             (*i)();
+            i.reset();
+            {
+                std::unique_lock<std::mutex> lock(cs);
+                running_clients.erase(std::this_thread::get_id());
+                AddToHistogram(stats.latency_histogram, GetTimeMicros() - time_queued);
+            }
         }
     }
     /** Interrupt and exit loops */
@@ -148,6 +275,49 @@ static WorkQueue<HTTPClosure>* workQueue = nullptr;
 std::vector<HTTPPathHandler> pathHandlers;
 //! Bound listening sockets
 std::vector<evhttp_bound_socket *> boundSockets;
+//! Whether to stop accepting connections while the work queue is full, instead of rejecting requests
+static bool fHTTPBackpressure = DEFAULT_HTTP_BACKPRESSURE;
+//! Protects boundSockets after the HTTP server was started, and fListenPaused
+static std::mutex cs_listen;
+//! Whether the bound sockets stopped accepting connections because the work queue is full
+static bool fListenPaused = false;
+//! Timer that keeps the event loop from exiting while it has no listeners nor connections to wait for
+static struct event* eventListenPaused = nullptr;
+
+static void http_listen_paused_cb(evutil_socket_t, short, void*)
+{
+}
+
+/** Stop accepting connections while the work queue is full. Connections
+ * wait in the backlog of the listening sockets until there is room again.
+ */
+static void PauseListening()
+{
+    std::unique_lock<std::mutex> lock(cs_listen);
+    if (fListenPaused)
+        return;
+    LogPrint(BCLog::HTTP, "Work queue full, no longer accepting connections\n");
+    for (evhttp_bound_socket* socket : boundSockets) {
+        evconnlistener_disable(evhttp_bound_socket_get_listener(socket));
+    }
+    struct timeval tv = {3600, 0};
+    event_add(eventListenPaused, &tv);
+    fListenPaused = true;
+}
+
+/** Accept connections again, if the work queue is no longer full */
+static void ResumeListening()
+{
+    std::unique_lock<std::mutex> lock(cs_listen);
+    if (!fListenPaused || !workQueue || workQueue->IsFull())
+        return;
+    LogPrint(BCLog::HTTP, "Accepting connections again\n");
+    for (evhttp_bound_socket* socket : boundSockets) {
+        evconnlistener_enable(evhttp_bound_socket_get_listener(socket));
+    }
+    event_del(eventListenPaused);
+    fListenPaused = false;
+}
 
 /** Check if a network address is allowed to access the HTTP server */
 static bool ClientAllowed(const CNetAddr& netaddr)
@@ -258,11 +428,14 @@ static void http_request_cb(struct evhttp_request* req, void* arg)
 
     // Dispatch to worker thread
     if (i != iend) {
+        CNetAddr client = hreq->GetPeer();
         std::unique_ptr<HTTPWorkItem> item(new HTTPWorkItem(std::move(hreq), path, i->handler));
         assert(workQueue);
-        if (workQueue->Enqueue(item.get()))
+        if (workQueue->Enqueue(item.get(), client, fHTTPBackpressure)) {
             item.release(); /* if true, queue took ownership */
-        else {
+            if (fHTTPBackpressure && workQueue->IsFull())
+                PauseListening();
+        } else {
             LogPrintf("WARNING: request rejected because http work queue depth exceeded, it can be increased with the -rpcworkqueue= setting\n");
             item->req->WriteReply(HTTP_INTERNAL, "Work queue depth exceeded");
         }
@@ -271,6 +444,17 @@ static void http_request_cb(struct evhttp_request* req, void* arg)
     }
 }
 
+bool QueueHTTPWork(std::function<void()> task)
+{
+    if (!workQueue)
+        return false;
+    std::unique_ptr<HTTPTaskItem> item(new HTTPTaskItem(std::move(task)));
+    if (!workQueue->EnqueueFromWorker(item.get()))
+        return false;
+    item.release(); /* queue took ownership */
+    return true;
+}
+
 /** Callback to reject HTTP requests after shutdown. */
 static void http_reject_request_cb(struct evhttp_request* req, void*)
 {
@@ -398,7 +582,16 @@ bool InitHTTPServer()
     int workQueueDepth = std::max((long)gArgs.GetArg("-rpcworkqueue", DEFAULT_HTTP_WORKQUEUE), 1L);
     LogPrintf("HTTP: creating work queue of depth %d\n", workQueueDepth);
 
-    workQueue = new WorkQueue<HTTPClosure>(workQueueDepth);
+    fHTTPBackpressure = gArgs.GetBoolArg("-rpcbackpressure", DEFAULT_HTTP_BACKPRESSURE);
+    struct event_base* base = base_ctr.get();
+    eventListenPaused = event_new(base, -1, EV_PERSIST, http_listen_paused_cb, nullptr);
+    workQueue = new WorkQueue<HTTPClosure>(workQueueDepth, [base] {
+        if (!fHTTPBackpressure)
+            return;
+        // Listeners are only touched from the event loop
+        HTTPEvent* ev = new HTTPEvent(base, true, ResumeListening);
+        ev->trigger(nullptr);
+    });
     // transfer ownership to eventBase/HTTP via .release()
     eventBase = base_ctr.release();
     eventHTTP = http_ctr.release();
@@ -443,9 +636,14 @@ void InterruptHTTPServer()
     LogPrint(BCLog::HTTP, "Interrupting HTTP server\n");
     if (eventHTTP) {
         // Unlisten sockets
+        std::unique_lock<std::mutex> lock(cs_listen);
         for (evhttp_bound_socket *socket : boundSockets) {
             evhttp_del_accept_socket(eventHTTP, socket);
         }
+        boundSockets.clear();
+        if (eventListenPaused)
+            event_del(eventListenPaused);
+        fListenPaused = false;
         // Reject requests on current connections
         evhttp_set_gencb(eventHTTP, http_reject_request_cb, nullptr);
     }
@@ -485,6 +683,10 @@ void StopHTTPServer()
         evhttp_free(eventHTTP);
         eventHTTP = nullptr;
     }
+    if (eventListenPaused) {
+        event_free(eventListenPaused);
+        eventListenPaused = nullptr;
+    }
     if (eventBase) {
         event_base_free(eventBase);
         eventBase = nullptr;
@@ -497,6 +699,15 @@ struct event_base* EventBase()
     return eventBase;
 }
 
+bool GetHTTPWorkQueueStats(HTTPWorkQueueStats& stats)
+{
+    if (!workQueue)
+        return false;
+    stats = workQueue->GetStats();
+    stats.backpressure = fHTTPBackpressure;
+    return true;
+}
+
 static void httpevent_callback_fn(evutil_socket_t, short, void* data)
 {
     // Static handler: simply call inner handler
@@ -524,12 +735,16 @@ void HTTPEvent::trigger(struct timeval* tv)
         evtimer_add(ev, tv); // trigger after timeval passed
 }
 HTTPRequest::HTTPRequest(struct evhttp_request* _req) : req(_req),
-                                                       replySent(false)
+                                                       replySent(false),
+                                                       replyStarted(false)
 {
 }
 HTTPRequest::~HTTPRequest()
 {
-    if (!replySent) {
+    if (replyStarted && !replySent) {
+        // Finish a chunked reply, even if the body is incomplete
+        EndChunkedReply();
+    } else if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
         WriteReply(HTTP_INTERNAL, "Unhandled request");
@@ -580,6 +795,22 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
  * Replies must be sent in the main loop in the main http thread,
  * this cannot be done from worker threads.
  */
+/** Re-enable reading from the socket after a reply was sent. This is the
+ * second part of the libevent workaround in http_request_cb.
+ */
+static void ReenableReading(struct evhttp_request* req)
+{
+    if (event_get_version_number() >= 0x02010600 && event_get_version_number() < 0x02020001) {
+        evhttp_connection* conn = evhttp_request_get_connection(req);
+        if (conn) {
+            bufferevent* bev = evhttp_connection_get_bufferevent(conn);
+            if (bev) {
+                bufferevent_enable(bev, EV_READ | EV_WRITE);
+            }
+        }
+    }
+}
+
 void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
 {
     assert(!replySent && req);
@@ -590,17 +821,114 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     auto req_copy = req;
     HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, nStatus]{
         evhttp_send_reply(req_copy, nStatus, nullptr, nullptr);
-        // Re-enable reading from the socket. This is the second part of the libevent
-        // workaround above.
-        if (event_get_version_number() >= 0x02010600 && event_get_version_number() < 0x02020001) {
-            evhttp_connection* conn = evhttp_request_get_connection(req_copy);
-            if (conn) {
-                bufferevent* bev = evhttp_connection_get_bufferevent(conn);
-                if (bev) {
-                    bufferevent_enable(bev, EV_READ | EV_WRITE);
-                }
-            }
+        ReenableReading(req_copy);
+    });
+    ev->trigger(nullptr);
+    replySent = true;
+    req = nullptr; // transferred back to main thread
+}
+
+/** Progress of a chunked reply, shared between its worker and the event loop */
+struct HTTPReplyFlow
+{
+    std::mutex cs;
+    std::condition_variable cond;
+    //! Bytes passed to WriteReplyChunk and not yet written to the connection
+    size_t nUnsent = 0;
+    //! Bytes handed to libevent since its output buffer was last empty
+    size_t nHanded = 0;
+    bool fClosed = false;
+};
+
+/** libevent wrote out everything handed to it for the connection */
+static void http_reply_flushed_cb(struct evhttp_connection* evcon, void* arg)
+{
+    HTTPReplyFlow* flow = static_cast<HTTPReplyFlow*>(arg);
+    std::lock_guard<std::mutex> lock(flow->cs);
+    flow->nUnsent -= flow->nHanded;
+    flow->nHanded = 0;
+    flow->cond.notify_all();
+}
+
+/** The connection of a chunked reply was closed */
+static void http_reply_closed_cb(struct evhttp_connection* evcon, void* arg)
+{
+    HTTPReplyFlow* flow = static_cast<HTTPReplyFlow*>(arg);
+    std::lock_guard<std::mutex> lock(flow->cs);
+    flow->fClosed = true;
+    flow->cond.notify_all();
+}
+
+void HTTPRequest::StartChunkedReply(int nStatus)
+{
+    assert(!replySent && !replyStarted && req);
+    replyFlow = std::make_shared<HTTPReplyFlow>();
+    auto req_copy = req;
+    auto flow = replyFlow;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, nStatus, flow]{
+        // The client may have disconnected already, in which case libevent
+        // only frees the request once the reply is ended
+        evhttp_connection* evcon = evhttp_request_get_connection(req_copy);
+        if (evcon) {
+            evhttp_connection_set_closecb(evcon, http_reply_closed_cb, flow.get());
+            evhttp_send_reply_start(req_copy, nStatus, nullptr);
+        } else {
+            http_reply_closed_cb(nullptr, flow.get());
+        }
+    });
+    ev->trigger(nullptr);
+    replyStarted = true;
+}
+
+bool HTTPRequest::WriteReplyChunk(const std::string& chunk)
+{
+    assert(replyStarted && !replySent && req);
+    {
+        std::unique_lock<std::mutex> lock(replyFlow->cs);
+        while (replyFlow->nUnsent > MAX_UNSENT_REPLY_SIZE && !replyFlow->fClosed) {
+            replyFlow->cond.wait(lock);
+        }
+        if (replyFlow->fClosed) return false;
+        if (chunk.empty()) return true; // an empty chunk would end the reply
+        replyFlow->nUnsent += chunk.size();
+    }
+    // Events are run in the order they were triggered, so the chunks are
+    // sent after the start and in order.
+    struct evbuffer* evb = evbuffer_new();
+    assert(evb);
+    evbuffer_add(evb, chunk.data(), chunk.size());
+    auto req_copy = req;
+    auto flow = replyFlow;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, evb, flow]{
+        {
+            std::lock_guard<std::mutex> lock(flow->cs);
+            flow->nHanded += evbuffer_get_length(evb);
+        }
+        if (evhttp_request_get_connection(req_copy)) {
+            evhttp_send_reply_chunk_with_cb(req_copy, evb, http_reply_flushed_cb, flow.get());
+        } else {
+            http_reply_closed_cb(nullptr, flow.get());
+        }
+        evbuffer_free(evb);
+    });
+    ev->trigger(nullptr);
+    return true;
+}
+
+void HTTPRequest::EndChunkedReply()
+{
+    assert(replyStarted && !replySent && req);
+    auto req_copy = req;
+    auto flow = replyFlow;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, flow]{
+        // Ending the reply replaces the write callback; the close callback
+        // has to go, as the connection may outlive flow
+        evhttp_connection* evcon = evhttp_request_get_connection(req_copy);
+        if (evcon) {
+            evhttp_connection_set_closecb(evcon, nullptr, nullptr);
         }
+        evhttp_send_reply_end(req_copy);
+        ReenableReading(req_copy);
     });
     ev->trigger(nullptr);
     replySent = true;
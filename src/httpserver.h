@@ -8,10 +8,13 @@
 #include <string>
 #include <stdint.h>
 #include <functional>
+#include <memory>
+#include <vector>
 
 static const int DEFAULT_HTTP_THREADS=4;
 static const int DEFAULT_HTTP_WORKQUEUE=128; // was 16 // FIXME.SUGAR // for huge RPC calling
 static const int DEFAULT_HTTP_SERVER_TIMEOUT=30;
+static const bool DEFAULT_HTTP_BACKPRESSURE=false;
 
 struct evhttp_request;
 struct event_base;
@@ -46,11 +49,49 @@ void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPR
 /** Unregister handler for prefix */
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch);
 
+/** Run task on one of the HTTP worker threads.
+ * Returns false if the work queue is full or the server is not running.
+ */
+bool QueueHTTPWork(std::function<void()> task);
+
+/** Statistics of the HTTP work queue */
+struct HTTPWorkQueueStats
+{
+    //! Number of queued requests, and the -rpcworkqueue limit
+    size_t depth;
+    size_t max_depth;
+    //! Number of clients with queued requests
+    size_t clients;
+    //! Whether a full queue delays new connections instead of rejecting requests
+    bool backpressure;
+    //! Number of requests queued, rejected because the queue was full, and queued beyond the limit
+    uint64_t queued;
+    uint64_t rejected;
+    uint64_t delayed;
+    //! Histograms by power of two: element 0 counts zeroes, element i > 0 the
+    //! values from 2^(i-1) up to 2^i - 1. Queue depths including the queued
+    //! request, microseconds until a request was taken by a worker, and
+    //! microseconds until a request was handled.
+    std::vector<uint64_t> depth_histogram;
+    std::vector<uint64_t> wait_histogram;
+    std::vector<uint64_t> latency_histogram;
+
+    HTTPWorkQueueStats() : depth(0), max_depth(0), clients(0), backpressure(false), queued(0), rejected(0), delayed(0) {}
+};
+
+/** Get the statistics of the HTTP work queue. Returns false if the HTTP server is not running. */
+bool GetHTTPWorkQueueStats(HTTPWorkQueueStats& stats);
+
 /** Return evhttp event base. This can be used by submodules to
  * queue timers or custom events.
  */
 struct event_base* EventBase();
 
+/** Bytes of a chunked reply that may wait to be sent before WriteReplyChunk blocks */
+static const size_t MAX_UNSENT_REPLY_SIZE = 1 << 20;
+
+struct HTTPReplyFlow;
+
 /** In-flight HTTP request.
  * Thin C++ wrapper around evhttp_request.
  */
@@ -59,6 +100,9 @@ class HTTPRequest
 private:
     struct evhttp_request* req;
     bool replySent;
+    bool replyStarted;
+    //! Flow control of a chunked reply
+    std::shared_ptr<HTTPReplyFlow> replyFlow;
 
 public:
     explicit HTTPRequest(struct evhttp_request* req);
@@ -114,6 +158,33 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Start a reply whose body is sent in pieces, as a chunked reply.
+     * nStatus is the HTTP status code to send. Write the body with
+     * WriteReplyChunk and finish the reply with EndChunkedReply.
+     *
+     * @note Use this instead of WriteReply, for replies that are too large
+     * to be assembled in memory first. Write the output headers before.
+     */
+    void StartChunkedReply(int nStatus);
+
+    /**
+     * Send a piece of the body of a reply started with StartChunkedReply.
+     * Waits while more than MAX_UNSENT_REPLY_SIZE bytes of the reply have
+     * not been written to the connection yet, so a slow client holds up the
+     * worker instead of filling memory. Returns false, sending nothing, once
+     * the client has disconnected.
+     */
+    bool WriteReplyChunk(const std::string& chunk);
+
+    /**
+     * Finish a reply started with StartChunkedReply.
+     *
+     * @note As this will give the request back to the main thread, do not
+     * call any other HTTPRequest methods after calling this.
+     */
+    void EndChunkedReply();
 };
 
 /** Event handler closure.
@@ -0,0 +1,354 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <coins.h>
+#include <compat/endian.h>
+#include <hash.h>
+#include <index/addressindex.h>
+#include <undo.h>
+#include <util.h>
+#include <validation.h>
+
+#include <map>
+#include <set>
+#include <tuple>
+
+#include <boost/optional.hpp>
+
+constexpr char DB_ADDRESS_TX = 'x';
+constexpr char DB_ADDRESS_UNSPENT = 'u';
+constexpr char DB_ADDRESS_BALANCE = 'b';
+
+std::unique_ptr<AddressIndex> g_addressindex;
+
+static uint160 ScriptHash(const CScript& script)
+{
+    return Hash160(script.begin(), script.end());
+}
+
+// Heights are stored big-endian so that the entries of a script sort in
+// chain order.
+template <typename Stream>
+static void SerializeBE32(Stream& s, uint32_t n)
+{
+    n = htobe32(n);
+    s.write((const char*)&n, sizeof(n));
+}
+
+template <typename Stream>
+static uint32_t UnserializeBE32(Stream& s)
+{
+    uint32_t n;
+    s.read((char*)&n, sizeof(n));
+    return be32toh(n);
+}
+
+template <typename Stream>
+static void UnserializePrefix(Stream& s, char prefix)
+{
+    char c;
+    ::Unserialize(s, c);
+    if (c != prefix) {
+        throw std::ios_base::failure("Unexpected address index key prefix");
+    }
+}
+
+namespace {
+
+/** A transaction of a script, at its position in the chain; the value is the txid */
+struct AddressTxKey
+{
+    uint160 hash;
+    uint32_t nHeight;
+    uint32_t nTxPos;
+
+    AddressTxKey() : nHeight(0), nTxPos(0) {}
+    AddressTxKey(const uint160& hashIn, uint32_t nHeightIn, uint32_t nTxPosIn) : hash(hashIn), nHeight(nHeightIn), nTxPos(nTxPosIn) {}
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        ::Serialize(s, DB_ADDRESS_TX);
+        ::Serialize(s, hash);
+        SerializeBE32(s, nHeight);
+        SerializeBE32(s, nTxPos);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        UnserializePrefix(s, DB_ADDRESS_TX);
+        ::Unserialize(s, hash);
+        nHeight = UnserializeBE32(s);
+        nTxPos = UnserializeBE32(s);
+    }
+
+    bool operator<(const AddressTxKey& other) const
+    {
+        return std::tie(hash, nHeight, nTxPos) < std::tie(other.hash, other.nHeight, other.nTxPos);
+    }
+};
+
+/** An unspent output of a script, under the height it was confirmed at */
+struct AddressUnspentKey
+{
+    uint160 hash;
+    uint32_t nHeight;
+    COutPoint outpoint;
+
+    AddressUnspentKey() : nHeight(0) {}
+    AddressUnspentKey(const uint160& hashIn, uint32_t nHeightIn, const COutPoint& outpointIn) : hash(hashIn), nHeight(nHeightIn), outpoint(outpointIn) {}
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        ::Serialize(s, DB_ADDRESS_UNSPENT);
+        ::Serialize(s, hash);
+        SerializeBE32(s, nHeight);
+        ::Serialize(s, outpoint);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        UnserializePrefix(s, DB_ADDRESS_UNSPENT);
+        ::Unserialize(s, hash);
+        nHeight = UnserializeBE32(s);
+        ::Unserialize(s, outpoint);
+    }
+
+    bool operator<(const AddressUnspentKey& other) const
+    {
+        return std::tie(hash, nHeight, outpoint) < std::tie(other.hash, other.nHeight, other.outpoint);
+    }
+};
+
+struct AddressUnspentValue
+{
+    CAmount nValue;
+    bool fCoinBase;
+
+    AddressUnspentValue() : nValue(0), fCoinBase(false) {}
+    AddressUnspentValue(CAmount nValueIn, bool fCoinBaseIn) : nValue(nValueIn), fCoinBase(fCoinBaseIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nValue);
+        READWRITE(fCoinBase);
+    }
+};
+
+} // namespace
+
+/**
+ * Access to the address index database (indexes/address/)
+ *
+ * The database stores a block locator of the chain the database is synced to
+ * so that the AddressIndex can efficiently determine the point it last stopped
+ * at. A locator is used instead of a simple hash of the chain tip because
+ * blocks and block index entries may not be flushed to disk until after this
+ * database is updated.
+ */
+class AddressIndex::DB : public BaseIndex::DB
+{
+public:
+    explicit DB(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+};
+
+AddressIndex::DB::DB(size_t n_cache_size, bool f_memory, bool f_wipe) :
+    BaseIndex::DB(GetDataDir() / "indexes" / "address", n_cache_size, f_memory, f_wipe)
+{}
+
+struct AddressIndex::Changes
+{
+    //! An empty entry is to be erased
+    std::map<AddressTxKey, boost::optional<uint256>> txs;
+    std::map<AddressUnspentKey, boost::optional<AddressUnspentValue>> unspent;
+    std::map<uint160, AddressBalance> balances;
+};
+
+AddressIndex::AddressIndex(size_t n_cache_size, bool f_memory, bool f_wipe)
+    : m_db(MakeUnique<AddressIndex::DB>(n_cache_size, f_memory, f_wipe)), m_changes(MakeUnique<Changes>())
+{}
+
+AddressIndex::~AddressIndex() {}
+
+bool AddressIndex::StageBlock(const CBlock& block, const CBlockIndex* pindex, bool fUndo)
+{
+    // The genesis block's outputs are not spendable
+    if (pindex->nHeight == 0) {
+        return true;
+    }
+
+    CBlockUndo blockundo;
+    if (!UndoReadFromDisk(blockundo, pindex)) {
+        return error("%s: Failed to read undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+    }
+    if (blockundo.vtxundo.size() + 1 != block.vtx.size()) {
+        return error("%s: Undo data of block %s does not match it", __func__, pindex->GetBlockHash().ToString());
+    }
+
+    auto stageBalance = [this](const uint160& hash, CAmount nBalanceChange, CAmount nReceivedChange) {
+        auto it = m_changes->balances.find(hash);
+        if (it == m_changes->balances.end()) {
+            it = m_changes->balances.emplace(hash, AddressBalance()).first;
+            m_db->Read(std::make_pair(DB_ADDRESS_BALANCE, hash), it->second);
+        }
+        it->second.nBalance += nBalanceChange;
+        it->second.nReceived += nReceivedChange;
+    };
+
+    // Undoing goes through the transactions backwards, so that an output
+    // created and spent in this block ends up erased either way
+    const int nSign = fUndo ? -1 : 1;
+    for (size_t n = 0; n < block.vtx.size(); n++) {
+        const size_t i = fUndo ? block.vtx.size() - 1 - n : n;
+        const CTransaction& tx = *block.vtx[i];
+        std::set<uint160> setTouched;
+        if (i > 0) {
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                const Coin& coin = txundo.vprevout[j];
+                const uint160 hash = ScriptHash(coin.out.scriptPubKey);
+                boost::optional<AddressUnspentValue> value;
+                if (fUndo) {
+                    value = AddressUnspentValue(coin.out.nValue, coin.IsCoinBase());
+                }
+                m_changes->unspent[AddressUnspentKey(hash, coin.nHeight, tx.vin[j].prevout)] = value;
+                stageBalance(hash, -nSign * coin.out.nValue, 0);
+                setTouched.insert(hash);
+            }
+        }
+        for (size_t j = 0; j < tx.vout.size(); j++) {
+            const CTxOut& out = tx.vout[j];
+            if (out.scriptPubKey.IsUnspendable()) {
+                continue;
+            }
+            const uint160 hash = ScriptHash(out.scriptPubKey);
+            boost::optional<AddressUnspentValue> value;
+            if (!fUndo) {
+                value = AddressUnspentValue(out.nValue, tx.IsCoinBase());
+            }
+            m_changes->unspent[AddressUnspentKey(hash, pindex->nHeight, COutPoint(tx.GetHash(), j))] = value;
+            stageBalance(hash, nSign * out.nValue, nSign * out.nValue);
+            setTouched.insert(hash);
+        }
+        for (const uint160& hash : setTouched) {
+            boost::optional<uint256> txid;
+            if (!fUndo) {
+                txid = tx.GetHash();
+            }
+            m_changes->txs[AddressTxKey(hash, pindex->nHeight, i)] = txid;
+        }
+    }
+    return true;
+}
+
+bool AddressIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    return StageBlock(block, pindex, false);
+}
+
+bool AddressIndex::Rewind(const CBlockIndex* current_tip, const CBlockIndex* new_tip)
+{
+    const Consensus::Params& consensus_params = Params().GetConsensus();
+    for (const CBlockIndex* pindex = current_tip; pindex != new_tip; pindex = pindex->pprev) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, consensus_params)) {
+            return error("%s: Failed to read block %s from disk", __func__, pindex->GetBlockHash().ToString());
+        }
+        if (!StageBlock(block, pindex, true)) {
+            return false;
+        }
+    }
+    return BaseIndex::Rewind(current_tip, new_tip);
+}
+
+bool AddressIndex::CommitInternal(CDBBatch& batch)
+{
+    for (const auto& entry : m_changes->txs) {
+        if (entry.second) {
+            batch.Write(entry.first, *entry.second);
+        } else {
+            batch.Erase(entry.first);
+        }
+    }
+    for (const auto& entry : m_changes->unspent) {
+        if (entry.second) {
+            batch.Write(entry.first, *entry.second);
+        } else {
+            batch.Erase(entry.first);
+        }
+    }
+    for (const auto& entry : m_changes->balances) {
+        const auto key = std::make_pair(DB_ADDRESS_BALANCE, entry.first);
+        if (entry.second.nReceived == 0) {
+            batch.Erase(key);
+        } else {
+            batch.Write(key, entry.second);
+        }
+    }
+    m_changes->txs.clear();
+    m_changes->unspent.clear();
+    m_changes->balances.clear();
+    return true;
+}
+
+bool AddressIndex::CommitNeeded() const
+{
+    return m_changes->txs.size() + m_changes->unspent.size() > MAX_STAGED_ENTRIES;
+}
+
+BaseIndex::DB& AddressIndex::GetDB() const { return *m_db; }
+
+bool AddressIndex::FindBalance(const CScript& script, AddressBalance& balance) const
+{
+    return m_db->Read(std::make_pair(DB_ADDRESS_BALANCE, ScriptHash(script)), balance);
+}
+
+void AddressIndex::FindTxs(const CScript& script, size_t nSkip, size_t nCount, std::vector<AddressTx>& txs) const
+{
+    const uint160 hash = ScriptHash(script);
+    std::unique_ptr<CDBIterator> pcursor(m_db->NewIterator());
+    AddressTxKey key;
+    for (pcursor->Seek(AddressTxKey(hash, 0, 0)); pcursor->Valid() && txs.size() < nCount; pcursor->Next()) {
+        if (!pcursor->GetKey(key) || key.hash != hash) {
+            break;
+        }
+        if (nSkip > 0) {
+            --nSkip;
+            continue;
+        }
+        AddressTx tx;
+        if (!pcursor->GetValue(tx.txid)) {
+            break;
+        }
+        tx.nHeight = key.nHeight;
+        txs.push_back(tx);
+    }
+}
+
+void AddressIndex::FindUnspent(const CScript& script, size_t nSkip, size_t nCount, std::vector<AddressUnspent>& unspent) const
+{
+    const uint160 hash = ScriptHash(script);
+    std::unique_ptr<CDBIterator> pcursor(m_db->NewIterator());
+    AddressUnspentKey key;
+    for (pcursor->Seek(AddressUnspentKey(hash, 0, COutPoint(uint256(), 0))); pcursor->Valid() && unspent.size() < nCount; pcursor->Next()) {
+        if (!pcursor->GetKey(key) || key.hash != hash) {
+            break;
+        }
+        if (nSkip > 0) {
+            --nSkip;
+            continue;
+        }
+        AddressUnspentValue value;
+        if (!pcursor->GetValue(value)) {
+            break;
+        }
+        unspent.push_back(AddressUnspent{key.outpoint, value.nValue, (int)key.nHeight, value.fCoinBase});
+    }
+}
@@ -0,0 +1,107 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_ADDRESSINDEX_H
+#define BITCOIN_INDEX_ADDRESSINDEX_H
+
+#include <amount.h>
+#include <index/base.h>
+#include <script/script.h>
+#include <uint256.h>
+
+#include <memory>
+#include <vector>
+
+static const bool DEFAULT_ADDRESSINDEX = false;
+
+/** An unspent transaction output paying to an indexed script */
+struct AddressUnspent
+{
+    COutPoint outpoint;
+    CAmount nValue;
+    int nHeight;
+    bool fCoinBase;
+};
+
+/** A confirmed transaction paying to or spending from an indexed script */
+struct AddressTx
+{
+    uint256 txid;
+    int nHeight;
+};
+
+/** Totals of the outputs paying to an indexed script */
+struct AddressBalance
+{
+    //! Value of the unspent outputs
+    CAmount nBalance;
+    //! Value of all outputs ever confirmed, spent or not
+    CAmount nReceived;
+
+    AddressBalance() : nBalance(0), nReceived(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nBalance);
+        READWRITE(nReceived);
+    }
+};
+
+/**
+ * AddressIndex is used to look up the transactions and unspent outputs of a
+ * scriptPubKey, keyed by its hash. Entries are built from the blocks and their
+ * undo data, so spends are indexed under the script of the output they spend.
+ */
+class AddressIndex final : public BaseIndex
+{
+protected:
+    class DB;
+
+private:
+    struct Changes;
+
+    const std::unique_ptr<DB> m_db;
+
+    //! Entries staged since the last commit
+    const std::unique_ptr<Changes> m_changes;
+
+    /** Stage the entries of one block, or their removal if fUndo */
+    bool StageBlock(const CBlock& block, const CBlockIndex* pindex, bool fUndo);
+
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) override;
+
+    bool CommitInternal(CDBBatch& batch) override;
+
+    bool CommitNeeded() const override;
+
+    bool Rewind(const CBlockIndex* current_tip, const CBlockIndex* new_tip) override;
+
+    BaseIndex::DB& GetDB() const override;
+
+    const char* GetName() const override { return "addressindex"; }
+
+public:
+    /// Constructs the index, which becomes available to be queried.
+    explicit AddressIndex(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+
+    // Destructor is declared because this class contains a unique_ptr to an incomplete type.
+    virtual ~AddressIndex() override;
+
+    /** Totals for script. Returns false if nothing was ever paid to it. */
+    bool FindBalance(const CScript& script, AddressBalance& balance) const;
+
+    /** Up to nCount transactions of script in chain order, after skipping the first nSkip. */
+    void FindTxs(const CScript& script, size_t nSkip, size_t nCount, std::vector<AddressTx>& txs) const;
+
+    /** Up to nCount unspent outputs of script, oldest first, after skipping the first nSkip. */
+    void FindUnspent(const CScript& script, size_t nSkip, size_t nCount, std::vector<AddressUnspent>& unspent) const;
+};
+
+/// The global address index, used in the getaddress* RPCs. May be null.
+extern std::unique_ptr<AddressIndex> g_addressindex;
+
+#endif // BITCOIN_INDEX_ADDRESSINDEX_H
@@ -0,0 +1,366 @@
+// Copyright (c) 2017-2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <index/base.h>
+#include <init.h>
+#include <tinyformat.h>
+#include <ui_interface.h>
+#include <util.h>
+#include <validation.h>
+#include <warnings.h>
+
+#include <algorithm>
+#include <vector>
+
+constexpr char DB_BEST_BLOCK = 'B';
+
+constexpr int64_t SYNC_LOG_INTERVAL = 30; // seconds
+constexpr int64_t SYNC_LOCATOR_WRITE_INTERVAL = 30; // seconds
+//! Blocks read from disk at once while catching up
+constexpr size_t SYNC_BATCH_SIZE = 64;
+//! Upper bound on the threads reading a batch
+constexpr int MAX_SYNC_READ_THREADS = 8;
+
+template<typename... Args>
+static void FatalError(const char* fmt, const Args&... args)
+{
+    std::string strMessage = tfm::format(fmt, args...);
+    SetMiscWarning(strMessage);
+    LogPrintf("*** %s\n", strMessage);
+    uiInterface.ThreadSafeMessageBox(
+        "Error: A fatal internal error occurred, see debug.log for details",
+        "", CClientUIInterface::MSG_ERROR);
+    StartShutdown();
+}
+
+BaseIndex::DB::DB(const fs::path& path, size_t n_cache_size, bool f_memory, bool f_wipe, bool f_obfuscate) :
+    CDBWrapper(path, n_cache_size, f_memory, f_wipe, f_obfuscate)
+{}
+
+bool BaseIndex::DB::ReadBestBlock(CBlockLocator& locator) const
+{
+    bool success = Read(DB_BEST_BLOCK, locator);
+    if (!success) {
+        locator.SetNull();
+    }
+    return success;
+}
+
+void BaseIndex::DB::WriteBestBlock(CDBBatch& batch, const CBlockLocator& locator)
+{
+    batch.Write(DB_BEST_BLOCK, locator);
+}
+
+BaseIndex::~BaseIndex()
+{
+    Interrupt();
+    Stop();
+}
+
+bool BaseIndex::Init()
+{
+    CBlockLocator locator;
+    if (!GetDB().ReadBestBlock(locator)) {
+        locator.SetNull();
+    }
+
+    LOCK(cs_main);
+    // Start from the block the index was last written at, even if it is no
+    // longer in the active chain, so that its entries can be rewound.
+    const CBlockIndex* pindex = nullptr;
+    if (!locator.IsNull()) {
+        BlockMap::const_iterator it = mapBlockIndex.find(locator.vHave.front());
+        if (it != mapBlockIndex.end() && it->second->nStatus & BLOCK_HAVE_UNDO) {
+            pindex = it->second;
+        }
+    }
+    // An empty locator means nothing was indexed yet, not even the genesis
+    // block, whose filter starts the filter header chain.
+    if (!pindex && !locator.IsNull()) {
+        pindex = FindForkInGlobalIndex(chainActive, locator);
+    }
+    m_best_block_index = pindex;
+    m_synced = m_best_block_index.load() == chainActive.Tip();
+    return true;
+}
+
+static const CBlockIndex* NextSyncBlock(const CBlockIndex* pindex_prev)
+{
+    AssertLockHeld(cs_main);
+
+    if (!pindex_prev) {
+        return chainActive.Genesis();
+    }
+
+    const CBlockIndex* pindex = chainActive.Next(pindex_prev);
+    if (pindex) {
+        return pindex;
+    }
+
+    return chainActive.Next(chainActive.FindFork(pindex_prev));
+}
+
+void BaseIndex::ThreadSync()
+{
+    const CBlockIndex* pindex = m_best_block_index.load();
+    if (!m_synced) {
+        auto& consensus_params = Params().GetConsensus();
+        // Reading a block checks its proof of work, which dominates the cost
+        // of catching up, so blocks are read on several threads at once.
+        const size_t n_read_threads = std::max(1, std::min(GetNumCores(), MAX_SYNC_READ_THREADS));
+
+        int64_t last_log_time = 0;
+        int64_t last_locator_write_time = GetTime();
+        while (true) {
+            if (m_interrupt) {
+                Commit();
+                return;
+            }
+
+            std::vector<const CBlockIndex*> batch;
+            {
+                LOCK(cs_main);
+                const CBlockIndex* pindex_next = NextSyncBlock(pindex);
+                if (!pindex_next) {
+                    // The index may be ahead of a chain that is being
+                    // rebuilt; it then skips blocks until the chain catches
+                    // up, and rewinds only if the chain takes another branch.
+                    if (!Commit()) {
+                        FatalError("%s: Failed to commit latest %s state", __func__, GetName());
+                        return;
+                    }
+                    m_synced = true;
+                    break;
+                }
+                if (pindex_next->pprev != pindex && !Rewind(pindex, pindex_next->pprev)) {
+                    FatalError("%s: Failed to rewind index %s to a previous chain tip",
+                               __func__, GetName());
+                    return;
+                }
+                // Blocks of the active chain stay in mapBlockIndex, so the
+                // batch can be used after cs_main is released. A reorg in the
+                // meantime is caught up with by the next iteration.
+                for (; pindex_next && batch.size() < SYNC_BATCH_SIZE; pindex_next = chainActive.Next(pindex_next)) {
+                    batch.push_back(pindex_next);
+                }
+            }
+
+            int64_t current_time = GetTime();
+            if (last_log_time + SYNC_LOG_INTERVAL < current_time) {
+                LogPrintf("Syncing %s with block chain from height %d\n",
+                          GetName(), batch.front()->nHeight);
+                last_log_time = current_time;
+            }
+
+            std::vector<CBlock> blocks(batch.size());
+            // Not std::vector<bool>, whose elements cannot be written concurrently
+            std::vector<char> read_ok(batch.size(), false);
+            auto read_blocks = [&](size_t start) {
+                for (size_t i = start; i < batch.size(); i += n_read_threads) {
+                    read_ok[i] = ReadBlockFromDisk(blocks[i], batch[i], consensus_params);
+                }
+            };
+            std::vector<std::thread> readers;
+            for (size_t i = 1; i < std::min(n_read_threads, batch.size()); ++i) {
+                readers.emplace_back(read_blocks, i);
+            }
+            read_blocks(0);
+            for (std::thread& reader : readers) {
+                reader.join();
+            }
+
+            for (size_t i = 0; i < batch.size(); ++i) {
+                pindex = batch[i];
+                if (!read_ok[i]) {
+                    FatalError("%s: Failed to read block %s from disk",
+                               __func__, pindex->GetBlockHash().ToString());
+                    return;
+                }
+                if (!WriteBlock(blocks[i], pindex)) {
+                    FatalError("%s: Failed to write block %s to index database",
+                               __func__, pindex->GetBlockHash().ToString());
+                    return;
+                }
+                m_best_block_index = pindex;
+
+                if (last_locator_write_time + SYNC_LOCATOR_WRITE_INTERVAL < current_time || CommitNeeded()) {
+                    if (!Commit()) {
+                        FatalError("%s: Failed to commit latest %s state", __func__, GetName());
+                        return;
+                    }
+                    last_locator_write_time = current_time;
+                }
+            }
+        }
+    }
+
+    if (pindex) {
+        LogPrintf("%s is enabled at height %d\n", GetName(), pindex->nHeight);
+    } else {
+        LogPrintf("%s is enabled\n", GetName());
+    }
+}
+
+bool BaseIndex::Commit()
+{
+    return Commit(m_best_block_index.load());
+}
+
+bool BaseIndex::Commit(const CBlockIndex* best_block_index)
+{
+    CDBBatch batch(GetDB());
+    if (!CommitInternal(batch)) {
+        return error("%s: Failed to stage %s changes", __func__, GetName());
+    }
+    GetDB().WriteBestBlock(batch, best_block_index ? CBlockLocator(std::vector<uint256>{best_block_index->GetBlockHash()}) : CBlockLocator());
+    if (!GetDB().WriteBatch(batch)) {
+        return error("%s: Failed to commit latest %s state", __func__, GetName());
+    }
+    return true;
+}
+
+bool BaseIndex::Rewind(const CBlockIndex* current_tip, const CBlockIndex* new_tip)
+{
+    assert(current_tip == m_best_block_index);
+    assert(!new_tip || current_tip->GetAncestor(new_tip->nHeight) == new_tip);
+
+    m_best_block_index = new_tip;
+    return Commit();
+}
+
+void BaseIndex::BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex,
+                               const std::vector<CTransactionRef>& txn_conflicted)
+{
+    if (!m_synced) {
+        return;
+    }
+
+    const CBlockIndex* best_block_index = m_best_block_index.load();
+    if (!best_block_index) {
+        if (pindex->nHeight != 0) {
+            FatalError("%s: First block connected is not the genesis block (height=%d)",
+                       __func__, pindex->nHeight);
+            return;
+        }
+    } else {
+        // The sync thread may have indexed blocks whose notifications are
+        // still in the queue when it caught up, or the index may be ahead of
+        // a chain that is being rebuilt.
+        if (best_block_index->GetAncestor(pindex->nHeight) == pindex) {
+            return;
+        }
+        // Ensure block connects to an ancestor of the current best block. This should be the case
+        // most of the time, but may not be immediately after the sync thread catches up and sets
+        // m_synced. Consider the case where there is a reorg and the blocks on the stale branch are
+        // in the ValidationInterface queue backlog even after the sync thread has caught up to the
+        // new chain tip. In this unlikely event, log a warning and let the queue clear.
+        if (best_block_index->GetAncestor(pindex->nHeight - 1) != pindex->pprev) {
+            LogPrintf("%s: WARNING: Block %s does not connect to an ancestor of " /* Continued */
+                      "known best chain (tip=%s); not updating index\n",
+                      __func__, pindex->GetBlockHash().ToString(),
+                      best_block_index->GetBlockHash().ToString());
+            return;
+        }
+        if (best_block_index != pindex->pprev && !Rewind(best_block_index, pindex->pprev)) {
+            FatalError("%s: Failed to rewind index %s to a previous chain tip",
+                       __func__, GetName());
+            return;
+        }
+    }
+
+    if (!WriteBlock(*block, pindex)) {
+        FatalError("%s: Failed to write block %s to index",
+                   __func__, pindex->GetBlockHash().ToString());
+        return;
+    }
+    // Commit before publishing the new best block, or a caller of
+    // BlockUntilSyncedToCurrentChain could look up entries still staged
+    if (!Commit(pindex)) {
+        FatalError("%s: Failed to commit latest %s state", __func__, GetName());
+        return;
+    }
+    m_best_block_index = pindex;
+}
+
+void BaseIndex::BlockDisconnected(const std::shared_ptr<const CBlock>& block)
+{
+    if (!m_synced) {
+        return;
+    }
+
+    const CBlockIndex* pindex = nullptr;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(block->GetHash());
+        if (it != mapBlockIndex.end()) {
+            pindex = it->second;
+        }
+    }
+
+    // The block may never have been indexed, or been rewound already when a
+    // block from the new chain was connected.
+    const CBlockIndex* best_block_index = m_best_block_index.load();
+    if (!pindex || !best_block_index || best_block_index->GetAncestor(pindex->nHeight) != pindex) {
+        return;
+    }
+    if (!Rewind(best_block_index, pindex->pprev)) {
+        FatalError("%s: Failed to rewind index %s past disconnected block %s",
+                   __func__, GetName(), pindex->GetBlockHash().ToString());
+    }
+}
+
+bool BaseIndex::BlockUntilSyncedToCurrentChain()
+{
+    AssertLockNotHeld(cs_main);
+
+    if (!m_synced) {
+        return false;
+    }
+
+    {
+        // Skip the queue-draining stuff if we know we're caught up with
+        // chainActive.Tip(). An index ahead of it still has disconnected
+        // blocks to rewind.
+        LOCK(cs_main);
+        const CBlockIndex* chain_tip = chainActive.Tip();
+        const CBlockIndex* best_block_index = m_best_block_index.load();
+        if (best_block_index == chain_tip) {
+            return true;
+        }
+    }
+
+    LogPrintf("%s: %s is catching up on block notifications\n", __func__, GetName());
+    SyncWithValidationInterfaceQueue();
+    return true;
+}
+
+void BaseIndex::Interrupt()
+{
+    m_interrupt();
+}
+
+void BaseIndex::Start()
+{
+    // Need to register this ValidationInterface before running Init(), so that
+    // callbacks are not missed if Init sets m_synced to true.
+    RegisterValidationInterface(this);
+    m_interrupt.reset();
+    if (!Init()) {
+        FatalError("%s: %s failed to initialize", __func__, GetName());
+        return;
+    }
+
+    m_thread_sync = std::thread(&TraceThread<std::function<void()>>, GetName(),
+                                std::bind(&BaseIndex::ThreadSync, this));
+}
+
+void BaseIndex::Stop()
+{
+    UnregisterValidationInterface(this);
+
+    if (m_thread_sync.joinable()) {
+        m_thread_sync.join();
+    }
+}
@@ -0,0 +1,359 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <coins.h>
+#include <consensus/consensus.h>
+#include <consensus/validation.h>
+#include <index/blockstatsindex.h>
+#include <undo.h>
+#include <util.h>
+#include <validation.h>
+
+#include <algorithm>
+
+/* The index database stores the statistics of each block. Those belonging to blocks on the active
+ * chain are indexed by height, and those belonging to blocks that have been reorganized out of the
+ * active chain are indexed by block hash, like in the block filter index.
+ *
+ * Keys for the height index have the type [DB_BLOCK_HEIGHT, uint32 (BE)], so that the statistics
+ * of a range of heights are adjacent. Keys for the hash index have the type [DB_BLOCK_HASH,
+ * uint256].
+ */
+constexpr char DB_BLOCK_HASH = 's';
+constexpr char DB_BLOCK_HEIGHT = 't';
+
+//! Approximate size in memory of a coin besides its output
+static constexpr size_t PER_UTXO_OVERHEAD = sizeof(COutPoint) + sizeof(uint32_t) + sizeof(bool);
+
+std::unique_ptr<BlockStatsIndex> g_block_stats_index;
+
+namespace {
+
+struct DBHeightKey {
+    int height;
+
+    DBHeightKey() : height(0) {}
+    explicit DBHeightKey(int height_in) : height(height_in) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        ser_writedata8(s, DB_BLOCK_HEIGHT);
+        ser_writedata32be(s, height);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s)
+    {
+        char prefix = ser_readdata8(s);
+        if (prefix != DB_BLOCK_HEIGHT) {
+            throw std::ios_base::failure("Invalid format for blockstatsindex DB height key");
+        }
+        height = ser_readdata32be(s);
+    }
+};
+
+struct DBHashKey {
+    uint256 hash;
+
+    explicit DBHashKey(const uint256& hash_in) : hash(hash_in) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        char prefix = DB_BLOCK_HASH;
+        READWRITE(prefix);
+        if (prefix != DB_BLOCK_HASH) {
+            throw std::ios_base::failure("Invalid format for blockstatsindex DB hash key");
+        }
+
+        READWRITE(hash);
+    }
+};
+
+} // namespace
+
+CBlockStats::CBlockStats() :
+    txs(0), ins(0), outs(0), total_size(0), total_weight(0), swtxs(0), swtotal_size(0), swtotal_weight(0),
+    total_out(0), totalfee(0), minfee(0), maxfee(0), medianfee(0), avgfee(0),
+    minfeerate(0), maxfeerate(0), avgfeerate(0),
+    mintxsize(0), maxtxsize(0), mediantxsize(0), avgtxsize(0), subsidy(0), utxo_increase(0), utxo_size_inc(0)
+{
+    std::fill(std::begin(feerate_percentiles), std::end(feerate_percentiles), 0);
+}
+
+template<typename T>
+static T CalculateTruncatedMedian(std::vector<T>& scores)
+{
+    size_t size = scores.size();
+    if (size == 0) {
+        return 0;
+    }
+
+    std::sort(scores.begin(), scores.end());
+    if (size % 2 == 0) {
+        return (scores[size / 2 - 1] + scores[size / 2]) / 2;
+    } else {
+        return scores[size / 2];
+    }
+}
+
+void CalculatePercentilesByWeight(CAmount result[NUM_GETBLOCKSTATS_PERCENTILES], std::vector<std::pair<CAmount, int64_t>>& scores, int64_t total_weight)
+{
+    if (scores.empty()) {
+        return;
+    }
+
+    std::sort(scores.begin(), scores.end());
+
+    // 10th, 25th, 50th, 75th, and 90th percentile weight units.
+    const double weights[NUM_GETBLOCKSTATS_PERCENTILES] = {
+        total_weight / 10.0, total_weight / 4.0, total_weight / 2.0, (total_weight * 3.0) / 4.0, (total_weight * 9.0) / 10.0
+    };
+
+    size_t next_percentile_index = 0;
+    int64_t cumulative_weight = 0;
+    for (const auto& element : scores) {
+        cumulative_weight += element.second;
+        while (next_percentile_index < NUM_GETBLOCKSTATS_PERCENTILES && cumulative_weight >= weights[next_percentile_index]) {
+            result[next_percentile_index] = element.first;
+            ++next_percentile_index;
+        }
+    }
+
+    // Fill any remaining percentiles with the last value.
+    for (size_t i = next_percentile_index; i < NUM_GETBLOCKSTATS_PERCENTILES; i++) {
+        result[i] = scores.back().first;
+    }
+}
+
+void ComputeBlockStats(const CBlock& block, const CBlockUndo& block_undo, int height, CBlockStats& stats)
+{
+    stats = CBlockStats();
+
+    CAmount minfee = MAX_MONEY;
+    CAmount minfeerate = MAX_MONEY;
+    int64_t mintxsize = MAX_BLOCK_SERIALIZED_SIZE;
+
+    std::vector<CAmount> fee_array;
+    std::vector<std::pair<CAmount, int64_t>> feerate_array;
+    std::vector<int64_t> txsize_array;
+
+    for (size_t i = 0; i < block.vtx.size(); ++i) {
+        const CTransaction& tx = *block.vtx[i];
+        stats.outs += tx.vout.size();
+
+        CAmount tx_total_out = 0;
+        for (const CTxOut& out : tx.vout) {
+            tx_total_out += out.nValue;
+            stats.utxo_size_inc += GetSerializeSize(out, SER_NETWORK, PROTOCOL_VERSION) + PER_UTXO_OVERHEAD;
+        }
+
+        if (tx.IsCoinBase()) {
+            continue;
+        }
+
+        stats.ins += tx.vin.size();
+        stats.total_out += tx_total_out;
+
+        int64_t tx_size = tx.GetTotalSize();
+        txsize_array.push_back(tx_size);
+        stats.maxtxsize = std::max(stats.maxtxsize, tx_size);
+        mintxsize = std::min(mintxsize, tx_size);
+        stats.total_size += tx_size;
+
+        int64_t weight = GetTransactionWeight(tx);
+        stats.total_weight += weight;
+
+        if (tx.HasWitness()) {
+            stats.swtxs++;
+            stats.swtotal_size += tx_size;
+            stats.swtotal_weight += weight;
+        }
+
+        // The undo data of a transaction lists the coins it spent; the
+        // coinbase has none, so transaction i is at i - 1.
+        CAmount tx_total_in = 0;
+        for (const Coin& coin : block_undo.vtxundo.at(i - 1).vprevout) {
+            tx_total_in += coin.out.nValue;
+            stats.utxo_size_inc -= GetSerializeSize(coin.out, SER_NETWORK, PROTOCOL_VERSION) + PER_UTXO_OVERHEAD;
+        }
+
+        CAmount txfee = tx_total_in - tx_total_out;
+        assert(MoneyRange(txfee));
+        fee_array.push_back(txfee);
+        stats.maxfee = std::max(stats.maxfee, txfee);
+        minfee = std::min(minfee, txfee);
+        stats.totalfee += txfee;
+
+        // New feerate uses satoshis per virtual byte instead of per serialized byte
+        CAmount feerate = weight ? (txfee * WITNESS_SCALE_FACTOR) / weight : 0;
+        feerate_array.emplace_back(feerate, weight);
+        stats.maxfeerate = std::max(stats.maxfeerate, feerate);
+        minfeerate = std::min(minfeerate, feerate);
+    }
+
+    const int64_t n_txs = block.vtx.size();
+    stats.txs = n_txs;
+    stats.avgfee = n_txs > 1 ? stats.totalfee / (n_txs - 1) : 0;
+    stats.avgfeerate = stats.total_weight ? (stats.totalfee * WITNESS_SCALE_FACTOR) / stats.total_weight : 0;
+    stats.avgtxsize = n_txs > 1 ? stats.total_size / (n_txs - 1) : 0;
+    CalculatePercentilesByWeight(stats.feerate_percentiles, feerate_array, stats.total_weight);
+    stats.medianfee = CalculateTruncatedMedian(fee_array);
+    stats.mediantxsize = CalculateTruncatedMedian(txsize_array);
+    stats.minfee = minfee == MAX_MONEY ? 0 : minfee;
+    stats.minfeerate = minfeerate == MAX_MONEY ? 0 : minfeerate;
+    stats.mintxsize = mintxsize == MAX_BLOCK_SERIALIZED_SIZE ? 0 : mintxsize;
+    stats.subsidy = GetBlockSubsidy(height, Params().GetConsensus());
+    stats.utxo_increase = stats.outs - stats.ins;
+}
+
+BlockStatsIndex::BlockStatsIndex(size_t n_cache_size, bool f_memory, bool f_wipe)
+    : m_db(MakeUnique<BaseIndex::DB>(GetDataDir() / "indexes" / "blockstats", n_cache_size, f_memory, f_wipe))
+{}
+
+bool BlockStatsIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    // The genesis block has no undo data, and its coinbase spends nothing.
+    CBlockUndo block_undo;
+    if (pindex->nHeight > 0 && !UndoReadFromDisk(block_undo, pindex)) {
+        return error("%s: Failed to read undo data of block %s",
+                     __func__, pindex->GetBlockHash().ToString());
+    }
+
+    m_pending.emplace_back(pindex, CBlockStats());
+    ComputeBlockStats(block, block_undo, pindex->nHeight, m_pending.back().second);
+    return true;
+}
+
+bool BlockStatsIndex::CommitInternal(CDBBatch& batch)
+{
+    for (const auto& entry : m_pending) {
+        batch.Write(DBHeightKey(entry.first->nHeight), std::make_pair(entry.first->GetBlockHash(), entry.second));
+    }
+    m_pending.clear();
+    return BaseIndex::CommitInternal(batch);
+}
+
+bool BlockStatsIndex::CommitNeeded() const
+{
+    return m_pending.size() >= MAX_STAGED_BLOCKS;
+}
+
+static bool CopyHeightIndexToHashIndex(CDBIterator& db_it, CDBBatch& batch,
+                                       int start_height, int stop_height)
+{
+    DBHeightKey key(start_height);
+    db_it.Seek(key);
+
+    for (int height = start_height; height <= stop_height; ++height) {
+        if (!db_it.GetKey(key) || key.height != height) {
+            return error("%s: unexpected key in blockstatsindex: expected (%c, %d)",
+                         __func__, DB_BLOCK_HEIGHT, height);
+        }
+
+        std::pair<uint256, CBlockStats> value;
+        if (!db_it.GetValue(value)) {
+            return error("%s: unable to read value in blockstatsindex at key (%c, %d)",
+                         __func__, DB_BLOCK_HEIGHT, height);
+        }
+
+        batch.Write(DBHashKey(value.first), value.second);
+
+        db_it.Next();
+    }
+    return true;
+}
+
+bool BlockStatsIndex::Rewind(const CBlockIndex* current_tip, const CBlockIndex* new_tip)
+{
+    assert(!new_tip || current_tip->GetAncestor(new_tip->nHeight) == new_tip);
+
+    // Write out the staged blocks first, some of which may be disconnected
+    if (!Commit()) {
+        return false;
+    }
+
+    // During a reorg, the statistics of the blocks that are getting
+    // disconnected are copied from the height index to the hash index so they
+    // can still be found once their height index entries are overwritten.
+    CDBBatch batch(*m_db);
+    std::unique_ptr<CDBIterator> db_it(m_db->NewIterator());
+    if (!CopyHeightIndexToHashIndex(*db_it, batch, new_tip ? new_tip->nHeight + 1 : 0, current_tip->nHeight)) {
+        return false;
+    }
+    if (!m_db->WriteBatch(batch)) return false;
+
+    return BaseIndex::Rewind(current_tip, new_tip);
+}
+
+bool BlockStatsIndex::LookUpStats(const CBlockIndex* block_index, CBlockStats& stats) const
+{
+    // First check if the result is stored under the height index and the value
+    // there matches the block hash. This should be the case if the block is on
+    // the active chain.
+    std::pair<uint256, CBlockStats> read_out;
+    if (!m_db->Read(DBHeightKey(block_index->nHeight), read_out)) {
+        return false;
+    }
+    if (read_out.first == block_index->GetBlockHash()) {
+        stats = read_out.second;
+        return true;
+    }
+
+    // If value at the height index corresponds to an different block, the
+    // result will be stored in the hash index.
+    return m_db->Read(DBHashKey(block_index->GetBlockHash()), stats);
+}
+
+bool BlockStatsIndex::LookUpStatsRange(int start_height, const CBlockIndex* stop_index, std::vector<CBlockStats>& stats) const
+{
+    if (start_height < 0 || start_height > stop_index->nHeight) {
+        return error("%s: invalid range from height %d to %d", __func__, start_height, stop_index->nHeight);
+    }
+
+    const size_t results_size = static_cast<size_t>(stop_index->nHeight - start_height + 1);
+    std::vector<std::pair<uint256, CBlockStats>> values(results_size);
+
+    DBHeightKey key(start_height);
+    std::unique_ptr<CDBIterator> db_it(m_db->NewIterator());
+    db_it->Seek(key);
+    for (int height = start_height; height <= stop_index->nHeight; ++height) {
+        if (!db_it->Valid() || !db_it->GetKey(key) || key.height != height) {
+            return false;
+        }
+
+        size_t i = static_cast<size_t>(height - start_height);
+        if (!db_it->GetValue(values[i])) {
+            return error("%s: unable to read value in blockstatsindex at key (%c, %d)",
+                         __func__, DB_BLOCK_HEIGHT, height);
+        }
+
+        db_it->Next();
+    }
+
+    stats.resize(results_size);
+
+    // Iterate backwards through block indexes to check each entry against the
+    // block hash, looking up those of stale blocks in the hash index.
+    for (const CBlockIndex* block_index = stop_index;
+         block_index && block_index->nHeight >= start_height;
+         block_index = block_index->pprev) {
+        const uint256 block_hash = block_index->GetBlockHash();
+
+        size_t i = static_cast<size_t>(block_index->nHeight - start_height);
+        if (block_hash == values[i].first) {
+            stats[i] = values[i].second;
+            continue;
+        }
+
+        if (!m_db->Read(DBHashKey(block_hash), stats[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,139 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_BLOCKSTATSINDEX_H
+#define BITCOIN_INDEX_BLOCKSTATSINDEX_H
+
+#include <amount.h>
+#include <index/base.h>
+#include <serialize.h>
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+class CBlockUndo;
+
+static const bool DEFAULT_BLOCKSTATSINDEX = false;
+
+static constexpr size_t NUM_GETBLOCKSTATS_PERCENTILES = 5;
+
+/** Per-block statistics, as computed from a block and its undo data */
+struct CBlockStats
+{
+    int64_t txs;
+    int64_t ins;
+    int64_t outs;
+    int64_t total_size;
+    int64_t total_weight;
+    int64_t swtxs;
+    int64_t swtotal_size;
+    int64_t swtotal_weight;
+    CAmount total_out;
+    CAmount totalfee;
+    CAmount minfee;
+    CAmount maxfee;
+    CAmount medianfee;
+    CAmount avgfee;
+    //! Fee rates in satoshis per virtual byte
+    CAmount minfeerate;
+    CAmount maxfeerate;
+    CAmount avgfeerate;
+    //! Fee rates at the 10th, 25th, 50th, 75th and 90th percentile weight unit
+    CAmount feerate_percentiles[NUM_GETBLOCKSTATS_PERCENTILES];
+    int64_t mintxsize;
+    int64_t maxtxsize;
+    int64_t mediantxsize;
+    int64_t avgtxsize;
+    CAmount subsidy;
+    int64_t utxo_increase;
+    int64_t utxo_size_inc;
+
+    CBlockStats();
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(txs);
+        READWRITE(ins);
+        READWRITE(outs);
+        READWRITE(total_size);
+        READWRITE(total_weight);
+        READWRITE(swtxs);
+        READWRITE(swtotal_size);
+        READWRITE(swtotal_weight);
+        READWRITE(total_out);
+        READWRITE(totalfee);
+        READWRITE(minfee);
+        READWRITE(maxfee);
+        READWRITE(medianfee);
+        READWRITE(avgfee);
+        READWRITE(minfeerate);
+        READWRITE(maxfeerate);
+        READWRITE(avgfeerate);
+        for (CAmount& feerate : feerate_percentiles) {
+            READWRITE(feerate);
+        }
+        READWRITE(mintxsize);
+        READWRITE(maxtxsize);
+        READWRITE(mediantxsize);
+        READWRITE(avgtxsize);
+        READWRITE(subsidy);
+        READWRITE(utxo_increase);
+        READWRITE(utxo_size_inc);
+    }
+};
+
+/** Compute the statistics of block at height from the block and its undo data */
+void ComputeBlockStats(const CBlock& block, const CBlockUndo& block_undo, int height, CBlockStats& stats);
+
+/** Fill result with the fee rates at the 10th, 25th, 50th, 75th and 90th percentile weight unit
+ *  of scores, pairs of fee rate and weight. Sorts scores. */
+void CalculatePercentilesByWeight(CAmount result[NUM_GETBLOCKSTATS_PERCENTILES], std::vector<std::pair<CAmount, int64_t>>& scores, int64_t total_weight);
+
+/**
+ * BlockStatsIndex caches the statistics of each block of the active chain by
+ * height, so that the statistics of a range of blocks are read with a single
+ * database scan instead of reading every block and its undo data from disk.
+ * The statistics of blocks that are reorganized out of the active chain stay
+ * available by block hash, like in the block filter index.
+ */
+class BlockStatsIndex final : public BaseIndex
+{
+private:
+    std::unique_ptr<BaseIndex::DB> m_db;
+
+    //! Statistics of the blocks indexed since the last commit
+    std::vector<std::pair<const CBlockIndex*, CBlockStats>> m_pending;
+
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) override;
+
+    bool CommitInternal(CDBBatch& batch) override;
+
+    bool CommitNeeded() const override;
+
+    bool Rewind(const CBlockIndex* current_tip, const CBlockIndex* new_tip) override;
+
+    BaseIndex::DB& GetDB() const override { return *m_db; }
+
+    const char* GetName() const override { return "blockstatsindex"; }
+
+public:
+    /// Constructs the index, which becomes available to be queried.
+    explicit BlockStatsIndex(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+
+    /** Look up the statistics of an indexed block. */
+    bool LookUpStats(const CBlockIndex* block_index, CBlockStats& stats) const;
+
+    /** Look up the statistics of the blocks from start_height to stop_index, in height order.
+     *  Fails if any of them is not indexed. */
+    bool LookUpStatsRange(int start_height, const CBlockIndex* stop_index, std::vector<CBlockStats>& stats) const;
+};
+
+/// The global block statistics index, used in getblockstats. May be null.
+extern std::unique_ptr<BlockStatsIndex> g_block_stats_index;
+
+#endif // BITCOIN_INDEX_BLOCKSTATSINDEX_H
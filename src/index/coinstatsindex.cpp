@@ -0,0 +1,385 @@
+// Copyright (c) 2020-2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <coins.h>
+#include <index/coinstatsindex.h>
+#include <serialize.h>
+#include <streams.h>
+#include <undo.h>
+#include <util.h>
+#include <validation.h>
+
+#include <algorithm>
+#include <thread>
+
+/* The index database stores the UTXO set statistics as of each block. Those belonging to blocks
+ * on the active chain are indexed by height, and those belonging to blocks that have been
+ * reorganized out of the active chain are indexed by block hash, like the block filter index.
+ *
+ * Keys for the height index have the type [DB_BLOCK_HEIGHT, uint32 (BE)], so that the statistics
+ * of a range of heights are adjacent. Keys for the hash index have the type [DB_BLOCK_HASH,
+ * uint256]. The running MuHash, which cannot be recovered from its finalized hash, is stored under
+ * DB_MUHASH along with the best block.
+ */
+constexpr char DB_BLOCK_HASH = 's';
+constexpr char DB_BLOCK_HEIGHT = 't';
+constexpr char DB_MUHASH = 'M';
+
+//! Upper bound on the threads finalizing the MuHash of staged blocks
+static const int MAX_FINALIZE_THREADS = 8;
+
+std::unique_ptr<CoinStatsIndex> g_coin_stats_index;
+
+namespace {
+
+struct DBVal {
+    uint256 muhash;
+    uint64_t transaction_output_count;
+    uint64_t bogo_size;
+    CAmount total_amount;
+
+    DBVal() : transaction_output_count(0), bogo_size(0), total_amount(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(muhash);
+        READWRITE(transaction_output_count);
+        READWRITE(bogo_size);
+        READWRITE(total_amount);
+    }
+};
+
+struct DBHeightKey {
+    int height;
+
+    DBHeightKey() : height(0) {}
+    explicit DBHeightKey(int height_in) : height(height_in) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        ser_writedata8(s, DB_BLOCK_HEIGHT);
+        ser_writedata32be(s, height);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s)
+    {
+        char prefix = ser_readdata8(s);
+        if (prefix != DB_BLOCK_HEIGHT) {
+            throw std::ios_base::failure("Invalid format for coinstatsindex DB height key");
+        }
+        height = ser_readdata32be(s);
+    }
+};
+
+struct DBHashKey {
+    uint256 hash;
+
+    explicit DBHashKey(const uint256& hash_in) : hash(hash_in) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        char prefix = DB_BLOCK_HASH;
+        READWRITE(prefix);
+        if (prefix != DB_BLOCK_HASH) {
+            throw std::ios_base::failure("Invalid format for coinstatsindex DB hash key");
+        }
+
+        READWRITE(hash);
+    }
+};
+
+} // namespace
+
+/** Statistics of an indexed block; the MuHash is finalized when they are written out */
+struct CoinStatsIndex::PendingEntry {
+    int height;
+    uint256 block_hash;
+    MuHash3072 muhash;
+    DBVal value;
+};
+
+std::vector<unsigned char> SerializeCoinForMuHash(const COutPoint& outpoint, const Coin& coin)
+{
+    std::vector<unsigned char> data;
+    CVectorWriter ss(SER_DISK, PROTOCOL_VERSION, data, 0);
+    ss << outpoint;
+    ss << static_cast<uint32_t>(coin.nHeight * 2 + coin.fCoinBase);
+    ss << coin.out;
+    return data;
+}
+
+uint64_t GetBogoSize(const CScript& script_pub_key)
+{
+    return 32 /* txid */ +
+           4 /* vout index */ +
+           4 /* height + coinbase */ +
+           8 /* amount */ +
+           2 /* scriptPubKey len */ +
+           script_pub_key.size() /* scriptPubKey */;
+}
+
+CoinStatsIndex::CoinStatsIndex(size_t n_cache_size, bool f_memory, bool f_wipe)
+    : m_db(MakeUnique<BaseIndex::DB>(GetDataDir() / "indexes" / "coinstats", n_cache_size, f_memory, f_wipe)),
+      m_transaction_output_count(0), m_bogo_size(0), m_total_amount(0)
+{}
+
+CoinStatsIndex::~CoinStatsIndex() {}
+
+bool CoinStatsIndex::ApplyBlock(const CBlock& block, const CBlockIndex* pindex, bool fUndo)
+{
+    // The genesis block's outputs are not spendable, and are not in the UTXO set
+    if (pindex->nHeight == 0) {
+        return true;
+    }
+
+    CBlockUndo block_undo;
+    if (!UndoReadFromDisk(block_undo, pindex)) {
+        return error("%s: Failed to read undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+    }
+    if (block_undo.vtxundo.size() + 1 != block.vtx.size()) {
+        return error("%s: Undo data of block %s does not match it", __func__, pindex->GetBlockHash().ToString());
+    }
+
+    for (size_t i = 0; i < block.vtx.size(); ++i) {
+        const CTransaction& tx = *block.vtx[i];
+        for (uint32_t j = 0; j < tx.vout.size(); ++j) {
+            const CTxOut& out = tx.vout[j];
+            // Unspendable outputs are never added to the UTXO set
+            if (out.scriptPubKey.IsUnspendable()) continue;
+
+            const std::vector<unsigned char> data = SerializeCoinForMuHash(COutPoint(tx.GetHash(), j), Coin(out, pindex->nHeight, tx.IsCoinBase()));
+            if (fUndo) {
+                m_muhash.Remove(data);
+                m_transaction_output_count--;
+                m_total_amount -= out.nValue;
+                m_bogo_size -= GetBogoSize(out.scriptPubKey);
+            } else {
+                m_muhash.Insert(data);
+                m_transaction_output_count++;
+                m_total_amount += out.nValue;
+                m_bogo_size += GetBogoSize(out.scriptPubKey);
+            }
+        }
+
+        if (tx.IsCoinBase()) continue;
+
+        const CTxUndo& tx_undo = block_undo.vtxundo[i - 1];
+        if (tx_undo.vprevout.size() != tx.vin.size()) {
+            return error("%s: Undo data of block %s does not match it", __func__, pindex->GetBlockHash().ToString());
+        }
+        for (size_t j = 0; j < tx.vin.size(); ++j) {
+            const Coin& coin = tx_undo.vprevout[j];
+            const std::vector<unsigned char> data = SerializeCoinForMuHash(tx.vin[j].prevout, coin);
+            if (fUndo) {
+                m_muhash.Insert(data);
+                m_transaction_output_count++;
+                m_total_amount += coin.out.nValue;
+                m_bogo_size += GetBogoSize(coin.out.scriptPubKey);
+            } else {
+                m_muhash.Remove(data);
+                m_transaction_output_count--;
+                m_total_amount -= coin.out.nValue;
+                m_bogo_size -= GetBogoSize(coin.out.scriptPubKey);
+            }
+        }
+    }
+    return true;
+}
+
+bool CoinStatsIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    if (!ApplyBlock(block, pindex, false)) {
+        return false;
+    }
+
+    PendingEntry entry;
+    entry.height = pindex->nHeight;
+    entry.block_hash = pindex->GetBlockHash();
+    entry.muhash = m_muhash;
+    entry.value.transaction_output_count = m_transaction_output_count;
+    entry.value.bogo_size = m_bogo_size;
+    entry.value.total_amount = m_total_amount;
+    m_pending.push_back(std::move(entry));
+    return true;
+}
+
+bool CoinStatsIndex::CommitInternal(CDBBatch& batch)
+{
+    // Finalizing a MuHash takes a modular inversion, which dominates the cost
+    // of indexing a block, so the staged blocks are finalized on several threads.
+    const size_t n_threads = std::min<size_t>(std::max(1, std::min(GetNumCores(), MAX_FINALIZE_THREADS)), m_pending.size());
+    auto finalize = [this, n_threads](size_t start) {
+        for (size_t i = start; i < m_pending.size(); i += n_threads) {
+            m_pending[i].muhash.Finalize(m_pending[i].value.muhash);
+        }
+    };
+    std::vector<std::thread> finalizers;
+    for (size_t i = 1; i < n_threads; ++i) {
+        finalizers.emplace_back(finalize, i);
+    }
+    if (n_threads > 0) finalize(0);
+    for (std::thread& finalizer : finalizers) {
+        finalizer.join();
+    }
+
+    for (const PendingEntry& entry : m_pending) {
+        batch.Write(DBHeightKey(entry.height), std::make_pair(entry.block_hash, entry.value));
+    }
+    m_pending.clear();
+
+    batch.Write(DB_MUHASH, m_muhash);
+    return BaseIndex::CommitInternal(batch);
+}
+
+bool CoinStatsIndex::CommitNeeded() const
+{
+    return m_pending.size() >= MAX_STAGED_BLOCKS;
+}
+
+static bool LookUpOne(const CDBWrapper& db, const CBlockIndex* block_index, DBVal& result)
+{
+    // First check if the result is stored under the height index and the value
+    // there matches the block hash. This should be the case if the block is on
+    // the active chain.
+    std::pair<uint256, DBVal> read_out;
+    if (!db.Read(DBHeightKey(block_index->nHeight), read_out)) {
+        return false;
+    }
+    if (read_out.first == block_index->GetBlockHash()) {
+        result = std::move(read_out.second);
+        return true;
+    }
+
+    // If value at the height index corresponds to an different block, the
+    // result will be stored in the hash index.
+    return db.Read(DBHashKey(block_index->GetBlockHash()), result);
+}
+
+static bool CopyHeightIndexToHashIndex(CDBIterator& db_it, CDBBatch& batch,
+                                       int start_height, int stop_height)
+{
+    DBHeightKey key(start_height);
+    db_it.Seek(key);
+
+    for (int height = start_height; height <= stop_height; ++height) {
+        if (!db_it.GetKey(key) || key.height != height) {
+            return error("%s: unexpected key in coinstatsindex: expected (%c, %d)",
+                         __func__, DB_BLOCK_HEIGHT, height);
+        }
+
+        std::pair<uint256, DBVal> value;
+        if (!db_it.GetValue(value)) {
+            return error("%s: unable to read value in coinstatsindex at key (%c, %d)",
+                         __func__, DB_BLOCK_HEIGHT, height);
+        }
+
+        batch.Write(DBHashKey(value.first), std::move(value.second));
+
+        db_it.Next();
+    }
+    return true;
+}
+
+bool CoinStatsIndex::Rewind(const CBlockIndex* current_tip, const CBlockIndex* new_tip)
+{
+    assert(!new_tip || current_tip->GetAncestor(new_tip->nHeight) == new_tip);
+
+    // Write out the staged blocks first, some of which may be disconnected
+    if (!Commit()) {
+        return false;
+    }
+
+    // During a reorg, the statistics of the blocks that are getting
+    // disconnected are copied from the height index to the hash index so they
+    // can still be found once their height index entries are overwritten.
+    CDBBatch batch(*m_db);
+    std::unique_ptr<CDBIterator> db_it(m_db->NewIterator());
+    if (!CopyHeightIndexToHashIndex(*db_it, batch, new_tip ? new_tip->nHeight + 1 : 0, current_tip->nHeight)) {
+        return false;
+    }
+    if (!m_db->WriteBatch(batch)) return false;
+
+    const Consensus::Params& consensus_params = Params().GetConsensus();
+    for (const CBlockIndex* pindex = current_tip; pindex != new_tip; pindex = pindex->pprev) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, consensus_params)) {
+            return error("%s: Failed to read block %s from disk",
+                         __func__, pindex->GetBlockHash().ToString());
+        }
+        if (!ApplyBlock(block, pindex, true)) {
+            return false;
+        }
+    }
+
+    // Check that the reverted state matches the one stored for new_tip
+    if (new_tip) {
+        DBVal expected;
+        if (!LookUpOne(*m_db, new_tip, expected)) {
+            return error("%s: Cannot read statistics of block %s", __func__, new_tip->GetBlockHash().ToString());
+        }
+        uint256 muhash;
+        m_muhash.Finalize(muhash);
+        if (muhash != expected.muhash || m_transaction_output_count != expected.transaction_output_count ||
+            m_total_amount != expected.total_amount || m_bogo_size != expected.bogo_size) {
+            return error("%s: Statistics of block %s do not match the ones rewound to",
+                         __func__, new_tip->GetBlockHash().ToString());
+        }
+    }
+
+    return BaseIndex::Rewind(current_tip, new_tip);
+}
+
+bool CoinStatsIndex::Init()
+{
+    if (!m_db->Read(DB_MUHASH, m_muhash)) {
+        // Check that the cause of the read failure is that the key does not
+        // exist. Any other errors indicate database corruption or a disk
+        // failure, and starting the index would cause further corruption.
+        if (m_db->Exists(DB_MUHASH)) {
+            return error("%s: Cannot read current %s state; index may be corrupted",
+                         __func__, GetName());
+        }
+    }
+
+    if (!BaseIndex::Init()) {
+        return false;
+    }
+
+    const CBlockIndex* pindex = GetBestBlockIndex();
+    if (pindex) {
+        DBVal entry;
+        if (!LookUpOne(*m_db, pindex, entry)) {
+            return error("%s: Cannot read current %s state; index may be corrupted",
+                         __func__, GetName());
+        }
+        m_transaction_output_count = entry.transaction_output_count;
+        m_bogo_size = entry.bogo_size;
+        m_total_amount = entry.total_amount;
+    }
+
+    return true;
+}
+
+bool CoinStatsIndex::LookUpStats(const CBlockIndex* block_index, CCoinsStats& stats) const
+{
+    DBVal entry;
+    if (!LookUpOne(*m_db, block_index, entry)) {
+        return false;
+    }
+
+    stats.nHeight = block_index->nHeight;
+    stats.hashBlock = block_index->GetBlockHash();
+    stats.nTransactionOutputs = entry.transaction_output_count;
+    stats.nBogoSize = entry.bogo_size;
+    stats.nTotalAmount = entry.total_amount;
+    stats.hashMuHash = entry.muhash;
+    return true;
+}
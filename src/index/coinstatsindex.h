@@ -0,0 +1,102 @@
+// Copyright (c) 2020-2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_COINSTATSINDEX_H
+#define BITCOIN_INDEX_COINSTATSINDEX_H
+
+#include <amount.h>
+#include <crypto/muhash.h>
+#include <index/base.h>
+#include <uint256.h>
+
+#include <memory>
+#include <vector>
+
+class Coin;
+class COutPoint;
+class CScript;
+
+static const bool DEFAULT_COINSTATSINDEX = false;
+
+/** Statistics about the unspent transaction output set */
+struct CCoinsStats
+{
+    int nHeight;
+    uint256 hashBlock;
+    //! Not tracked by the coin stats index
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nBogoSize;
+    uint256 hashSerialized;
+    uint256 hashMuHash;
+    //! Not tracked by the coin stats index
+    uint64_t nDiskSize;
+    CAmount nTotalAmount;
+
+    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0), nTotalAmount(0) {}
+};
+
+/** Serialize a coin the way it is hashed into the MuHash of the UTXO set */
+std::vector<unsigned char> SerializeCoinForMuHash(const COutPoint& outpoint, const Coin& coin);
+
+/** The bogosize of an unspent output: a meaningless metric, kept stable across versions */
+uint64_t GetBogoSize(const CScript& script_pub_key);
+
+/**
+ * CoinStatsIndex maintains statistics on the UTXO set as of every block: the
+ * number of unspent outputs, their total amount and bogosize, and a MuHash of
+ * the set. The running values are updated with the outputs created and spent
+ * by each connected block, and reverted from the block's undo data when it is
+ * disconnected, so the statistics at any height are available without
+ * scanning the chainstate.
+ */
+class CoinStatsIndex final : public BaseIndex
+{
+private:
+    struct PendingEntry;
+
+    std::unique_ptr<BaseIndex::DB> m_db;
+
+    MuHash3072 m_muhash;
+    uint64_t m_transaction_output_count;
+    uint64_t m_bogo_size;
+    CAmount m_total_amount;
+
+    //! Statistics of the blocks indexed since the last commit
+    std::vector<PendingEntry> m_pending;
+
+    /** Apply the outputs created and spent by block to the running statistics, or revert them if fUndo */
+    bool ApplyBlock(const CBlock& block, const CBlockIndex* pindex, bool fUndo);
+
+protected:
+    bool Init() override;
+
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) override;
+
+    bool CommitInternal(CDBBatch& batch) override;
+
+    bool CommitNeeded() const override;
+
+    bool Rewind(const CBlockIndex* current_tip, const CBlockIndex* new_tip) override;
+
+    BaseIndex::DB& GetDB() const override { return *m_db; }
+
+    const char* GetName() const override { return "coinstatsindex"; }
+
+public:
+    /// Constructs the index, which becomes available to be queried.
+    explicit CoinStatsIndex(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+
+    // Destructor is declared because this class contains a vector of an incomplete type.
+    virtual ~CoinStatsIndex() override;
+
+    /** Look up the statistics as of block_index, filling in all but nTransactions,
+     *  hashSerialized and nDiskSize. */
+    bool LookUpStats(const CBlockIndex* block_index, CCoinsStats& stats) const;
+};
+
+/// The global UTXO set statistics index, used in gettxoutsetinfo. May be null.
+extern std::unique_ptr<CoinStatsIndex> g_coin_stats_index;
+
+#endif // BITCOIN_INDEX_COINSTATSINDEX_H
@@ -5,6 +5,11 @@
 #ifndef BITCOIN_INDIRECTMAP_H
 #define BITCOIN_INDIRECTMAP_H
 
+#include <map>
+#include <stddef.h>
+#include <utility>
+#include <vector>
+
 template <class T>
 struct DereferencingComparator { bool operator()(const T a, const T b) const { return *a < *b; } };
 
@@ -53,4 +58,131 @@ public:
     const_iterator cend() const     { return m.cend(); }
 };
 
+/* Hash map whose keys are pointers, but are hashed and compared by their
+ * dereferenced values, with the same interface as indirectmap except for the
+ * ordered lookups.
+ *
+ * Elements are kept in one flat array using open addressing with linear
+ * probing, so each costs just its key pointer and value. The array grows at
+ * three quarters load and shrinks below three sixteenths. Erasing shifts the
+ * rest of the probe run back rather than leaving tombstones. Inserting or
+ * erasing invalidates iterators.
+ *
+ * Objects pointed to by keys must not be modified in any way that changes
+ * their hash or equality.
+ */
+template <class K, class T, class Hasher>
+class indirecthashmap {
+public:
+    typedef std::pair<const K*, T> value_type;
+    typedef size_t size_type;
+
+    class const_iterator
+    {
+    public:
+        const_iterator(const value_type* pIn, const value_type* pEndIn) : p(pIn), pEnd(pEndIn) { SkipEmpty(); }
+        const value_type& operator*() const { return *p; }
+        const value_type* operator->() const { return p; }
+        const_iterator& operator++() { ++p; SkipEmpty(); return *this; }
+        const_iterator operator++(int) { const_iterator copy(*this); ++*this; return copy; }
+        bool operator==(const const_iterator& other) const { return p == other.p; }
+        bool operator!=(const const_iterator& other) const { return p != other.p; }
+    private:
+        const value_type* p;
+        const value_type* pEnd;
+        void SkipEmpty() { while (p != pEnd && p->first == nullptr) ++p; }
+        friend class indirecthashmap;
+    };
+    typedef const_iterator iterator;
+
+private:
+    static const size_type MIN_CAPACITY = 16;
+
+    std::vector<value_type> slots;
+    size_type count_;
+    Hasher hasher;
+
+    size_type Home(const K& key) const { return hasher(key) & (slots.size() - 1); }
+
+    // Slot holding key, or the empty slot ending its probe run
+    size_type Locate(const K& key) const
+    {
+        size_type i = Home(key);
+        while (slots[i].first != nullptr && !(*slots[i].first == key)) {
+            i = (i + 1) & (slots.size() - 1);
+        }
+        return i;
+    }
+
+    void Rehash(size_type capacity)
+    {
+        std::vector<value_type> old(capacity, value_type(nullptr, T()));
+        old.swap(slots);
+        for (const value_type& value : old) {
+            if (value.first != nullptr) {
+                slots[Locate(*value.first)] = value;
+            }
+        }
+    }
+
+    const_iterator At(size_type i) const { return const_iterator(slots.data() + i, slots.data() + slots.size()); }
+
+public:
+    indirecthashmap() : count_(0) { clear(); }
+
+    std::pair<iterator, bool> insert(const value_type& value)
+    {
+        if ((count_ + 1) * 4 > slots.size() * 3) {
+            Rehash(slots.size() * 2);
+        }
+        const size_type i = Locate(*value.first);
+        if (slots[i].first != nullptr) {
+            return std::make_pair(At(i), false);
+        }
+        slots[i] = value;
+        ++count_;
+        return std::make_pair(At(i), true);
+    }
+
+    const_iterator find(const K& key) const
+    {
+        const size_type i = Locate(key);
+        return slots[i].first == nullptr ? end() : At(i);
+    }
+
+    size_type count(const K& key) const { return slots[Locate(key)].first != nullptr; }
+
+    size_type erase(const K& key)
+    {
+        size_type hole = Locate(key);
+        if (slots[hole].first == nullptr) {
+            return 0;
+        }
+        // Move back every later element of the run whose home slot is not
+        // between the hole and itself, so lookups never hit a gap.
+        const size_type mask = slots.size() - 1;
+        for (size_type i = (hole + 1) & mask; slots[i].first != nullptr; i = (i + 1) & mask) {
+            if (((i - Home(*slots[i].first)) & mask) >= ((i - hole) & mask)) {
+                slots[hole] = slots[i];
+                hole = i;
+            }
+        }
+        slots[hole] = value_type(nullptr, T());
+        --count_;
+        if (slots.size() > MIN_CAPACITY && count_ * 16 < slots.size() * 3) {
+            Rehash(slots.size() / 2);
+        }
+        return 1;
+    }
+
+    bool empty() const              { return count_ == 0; }
+    size_type size() const          { return count_; }
+    size_type capacity() const      { return slots.size(); }
+    void clear()                    { std::vector<value_type>(MIN_CAPACITY, value_type(nullptr, T())).swap(slots); count_ = 0; }
+    const_iterator begin() const    { return At(0); }
+    const_iterator end() const      { return At(slots.size()); }
+    const_iterator cbegin() const   { return begin(); }
+    const_iterator cend() const     { return end(); }
+};
+
 #endif // BITCOIN_INDIRECTMAP_H
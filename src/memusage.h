@@ -131,6 +131,12 @@ static inline size_t IncrementalDynamicUsage(const indirectmap<X, Y>& m)
     return MallocUsage(sizeof(stl_tree_node<std::pair<const X*, Y> >));
 }
 
+template<typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const indirecthashmap<X, Y, Z>& m)
+{
+    return MallocUsage(sizeof(std::pair<const X*, Y>) * m.capacity());
+}
+
 template<typename X>
 static inline size_t DynamicUsage(const std::unique_ptr<X>& p)
 {
@@ -39,8 +39,8 @@
 //
 // Unconfirmed transactions in the memory pool often depend on other
 // transactions in the memory pool. When we select transactions from the
-// pool, we select by highest fee rate of a transaction combined with all
-// its ancestors.
+// pool, we select by highest fee rate of the chunks the mempool splits each
+// cluster of dependent transactions into.
 
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockWeight = 0;
@@ -63,11 +63,13 @@ int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParam
 BlockAssembler::Options::Options() {
     blockMinFeeRate = CFeeRate(DEFAULT_BLOCK_MIN_TX_FEE);
     nBlockMaxWeight = DEFAULT_BLOCK_MAX_WEIGHT;
+    fTestBlockValidity = DEFAULT_TEST_BLOCK_VALIDITY;
 }
 
 BlockAssembler::BlockAssembler(const CChainParams& params, const Options& options) : chainparams(params)
 {
     blockMinFeeRate = options.blockMinFeeRate;
+    fTestBlockValidity = options.fTestBlockValidity;
     // Limit weight to between 4K and MAX_BLOCK_WEIGHT-4K for sanity:
     nBlockMaxWeight = std::max<size_t>(4000, std::min<size_t>(MAX_BLOCK_WEIGHT - 4000, options.nBlockMaxWeight));
 }
@@ -85,6 +87,7 @@ static BlockAssembler::Options DefaultOptions(const CChainParams& params)
     } else {
         options.blockMinFeeRate = CFeeRate(DEFAULT_BLOCK_MIN_TX_FEE);
     }
+    options.fTestBlockValidity = gArgs.GetBoolArg("-testblockvalidity", DEFAULT_TEST_BLOCK_VALIDITY);
     return options;
 }
 
@@ -98,6 +101,7 @@ void BlockAssembler::resetBlock()
     nBlockWeight = 4000;
     nBlockSigOpsCost = 400;
     fIncludeWitness = false;
+    fBlockFull = false;
 
     // These counters do not include coinbase tx
     nBlockTx = 0;
@@ -147,9 +151,8 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     // transaction (which in most cases can be a no-op).
     fIncludeWitness = IsWitnessEnabled(pindexPrev, chainparams.GetConsensus()) && fMineWitnessTx;
 
-    int nPackagesSelected = 0;
-    int nDescendantsUpdated = 0;
-    addPackageTxs(nPackagesSelected, nDescendantsUpdated);
+    int nChunksSelected = 0;
+    addChunkTxs(nChunksSelected);
 
     int64_t nTime1 = GetTimeMicros();
 
@@ -176,29 +179,63 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
     pblock->nNonce         = 0;
     pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(*pblock->vtx[0]);
-
-    CValidationState state;
-    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
-        throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+    pblocktemplate->vCoinbaseMerkleBranch = BlockMerkleBranch(*pblock, 0);
+
+    // Every selected transaction passed mempool acceptance against this tip,
+    // so this only guards against bugs in the assembly itself.
+    if (fTestBlockValidity) {
+        CValidationState state;
+        if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
+            throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+        }
     }
     int64_t nTime2 = GetTimeMicros();
 
-    LogPrint(BCLog::BENCH, "CreateNewBlock() packages: %.2fms (%d packages, %d updated descendants), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nPackagesSelected, nDescendantsUpdated, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
+    LogPrint(BCLog::BENCH, "CreateNewBlock() chunks: %.2fms (%d chunks), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nChunksSelected, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
 
     return std::move(pblocktemplate);
 }
 
-void BlockAssembler::onlyUnconfirmed(CTxMemPool::setEntries& testSet)
+bool BlockAssembler::AppendToBlock(CBlockTemplate& blocktemplate, CTxMemPool::txiter iter)
 {
-    for (CTxMemPool::setEntries::iterator iit = testSet.begin(); iit != testSet.end(); ) {
-        // Only test txs not already in the block
-        if (inBlock.count(*iit)) {
-            testSet.erase(iit++);
-        }
-        else {
-            iit++;
-        }
+    // Once something has been left out for lack of room, which transactions
+    // make it in depends on the feerate of everything in the mempool.
+    if (fBlockFull)
+        return false;
+    if (inBlock.count(iter))
+        return true;
+
+    // A package is only the transaction itself if its parents are all in the
+    // block already; otherwise its parents were skipped and it may pull them in.
+    for (CTxMemPool::txiter parent : mempool.GetMemPoolParents(iter)) {
+        if (!inBlock.count(parent))
+            return false;
     }
+
+    // Below the minimum feerate or not final: CreateNewBlock would skip it too
+    if (iter->GetModifiedFee() < blockMinFeeRate.GetFee(iter->GetTxSize()))
+        return true;
+    if (!TestPackageTransactions(CTxMemPool::setEntries{iter}))
+        return true;
+
+    if (!TestPackage(iter->GetTxSize(), iter->GetSigOpCost())) {
+        fBlockFull = true;
+        return false;
+    }
+
+    blocktemplate.block.vtx.emplace_back(iter->GetSharedTx());
+    blocktemplate.vTxFees.push_back(iter->GetFee());
+    blocktemplate.vTxSigOpsCost.push_back(iter->GetSigOpCost());
+    nBlockWeight += iter->GetTxWeight();
+    ++nBlockTx;
+    nBlockSigOpsCost += iter->GetSigOpCost();
+    nFees += iter->GetFee();
+    inBlock.insert(iter);
+    blocktemplate.vTxFees[0] = -nFees;
+
+    nLastBlockTx = nBlockTx;
+    nLastBlockWeight = nBlockWeight;
+    return true;
 }
 
 bool BlockAssembler::TestPackage(uint64_t packageSize, int64_t packageSigOpsCost) const
@@ -245,83 +282,60 @@ void BlockAssembler::AddToBlock(CTxMemPool::txiter iter)
     }
 }
 
-int BlockAssembler::UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded,
-        indexed_modified_transaction_set &mapModifiedTx)
-{
-    int nDescendantsUpdated = 0;
-    for (const CTxMemPool::txiter it : alreadyAdded) {
-        CTxMemPool::setEntries descendants;
-        mempool.CalculateDescendants(it, descendants);
-        // Insert all descendants (not yet in block) into the modified set
-        for (CTxMemPool::txiter desc : descendants) {
-            if (alreadyAdded.count(desc))
-                continue;
-            ++nDescendantsUpdated;
-            modtxiter mit = mapModifiedTx.find(desc);
-            if (mit == mapModifiedTx.end()) {
-                CTxMemPoolModifiedEntry modEntry(desc);
-                modEntry.nSizeWithAncestors -= it->GetTxSize();
-                modEntry.nModFeesWithAncestors -= it->GetModifiedFee();
-                modEntry.nSigOpCostWithAncestors -= it->GetSigOpCost();
-                mapModifiedTx.insert(modEntry);
-            } else {
-                mapModifiedTx.modify(mit, update_for_parent_inclusion(it));
-            }
+namespace {
+// The next chunk to consider from one of the mempool's clusters. Its fee and
+// size are copied so the queue can be ordered without touching the cluster.
+// A transaction linked to no other is a cluster and chunk of its own, with
+// no TxCluster.
+struct ClusterChunk {
+    CAmount nFee;
+    uint64_t nSize;
+    CTxMemPool::txiter tail; //!< The cluster's last transaction
+    const CTxMemPool::TxCluster* pcluster;
+    size_t nChunk;
+
+    explicit ClusterChunk(CTxMemPool::txiter it) :
+        nFee(it->GetModifiedFee()), nSize(it->GetTxSize()), tail(it), pcluster(nullptr), nChunk(0) {}
+    ClusterChunk(CTxMemPool::txiter tailIn, const CTxMemPool::TxCluster* pclusterIn, size_t nChunkIn) :
+        nFee(pclusterIn->vChunks[nChunkIn].nFee), nSize(pclusterIn->vChunks[nChunkIn].nSize), tail(tailIn), pcluster(pclusterIn), nChunk(nChunkIn) {}
+};
+
+// Orders a priority queue of ClusterChunks highest feerate first
+struct CompareClusterChunkByFeeRate {
+    bool operator()(const ClusterChunk& a, const ClusterChunk& b) const
+    {
+        // Avoid division by rewriting (a/b < c/d) as (a*d < c*b).
+        double f1 = (double)a.nFee * b.nSize;
+        double f2 = (double)b.nFee * a.nSize;
+        if (f1 == f2) {
+            return &*a.tail > &*b.tail;
         }
+        return f1 < f2;
     }
-    return nDescendantsUpdated;
-}
-
-// Skip entries in mapTx that are already in a block or are present
-// in mapModifiedTx (which implies that the mapTx ancestor state is
-// stale due to ancestor inclusion in the block)
-// Also skip transactions that we've already failed to add. This can happen if
-// we consider a transaction in mapModifiedTx and it fails: we can then
-// potentially consider it again while walking mapTx.  It's currently
-// guaranteed to fail again, but as a belt-and-suspenders check we put it in
-// failedTx and avoid re-evaluation, since the re-evaluation would be using
-// cached size/sigops/fee values that are not actually correct.
-bool BlockAssembler::SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set &mapModifiedTx, CTxMemPool::setEntries &failedTx)
-{
-    assert (it != mempool.mapTx.end());
-    return mapModifiedTx.count(it) || inBlock.count(it) || failedTx.count(it);
-}
-
-void BlockAssembler::SortForBlock(const CTxMemPool::setEntries& package, CTxMemPool::txiter entry, std::vector<CTxMemPool::txiter>& sortedEntries)
-{
-    // Sort package by ancestor count
-    // If a transaction A depends on transaction B, then A's ancestor count
-    // must be greater than B's.  So this is sufficient to validly order the
-    // transactions for block inclusion.
-    sortedEntries.clear();
-    sortedEntries.insert(sortedEntries.begin(), package.begin(), package.end());
-    std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
-}
-
-// This transaction selection algorithm orders the mempool based
-// on feerate of a transaction including all unconfirmed ancestors.
-// Since we don't remove transactions from the mempool as we select them
-// for block inclusion, we need an alternate method of updating the feerate
-// of a transaction with its not-yet-selected ancestors as we go.
-// This is accomplished by walking the in-mempool descendants of selected
-// transactions and storing a temporary modified state in mapModifiedTxs.
-// Each time through the loop, we compare the best transaction in
-// mapModifiedTxs with the next transaction in the mempool to decide what
-// transaction package to work on next.
-void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpdated)
+};
+} // namespace
+
+// This transaction selection algorithm relies on the mempool's cluster
+// linearization. Every cluster is already split into chunks of non-increasing
+// feerate, each of which only depends on itself and earlier chunks of the
+// same cluster. Merging the clusters' chunk sequences by feerate, the way a
+// merge sort would, therefore gives a valid block order that takes the
+// highest feerate chunks first, without the descendant bookkeeping that
+// selecting by ancestor feerate needs.
+void BlockAssembler::addChunkTxs(int &nChunksSelected)
 {
-    // mapModifiedTx will store sorted packages after they are modified
-    // because some of their txs are already in the block
-    indexed_modified_transaction_set mapModifiedTx;
-    // Keep track of entries that failed inclusion, to avoid duplicate work
-    CTxMemPool::setEntries failedTx;
-
-    // Start by adding all descendants of previously added txs to mapModifiedTx
-    // and modifying them for their already included ancestors
-    UpdatePackagesForAdded(inBlock, mapModifiedTx);
+    mempool.LinearizeClusters();
 
-    CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator mi = mempool.mapTx.get<ancestor_score>().begin();
-    CTxMemPool::txiter iter;
+    std::vector<ClusterChunk> vHeads;
+    vHeads.reserve(mempool.GetClusterTails().size());
+    for (CTxMemPool::txiter tail : mempool.GetClusterTails()) {
+        if (tail->nClusterId == 0) {
+            vHeads.emplace_back(tail);
+        } else {
+            vHeads.emplace_back(tail, &mempool.GetCluster(tail->nClusterId), 0);
+        }
+    }
+    std::priority_queue<ClusterChunk, std::vector<ClusterChunk>, CompareClusterChunkByFeeRate> queue(CompareClusterChunkByFeeRate(), std::move(vHeads));
 
     // Limit the number of attempts to add transactions to the block when it is
     // close to full; this is just a simple heuristic to finish quickly if the
@@ -329,68 +343,46 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
     const int64_t MAX_CONSECUTIVE_FAILURES = 1000;
     int64_t nConsecutiveFailed = 0;
 
-    while (mi != mempool.mapTx.get<ancestor_score>().end() || !mapModifiedTx.empty())
-    {
-        // First try to find a new transaction in mapTx to evaluate.
-        if (mi != mempool.mapTx.get<ancestor_score>().end() &&
-                SkipMapTxEntry(mempool.mapTx.project<0>(mi), mapModifiedTx, failedTx)) {
-            ++mi;
-            continue;
-        }
+    std::vector<CTxMemPool::txiter> vChunkTxs;
+    while (!queue.empty()) {
+        const ClusterChunk next = queue.top();
+        queue.pop();
 
-        // Now that mi is not stale, determine which transaction to evaluate:
-        // the next entry from mapTx, or the best from mapModifiedTx?
-        bool fUsingModified = false;
+        if (next.nFee < blockMinFeeRate.GetFee(next.nSize)) {
+            // Everything else we might consider has a lower fee rate
+            return;
+        }
 
-        modtxscoreiter modit = mapModifiedTx.get<ancestor_score>().begin();
-        if (mi == mempool.mapTx.get<ancestor_score>().end()) {
-            // We're out of entries in mapTx; use the entry from mapModifiedTx
-            iter = modit->iter;
-            fUsingModified = true;
+        // The chunk's transactions in linearization order
+        if (next.pcluster == nullptr) {
+            vChunkTxs.assign(1, next.tail);
         } else {
-            // Try to compare the mapTx entry to the mapModifiedTx entry
-            iter = mempool.mapTx.project<0>(mi);
-            if (modit != mapModifiedTx.get<ancestor_score>().end() &&
-                    CompareTxMemPoolEntryByAncestorFee()(*modit, CTxMemPoolModifiedEntry(iter))) {
-                // The best entry in mapModifiedTx has higher score
-                // than the one from mapTx.
-                // Switch which transaction (package) to consider
-                iter = modit->iter;
-                fUsingModified = true;
-            } else {
-                // Either no entry in mapModifiedTx, or it's worse than mapTx.
-                // Increment mi for the next loop iteration.
-                ++mi;
+            const CTxMemPool::TxChunk& chunk = next.pcluster->vChunks[next.nChunk];
+            vChunkTxs.assign(next.pcluster->vTxs.begin() + chunk.nBegin, next.pcluster->vTxs.begin() + chunk.nEnd);
+            // Later chunks of the cluster are worth a look even if this one
+            // is left out, as long as they do not depend on it.
+            if (next.nChunk + 1 < next.pcluster->vChunks.size()) {
+                queue.emplace(next.tail, next.pcluster, next.nChunk + 1);
             }
         }
 
-        // We skip mapTx entries that are inBlock, and mapModifiedTx shouldn't
-        // contain anything that is inBlock.
-        assert(!inBlock.count(iter));
-
-        uint64_t packageSize = iter->GetSizeWithAncestors();
-        CAmount packageFees = iter->GetModFeesWithAncestors();
-        int64_t packageSigOpsCost = iter->GetSigOpCostWithAncestors();
-        if (fUsingModified) {
-            packageSize = modit->nSizeWithAncestors;
-            packageFees = modit->nModFeesWithAncestors;
-            packageSigOpsCost = modit->nSigOpCostWithAncestors;
+        CTxMemPool::setEntries package(vChunkTxs.begin(), vChunkTxs.end());
+        int64_t packageSigOpsCost = 0;
+        bool fMissingParent = false;
+        for (CTxMemPool::txiter it : package) {
+            packageSigOpsCost += it->GetSigOpCost();
+            for (CTxMemPool::txiter parent : mempool.GetMemPoolParents(it)) {
+                if (!package.count(parent) && !inBlock.count(parent)) {
+                    fMissingParent = true;
+                }
+            }
         }
-
-        if (packageFees < blockMinFeeRate.GetFee(packageSize)) {
-            // Everything else we might consider has a lower fee rate
-            return;
+        if (fMissingParent) {
+            continue;
         }
 
-        if (!TestPackage(packageSize, packageSigOpsCost)) {
-            if (fUsingModified) {
-                // Since we always look at the best entry in mapModifiedTx,
-                // we must erase failed entries so that we can consider the
-                // next best entry on the next loop iteration
-                mapModifiedTx.get<ancestor_score>().erase(modit);
-                failedTx.insert(iter);
-            }
-
+        if (!TestPackage(next.nSize, packageSigOpsCost)) {
+            fBlockFull = true;
             ++nConsecutiveFailed;
 
             if (nConsecutiveFailed > MAX_CONSECUTIVE_FAILURES && nBlockWeight >
@@ -401,44 +393,164 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
             continue;
         }
 
-        CTxMemPool::setEntries ancestors;
-        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
-        std::string dummy;
-        mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
-
-        onlyUnconfirmed(ancestors);
-        ancestors.insert(iter);
-
         // Test if all tx's are Final
-        if (!TestPackageTransactions(ancestors)) {
-            if (fUsingModified) {
-                mapModifiedTx.get<ancestor_score>().erase(modit);
-                failedTx.insert(iter);
-            }
+        if (!TestPackageTransactions(package)) {
             continue;
         }
 
-        // This transaction will make it in; reset the failed counter.
+        // This chunk will make it in; reset the failed counter.
         nConsecutiveFailed = 0;
 
-        // Package can be added. Sort the entries in a valid order.
-        std::vector<CTxMemPool::txiter> sortedEntries;
-        SortForBlock(ancestors, iter, sortedEntries);
-
-        for (size_t i=0; i<sortedEntries.size(); ++i) {
-            AddToBlock(sortedEntries[i]);
-            // Erase from the modified set, if present
-            mapModifiedTx.erase(sortedEntries[i]);
+        // The linearization is a valid order for the block
+        for (CTxMemPool::txiter it : vChunkTxs) {
+            AddToBlock(it);
         }
 
-        ++nPackagesSelected;
+        ++nChunksSelected;
+    }
+}
+
+std::unique_ptr<BlockTemplateCache> g_block_template_cache;
+
+BlockTemplateCache::BlockTemplateCache(const CChainParams& params) : chainparams(params), pindexPrev(nullptr), fWitness(true), fStale(false), fCoinbaseDirty(false), nTimeBuilt(0), nTransactionsUpdated(0), nSequence(0) {}
+
+void BlockTemplateCache::Rebuild(bool fMineWitnessTx)
+{
+    AssertLockHeld(cs);
+    // Clear the template first so a failure below leaves nothing stale behind
+    pblocktemplate.reset();
+    pindexPrev = nullptr;
+
+    nTransactionsUpdated = mempool.GetTransactionsUpdated();
+    assembler.reset(new BlockAssembler(chainparams));
+    pblocktemplate = assembler->CreateNewBlock(CScript() << OP_TRUE, fMineWitnessTx);
+    pindexPrev = chainActive.Tip();
+    fWitness = fMineWitnessTx;
+    fStale = false;
+    fCoinbaseDirty = false;
+    nTimeBuilt = GetTime();
+    ++nSequence;
+}
+
+void BlockTemplateCache::UpdateCoinbase()
+{
+    AssertLockHeld(cs);
+    CBlock& block = pblocktemplate->block;
+    CMutableTransaction coinbaseTx(*block.vtx[0]);
+    // Drop the old witness commitment; it is regenerated below
+    coinbaseTx.vout.resize(1);
+    coinbaseTx.vout[0].nValue = GetBlockSubsidy(pindexPrev->nHeight + 1, chainparams.GetConsensus()) - pblocktemplate->vTxFees[0];
+    block.vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
+    pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(block, pindexPrev, chainparams.GetConsensus());
+    pblocktemplate->vCoinbaseMerkleBranch = BlockMerkleBranch(block, 0);
+    fCoinbaseDirty = false;
+}
+
+std::unique_ptr<CBlockTemplate> BlockTemplateCache::GetTemplate(bool fMineWitnessTx, uint64_t* pnSequence, unsigned int* pnTransactionsUpdated)
+{
+    LOCK2(cs_main, mempool.cs);
+    LOCK(cs);
+    if (!pblocktemplate || pindexPrev != chainActive.Tip() || fWitness != fMineWitnessTx ||
+        (fStale && GetTime() - nTimeBuilt > BLOCK_TEMPLATE_REBUILD_INTERVAL)) {
+        Rebuild(fMineWitnessTx);
+    }
+    if (fCoinbaseDirty) {
+        UpdateCoinbase();
+    }
+    if (pnSequence)
+        *pnSequence = nSequence;
+    if (pnTransactionsUpdated)
+        *pnTransactionsUpdated = nTransactionsUpdated;
+    return std::unique_ptr<CBlockTemplate>(new CBlockTemplate(*pblocktemplate));
+}
+
+void BlockTemplateCache::Invalidate()
+{
+    LOCK(cs);
+    if (!pblocktemplate)
+        return;
+    // Skip the rebuild interval; the caller expects to see the change now.
+    fStale = true;
+    nTimeBuilt = 0;
+}
+
+void BlockTemplateCache::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    if (fInitialDownload)
+        return;
+    {
+        LOCK(cs);
+        if (!pblocktemplate)
+            return;
+    }
+    LOCK2(cs_main, mempool.cs);
+    LOCK(cs);
+    // Only keep a template around once somebody has asked for one, and only
+    // if getblocktemplate has not already built one on the new tip.
+    if (!pblocktemplate || pindexPrev == chainActive.Tip())
+        return;
+    try {
+        Rebuild(fWitness);
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+}
+
+void BlockTemplateCache::TransactionAddedToMempool(const CTransactionRef& ptx)
+{
+    {
+        // Most transactions arrive while nobody is mining or while the template
+        // is stale and not due for a rebuild; don't contend on cs_main for those.
+        LOCK(cs);
+        if (!pblocktemplate || (fStale && GetTime() - nTimeBuilt <= BLOCK_TEMPLATE_REBUILD_INTERVAL))
+            return;
+    }
+    LOCK2(cs_main, mempool.cs);
+    LOCK(cs);
+    if (!pblocktemplate || pindexPrev != chainActive.Tip())
+        return;
+    if (fStale) {
+        // Rebuild here rather than in getblocktemplate, but no more often
+        // than getblocktemplate itself would.
+        if (GetTime() - nTimeBuilt > BLOCK_TEMPLATE_REBUILD_INTERVAL) {
+            try {
+                Rebuild(fWitness);
+            } catch (const std::exception& e) {
+                LogPrintf("%s: %s\n", __func__, e.what());
+            }
+        }
+        return;
+    }
+    // Notifications are delivered asynchronously, so the transaction may have
+    // left the mempool again by now.
+    CTxMemPool::txiter it = mempool.mapTx.find(ptx->GetHash());
+    if (it == mempool.mapTx.end())
+        return;
+    size_t nTx = pblocktemplate->block.vtx.size();
+    if (!assembler->AppendToBlock(*pblocktemplate, it)) {
+        fStale = true;
+    } else if (pblocktemplate->block.vtx.size() != nTx) {
+        fCoinbaseDirty = true;
+        ++nSequence;
+    }
+}
 
-        // Update transactions that depend on each of these
-        nDescendantsUpdated += UpdatePackagesForAdded(ancestors, mapModifiedTx);
+void BlockTemplateCache::TransactionRemovedFromMempool(const CTransactionRef& ptx)
+{
+    LOCK(cs);
+    if (!pblocktemplate || fStale)
+        return;
+    // The template shares transaction pointers with the mempool, and ptx keeps
+    // the removed one alive, so comparing pointers is enough.
+    for (const CTransactionRef& tx : pblocktemplate->block.vtx) {
+        if (tx == ptx) {
+            fStale = true;
+            return;
+        }
     }
 }
 
-void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
+void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce, const std::vector<uint256>* pvCoinbaseMerkleBranch)
 {
     // Update nExtraNonce
     static uint256 hashPrevBlock;
@@ -454,5 +566,9 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
     assert(txCoinbase.vin[0].scriptSig.size() <= 100);
 
     pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
-    pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
+    if (pvCoinbaseMerkleBranch) {
+        pblock->hashMerkleRoot = ComputeMerkleRootFromBranch(pblock->vtx[0]->GetHash(), *pvCoinbaseMerkleBranch, 0);
+    } else {
+        pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
+    }
 }
@@ -7,12 +7,12 @@
 #define BITCOIN_MINER_H
 
 #include <primitives/block.h>
+#include <sync.h>
 #include <txmempool.h>
+#include <validationinterface.h>
 
 #include <stdint.h>
 #include <memory>
-#include <boost/multi_index_container.hpp>
-#include <boost/multi_index/ordered_index.hpp>
 
 class CBlockIndex;
 class CChainParams;
@@ -21,6 +21,10 @@ class CScript;
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -testblockvalidity */
+static const bool DEFAULT_TEST_BLOCK_VALIDITY = true;
+/** Minimum time between rebuilds of a stale block template, in seconds */
+static const int64_t BLOCK_TEMPLATE_REBUILD_INTERVAL = 5;
 
 struct CBlockTemplate
 {
@@ -28,95 +32,9 @@ struct CBlockTemplate
     std::vector<CAmount> vTxFees;
     std::vector<int64_t> vTxSigOpsCost;
     std::vector<unsigned char> vchCoinbaseCommitment;
-};
-
-// Container for tracking updates to ancestor feerate as we include (parent)
-// transactions in a block
-struct CTxMemPoolModifiedEntry {
-    explicit CTxMemPoolModifiedEntry(CTxMemPool::txiter entry)
-    {
-        iter = entry;
-        nSizeWithAncestors = entry->GetSizeWithAncestors();
-        nModFeesWithAncestors = entry->GetModFeesWithAncestors();
-        nSigOpCostWithAncestors = entry->GetSigOpCostWithAncestors();
-    }
-
-    int64_t GetModifiedFee() const { return iter->GetModifiedFee(); }
-    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
-    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
-    size_t GetTxSize() const { return iter->GetTxSize(); }
-    const CTransaction& GetTx() const { return iter->GetTx(); }
-
-    CTxMemPool::txiter iter;
-    uint64_t nSizeWithAncestors;
-    CAmount nModFeesWithAncestors;
-    int64_t nSigOpCostWithAncestors;
-};
-
-/** Comparator for CTxMemPool::txiter objects.
- *  It simply compares the internal memory address of the CTxMemPoolEntry object
- *  pointed to. This means it has no meaning, and is only useful for using them
- *  as key in other indexes.
- */
-struct CompareCTxMemPoolIter {
-    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
-    {
-        return &(*a) < &(*b);
-    }
-};
-
-struct modifiedentry_iter {
-    typedef CTxMemPool::txiter result_type;
-    result_type operator() (const CTxMemPoolModifiedEntry &entry) const
-    {
-        return entry.iter;
-    }
-};
-
-// A comparator that sorts transactions based on number of ancestors.
-// This is sufficient to sort an ancestor package in an order that is valid
-// to appear in a block.
-struct CompareTxIterByAncestorCount {
-    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b) const
-    {
-        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
-            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
-        return CTxMemPool::CompareIteratorByHash()(a, b);
-    }
-};
-
-typedef boost::multi_index_container<
-    CTxMemPoolModifiedEntry,
-    boost::multi_index::indexed_by<
-        boost::multi_index::ordered_unique<
-            modifiedentry_iter,
-            CompareCTxMemPoolIter
-        >,
-        // sorted by modified ancestor fee rate
-        boost::multi_index::ordered_non_unique<
-            // Reuse same tag from CTxMemPool's similar index
-            boost::multi_index::tag<ancestor_score>,
-            boost::multi_index::identity<CTxMemPoolModifiedEntry>,
-            CompareTxMemPoolEntryByAncestorFee
-        >
-    >
-> indexed_modified_transaction_set;
-
-typedef indexed_modified_transaction_set::nth_index<0>::type::iterator modtxiter;
-typedef indexed_modified_transaction_set::index<ancestor_score>::type::iterator modtxscoreiter;
-
-struct update_for_parent_inclusion
-{
-    explicit update_for_parent_inclusion(CTxMemPool::txiter it) : iter(it) {}
-
-    void operator() (CTxMemPoolModifiedEntry &e)
-    {
-        e.nModFeesWithAncestors -= iter->GetFee();
-        e.nSizeWithAncestors -= iter->GetTxSize();
-        e.nSigOpCostWithAncestors -= iter->GetSigOpCost();
-    }
-
-    CTxMemPool::txiter iter;
+    // Merkle branch of the coinbase, so hashMerkleRoot can be recomputed
+    // after changing only the coinbase
+    std::vector<uint256> vCoinbaseMerkleBranch;
 };
 
 /** Generate a new block, without valid proof-of-work */
@@ -132,6 +50,7 @@ private:
     bool fIncludeWitness;
     unsigned int nBlockMaxWeight;
     CFeeRate blockMinFeeRate;
+    bool fTestBlockValidity;
 
     // Information on the current status of the block
     uint64_t nBlockWeight;
@@ -139,6 +58,8 @@ private:
     uint64_t nBlockSigOpsCost;
     CAmount nFees;
     CTxMemPool::setEntries inBlock;
+    // Whether a package was left out because it did not fit
+    bool fBlockFull;
 
     // Chain context for the block
     int nHeight;
@@ -150,6 +71,7 @@ public:
         Options();
         size_t nBlockMaxWeight;
         CFeeRate blockMinFeeRate;
+        bool fTestBlockValidity;
     };
 
     explicit BlockAssembler(const CChainParams& params);
@@ -158,6 +80,15 @@ public:
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx=true);
 
+    /** Append a transaction that entered the mempool after CreateNewBlock to the
+      * template it returned. Returns false if the result could differ from what
+      * a fresh CreateNewBlock would select, in which case the template must be
+      * rebuilt. Transactions CreateNewBlock would skip are left out and return
+      * true. The caller must hold cs_main and mempool.cs, and must not have
+      * changed the tip since CreateNewBlock. The witness commitment and coinbase
+      * value are not updated; see BlockTemplateCache. */
+    bool AppendToBlock(CBlockTemplate& blocktemplate, CTxMemPool::txiter iter);
+
 private:
     // utility functions
     /** Clear the block's state and prepare for assembling a new block */
@@ -166,14 +97,12 @@ private:
     void AddToBlock(CTxMemPool::txiter iter);
 
     // Methods for how to add transactions to a block.
-    /** Add transactions based on feerate including unconfirmed ancestors
-      * Increments nPackagesSelected / nDescendantsUpdated with corresponding
-      * statistics from the package selection (for logging statistics). */
-    void addPackageTxs(int &nPackagesSelected, int &nDescendantsUpdated);
-
-    // helper functions for addPackageTxs()
-    /** Remove confirmed (inBlock) entries from given set */
-    void onlyUnconfirmed(CTxMemPool::setEntries& testSet);
+    /** Add the mempool's cluster chunks in order of feerate
+      * Increments nChunksSelected with the number of chunks added (for
+      * logging statistics). */
+    void addChunkTxs(int &nChunksSelected);
+
+    // helper functions for addChunkTxs()
     /** Test if a new package would "fit" in the block */
     bool TestPackage(uint64_t packageSize, int64_t packageSigOpsCost) const;
     /** Perform checks on each transaction in a package:
@@ -181,19 +110,66 @@ private:
       * These checks should always succeed, and they're here
       * only as an extra check in case of suboptimal node configuration */
     bool TestPackageTransactions(const CTxMemPool::setEntries& package);
-    /** Return true if given transaction from mapTx has already been evaluated,
-      * or if the transaction's cached data in mapTx is incorrect. */
-    bool SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set &mapModifiedTx, CTxMemPool::setEntries &failedTx);
-    /** Sort the package in an order that is valid to appear in a block */
-    void SortForBlock(const CTxMemPool::setEntries& package, CTxMemPool::txiter entry, std::vector<CTxMemPool::txiter>& sortedEntries);
-    /** Add descendants of given transactions to mapModifiedTx with ancestor
-      * state updated assuming given transactions are inBlock. Returns number
-      * of updated descendants. */
-    int UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
 };
 
-/** Modify the extranonce in a block */
-void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
+/**
+ * Keeps the next block template up to date as transactions enter and leave the
+ * mempool and as the tip changes, so getblocktemplate does not have to assemble
+ * a block from the whole mempool on every call.
+ *
+ * While the block has room, transactions accepted to the mempool are appended
+ * to the cached template. Once it is full, or a transaction in it leaves the
+ * mempool, the template is marked stale and rebuilt at most every
+ * BLOCK_TEMPLATE_REBUILD_INTERVAL seconds. New tips are assembled in the
+ * background. Nothing is tracked until the first template is requested.
+ */
+class BlockTemplateCache : public CValidationInterface
+{
+public:
+    explicit BlockTemplateCache(const CChainParams& params);
+
+    /** Return a copy of the template for the current tip, paying to an OP_TRUE
+      * coinbase. If pnSequence is given it is set to a number that changes
+      * whenever the template does. If pnTransactionsUpdated is given it is set
+      * to the mempool's transactions-updated counter from when the template
+      * was built. Caller must hold cs_main. */
+    std::unique_ptr<CBlockTemplate> GetTemplate(bool fMineWitnessTx, uint64_t* pnSequence = nullptr, unsigned int* pnTransactionsUpdated = nullptr);
+
+    /** Make the next GetTemplate rebuild the template right away. Call this
+      * after changing something transaction selection depends on that the
+      * mempool notifications do not cover, such as fee deltas. */
+    void Invalidate();
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
+    void TransactionAddedToMempool(const CTransactionRef& ptx) override;
+    void TransactionRemovedFromMempool(const CTransactionRef& ptx) override;
+
+private:
+    void Rebuild(bool fMineWitnessTx);
+    /** Bring the coinbase value and witness commitment up to date after appends */
+    void UpdateCoinbase();
+
+    const CChainParams& chainparams;
+
+    CCriticalSection cs;
+    // Everything below is protected by cs
+    std::unique_ptr<BlockAssembler> assembler;
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    const CBlockIndex* pindexPrev;
+    bool fWitness;
+    bool fStale;
+    bool fCoinbaseDirty;
+    int64_t nTimeBuilt;
+    unsigned int nTransactionsUpdated;
+    uint64_t nSequence;
+};
+
+extern std::unique_ptr<BlockTemplateCache> g_block_template_cache;
+
+/** Modify the extranonce in a block. If the coinbase merkle branch is given,
+ *  only that branch is hashed to update hashMerkleRoot. */
+void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce, const std::vector<uint256>* pvCoinbaseMerkleBranch = nullptr);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
 
 #endif // BITCOIN_MINER_H
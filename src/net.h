@@ -34,6 +34,7 @@
 #endif
 
 
+class CBlockIndex;
 class CScheduler;
 class CNode;
 
@@ -620,6 +621,8 @@ public:
     CCriticalSection cs_sendProcessing;
 
     std::deque<CInv> vRecvGetData;
+    //! Blocks of a getblkrange request that are still to be sent, in order
+    std::deque<const CBlockIndex*> vRecvGetBlockRange;
     uint64_t nRecvBytes;
     std::atomic<int> nRecvVersion;
 
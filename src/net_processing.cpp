@@ -9,9 +9,11 @@
 #include <addrman.h>
 #include <arith_uint256.h>
 #include <blockencodings.h>
+#include <blockfilter.h>
 #include <chainparams.h>
 #include <consensus/validation.h>
 #include <hash.h>
+#include <index/blockfilterindex.h>
 #include <init.h>
 #include <validation.h>
 #include <merkleblock.h>
@@ -31,6 +33,7 @@
 #include <utilmoneystr.h>
 #include <utilstrencodings.h>
 
+#include <limits>
 #include <memory>
 
 #if defined(NDEBUG)
@@ -72,6 +75,11 @@ static const int STALE_RELAY_AGE_LIMIT = 30 * 24 * 60 * 60;
 /// limiting block relay. Set to one week, denominated in seconds.
 static const int HISTORICAL_BLOCK_AGE = 7 * 24 * 60 * 60;
 
+/** Maximum number of compact filters that may be requested with one getcfilters. See BIP 157. */
+static constexpr uint32_t MAX_GETCFILTERS_SIZE = 1000;
+/** Maximum number of cf hashes that may be requested with one getcfheaders. See BIP 157. */
+static constexpr uint32_t MAX_GETCFHEADERS_SIZE = 2000;
+
 // Internal stuff
 namespace {
     /** Number of nodes with fSyncStarted. */
@@ -114,6 +122,7 @@ namespace {
         uint256 hash;
         const CBlockIndex* pindex;                               //!< Optional.
         bool fValidatedHeaders;                                  //!< Whether this block has validated headers at the time of request.
+        int64_t nTimeRequested;                                  //!< When this block was requested (in microseconds).
         std::unique_ptr<PartiallyDownloadedBlock> partialBlock;  //!< Optional, used for CMPCTBLOCK downloads
     };
     std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> > mapBlocksInFlight;
@@ -188,6 +197,22 @@ struct CNodeState {
     int64_t nDownloadingSince;
     int nBlocksInFlight;
     int nBlocksInFlightValidHeaders;
+    //! Adaptive limit on the number of blocks we request from this peer at once.
+    int nBlocksInFlightLimit;
+    //! Smoothed time between requesting and receiving a block (in microseconds), or 0 if unknown.
+    int64_t nBlockDownloadLatency;
+    //! Lowest observed time between requesting and receiving a block (in microseconds), or 0 if unknown.
+    int64_t nBlockDownloadMinLatency;
+    //! Smoothed time between consecutive requested blocks arriving (in microseconds), or 0 if unknown.
+    int64_t nBlockDownloadInterval;
+    //! Smoothed size of the requested blocks we received (in bytes).
+    int64_t nBlockDownloadSize;
+    //! When the last requested block from this peer arrived (in microseconds).
+    int64_t nLastBlockReceived;
+    //! Number of requested blocks received from this peer.
+    uint64_t nBlocksDownloaded;
+    //! Number of times blocks in flight from this peer were handed to other peers because it stalled.
+    int nStallReassignments;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
     //! Whether this peer wants invs or headers (when possible) for block announcements.
@@ -255,6 +280,14 @@ struct CNodeState {
         nDownloadingSince = 0;
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
+        nBlocksInFlightLimit = MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+        nBlockDownloadLatency = 0;
+        nBlockDownloadMinLatency = 0;
+        nBlockDownloadInterval = 0;
+        nBlockDownloadSize = 0;
+        nLastBlockReceived = 0;
+        nBlocksDownloaded = 0;
+        nStallReassignments = 0;
         fPreferredDownload = false;
         fPreferHeaders = false;
         fPreferHeaderAndIDs = false;
@@ -324,7 +357,7 @@ bool MarkBlockAsReceived(const uint256& hash) {
         }
         if (state->vBlocksInFlight.begin() == itInFlight->second.second) {
             // First block on the queue was received, update the start download time for the next one
-            state->nDownloadingSince = std::max(state->nDownloadingSince, GetTimeMicros());
+            state->nDownloadingSince = std::max(state->nDownloadingSince, GetMockableTimeMicros());
         }
         state->vBlocksInFlight.erase(itInFlight->second.second);
         state->nBlocksInFlight--;
@@ -355,12 +388,12 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const CBlockIndex*
     MarkBlockAsReceived(hash);
 
     std::list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(),
-            {hash, pindex, pindex != nullptr, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : nullptr)});
+            {hash, pindex, pindex != nullptr, GetMockableTimeMicros(), std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : nullptr)});
     state->nBlocksInFlight++;
     state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
     if (state->nBlocksInFlight == 1) {
         // We're starting a block download (batch) from this peer.
-        state->nDownloadingSince = GetTimeMicros();
+        state->nDownloadingSince = GetMockableTimeMicros();
     }
     if (state->nBlocksInFlightValidHeaders == 1 && pindex != nullptr) {
         nPeersWithValidatedDownloads++;
@@ -371,6 +404,72 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const CBlockIndex*
     return true;
 }
 
+// Requires cs_main.
+// Update the download statistics and the adaptive in-flight limit of a peer
+// after it delivered a block we requested from it.
+void RecordBlockDownload(NodeId nodeid, const uint256& hash, size_t nBlockSize) {
+    std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != nodeid)
+        return;
+    CNodeState *state = State(nodeid);
+    assert(state != nullptr);
+
+    const int64_t nNow = GetMockableTimeMicros();
+    const int64_t nTimeRequested = itInFlight->second.second->nTimeRequested;
+    const int64_t nLatency = std::max<int64_t>(nNow - nTimeRequested, 1);
+    // Only the time since the later of the request and the previous arrival is
+    // spent on this block; anything before that was spent on earlier blocks.
+    const int64_t nInterval = std::max<int64_t>(nNow - std::max(nTimeRequested, state->nLastBlockReceived), 1);
+
+    if (state->nBlocksDownloaded == 0) {
+        state->nBlockDownloadLatency = nLatency;
+        state->nBlockDownloadMinLatency = nLatency;
+        state->nBlockDownloadInterval = nInterval;
+        state->nBlockDownloadSize = nBlockSize;
+    } else {
+        state->nBlockDownloadLatency = (7 * state->nBlockDownloadLatency + nLatency) / 8;
+        state->nBlockDownloadMinLatency = std::min(state->nBlockDownloadMinLatency, nLatency);
+        state->nBlockDownloadInterval = (7 * state->nBlockDownloadInterval + nInterval) / 8;
+        state->nBlockDownloadSize = (7 * state->nBlockDownloadSize + (int64_t)nBlockSize) / 8;
+    }
+    state->nLastBlockReceived = nNow;
+    state->nBlocksDownloaded++;
+
+    // Keep twice the bandwidth-delay product of the connection in flight, so the
+    // peer never idles while a getdata round-trip is outstanding. The window may
+    // at most double per received block, and stays within the static bounds.
+    int64_t nTarget = 2 * state->nBlockDownloadMinLatency / state->nBlockDownloadInterval + 1;
+    nTarget = std::min<int64_t>(nTarget, 2 * state->nBlocksInFlightLimit);
+    state->nBlocksInFlightLimit = std::max<int64_t>(MAX_BLOCKS_IN_TRANSIT_PER_PEER, std::min<int64_t>(nTarget, MAX_BLOCKS_IN_TRANSIT_PER_PEER_ADAPTIVE));
+}
+
+// Requires cs_main.
+// How long a peer may hold back the download window before the blocks it has
+// in flight are handed to other peers (in microseconds).
+int64_t GetStallReassignTimeout(const CNodeState* state) {
+    return std::min<int64_t>(std::max<int64_t>(BLOCK_STALLING_REASSIGN_TIMEOUT_MIN, 4 * state->nBlockDownloadLatency), 1000000 * BLOCK_STALLING_TIMEOUT);
+}
+
+// Requires cs_main.
+// Stop waiting for the blocks in flight from a stalling peer, so they can be
+// requested from other peers, and shrink the peer's in-flight limit.
+void ReassignBlocksInFlight(NodeId nodeid) {
+    CNodeState *state = State(nodeid);
+    assert(state != nullptr);
+
+    // Keep the stalling timer running: while it runs the peer is not asked for
+    // blocks, so it does not get back the ones just taken away. Nothing is in
+    // flight from it any more to reset the timer, so it is disconnected after
+    // BLOCK_STALLING_TIMEOUT just as it would have been without reassignment.
+    const int64_t nStallingSince = state->nStallingSince;
+    while (!state->vBlocksInFlight.empty()) {
+        MarkBlockAsReceived(state->vBlocksInFlight.front().hash);
+    }
+    state->nStallingSince = nStallingSince;
+    state->nBlocksInFlightLimit = std::max(MAX_BLOCKS_IN_TRANSIT_PER_PEER, state->nBlocksInFlightLimit / 2);
+    state->nStallReassignments++;
+}
+
 /** Check whether the last unknown block a peer advertised is not yet known. */
 void ProcessBlockAvailability(NodeId nodeid) {
     CNodeState *state = State(nodeid);
@@ -561,6 +660,21 @@ void UpdateLastBlockAnnounceTime(NodeId node, int64_t time_in_seconds)
     if (state) state->m_last_block_announcement = time_in_seconds;
 }
 
+// These functions are used for testing the stalling block download logic, see
+// DoS_tests.cpp
+void MarkBlockAsAvailable(NodeId node, const uint256& hash)
+{
+    LOCK(cs_main);
+    UpdateBlockAvailability(node, hash);
+}
+
+void MarkPeerAsStalling(NodeId node, int64_t nStallingSince)
+{
+    LOCK(cs_main);
+    CNodeState *state = State(node);
+    if (state) state->nStallingSince = nStallingSince;
+}
+
 // Returns true for outbound peers, excluding manual connections, feelers, and
 // one-shots
 bool IsOutboundDisconnectionCandidate(const CNode *node)
@@ -627,6 +741,11 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
     }
+    stats.nBlocksInFlightLimit = state->nBlocksInFlightLimit;
+    stats.nBlockDownloadLatency = state->nBlockDownloadLatency;
+    stats.nBlockDownloadRate = state->nBlockDownloadInterval > 0 ? state->nBlockDownloadSize * 1000000 / state->nBlockDownloadInterval : 0;
+    stats.nBlocksDownloaded = state->nBlocksDownloaded;
+    stats.nStallReassignments = state->nStallReassignments;
     return true;
 }
 
@@ -849,6 +968,22 @@ static std::shared_ptr<const CBlockHeaderAndShortTxIDs> most_recent_compact_bloc
 static uint256 most_recent_block_hash;
 static bool fWitnessesPresentInMostRecentCompactBlock;
 
+// Per-hop block relay latency: the time from receiving a new block (or its
+// cmpctblock) to announcing it onwards. Protected by cs_main.
+static uint256 hashLastBlockReceived;
+static int64_t nTimeLastBlockReceived = 0;
+static CBlockRelayStats blockRelayStats = {};
+
+// Requires cs_main.
+static void RecordBlockReceivedTime(const uint256& hash, int64_t nTimeReceived)
+{
+    // Keep the first sighting; the full block may follow a cmpctblock.
+    if (hash == hashLastBlockReceived)
+        return;
+    hashLastBlockReceived = hash;
+    nTimeLastBlockReceived = nTimeReceived;
+}
+
 void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& pblock) {
     std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs> (*pblock, true);
     const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
@@ -871,7 +1006,8 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
         fWitnessesPresentInMostRecentCompactBlock = fWitnessEnabled;
     }
 
-    connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker, fWitnessEnabled, &hashBlock](CNode* pnode) {
+    bool fAnnounced = false;
+    connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker, fWitnessEnabled, &hashBlock, &fAnnounced](CNode* pnode) {
         // TODO: Avoid the repeated-serialization here
         if (pnode->nVersion < INVALID_CB_NO_BAN_VERSION || pnode->fDisconnect)
             return;
@@ -886,8 +1022,22 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
                     hashBlock.ToString(), pnode->GetId());
             connman->PushMessage(pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
             state.pindexBestHeaderSent = pindex;
+            fAnnounced = true;
         }
     });
+
+    if (fAnnounced && hashBlock == hashLastBlockReceived) {
+        const int64_t nLatency = GetTimeMicros() - nTimeLastBlockReceived;
+        blockRelayStats.nLastHopLatency = nLatency;
+        blockRelayStats.nAvgHopLatency = blockRelayStats.nBlocksRelayed ? (blockRelayStats.nAvgHopLatency * 7 + nLatency) / 8 : nLatency;
+        blockRelayStats.nBlocksRelayed++;
+        LogPrint(BCLog::CMPCTBLOCK, "Relayed block %s %.3fms after receiving it\n", hashBlock.ToString(), nLatency * 0.001);
+    }
+}
+
+void GetBlockRelayStats(CBlockRelayStats &stats) {
+    LOCK(cs_main);
+    stats = blockRelayStats;
 }
 
 void PeerLogicValidation::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) {
@@ -1247,6 +1397,259 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
     }
 }
 
+void static ProcessGetBlockRange(CNode* pfrom, const Consensus::Params& consensusParams, CConnman* connman, const std::atomic<bool>& interruptMsgProc)
+{
+    AssertLockNotHeld(cs_main);
+
+    // Read the blocks without holding cs_main and stream them in as few
+    // blkrange messages as MAX_BLOCKRANGE_MESSAGE_SIZE allows, for as long
+    // as the send buffer is not full.
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    std::vector<std::shared_ptr<const CBlock>> vBlocks;
+    size_t nBatchSize = 0;
+    while (!pfrom->vRecvGetBlockRange.empty() && !pfrom->fPauseSend) {
+        if (interruptMsgProc)
+            return;
+        const CBlockIndex* pindex = pfrom->vRecvGetBlockRange.front();
+        pfrom->vRecvGetBlockRange.pop_front();
+
+        // Pruning may have removed the block since the request, and changes
+        // the position in the index when it does.
+        CDiskBlockPos blockPos;
+        {
+            LOCK(cs_main);
+            if (pindex->nStatus & BLOCK_HAVE_DATA)
+                blockPos = pindex->GetBlockPos();
+        }
+        std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        if (blockPos.IsNull() || !ReadBlockFromDisk(*pblock, blockPos, consensusParams) ||
+            pblock->GetHash() != pindex->GetBlockHash()) {
+            // Treat it like a block we don't have; the peer times out on the
+            // remainder of the range.
+            LogPrint(BCLog::NET, "%s: block %s no longer available for peer=%d\n", __func__, pindex->GetBlockHash().ToString(), pfrom->GetId());
+            pfrom->vRecvGetBlockRange.clear();
+            break;
+        }
+        const size_t nBlockSize = ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION);
+        // A maximum size block plus the framing would exceed the message
+        // limit, so it goes in a block message of its own
+        const bool fOversized = nBlockSize >= MAX_PROTOCOL_MESSAGE_LENGTH;
+        if (!vBlocks.empty() && (fOversized || nBatchSize + nBlockSize > MAX_BLOCKRANGE_MESSAGE_SIZE)) {
+            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCKRANGE, vBlocks));
+            vBlocks.clear();
+            nBatchSize = 0;
+        }
+        if (fOversized) {
+            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, *pblock));
+            continue;
+        }
+        vBlocks.push_back(pblock);
+        nBatchSize += nBlockSize;
+    }
+    if (!vBlocks.empty()) {
+        connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCKRANGE, vBlocks));
+    }
+}
+
+/**
+ * Validation logic for compact filters request handling.
+ *
+ * May disconnect from the peer in the case of a bad request.
+ *
+ * @param[in]   pfrom           The peer that we received the request from
+ * @param[in]   chainparams     Chain parameters
+ * @param[in]   filter_type     The filter type the request is for. Must be basic filters.
+ * @param[in]   start_height    The start height for the request
+ * @param[in]   stop_hash       The stop_hash for the request
+ * @param[in]   max_height_diff The maximum number of items permitted to request, as specified in BIP 157
+ * @param[out]  stop_index      The CBlockIndex for the stop_hash block, if the request can be serviced.
+ * @param[out]  filter_index    The filter index, if the request can be serviced.
+ * @return                      True if the request can be serviced.
+ */
+static bool PrepareBlockFilterRequest(CNode* pfrom, const CChainParams& chainparams,
+                                      BlockFilterType filter_type, uint32_t start_height,
+                                      const uint256& stop_hash, uint32_t max_height_diff,
+                                      const CBlockIndex*& stop_index,
+                                      BlockFilterIndex*& filter_index)
+{
+    const bool supported_filter_type =
+        (filter_type == BlockFilterType::BASIC &&
+         (pfrom->GetLocalServices() & NODE_COMPACT_FILTERS));
+    if (!supported_filter_type) {
+        LogPrint(BCLog::NET, "peer %d requested unsupported block filter type: %d\n",
+                 pfrom->GetId(), static_cast<uint8_t>(filter_type));
+        pfrom->fDisconnect = true;
+        return false;
+    }
+
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(stop_hash);
+        stop_index = it != mapBlockIndex.end() ? it->second : nullptr;
+
+        // Check that the stop block exists and the peer would be allowed to fetch it.
+        if (!stop_index || !BlockRequestAllowed(stop_index, chainparams.GetConsensus())) {
+            LogPrint(BCLog::NET, "peer %d requested invalid block hash: %s\n",
+                     pfrom->GetId(), stop_hash.ToString());
+            pfrom->fDisconnect = true;
+            return false;
+        }
+    }
+
+    uint32_t stop_height = stop_index->nHeight;
+    if (start_height > stop_height) {
+        LogPrint(BCLog::NET, "peer %d sent invalid getcfilters/getcfheaders with " /* Continued */
+                 "start height %d and stop height %d\n",
+                 pfrom->GetId(), start_height, stop_height);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    if (stop_height - start_height >= max_height_diff) {
+        LogPrint(BCLog::NET, "peer %d requested too many cfilters/cfheaders: %d / %d\n",
+                 pfrom->GetId(), stop_height - start_height + 1, max_height_diff);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+
+    filter_index = GetBlockFilterIndex(filter_type);
+    if (!filter_index) {
+        LogPrint(BCLog::NET, "Filter index for supported type %s not found\n", BlockFilterTypeName(filter_type));
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Handle a cfilters request.
+ *
+ * May disconnect from the peer in the case of a bad request.
+ */
+static void ProcessGetCFilters(CNode* pfrom, CDataStream& vRecv, const CChainParams& chainparams,
+                               CConnman* connman)
+{
+    uint8_t filter_type_ser;
+    uint32_t start_height;
+    uint256 stop_hash;
+
+    vRecv >> filter_type_ser >> start_height >> stop_hash;
+
+    const BlockFilterType filter_type = static_cast<BlockFilterType>(filter_type_ser);
+
+    const CBlockIndex* stop_index;
+    BlockFilterIndex* filter_index;
+    if (!PrepareBlockFilterRequest(pfrom, chainparams, filter_type, start_height, stop_hash,
+                                   MAX_GETCFILTERS_SIZE, stop_index, filter_index)) {
+        return;
+    }
+
+    std::vector<BlockFilter> filters;
+    if (!filter_index->LookupFilterRange(start_height, stop_index, filters)) {
+        LogPrint(BCLog::NET, "Failed to find block filter in index: filter_type=%s, start_height=%d, stop_hash=%s\n",
+                 BlockFilterTypeName(filter_type), start_height, stop_hash.ToString());
+        return;
+    }
+
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    for (const auto& filter : filters) {
+        connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::CFILTER, filter));
+    }
+}
+
+/**
+ * Handle a cfheaders request.
+ *
+ * May disconnect from the peer in the case of a bad request.
+ */
+static void ProcessGetCFHeaders(CNode* pfrom, CDataStream& vRecv, const CChainParams& chainparams,
+                                CConnman* connman)
+{
+    uint8_t filter_type_ser;
+    uint32_t start_height;
+    uint256 stop_hash;
+
+    vRecv >> filter_type_ser >> start_height >> stop_hash;
+
+    const BlockFilterType filter_type = static_cast<BlockFilterType>(filter_type_ser);
+
+    const CBlockIndex* stop_index;
+    BlockFilterIndex* filter_index;
+    if (!PrepareBlockFilterRequest(pfrom, chainparams, filter_type, start_height, stop_hash,
+                                   MAX_GETCFHEADERS_SIZE, stop_index, filter_index)) {
+        return;
+    }
+
+    uint256 prev_header;
+    if (start_height > 0) {
+        const CBlockIndex* const prev_block =
+            stop_index->GetAncestor(static_cast<int>(start_height - 1));
+        if (!filter_index->LookupFilterHeader(prev_block, prev_header)) {
+            LogPrint(BCLog::NET, "Failed to find block filter header in index: filter_type=%s, block_hash=%s\n",
+                     BlockFilterTypeName(filter_type), prev_block->GetBlockHash().ToString());
+            return;
+        }
+    }
+
+    std::vector<uint256> filter_hashes;
+    if (!filter_index->LookupFilterHashRange(start_height, stop_index, filter_hashes)) {
+        LogPrint(BCLog::NET, "Failed to find block filter hashes in index: filter_type=%s, start_height=%d, stop_hash=%s\n",
+                 BlockFilterTypeName(filter_type), start_height, stop_hash.ToString());
+        return;
+    }
+
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::CFHEADERS,
+                                              filter_type_ser,
+                                              stop_index->GetBlockHash(),
+                                              prev_header,
+                                              filter_hashes));
+}
+
+/**
+ * Handle a getcfcheckpt request.
+ *
+ * May disconnect from the peer in the case of a bad request.
+ */
+static void ProcessGetCFCheckPt(CNode* pfrom, CDataStream& vRecv, const CChainParams& chainparams,
+                                CConnman* connman)
+{
+    uint8_t filter_type_ser;
+    uint256 stop_hash;
+
+    vRecv >> filter_type_ser >> stop_hash;
+
+    const BlockFilterType filter_type = static_cast<BlockFilterType>(filter_type_ser);
+
+    const CBlockIndex* stop_index;
+    BlockFilterIndex* filter_index;
+    if (!PrepareBlockFilterRequest(pfrom, chainparams, filter_type, /*start_height=*/0, stop_hash,
+                                   /*max_height_diff=*/std::numeric_limits<uint32_t>::max(),
+                                   stop_index, filter_index)) {
+        return;
+    }
+
+    std::vector<uint256> headers(stop_index->nHeight / CFCHECKPT_INTERVAL);
+
+    // Populate headers.
+    const CBlockIndex* block_index = stop_index;
+    for (int i = headers.size() - 1; i >= 0; i--) {
+        int height = (i + 1) * CFCHECKPT_INTERVAL;
+        block_index = block_index->GetAncestor(height);
+
+        if (!filter_index->LookupFilterHeader(block_index, headers[i])) {
+            LogPrint(BCLog::NET, "Failed to find block filter header in index: filter_type=%s, block_hash=%s\n",
+                     BlockFilterTypeName(filter_type), block_index->GetBlockHash().ToString());
+            return;
+        }
+    }
+
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::CFCHECKPT,
+                                              filter_type_ser,
+                                              stop_index->GetBlockHash(),
+                                              headers));
+}
+
 uint32_t GetFetchFlags(CNode* pfrom) {
     uint32_t nFetchFlags = 0;
     if ((pfrom->GetLocalServices() & NODE_WITNESS) && State(pfrom->GetId())->fHaveWitness) {
@@ -1255,6 +1658,17 @@ uint32_t GetFetchFlags(CNode* pfrom) {
     return nFetchFlags;
 }
 
+// Requires cs_main.
+// Request a run of consecutive blocks, with a getblkrange if there is more than one.
+void static RequestBlockRange(CNode* pto, const std::vector<const CBlockIndex*>& vRun, std::vector<CInv>& vGetData, CConnman* connman) {
+    if (vRun.size() == 1) {
+        vGetData.push_back(CInv(MSG_BLOCK | GetFetchFlags(pto), vRun.front()->GetBlockHash()));
+        return;
+    }
+    LogPrint(BCLog::NET, "Requesting block range %d-%d peer=%d\n", vRun.front()->nHeight, vRun.back()->nHeight, pto->GetId());
+    connman->PushMessage(pto, CNetMsgMaker(pto->GetSendVersion()).Make(NetMsgType::GETBLOCKRANGE, vRun.front()->nHeight, (uint32_t)vRun.size(), vRun.back()->GetBlockHash()));
+}
+
 inline void static SendBlockTransactions(const CBlock& block, const BlockTransactionsRequest& req, CNode* pfrom, CConnman* connman) {
     BlockTransactions resp(req);
     for (size_t i = 0; i < req.indexes.size(); i++) {
@@ -1437,7 +1851,7 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
                 std::vector<CInv> vGetData;
                 // Download as much as possible, from earliest to latest.
                 for (const CBlockIndex *pindex : reverse_iterate(vToFetch)) {
-                    if (nodestate->nBlocksInFlight >= MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+                    if (nodestate->nBlocksInFlight >= nodestate->nBlocksInFlightLimit) {
                         // Can't download any more from this peer
                         break;
                     }
@@ -1519,6 +1933,13 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         }
     }
 
+    if (!(pfrom->GetLocalServices() & NODE_BLOCKRANGE) && strCommand == NetMsgType::GETBLOCKRANGE)
+    {
+        LOCK(cs_main);
+        Misbehaving(pfrom->GetId(), 100);
+        return false;
+    }
+
     if (strCommand == NetMsgType::REJECT)
     {
         if (LogAcceptCategory(BCLog::NET)) {
@@ -2047,6 +2468,57 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     }
 
 
+    else if (strCommand == NetMsgType::GETBLOCKRANGE)
+    {
+        int32_t nHeight;
+        uint32_t nCount;
+        uint256 hashStop;
+        vRecv >> nHeight >> nCount >> hashStop;
+
+        if (nHeight < 0 || nCount == 0 || nCount > MAX_BLOCKRANGE_BLOCKS || nHeight > std::numeric_limits<int>::max() - (int)nCount) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), 20);
+            return error("getblkrange height = %d, count = %u", nHeight, nCount);
+        }
+
+        {
+            LOCK(cs_main);
+
+            BlockMap::iterator it = mapBlockIndex.find(hashStop);
+            if (it == mapBlockIndex.end() || it->second->nHeight != nHeight + (int)nCount - 1) {
+                LogPrint(BCLog::NET, "Peer %d sent us a getblkrange for a block range we don't know\n", pfrom->GetId());
+                return true;
+            }
+
+            std::vector<const CBlockIndex*> vRange(nCount);
+            const CBlockIndex* pindexWalk = it->second;
+            for (unsigned int i = nCount; i > 0; i--) {
+                vRange[i - 1] = pindexWalk;
+                pindexWalk = pindexWalk->pprev;
+            }
+
+            // Serve the range up to the first block we can't or won't send;
+            // the peer times out on the remainder as it would for a getdata.
+            for (const CBlockIndex* pindex : vRange) {
+                if (!(pindex->nStatus & BLOCK_HAVE_DATA) || !BlockRequestAllowed(pindex, chainparams.GetConsensus())) {
+                    LogPrint(BCLog::NET, "%s: ignoring request from peer=%i for blocks from height %d\n", __func__, pfrom->GetId(), pindex->nHeight);
+                    break;
+                }
+                // disconnect node in case we have reached the outbound limit for serving historical blocks
+                // never disconnect whitelisted nodes
+                if (connman->OutboundTargetReached(true) && (pindexBestHeader != nullptr) && (pindexBestHeader->GetBlockTime() - pindex->GetBlockTime() > HISTORICAL_BLOCK_AGE) && !pfrom->fWhitelisted) {
+                    LogPrint(BCLog::NET, "historical block serving limit reached, disconnect peer=%d\n", pfrom->GetId());
+                    pfrom->fDisconnect = true;
+                    return true;
+                }
+                pfrom->vRecvGetBlockRange.push_back(pindex);
+            }
+        }
+        // The message processing loop will send the blocks as the send
+        // buffer allows, before processing further messages
+    }
+
+
     else if (strCommand == NetMsgType::GETHEADERS)
     {
         CBlockLocator locator;
@@ -2362,6 +2834,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         // peer's last block announcement time
         if (received_new_header && pindex->nChainWork > chainActive.Tip()->nChainWork) {
             nodestate->m_last_block_announcement = GetTime();
+            RecordBlockReceivedTime(pindex->GetBlockHash(), nTimeReceived);
         }
 
         std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator blockInFlightIt = mapBlocksInFlight.find(pindex->GetBlockHash());
@@ -2395,7 +2868,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         // We want to be a bit conservative just to be extra careful about DoS
         // possibilities in compact block processing...
         if (pindex->nHeight <= chainActive.Height() + 2) {
-            if ((!fAlreadyInFlight && nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) ||
+            if ((!fAlreadyInFlight && nodestate->nBlocksInFlight < nodestate->nBlocksInFlightLimit) ||
                  (fAlreadyInFlight && blockInFlightIt->second.first == pfrom->GetId())) {
                 std::list<QueuedBlock>::iterator* queuedBlockIt = nullptr;
                 if (!MarkBlockAsInFlight(pfrom->GetId(), pindex->GetBlockHash(), pindex, &queuedBlockIt)) {
@@ -2566,6 +3039,9 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 // though the block was successfully read, and rely on the
                 // handling in ProcessNewBlock to ensure the block index is
                 // updated, reject messages go out, etc.
+                // A block completed from a compact block counts towards the
+                // download statistics like one received in full.
+                RecordBlockDownload(pfrom->GetId(), resp.blockhash, ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION));
                 MarkBlockAsReceived(resp.blockhash); // it is now an empty pointer
                 fBlockRead = true;
                 // mapBlockSource is only used for sending reject messages and DoS scores,
@@ -2622,6 +3098,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
 
     else if (strCommand == NetMsgType::BLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
     {
+        const size_t nBlockSize = vRecv.size();
         std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
         vRecv >> *pblock;
 
@@ -2631,6 +3108,8 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         const uint256 hash(pblock->GetHash());
         {
             LOCK(cs_main);
+            RecordBlockDownload(pfrom->GetId(), hash, nBlockSize);
+            RecordBlockReceivedTime(hash, nTimeReceived);
             // Also always process if we requested the block explicitly, as we may
             // need it even though it is not a candidate for a new best tip.
             forceProcessing |= MarkBlockAsReceived(hash);
@@ -2649,6 +3128,69 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     }
 
 
+    else if (strCommand == NetMsgType::BLOCKRANGE && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        // Bypass the vector deserialization to learn the size of each block.
+        unsigned int nCount = ReadCompactSize(vRecv);
+        if (nCount > MAX_BLOCKRANGE_BLOCKS) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), 20);
+            return error("blkrange message size = %u", nCount);
+        }
+        std::vector<std::shared_ptr<const CBlock>> vBlocks;
+        std::vector<size_t> vBlockSize;
+        vBlocks.reserve(nCount);
+        vBlockSize.reserve(nCount);
+        for (unsigned int n = 0; n < nCount; n++) {
+            const size_t nRemaining = vRecv.size();
+            std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+            vRecv >> *pblock;
+            vBlocks.push_back(pblock);
+            vBlockSize.push_back(nRemaining - vRecv.size());
+        }
+
+        LogPrint(BCLog::NET, "received %u blocks in range peer=%d\n", nCount, pfrom->GetId());
+
+        // Only process blocks we asked this peer for; all of them are then
+        // treated as requested, like a block received after a getdata.
+        std::vector<std::shared_ptr<const CBlock>> vRequested;
+        {
+            LOCK(cs_main);
+            for (unsigned int n = 0; n < nCount; n++) {
+                const uint256 hash(vBlocks[n]->GetHash());
+                std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+                if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != pfrom->GetId()) {
+                    LogPrint(BCLog::NET, "Peer %d sent us block %s in a range we didn't request from it\n", pfrom->GetId(), hash.ToString());
+                    continue;
+                }
+                RecordBlockDownload(pfrom->GetId(), hash, vBlockSize[n]);
+                MarkBlockAsReceived(hash);
+                // mapBlockSource is only used for sending reject messages and DoS scores,
+                // so the race between here and cs_main in ProcessNewBlocks is fine.
+                mapBlockSource.emplace(hash, std::make_pair(pfrom->GetId(), true));
+                vRequested.push_back(vBlocks[n]);
+            }
+        }
+
+        std::vector<bool> vNewBlock;
+        ProcessNewBlocks(chainparams, vRequested, /*fForceProcessing=*/true, &vNewBlock);
+        bool fAnyNewBlock = false;
+        {
+            LOCK(cs_main);
+            for (size_t i = 0; i < vRequested.size(); i++) {
+                if (vNewBlock[i]) {
+                    fAnyNewBlock = true;
+                } else {
+                    mapBlockSource.erase(vRequested[i]->GetHash());
+                }
+            }
+        }
+        if (fAnyNewBlock) {
+            pfrom->nLastBlockTime = GetTime();
+        }
+    }
+
+
     else if (strCommand == NetMsgType::GETADDR)
     {
         // This asymmetric behavior for inbound and outbound connections was introduced
@@ -2844,6 +3386,18 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         }
     }
 
+    else if (strCommand == NetMsgType::GETCFILTERS) {
+        ProcessGetCFilters(pfrom, vRecv, chainparams, connman);
+    }
+
+    else if (strCommand == NetMsgType::GETCFHEADERS) {
+        ProcessGetCFHeaders(pfrom, vRecv, chainparams, connman);
+    }
+
+    else if (strCommand == NetMsgType::GETCFCHECKPT) {
+        ProcessGetCFCheckPt(pfrom, vRecv, chainparams, connman);
+    }
+
     else if (strCommand == NetMsgType::NOTFOUND) {
         // We do not care about the NOTFOUND message, but logging an Unknown Command
         // message would be undesirable as we transmit it ourselves.
@@ -2911,6 +3465,11 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
     // this maintains the order of responses
     if (!pfrom->vRecvGetData.empty()) return true;
 
+    if (!pfrom->vRecvGetBlockRange.empty())
+        ProcessGetBlockRange(pfrom, chainparams.GetConsensus(), connman, interruptMsgProc);
+
+    if (!pfrom->vRecvGetBlockRange.empty()) return true;
+
     // Don't bother if send buffer is too full to respond anyway
     if (pfrom->fPauseSend)
         return false;
@@ -2967,7 +3526,7 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
         fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime, chainparams, connman, interruptMsgProc);
         if (interruptMsgProc)
             return false;
-        if (!pfrom->vRecvGetData.empty())
+        if (!pfrom->vRecvGetData.empty() || !pfrom->vRecvGetBlockRange.empty())
             fMoreWork = true;
     }
     catch (const std::ios_base::failure& e)
@@ -3552,7 +4111,9 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
 
         // Detect whether we're stalling
         nNow = GetTimeMicros();
-        if (state.nStallingSince && state.nStallingSince < nNow - 1000000 * BLOCK_STALLING_TIMEOUT) {
+        // Block download timing follows mocktime, so tests can drive it
+        const int64_t nNowDownload = GetMockableTimeMicros();
+        if (state.nStallingSince && state.nStallingSince < nNowDownload - 1000000 * BLOCK_STALLING_TIMEOUT) {
             // Stalling only triggers when the block download window cannot move. During normal steady state,
             // the download window should be much larger than the to-be-downloaded set of blocks, so disconnection
             // should only happen during initial block download.
@@ -3560,6 +4121,13 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
             pto->fDisconnect = true;
             return true;
         }
+        // Don't wait for the full stalling timeout before letting other peers fetch
+        // the blocks that hold back the download window; with 5-second blocks a
+        // stalled window costs hundreds of blocks of progress per second.
+        if (state.nStallingSince && state.nBlocksInFlight > 0 && state.nStallingSince < nNowDownload - GetStallReassignTimeout(&state)) {
+            LogPrint(BCLog::NET, "Peer=%d is stalling block download, reassigning %d blocks in flight\n", pto->GetId(), state.nBlocksInFlight);
+            ReassignBlocksInFlight(pto->GetId());
+        }
         // In case there is a block that has been in flight from this peer for 2 + 0.5 * N times the block interval
         // (with N the number of peers from which we're downloading validated blocks), disconnect due to timeout.
         // We compensate for other peers to prevent killing off peers due to our own downstream link
@@ -3573,7 +4141,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
             // 120x faster than bitcoin
             // (consensusParams.nPowTargetSpacing * 120) = 600 seconds = 10 minutes (BTC)
 
-            if (nNow > state.nDownloadingSince + (consensusParams.nPowTargetSpacing * 120) * (BLOCK_DOWNLOAD_TIMEOUT_BASE + BLOCK_DOWNLOAD_TIMEOUT_PER_PEER * nOtherPeersWithValidatedDownloads)) {
+            if (nNowDownload > state.nDownloadingSince + (consensusParams.nPowTargetSpacing * 120) * (BLOCK_DOWNLOAD_TIMEOUT_BASE + BLOCK_DOWNLOAD_TIMEOUT_PER_PEER * nOtherPeersWithValidatedDownloads)) {
                 LogPrintf("Timeout downloading block %s from peer=%d, disconnecting\n", queuedBlock.hash.ToString(), pto->GetId());
                 pto->fDisconnect = true;
                 return true;
@@ -3620,20 +4188,35 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
         // Message: getdata (blocks)
         //
         std::vector<CInv> vGetData;
-        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nStallingSince == 0 && state.nBlocksInFlight < state.nBlocksInFlightLimit) {
             std::vector<const CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller, consensusParams);
+            FindNextBlocksToDownload(pto->GetId(), state.nBlocksInFlightLimit - state.nBlocksInFlight, vToDownload, staller, consensusParams);
+            // Peers serving block ranges get one getblkrange per run of
+            // consecutive blocks instead of one getdata entry per block.
+            const bool fFetchRanges = (pto->nServices & NODE_BLOCKRANGE) != 0;
+            std::vector<const CBlockIndex*> vRun;
             for (const CBlockIndex *pindex : vToDownload) {
-                uint32_t nFetchFlags = GetFetchFlags(pto);
-                vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindex->GetBlockHash()));
                 MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), pindex);
                 LogPrint(BCLog::NET, "Requesting block %s (%d) peer=%d\n", pindex->GetBlockHash().ToString(),
                     pindex->nHeight, pto->GetId());
+                if (!fFetchRanges) {
+                    uint32_t nFetchFlags = GetFetchFlags(pto);
+                    vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindex->GetBlockHash()));
+                    continue;
+                }
+                if (!vRun.empty() && (pindex->pprev != vRun.back() || vRun.size() == MAX_BLOCKRANGE_BLOCKS)) {
+                    RequestBlockRange(pto, vRun, vGetData, connman);
+                    vRun.clear();
+                }
+                vRun.push_back(pindex);
+            }
+            if (!vRun.empty()) {
+                RequestBlockRange(pto, vRun, vGetData, connman);
             }
             if (state.nBlocksInFlight == 0 && staller != -1) {
                 if (State(staller)->nStallingSince == 0) {
-                    State(staller)->nStallingSince = nNow;
+                    State(staller)->nStallingSince = nNowDownload;
                     LogPrint(BCLog::NET, "Stall started peer=%d\n", staller);
                 }
             }
@@ -83,10 +83,24 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    int nBlocksInFlightLimit;
+    int64_t nBlockDownloadLatency;
+    int64_t nBlockDownloadRate;
+    uint64_t nBlocksDownloaded;
+    int nStallReassignments;
 };
 
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
+
+struct CBlockRelayStats {
+    uint64_t nBlocksRelayed;   //! Blocks received from a peer and announced onwards via cmpctblock
+    int64_t nLastHopLatency;   //! Microseconds from receipt to announcement of the last such block
+    int64_t nAvgHopLatency;    //! Moving average of the above
+};
+
+/** Get statistics on how quickly received blocks are relayed onwards */
+void GetBlockRelayStats(CBlockRelayStats &stats);
 /** Increase a node's misbehavior score. */
 void Misbehaving(NodeId nodeid, int howmuch);
 
@@ -7,13 +7,19 @@
 #include <policy/policy.h>
 
 #include <clientversion.h>
+#include <hash.h>
 #include <primitives/transaction.h>
 #include <streams.h>
 #include <txmempool.h>
 #include <util.h>
 
+#include <cmath>
+
 static constexpr double INF_FEERATE = 1e99;
 
+/** Estimates files written by this version onwards: they decay by time and may have changes appended */
+static constexpr int FEE_ESTIMATES_VERSION = 160300;
+
 std::string StringForFeeEstimateHorizon(FeeEstimateHorizon horizon) {
     static const std::map<FeeEstimateHorizon, std::string> horizon_strings = {
         {FeeEstimateHorizon::SHORT_HALFLIFE, "short"},
@@ -98,6 +104,14 @@ private:
 
     double decay;
 
+    // The moving averages above are stored divided by decayFactor, the product of
+    // the decay of every block since they were last renormalized, so decaying them
+    // for a new block only updates decayFactor
+    double decayFactor;
+
+    // Buckets whose averages have been updated since they were last written
+    std::vector<bool> bucketChanged;
+
     // Resolution (# of blocks) with which confirmations are tracked
     unsigned int scale;
 
@@ -105,11 +119,17 @@ private:
     // For each bucket X, track the number of transactions in the mempool
     // that are unconfirmed for each possible confirmation value Y
     std::vector<std::vector<int> > unconfTxs;  //unconfTxs[Y][X]
+    // For each Y, the buckets X that have had a transaction added to unconfTxs[Y][X]
+    // since the circular buffer last rolled over Y
+    std::vector<std::vector<unsigned int> > unconfBuckets;
     // transactions still unconfirmed after GetMaxConfirms for each bucket
     std::vector<int> oldUnconfTxs;
 
     void resizeInMemoryCounters(size_t newbuckets);
 
+    /** Fold decayFactor back into the stored moving averages */
+    void Renormalize();
+
 public:
     /**
      * Create new TxConfirmStats. This is called by BlockPolicyEstimator's
@@ -139,8 +159,7 @@ public:
     void removeTx(unsigned int entryHeight, unsigned int nBestSeenHeight,
                   unsigned int bucketIndex, bool inBlock);
 
-    /** Update our estimates by decaying our historical moving average and updating
-        with the data gathered from the current block */
+    /** Decay our historical moving averages by one block */
     void UpdateMovingAverages();
 
     /**
@@ -162,13 +181,19 @@ public:
     unsigned int GetMaxConfirms() const { return scale * confAvg.size(); }
 
     /** Write state of estimation data to a file*/
-    void Write(CAutoFile& fileout) const;
+    void Write(CAutoFile& fileout);
+
+    /** Write the moving averages of the buckets changed since the last Write or WriteChanges */
+    unsigned int WriteChanges(CDataStream& s);
 
     /**
      * Read saved state of estimation data from a file and replace all internal data structures and
      * variables with this state.
      */
     void Read(CAutoFile& filein, int nFileVersion, size_t numBuckets);
+
+    /** Replace the moving averages of the buckets written by WriteChanges */
+    void ReadChanges(CDataStream& s);
 };
 
 
@@ -178,6 +203,7 @@ TxConfirmStats::TxConfirmStats(const std::vector<double>& defaultBuckets,
     : buckets(defaultBuckets), bucketMap(defaultBucketMap)
 {
     decay = _decay;
+    decayFactor = 1;
     assert(_scale != 0 && "_scale must be non-zero");
     scale = _scale;
     confAvg.resize(maxPeriods);
@@ -191,6 +217,7 @@ TxConfirmStats::TxConfirmStats(const std::vector<double>& defaultBuckets,
 
     txCtAvg.resize(buckets.size());
     avg.resize(buckets.size());
+    bucketChanged.resize(buckets.size());
 
     resizeInMemoryCounters(buckets.size());
 }
@@ -198,6 +225,7 @@ TxConfirmStats::TxConfirmStats(const std::vector<double>& defaultBuckets,
 void TxConfirmStats::resizeInMemoryCounters(size_t newbuckets) {
     // newbuckets must be passed in because the buckets referred to during Read have not been updated yet.
     unconfTxs.resize(GetMaxConfirms());
+    unconfBuckets.resize(GetMaxConfirms());
     for (unsigned int i = 0; i < unconfTxs.size(); i++) {
         unconfTxs[i].resize(newbuckets);
     }
@@ -207,10 +235,12 @@ void TxConfirmStats::resizeInMemoryCounters(size_t newbuckets) {
 // Roll the unconfirmed txs circular buffer
 void TxConfirmStats::ClearCurrent(unsigned int nBlockHeight)
 {
-    for (unsigned int j = 0; j < buckets.size(); j++) {
-        oldUnconfTxs[j] += unconfTxs[nBlockHeight%unconfTxs.size()][j];
-        unconfTxs[nBlockHeight%unconfTxs.size()][j] = 0;
+    unsigned int blockIndex = nBlockHeight % unconfTxs.size();
+    for (unsigned int j : unconfBuckets[blockIndex]) {
+        oldUnconfTxs[j] += unconfTxs[blockIndex][j];
+        unconfTxs[blockIndex][j] = 0;
     }
+    unconfBuckets[blockIndex].clear();
 }
 
 
@@ -222,22 +252,33 @@ void TxConfirmStats::Record(int blocksToConfirm, double val)
     int periodsToConfirm = (blocksToConfirm + scale - 1)/scale;
     unsigned int bucketindex = bucketMap.lower_bound(val)->second;
     for (size_t i = periodsToConfirm; i <= confAvg.size(); i++) {
-        confAvg[i - 1][bucketindex]++;
+        confAvg[i - 1][bucketindex] += 1 / decayFactor;
     }
-    txCtAvg[bucketindex]++;
-    avg[bucketindex] += val;
+    txCtAvg[bucketindex] += 1 / decayFactor;
+    avg[bucketindex] += val / decayFactor;
+    bucketChanged[bucketindex] = true;
 }
 
 void TxConfirmStats::UpdateMovingAverages()
+{
+    decayFactor *= decay;
+    // Keep the stored averages, which grow as decayFactor shrinks, well inside the range of a double
+    if (decayFactor < 1e-64) {
+        Renormalize();
+    }
+}
+
+void TxConfirmStats::Renormalize()
 {
     for (unsigned int j = 0; j < buckets.size(); j++) {
         for (unsigned int i = 0; i < confAvg.size(); i++)
-            confAvg[i][j] = confAvg[i][j] * decay;
+            confAvg[i][j] *= decayFactor;
         for (unsigned int i = 0; i < failAvg.size(); i++)
-            failAvg[i][j] = failAvg[i][j] * decay;
-        avg[j] = avg[j] * decay;
-        txCtAvg[j] = txCtAvg[j] * decay;
+            failAvg[i][j] *= decayFactor;
+        avg[j] *= decayFactor;
+        txCtAvg[j] *= decayFactor;
     }
+    decayFactor = 1;
 }
 
 // returns -1 on error conditions
@@ -285,9 +326,9 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
             newBucketRange = false;
         }
         curFarBucket = bucket;
-        nConf += confAvg[periodTarget - 1][bucket];
-        totalNum += txCtAvg[bucket];
-        failNum += failAvg[periodTarget - 1][bucket];
+        nConf += confAvg[periodTarget - 1][bucket] * decayFactor;
+        totalNum += txCtAvg[bucket] * decayFactor;
+        failNum += failAvg[periodTarget - 1][bucket] * decayFactor;
         for (unsigned int confct = confTarget; confct < GetMaxConfirms(); confct++)
             extraNum += unconfTxs[(nBlockHeight - confct)%bins][bucket];
         extraNum += oldUnconfTxs[bucket];
@@ -393,14 +434,38 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     return median;
 }
 
-void TxConfirmStats::Write(CAutoFile& fileout) const
+void TxConfirmStats::Write(CAutoFile& fileout)
 {
+    Renormalize();
     fileout << decay;
     fileout << scale;
     fileout << avg;
     fileout << txCtAvg;
     fileout << confAvg;
     fileout << failAvg;
+    bucketChanged.assign(buckets.size(), false);
+}
+
+unsigned int TxConfirmStats::WriteChanges(CDataStream& s)
+{
+    std::vector<unsigned int> changed;
+    for (unsigned int j = 0; j < buckets.size(); j++) {
+        if (bucketChanged[j]) changed.push_back(j);
+    }
+    s << (uint32_t)changed.size();
+    for (unsigned int j : changed) {
+        // Each bucket's averages as of the current block, in the order Write stores them
+        std::vector<double> averages;
+        averages.push_back(avg[j] * decayFactor);
+        averages.push_back(txCtAvg[j] * decayFactor);
+        for (unsigned int i = 0; i < confAvg.size(); i++)
+            averages.push_back(confAvg[i][j] * decayFactor);
+        for (unsigned int i = 0; i < failAvg.size(); i++)
+            averages.push_back(failAvg[i][j] * decayFactor);
+        s << (uint32_t)j << averages;
+        bucketChanged[j] = false;
+    }
+    return changed.size();
 }
 
 void TxConfirmStats::Read(CAutoFile& filein, int nFileVersion, size_t numBuckets)
@@ -451,6 +516,9 @@ void TxConfirmStats::Read(CAutoFile& filein, int nFileVersion, size_t numBuckets
         }
     }
 
+    decayFactor = 1;
+    bucketChanged.assign(numBuckets, false);
+
     // Resize the current block variables which aren't stored in the data file
     // to match the number of confirms and buckets
     resizeInMemoryCounters(numBuckets);
@@ -459,11 +527,37 @@ void TxConfirmStats::Read(CAutoFile& filein, int nFileVersion, size_t numBuckets
              numBuckets, maxConfirms);
 }
 
+void TxConfirmStats::ReadChanges(CDataStream& s)
+{
+    uint32_t numChanged;
+    s >> numChanged;
+    if (numChanged > avg.size()) {
+        throw std::runtime_error("Corrupt estimates file. More changed buckets than buckets");
+    }
+    for (uint32_t n = 0; n < numChanged; n++) {
+        uint32_t j;
+        std::vector<double> averages;
+        s >> j >> averages;
+        if (j >= avg.size() || averages.size() != 2 + confAvg.size() + failAvg.size()) {
+            throw std::runtime_error("Corrupt estimates file. Mismatch in changed bucket averages");
+        }
+        std::vector<double>::const_iterator it = averages.begin();
+        avg[j] = *it++ / decayFactor;
+        txCtAvg[j] = *it++ / decayFactor;
+        for (unsigned int i = 0; i < confAvg.size(); i++)
+            confAvg[i][j] = *it++ / decayFactor;
+        for (unsigned int i = 0; i < failAvg.size(); i++)
+            failAvg[i][j] = *it++ / decayFactor;
+    }
+}
+
 unsigned int TxConfirmStats::NewTx(unsigned int nBlockHeight, double val)
 {
     unsigned int bucketindex = bucketMap.lower_bound(val)->second;
     unsigned int blockIndex = nBlockHeight % unconfTxs.size();
-    unconfTxs[blockIndex][bucketindex]++;
+    if (unconfTxs[blockIndex][bucketindex]++ == 0) {
+        unconfBuckets[blockIndex].push_back(bucketindex);
+    }
     return bucketindex;
 }
 
@@ -499,8 +593,9 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
         assert(scale != 0);
         unsigned int periodsAgo = blocksAgo / scale;
         for (size_t i = 0; i < periodsAgo && i < failAvg.size(); i++) {
-            failAvg[i][bucketindex]++;
+            failAvg[i][bucketindex] += 1 / decayFactor;
         }
+        bucketChanged[bucketindex] = true;
     }
 }
 
@@ -525,7 +620,9 @@ bool CBlockPolicyEstimator::removeTx(uint256 hash, bool inBlock)
 }
 
 CBlockPolicyEstimator::CBlockPolicyEstimator()
-    : nBestSeenHeight(0), firstRecordedHeight(0), historicalFirst(0), historicalBest(0), trackedTxs(0), untrackedTxs(0)
+    : nBlockSpacing(0), sufficientFeeTxs(0), sufficientTxsShort(0),
+      nBestSeenHeight(0), firstRecordedHeight(0), historicalFirst(0), historicalBest(0),
+      fullWriteNeeded(true), changesWritten(0), trackedTxs(0), untrackedTxs(0)
 {
     static_assert(MIN_BUCKET_FEERATE > 0, "Min feerate must be nonzero");
     size_t bucketIndex = 0;
@@ -536,10 +633,37 @@ CBlockPolicyEstimator::CBlockPolicyEstimator()
     buckets.push_back(INF_FEERATE);
     bucketMap[INF_FEERATE] = bucketIndex;
     assert(bucketMap.size() == buckets.size());
+}
+
+CBlockPolicyEstimator::CBlockPolicyEstimator(int64_t nBlockSpacingIn)
+    : CBlockPolicyEstimator()
+{
+    SetBlockSpacing(nBlockSpacingIn);
+}
 
-    feeStats = std::unique_ptr<TxConfirmStats>(new TxConfirmStats(buckets, bucketMap, MED_BLOCK_PERIODS, MED_DECAY, MED_SCALE));
-    shortStats = std::unique_ptr<TxConfirmStats>(new TxConfirmStats(buckets, bucketMap, SHORT_BLOCK_PERIODS, SHORT_DECAY, SHORT_SCALE));
-    longStats = std::unique_ptr<TxConfirmStats>(new TxConfirmStats(buckets, bucketMap, LONG_BLOCK_PERIODS, LONG_DECAY, LONG_SCALE));
+void CBlockPolicyEstimator::SetBlockSpacing(int64_t nBlockSpacingIn)
+{
+    LOCK(cs_feeEstimator);
+    assert(nBlockSpacingIn > 0);
+    // The decay of the stats depends on the spacing, so what was tracked so far is dropped
+    nBestSeenHeight = firstRecordedHeight = historicalFirst = historicalBest = 0;
+    fullWriteNeeded = true;
+    changesWritten = 0;
+    trackedTxs = untrackedTxs = 0;
+    mapMemPoolTxs.clear();
+    nBlockSpacing = nBlockSpacingIn;
+    sufficientFeeTxs = SUFFICIENT_FEETXS * nBlockSpacing / SUFFICIENT_TXS_TIME;
+    sufficientTxsShort = SUFFICIENT_TXS_SHORT * nBlockSpacing / SUFFICIENT_TXS_TIME;
+
+    feeStats = std::unique_ptr<TxConfirmStats>(NewStats(MED_BLOCK_PERIODS, MED_HALFLIFE_TIME, MED_SCALE));
+    shortStats = std::unique_ptr<TxConfirmStats>(NewStats(SHORT_BLOCK_PERIODS, SHORT_HALFLIFE_TIME, SHORT_SCALE));
+    longStats = std::unique_ptr<TxConfirmStats>(NewStats(LONG_BLOCK_PERIODS, LONG_HALFLIFE_TIME, LONG_SCALE));
+}
+
+TxConfirmStats* CBlockPolicyEstimator::NewStats(unsigned int maxPeriods, int64_t halfLife, unsigned int scale) const
+{
+    double decay = std::pow(0.5, (double)nBlockSpacing / halfLife);
+    return new TxConfirmStats(buckets, bucketMap, maxPeriods, decay, scale);
 }
 
 CBlockPolicyEstimator::~CBlockPolicyEstimator()
@@ -625,6 +749,10 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
         return;
     }
 
+    // Decay once for every block since the last one seen, as Read does
+    // between the records it applies
+    unsigned int nBlocks = nBestSeenHeight ? nBlockHeight - nBestSeenHeight : 1;
+
     // Must update nBestSeenHeight in sync with ClearCurrent so that
     // calls to removeTx (via processBlockTx) correctly calculate age
     // of unconfirmed txs to remove from tracking.
@@ -635,10 +763,12 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
     shortStats->ClearCurrent(nBlockHeight);
     longStats->ClearCurrent(nBlockHeight);
 
-    // Decay all exponential averages
-    feeStats->UpdateMovingAverages();
-    shortStats->UpdateMovingAverages();
-    longStats->UpdateMovingAverages();
+    // Decay all exponential averages, lazily
+    for (unsigned int i = 0; i < nBlocks; i++) {
+        feeStats->UpdateMovingAverages();
+        shortStats->UpdateMovingAverages();
+        longStats->UpdateMovingAverages();
+    }
 
     unsigned int countedTxs = 0;
     // Update averages with data points from current block
@@ -673,11 +803,11 @@ CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget) const
 CFeeRate CBlockPolicyEstimator::estimateRawFee(int confTarget, double successThreshold, FeeEstimateHorizon horizon, EstimationResult* result) const
 {
     TxConfirmStats* stats;
-    double sufficientTxs = SUFFICIENT_FEETXS;
+    double sufficientTxs = sufficientFeeTxs;
     switch (horizon) {
     case FeeEstimateHorizon::SHORT_HALFLIFE: {
         stats = shortStats.get();
-        sufficientTxs = SUFFICIENT_TXS_SHORT;
+        sufficientTxs = sufficientTxsShort;
         break;
     }
     case FeeEstimateHorizon::MED_HALFLIFE: {
@@ -739,7 +869,7 @@ unsigned int CBlockPolicyEstimator::HistoricalBlockSpan() const
     if (historicalFirst == 0) return 0;
     assert(historicalBest >= historicalFirst);
 
-    if (nBestSeenHeight - historicalBest > OLDEST_ESTIMATE_HISTORY) return 0;
+    if (nBestSeenHeight - historicalBest > OLDEST_ESTIMATE_HISTORY / nBlockSpacing) return 0;
 
     return historicalBest - historicalFirst;
 }
@@ -760,26 +890,26 @@ double CBlockPolicyEstimator::estimateCombinedFee(unsigned int confTarget, doubl
     if (confTarget >= 1 && confTarget <= longStats->GetMaxConfirms()) {
         // Find estimate from shortest time horizon possible
         if (confTarget <= shortStats->GetMaxConfirms()) { // short horizon
-            estimate = shortStats->EstimateMedianVal(confTarget, SUFFICIENT_TXS_SHORT, successThreshold, true, nBestSeenHeight, result);
+            estimate = shortStats->EstimateMedianVal(confTarget, sufficientTxsShort, successThreshold, true, nBestSeenHeight, result);
         }
         else if (confTarget <= feeStats->GetMaxConfirms()) { // medium horizon
-            estimate = feeStats->EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, successThreshold, true, nBestSeenHeight, result);
+            estimate = feeStats->EstimateMedianVal(confTarget, sufficientFeeTxs, successThreshold, true, nBestSeenHeight, result);
         }
         else { // long horizon
-            estimate = longStats->EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, successThreshold, true, nBestSeenHeight, result);
+            estimate = longStats->EstimateMedianVal(confTarget, sufficientFeeTxs, successThreshold, true, nBestSeenHeight, result);
         }
         if (checkShorterHorizon) {
             EstimationResult tempResult;
             // If a lower confTarget from a more recent horizon returns a lower answer use it.
             if (confTarget > feeStats->GetMaxConfirms()) {
-                double medMax = feeStats->EstimateMedianVal(feeStats->GetMaxConfirms(), SUFFICIENT_FEETXS, successThreshold, true, nBestSeenHeight, &tempResult);
+                double medMax = feeStats->EstimateMedianVal(feeStats->GetMaxConfirms(), sufficientFeeTxs, successThreshold, true, nBestSeenHeight, &tempResult);
                 if (medMax > 0 && (estimate == -1 || medMax < estimate)) {
                     estimate = medMax;
                     if (result) *result = tempResult;
                 }
             }
             if (confTarget > shortStats->GetMaxConfirms()) {
-                double shortMax = shortStats->EstimateMedianVal(shortStats->GetMaxConfirms(), SUFFICIENT_TXS_SHORT, successThreshold, true, nBestSeenHeight, &tempResult);
+                double shortMax = shortStats->EstimateMedianVal(shortStats->GetMaxConfirms(), sufficientTxsShort, successThreshold, true, nBestSeenHeight, &tempResult);
                 if (shortMax > 0 && (estimate == -1 || shortMax < estimate)) {
                     estimate = shortMax;
                     if (result) *result = tempResult;
@@ -798,10 +928,10 @@ double CBlockPolicyEstimator::estimateConservativeFee(unsigned int doubleTarget,
     double estimate = -1;
     EstimationResult tempResult;
     if (doubleTarget <= shortStats->GetMaxConfirms()) {
-        estimate = feeStats->EstimateMedianVal(doubleTarget, SUFFICIENT_FEETXS, DOUBLE_SUCCESS_PCT, true, nBestSeenHeight, result);
+        estimate = feeStats->EstimateMedianVal(doubleTarget, sufficientFeeTxs, DOUBLE_SUCCESS_PCT, true, nBestSeenHeight, result);
     }
     if (doubleTarget <= feeStats->GetMaxConfirms()) {
-        double longEstimate = longStats->EstimateMedianVal(doubleTarget, SUFFICIENT_FEETXS, DOUBLE_SUCCESS_PCT, true, nBestSeenHeight, &tempResult);
+        double longEstimate = longStats->EstimateMedianVal(doubleTarget, sufficientFeeTxs, DOUBLE_SUCCESS_PCT, true, nBestSeenHeight, &tempResult);
         if (longEstimate > estimate) {
             estimate = longEstimate;
             if (result) *result = tempResult;
@@ -896,11 +1026,11 @@ CFeeRate CBlockPolicyEstimator::estimateSmartFee(int confTarget, FeeCalculation
 }
 
 
-bool CBlockPolicyEstimator::Write(CAutoFile& fileout) const
+bool CBlockPolicyEstimator::Write(CAutoFile& fileout)
 {
     try {
         LOCK(cs_feeEstimator);
-        fileout << 149900; // version required to read: 0.14.99 or later
+        fileout << FEE_ESTIMATES_VERSION; // version required to read: 0.16.3 or later
         fileout << CLIENT_VERSION; // version that wrote the file
         fileout << nBestSeenHeight;
         if (BlockSpan() > HistoricalBlockSpan()/2) {
@@ -913,6 +1043,8 @@ bool CBlockPolicyEstimator::Write(CAutoFile& fileout) const
         feeStats->Write(fileout);
         shortStats->Write(fileout);
         longStats->Write(fileout);
+        fullWriteNeeded = false;
+        changesWritten = 0;
     }
     catch (const std::exception&) {
         LogPrintf("CBlockPolicyEstimator::Write(): unable to write policy estimator data (non-fatal)\n");
@@ -921,6 +1053,45 @@ bool CBlockPolicyEstimator::Write(CAutoFile& fileout) const
     return true;
 }
 
+// Each change record holds the heights Write stores followed by the changed
+// buckets of each TxConfirmStats, with a checksum so that a record cut short
+// by a crash is recognized and ignored by Read.
+bool CBlockPolicyEstimator::WriteChanges(CAutoFile& fileout)
+{
+    try {
+        LOCK(cs_feeEstimator);
+        CDataStream ssRecord(SER_DISK, CLIENT_VERSION);
+        ssRecord << nBestSeenHeight;
+        if (BlockSpan() > HistoricalBlockSpan()/2) {
+            ssRecord << firstRecordedHeight << nBestSeenHeight;
+        }
+        else {
+            ssRecord << historicalFirst << historicalBest;
+        }
+        unsigned int nChanged = feeStats->WriteChanges(ssRecord);
+        nChanged += shortStats->WriteChanges(ssRecord);
+        nChanged += longStats->WriteChanges(ssRecord);
+        std::vector<unsigned char> vRecord(ssRecord.begin(), ssRecord.end());
+        fileout << vRecord << Hash(vRecord.begin(), vRecord.end());
+        changesWritten += 1 + nChanged;
+        LogPrint(BCLog::ESTIMATEFEE, "Appended %u changed buckets to estimates at height %u\n", nChanged, nBestSeenHeight);
+    }
+    catch (const std::exception&) {
+        LogPrintf("CBlockPolicyEstimator::WriteChanges(): unable to write policy estimator data (non-fatal)\n");
+        // The buckets written to the record are no longer marked as changed
+        fullWriteNeeded = true;
+        return false;
+    }
+    return true;
+}
+
+bool CBlockPolicyEstimator::NeedsFullWrite() const
+{
+    LOCK(cs_feeEstimator);
+    // Rewrite once the appended records could hold every bucket of every horizon
+    return fullWriteNeeded || changesWritten >= 3 * buckets.size();
+}
+
 bool CBlockPolicyEstimator::Read(CAutoFile& filein)
 {
     try {
@@ -935,9 +1106,10 @@ bool CBlockPolicyEstimator::Read(CAutoFile& filein)
         unsigned int nFileBestSeenHeight;
         filein >> nFileBestSeenHeight;
 
-        if (nVersionRequired < 149900) {
-            LogPrintf("%s: incompatible old fee estimation data (non-fatal). Version: %d\n", __func__, nVersionRequired);
-        } else { // New format introduced in 149900
+        if (nVersionRequired < FEE_ESTIMATES_VERSION) {
+            // Older files decayed per block rather than per span of time, so their averages do not carry over
+            LogPrintf("%s: discarding incompatible old fee estimation data (non-fatal), estimates start over. Version: %d\n", __func__, nVersionRequired);
+        } else { // Time based decay and change records introduced in FEE_ESTIMATES_VERSION
             unsigned int nFileHistoricalFirst, nFileHistoricalBest;
             filein >> nFileHistoricalFirst >> nFileHistoricalBest;
             if (nFileHistoricalFirst > nFileHistoricalBest || nFileHistoricalBest > nFileBestSeenHeight) {
@@ -949,13 +1121,48 @@ bool CBlockPolicyEstimator::Read(CAutoFile& filein)
             if (numBuckets <= 1 || numBuckets > 1000)
                 throw std::runtime_error("Corrupt estimates file. Must have between 2 and 1000 feerate buckets");
 
-            std::unique_ptr<TxConfirmStats> fileFeeStats(new TxConfirmStats(buckets, bucketMap, MED_BLOCK_PERIODS, MED_DECAY, MED_SCALE));
-            std::unique_ptr<TxConfirmStats> fileShortStats(new TxConfirmStats(buckets, bucketMap, SHORT_BLOCK_PERIODS, SHORT_DECAY, SHORT_SCALE));
-            std::unique_ptr<TxConfirmStats> fileLongStats(new TxConfirmStats(buckets, bucketMap, LONG_BLOCK_PERIODS, LONG_DECAY, LONG_SCALE));
+            std::unique_ptr<TxConfirmStats> fileFeeStats(NewStats(MED_BLOCK_PERIODS, MED_HALFLIFE_TIME, MED_SCALE));
+            std::unique_ptr<TxConfirmStats> fileShortStats(NewStats(SHORT_BLOCK_PERIODS, SHORT_HALFLIFE_TIME, SHORT_SCALE));
+            std::unique_ptr<TxConfirmStats> fileLongStats(NewStats(LONG_BLOCK_PERIODS, LONG_HALFLIFE_TIME, LONG_SCALE));
             fileFeeStats->Read(filein, nVersionThatWrote, numBuckets);
             fileShortStats->Read(filein, nVersionThatWrote, numBuckets);
             fileLongStats->Read(filein, nVersionThatWrote, numBuckets);
 
+            // Apply the change records appended since, decaying the averages up to each record's height
+            unsigned int nRecords = 0;
+            while (true) {
+                std::vector<unsigned char> vRecord;
+                uint256 hashRecord;
+                try {
+                    filein >> vRecord >> hashRecord;
+                } catch (const std::ios_base::failure&) {
+                    break; // End of file, or a record cut short
+                }
+                if (hashRecord != Hash(vRecord.begin(), vRecord.end())) {
+                    LogPrintf("%s: ignoring fee estimation data after a damaged record (non-fatal)\n", __func__);
+                    break;
+                }
+                CDataStream ssRecord(vRecord, SER_DISK, CLIENT_VERSION);
+                unsigned int nRecordBestSeenHeight, nRecordHistoricalFirst, nRecordHistoricalBest;
+                ssRecord >> nRecordBestSeenHeight >> nRecordHistoricalFirst >> nRecordHistoricalBest;
+                if (nRecordBestSeenHeight < nFileBestSeenHeight || nRecordHistoricalFirst > nRecordHistoricalBest || nRecordHistoricalBest > nRecordBestSeenHeight) {
+                    throw std::runtime_error("Corrupt estimates file. Block range of appended estimates is invalid");
+                }
+                for (unsigned int nHeight = nFileBestSeenHeight; nHeight < nRecordBestSeenHeight; nHeight++) {
+                    fileFeeStats->UpdateMovingAverages();
+                    fileShortStats->UpdateMovingAverages();
+                    fileLongStats->UpdateMovingAverages();
+                }
+                fileFeeStats->ReadChanges(ssRecord);
+                fileShortStats->ReadChanges(ssRecord);
+                fileLongStats->ReadChanges(ssRecord);
+                nFileBestSeenHeight = nRecordBestSeenHeight;
+                nFileHistoricalFirst = nRecordHistoricalFirst;
+                nFileHistoricalBest = nRecordHistoricalBest;
+                nRecords++;
+            }
+            LogPrint(BCLog::ESTIMATEFEE, "Read %u appended fee estimate records up to height %u\n", nRecords, nFileBestSeenHeight);
+
             // Fee estimates file parsed correctly
             // Copy buckets from file and refresh our bucketmap
             buckets = fileBuckets;
@@ -972,6 +1179,8 @@ bool CBlockPolicyEstimator::Read(CAutoFile& filein)
             nBestSeenHeight = nFileBestSeenHeight;
             historicalFirst = nFileHistoricalFirst;
             historicalBest = nFileHistoricalBest;
+            // Fold the appended records into a fresh file on the next write
+            fullWriteNeeded = true;
         }
     }
     catch (const std::exception& e) {
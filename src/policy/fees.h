@@ -17,6 +17,7 @@
 #include <vector>
 
 class CAutoFile;
+class CDataStream;
 class CFeeRate;
 class CTxMemPoolEntry;
 class CTxMemPool;
@@ -65,6 +66,12 @@ class TxConfirmStats;
  * outstanding and use both of these numbers to increase the number of transactions
  * we've seen in that feerate bucket when calculating an estimate for any number
  * of confirmations below the number of blocks they've been outstanding.
+ *
+ * The half-life of each data set is a span of time rather than a number of
+ * blocks, so the decay per block follows from the block spacing.  The decay is
+ * applied lazily: the moving averages are stored divided by the accumulated
+ * decay, so a new block only touches the buckets of the transactions it
+ * confirms or that left the mempool unconfirmed.
  */
 
 /* Identifier for each of the 3 different TxConfirmStats which will track
@@ -147,15 +154,15 @@ private:
     /** Track confirm delays up to 1008 blocks for long horizon */
     static constexpr unsigned int LONG_BLOCK_PERIODS = 42;
     static constexpr unsigned int LONG_SCALE = 24;
-    /** Historical estimates that are older than this aren't valid */
-    static const unsigned int OLDEST_ESTIMATE_HISTORY = 6 * 1008;
+    /** Historical estimates that are older than this many seconds (six weeks) aren't valid */
+    static constexpr int64_t OLDEST_ESTIMATE_HISTORY = 6 * 7 * 24 * 60 * 60;
 
-    /** Decay of .962 is a half-life of 18 blocks or about 3 hours */
-    static constexpr double SHORT_DECAY = .962;
-    /** Decay of .998 is a half-life of 144 blocks or about 1 day */
-    static constexpr double MED_DECAY = .9952;
-    /** Decay of .9995 is a half-life of 1008 blocks or about 1 week */
-    static constexpr double LONG_DECAY = .99931;
+    /** Half-life of 3 hours for the short horizon (a decay of .962 per block at 10 minute blocks) */
+    static constexpr int64_t SHORT_HALFLIFE_TIME = 3 * 60 * 60;
+    /** Half-life of 1 day for the medium horizon (.9952 at 10 minute blocks) */
+    static constexpr int64_t MED_HALFLIFE_TIME = 24 * 60 * 60;
+    /** Half-life of 1 week for the long horizon (.99931 at 10 minute blocks) */
+    static constexpr int64_t LONG_HALFLIFE_TIME = 7 * 24 * 60 * 60;
 
     /** Require greater than 60% of X feerate transactions to be confirmed within Y/2 blocks*/
     static constexpr double HALF_SUCCESS_PCT = .6;
@@ -164,10 +171,11 @@ private:
     /** Require greater than 95% of X feerate transactions to be confirmed within 2 * Y blocks*/
     static constexpr double DOUBLE_SUCCESS_PCT = .95;
 
-    /** Require an avg of 0.1 tx in the combined feerate bucket per block to have stat significance */
+    /** Require an avg of 0.1 tx in the combined feerate bucket per 10 minutes to have stat significance */
     static constexpr double SUFFICIENT_FEETXS = 0.1;
     /** Require an avg of 0.5 tx when using short decay since there are fewer blocks considered*/
     static constexpr double SUFFICIENT_TXS_SHORT = 0.5;
+    static constexpr int64_t SUFFICIENT_TXS_TIME = 10 * 60;
 
     /** Minimum and Maximum values for tracking feerates
      * The MIN_BUCKET_FEERATE should just be set to the lowest reasonable feerate we
@@ -187,10 +195,15 @@ private:
     static constexpr double FEE_SPACING = 1.05;
 
 public:
-    /** Create new BlockPolicyEstimator and initialize stats tracking classes with default values */
+    /** Create new BlockPolicyEstimator for blocks nBlockSpacing seconds apart and initialize stats tracking classes */
+    explicit CBlockPolicyEstimator(int64_t nBlockSpacing);
+    /** Create new BlockPolicyEstimator whose block spacing is set with SetBlockSpacing before use */
     CBlockPolicyEstimator();
     ~CBlockPolicyEstimator();
 
+    /** Set the block spacing, normally consensus.nPowTargetSpacing, and start over with no data */
+    void SetBlockSpacing(int64_t nBlockSpacing);
+
     /** Process all the transactions that have been included in a block */
     void processBlock(unsigned int nBlockHeight,
                       std::vector<const CTxMemPoolEntry*>& entries);
@@ -218,7 +231,13 @@ public:
     CFeeRate estimateRawFee(int confTarget, double successThreshold, FeeEstimateHorizon horizon, EstimationResult *result = nullptr) const;
 
     /** Write estimation data to a file */
-    bool Write(CAutoFile& fileout) const;
+    bool Write(CAutoFile& fileout);
+
+    /** Append the estimation data changed since the last Write or WriteChanges to a file written by Write */
+    bool WriteChanges(CAutoFile& fileout);
+
+    /** Whether the file needs rewriting with Write rather than appending to with WriteChanges */
+    bool NeedsFullWrite() const;
 
     /** Read estimation data from a file */
     bool Read(CAutoFile& filein);
@@ -230,11 +249,21 @@ public:
     unsigned int HighestTargetTracked(FeeEstimateHorizon horizon) const;
 
 private:
+    int64_t nBlockSpacing;
+    /** Per block rates of SUFFICIENT_FEETXS and SUFFICIENT_TXS_SHORT at nBlockSpacing */
+    double sufficientFeeTxs;
+    double sufficientTxsShort;
+
     unsigned int nBestSeenHeight;
     unsigned int firstRecordedHeight;
     unsigned int historicalFirst;
     unsigned int historicalBest;
 
+    /** Set until the next Write after construction or Read */
+    bool fullWriteNeeded;
+    /** Buckets and records appended by WriteChanges since the last Write */
+    unsigned int changesWritten;
+
     struct TxStatsInfo
     {
         unsigned int blockHeight;
@@ -271,6 +300,8 @@ private:
     unsigned int HistoricalBlockSpan() const;
     /** Calculation of highest target that reasonable estimate can be provided for */
     unsigned int MaxUsableEstimate() const;
+    /** Create the TxConfirmStats for a time horizon */
+    TxConfirmStats* NewStats(unsigned int maxPeriods, int64_t halfLife, unsigned int scale) const;
 };
 
 class FeeFilterRounder
@@ -111,6 +111,7 @@ public:
 
     // memory only
     mutable bool fChecked;
+    mutable bool fWitnessChecked;
 
     CBlock()
     {
@@ -136,6 +137,7 @@ public:
         CBlockHeader::SetNull();
         vtx.clear();
         fChecked = false;
+        fWitnessChecked = false;
     }
 
     CBlockHeader GetBlockHeader() const
@@ -6,11 +6,15 @@
 #include <chain.h>
 #include <chainparams.h>
 #include <core_io.h>
+#include <crypto/common.h>
+#include <index/txindex.h>
 #include <primitives/block.h>
 #include <primitives/transaction.h>
 #include <validation.h>
+#include <httprpc.h>
 #include <httpserver.h>
 #include <rpc/blockchain.h>
+#include <rpc/jsonwriter.h>
 #include <rpc/server.h>
 #include <streams.h>
 #include <sync.h>
@@ -23,6 +27,9 @@
 #include <univalue.h>
 
 static const size_t MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
+static const int MAX_REST_BLOCKRANGE_COUNT = 2000; //allow a max of 2000 blocks to be queried at once
+//! Block range replies are sent in chunks of about this many bytes
+static const size_t REST_BLOCKRANGE_CHUNK_SIZE = 64 * 1024;
 
 enum RetFormat {
     RF_UNDEF,
@@ -242,15 +249,9 @@ static bool rest_block(HTTPRequest* req,
     }
 
     case RF_JSON: {
-        UniValue objBlock;
-        {
-            LOCK(cs_main);
-            objBlock = blockToJSON(block, pblockindex, showTxDetails);
-        }
-        std::string strJSON = objBlock.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
-        return true;
+        return WriteJSONReply(req, [&](JSONWriter& writer) {
+            blockToJSON(block, pblockindex, showTxDetails, writer);
+        });
     }
 
     default: {
@@ -269,6 +270,174 @@ static bool rest_block_notxdetails(HTTPRequest* req, const std::string& strURIPa
     return rest_block(req, strURIPart, false);
 }
 
+/** Read the serialized block of pindex, straight from the block files unless
+ *  it must be serialized without witness data */
+static bool ReadSerializedBlock(std::vector<unsigned char>& data, const CBlockIndex* pindex)
+{
+    const int serializeFlags = RPCSerializationFlags();
+    if (serializeFlags == 0)
+        return ReadRawBlockFromDisk(data, pindex, Params().MessageStart());
+
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex, Params().GetConsensus()))
+        return false;
+    data.clear();
+    CVectorWriter(SER_NETWORK, PROTOCOL_VERSION | serializeFlags, data, 0) << block;
+    return true;
+}
+
+/** Append data to buffer, preceded by its size as 4 byte little endian number */
+static void AppendSizedData(std::string& buffer, const std::vector<unsigned char>& data)
+{
+    unsigned char size[4];
+    WriteLE32(size, data.size());
+    buffer.append((const char*)size, sizeof(size));
+    buffer.append(data.begin(), data.end());
+}
+
+static bool rest_blockrange(HTTPRequest* req,
+                            const std::string& strURIPart,
+                            bool withUndo)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    if (rf != RF_BINARY)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin)");
+
+    std::vector<std::string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+    if (path.size() != 2)
+        return RESTERR(req, HTTP_BAD_REQUEST, "No block count specified. Use /rest/blockrange/<start>/<count>.bin.");
+
+    int32_t start, count;
+    if (!ParseInt32(path[0], &start) || start < 0)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid height: " + SanitizeString(path[0]));
+    if (!ParseInt32(path[1], &count) || count < 1 || count > MAX_REST_BLOCKRANGE_COUNT)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Block count out of range: " + SanitizeString(path[1]));
+
+    // The blocks of the active chain at the time of the request are sent,
+    // even if it is reorganized in the meantime
+    std::vector<const CBlockIndex*> blocks;
+    {
+        LOCK(cs_main);
+        if (start > chainActive.Height())
+            return RESTERR(req, HTTP_NOT_FOUND, "Block height out of range");
+        for (int height = start; height <= chainActive.Height() && blocks.size() < (size_t)count; ++height) {
+            const CBlockIndex* pindex = chainActive[height];
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA) || (withUndo && pindex->pprev && !(pindex->nStatus & BLOCK_HAVE_UNDO)))
+                return RESTERR(req, HTTP_NOT_FOUND, pindex->GetBlockHash().GetHex() + " not available (pruned data)");
+            blocks.push_back(pindex);
+        }
+    }
+
+    // WriteReplyChunk waits for a slow client, so the reply never holds more
+    // than a few chunks in memory however many blocks it covers
+    std::string buffer;
+    bool started = false;
+    std::vector<unsigned char> block, undo;
+    for (const CBlockIndex* pindex : blocks) {
+        // The genesis block has no undo data
+        undo.clear();
+        if (!ReadSerializedBlock(block, pindex) ||
+            (withUndo && pindex->pprev && !ReadRawUndoFromDisk(undo, pindex, Params().MessageStart()))) {
+            if (!started)
+                return RESTERR(req, HTTP_NOT_FOUND, pindex->GetBlockHash().GetHex() + " not found");
+            // Only whole blocks were sent so far
+            LogPrintf("%s: reply to %s cut short: failed to read %s\n", __func__, req->GetURI(), pindex->GetBlockHash().ToString());
+            req->WriteReplyChunk(buffer);
+            req->EndChunkedReply();
+            return false;
+        }
+
+        AppendSizedData(buffer, block);
+        if (withUndo)
+            AppendSizedData(buffer, undo);
+        if (buffer.size() >= REST_BLOCKRANGE_CHUNK_SIZE) {
+            if (!started) {
+                req->WriteHeader("Content-Type", "application/octet-stream");
+                req->StartChunkedReply(HTTP_OK);
+                started = true;
+            }
+            if (!req->WriteReplyChunk(buffer)) {
+                LogPrintf("%s: reply to %s cut short: client disconnected\n", __func__, req->GetURI());
+                req->EndChunkedReply();
+                return false;
+            }
+            buffer.clear();
+        }
+    }
+
+    if (started) {
+        req->WriteReplyChunk(buffer);
+        req->EndChunkedReply();
+    } else {
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK, buffer);
+    }
+    return true;
+}
+
+static bool rest_blockrange_plain(HTTPRequest* req, const std::string& strURIPart)
+{
+    return rest_blockrange(req, strURIPart, false);
+}
+
+static bool rest_blockrange_withundo(HTTPRequest* req, const std::string& strURIPart)
+{
+    return rest_blockrange(req, strURIPart, true);
+}
+
+static bool rest_blockhash_by_height(HTTPRequest* req,
+                                     const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string heightStr;
+    const RetFormat rf = ParseDataFormat(heightStr, strURIPart);
+
+    int32_t height;
+    if (!ParseInt32(heightStr, &height) || height < 0)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid height: " + SanitizeString(heightStr));
+
+    uint256 hash;
+    {
+        LOCK(cs_main);
+        if (height > chainActive.Height())
+            return RESTERR(req, HTTP_NOT_FOUND, "Block height out of range");
+        hash = chainActive[height]->GetBlockHash();
+    }
+
+    switch (rf) {
+    case RF_BINARY: {
+        CDataStream ssHash(SER_NETWORK, PROTOCOL_VERSION);
+        ssHash << hash;
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK, ssHash.str());
+        return true;
+    }
+
+    case RF_HEX: {
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, hash.GetHex() + "\n");
+        return true;
+    }
+
+    case RF_JSON: {
+        UniValue resp(UniValue::VOBJ);
+        resp.push_back(Pair("blockhash", hash.GetHex()));
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, resp.write() + "\n");
+        return true;
+    }
+
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+}
+
 // A bit of a hack - dependency on a function defined in rpc/blockchain.cpp
 UniValue getblockchaininfo(const JSONRPCRequest& request);
 
@@ -326,12 +495,9 @@ static bool rest_mempool_contents(HTTPRequest* req, const std::string& strURIPar
 
     switch (rf) {
     case RF_JSON: {
-        UniValue mempoolObject = mempoolToJSON(true);
-
-        std::string strJSON = mempoolObject.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
-        return true;
+        return WriteJSONReply(req, [](JSONWriter& writer) {
+            mempoolToJSON(true, writer);
+        });
     }
     default: {
         return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json)");
@@ -350,6 +516,10 @@ static bool rest_tx(HTTPRequest* req, const std::string& strURIPart)
     if (!ParseHashStr(hashStr, hash))
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
+    if (g_txindex) {
+        g_txindex->BlockUntilSyncedToCurrentChain();
+    }
+
     CTransactionRef tx;
     uint256 hashBlock = uint256();
     if (!GetTransaction(hash, tx, Params().GetConsensus(), hashBlock, true))
@@ -577,6 +747,9 @@ static const struct {
       {"/rest/tx/", rest_tx},
       {"/rest/block/notxdetails/", rest_block_notxdetails},
       {"/rest/block/", rest_block_extended},
+      {"/rest/blockrange/withundo/", rest_blockrange_withundo},
+      {"/rest/blockrange/", rest_blockrange_plain},
+      {"/rest/blockhashbyheight/", rest_blockhash_by_height},
       {"/rest/chaininfo", rest_chaininfo},
       {"/rest/mempool/info", rest_mempool_info},
       {"/rest/mempool/contents", rest_mempool_contents},
@@ -6,21 +6,28 @@
 #include <rpc/blockchain.h>
 
 #include <amount.h>
+#include <blockfilter.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <checkpoints.h>
 #include <coins.h>
 #include <consensus/validation.h>
+#include <crypto/muhash.h>
+#include <index/blockfilterindex.h>
+#include <index/blockstatsindex.h>
+#include <index/coinstatsindex.h>
 #include <validation.h>
 #include <core_io.h>
 #include <policy/feerate.h>
 #include <policy/policy.h>
 #include <primitives/transaction.h>
+#include <rpc/jsonwriter.h>
 #include <rpc/server.h>
 #include <streams.h>
 #include <sync.h>
 #include <txdb.h>
 #include <txmempool.h>
+#include <undo.h>
 #include <util.h>
 #include <utilstrencodings.h>
 #include <hash.h>
@@ -35,6 +42,7 @@
 
 #include <memory>
 #include <mutex>
+#include <set>
 #include <condition_variable>
 
 struct CUpdatedBlock
@@ -43,6 +51,11 @@ struct CUpdatedBlock
     int height;
 };
 
+//! Blocks a range query returns at most: a day of blocks at the 5 second spacing
+static const int MAX_BLOCK_RANGE = 17280;
+//! Verbose mempool entries described per hold of mempool.cs when streaming
+static const size_t MEMPOOL_JSON_BATCH_SIZE = 1000;
+
 static std::mutex cs_blockchange;
 static std::condition_variable cond_blockchange;
 static CUpdatedBlock latestblock;
@@ -115,23 +128,45 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     return result;
 }
 
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails)
+/** The fields of the block description before and after its transactions */
+static void blockFieldsToJSON(const CBlock& block, const CBlockIndex* blockindex, UniValue& before_tx, UniValue& after_tx)
 {
     AssertLockHeld(cs_main);
-    UniValue result(UniValue::VOBJ);
-    result.push_back(Pair("hash", blockindex->GetBlockHash().GetHex()));
+    before_tx.setObject();
+    before_tx.push_back(Pair("hash", blockindex->GetBlockHash().GetHex()));
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
     if (chainActive.Contains(blockindex))
         confirmations = chainActive.Height() - blockindex->nHeight + 1;
-    result.push_back(Pair("confirmations", confirmations));
-    result.push_back(Pair("strippedsize", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS)));
-    result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
-    result.push_back(Pair("weight", (int)::GetBlockWeight(block)));
-    result.push_back(Pair("height", blockindex->nHeight));
-    result.push_back(Pair("version", block.nVersion));
-    result.push_back(Pair("versionHex", strprintf("%08x", block.nVersion)));
-    result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
+    before_tx.push_back(Pair("confirmations", confirmations));
+    before_tx.push_back(Pair("strippedsize", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS)));
+    before_tx.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
+    before_tx.push_back(Pair("weight", (int)::GetBlockWeight(block)));
+    before_tx.push_back(Pair("height", blockindex->nHeight));
+    before_tx.push_back(Pair("version", block.nVersion));
+    before_tx.push_back(Pair("versionHex", strprintf("%08x", block.nVersion)));
+    before_tx.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
+
+    after_tx.setObject();
+    after_tx.push_back(Pair("time", block.GetBlockTime()));
+    after_tx.push_back(Pair("mediantime", (int64_t)blockindex->GetMedianTimePast()));
+    after_tx.push_back(Pair("nonce", (uint64_t)block.nNonce));
+    after_tx.push_back(Pair("bits", strprintf("%08x", block.nBits)));
+    after_tx.push_back(Pair("difficulty", GetDifficulty(blockindex)));
+    after_tx.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
+    after_tx.push_back(Pair("nTx", (uint64_t)blockindex->nTx));
+
+    if (blockindex->pprev)
+        after_tx.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
+    CBlockIndex *pnext = chainActive.Next(blockindex);
+    if (pnext)
+        after_tx.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
+}
+
+UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails)
+{
+    UniValue result, after_tx;
+    blockFieldsToJSON(block, blockindex, result, after_tx);
     UniValue txs(UniValue::VARR);
     for(const auto& tx : block.vtx)
     {
@@ -145,22 +180,42 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
             txs.push_back(tx->GetHash().GetHex());
     }
     result.push_back(Pair("tx", txs));
-    result.push_back(Pair("time", block.GetBlockTime()));
-    result.push_back(Pair("mediantime", (int64_t)blockindex->GetMedianTimePast()));
-    result.push_back(Pair("nonce", (uint64_t)block.nNonce));
-    result.push_back(Pair("bits", strprintf("%08x", block.nBits)));
-    result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
-    result.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
-    result.push_back(Pair("nTx", (uint64_t)blockindex->nTx));
-
-    if (blockindex->pprev)
-        result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    CBlockIndex *pnext = chainActive.Next(blockindex);
-    if (pnext)
-        result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
+    result.pushKVs(after_tx);
     return result;
 }
 
+void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails, JSONWriter& writer)
+{
+    // Writing waits for the client to read, so cs_main is only held to fill
+    // in the fields that come from the block index.
+    AssertLockNotHeld(cs_main);
+    UniValue before_tx, after_tx;
+    {
+        LOCK(cs_main);
+        blockFieldsToJSON(block, blockindex, before_tx, after_tx);
+    }
+    writer.BeginObject();
+    for (size_t i = 0; i < before_tx.size(); ++i)
+        writer.KV(before_tx.getKeys()[i], before_tx.getValues()[i]);
+    // Only one transaction at a time is converted to a UniValue
+    writer.Key("tx").BeginArray();
+    for (const auto& tx : block.vtx)
+    {
+        if (txDetails)
+        {
+            UniValue objTx(UniValue::VOBJ);
+            TxToUniv(*tx, uint256(), objTx, true, RPCSerializationFlags());
+            writer.Value(objTx);
+        }
+        else
+            writer.Value(tx->GetHash().GetHex());
+    }
+    writer.EndArray();
+    for (size_t i = 0; i < after_tx.size(); ++i)
+        writer.KV(after_tx.getKeys()[i], after_tx.getValues()[i]);
+    writer.EndObject();
+}
+
 UniValue getblockcount(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 0)
@@ -416,12 +471,14 @@ UniValue mempoolToJSON(bool fVerbose)
     if (fVerbose)
     {
         LOCK(mempool.cs);
+        // In the same order as the streamed version
+        std::vector<uint256> vtxid;
+        mempool.queryHashes(vtxid);
         UniValue o(UniValue::VOBJ);
-        for (const CTxMemPoolEntry& e : mempool.mapTx)
+        for (const uint256& hash : vtxid)
         {
-            const uint256& hash = e.GetTx().GetHash();
             UniValue info(UniValue::VOBJ);
-            entryToJSON(info, e);
+            entryToJSON(info, *mempool.mapTx.find(hash));
             o.push_back(Pair(hash.ToString(), info));
         }
         return o;
@@ -439,7 +496,42 @@ UniValue mempoolToJSON(bool fVerbose)
     }
 }
 
-UniValue getrawmempool(const JSONRPCRequest& request)
+void mempoolToJSON(bool fVerbose, JSONWriter& writer)
+{
+    // Writing waits for the client to read, so nothing is written while
+    // mempool.cs is held. The entries are described a batch at a time, and
+    // transactions that leave the mempool before their batch are left out.
+    std::vector<uint256> vtxid;
+    mempool.queryHashes(vtxid);
+    if (!fVerbose) {
+        writer.BeginArray();
+        for (const uint256& hash : vtxid)
+            writer.Value(hash.ToString());
+        writer.EndArray();
+        return;
+    }
+    writer.BeginObject();
+    std::vector<std::pair<uint256, UniValue>> batch;
+    for (size_t start = 0; start < vtxid.size(); start += MEMPOOL_JSON_BATCH_SIZE) {
+        const size_t end = std::min(vtxid.size(), start + MEMPOOL_JSON_BATCH_SIZE);
+        batch.clear();
+        {
+            LOCK(mempool.cs);
+            for (size_t i = start; i < end; ++i) {
+                CTxMemPool::txiter it = mempool.mapTx.find(vtxid[i]);
+                if (it == mempool.mapTx.end())
+                    continue;
+                batch.emplace_back(vtxid[i], UniValue(UniValue::VOBJ));
+                entryToJSON(batch.back().second, *it);
+            }
+        }
+        for (const auto& entry : batch)
+            writer.KV(entry.first.ToString(), entry.second);
+    }
+    writer.EndObject();
+}
+
+static bool ParseGetRawMempoolRequest(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() > 1)
         throw std::runtime_error(
@@ -467,8 +559,17 @@ UniValue getrawmempool(const JSONRPCRequest& request)
     bool fVerbose = false;
     if (!request.params[0].isNull())
         fVerbose = request.params[0].get_bool();
+    return fVerbose;
+}
 
-    return mempoolToJSON(fVerbose);
+UniValue getrawmempool(const JSONRPCRequest& request)
+{
+    return mempoolToJSON(ParseGetRawMempoolRequest(request));
+}
+
+static void getrawmempool_stream(const JSONRPCRequest& request, JSONWriter& writer)
+{
+    mempoolToJSON(ParseGetRawMempoolRequest(request), writer);
 }
 
 UniValue getmempoolancestors(const JSONRPCRequest& request)
@@ -657,6 +758,151 @@ UniValue getblockhash(const JSONRPCRequest& request)
     return pblockindex->GetBlockHash().GetHex();
 }
 
+/** Select the blocks of the active chain from start_height, at most count of them and no further than the tip */
+static std::vector<const CBlockIndex*> ParseHeightRange(const UniValue& start_param, const UniValue& count_param)
+{
+    AssertLockHeld(cs_main);
+
+    const int start_height = start_param.get_int();
+    const int count = count_param.get_int();
+    if (start_height < 0 || start_height > chainActive.Height()) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+    }
+    if (count < 1 || count > MAX_BLOCK_RANGE) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Count must be between 1 and %d", MAX_BLOCK_RANGE));
+    }
+
+    const int end_height = std::min(chainActive.Height(), start_height + count - 1);
+    std::vector<const CBlockIndex*> block_indexes;
+    block_indexes.reserve(end_height - start_height + 1);
+    for (int height = start_height; height <= end_height; ++height) {
+        block_indexes.push_back(chainActive[height]);
+    }
+    return block_indexes;
+}
+
+UniValue getblockhashes(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 2)
+        throw std::runtime_error(
+            "getblockhashes start_height count\n"
+            "\nReturns the hashes of the blocks in best-block-chain from start_height on.\n"
+            "Fewer than count hashes are returned if the chain ends first.\n"
+            "\nArguments:\n"
+            "1. start_height   (numeric, required) The height index of the first block\n"
+            "2. count          (numeric, required) The number of blocks, at most " + std::to_string(MAX_BLOCK_RANGE) + "\n"
+            "\nResult:\n"
+            "[                 (json array of string)\n"
+            "  \"hash\"          (string) The block hash\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockhashes", "1000 100")
+            + HelpExampleRpc("getblockhashes", "1000, 100")
+        );
+
+    LOCK(cs_main);
+
+    UniValue ret(UniValue::VARR);
+    for (const CBlockIndex* pblockindex : ParseHeightRange(request.params[0], request.params[1])) {
+        ret.push_back(pblockindex->GetBlockHash().GetHex());
+    }
+    return ret;
+}
+
+UniValue getblockheaders(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 2 || request.params.size() > 3)
+        throw std::runtime_error(
+            "getblockheaders start_height count ( \"format\" )\n"
+            "\nReturns the headers of the blocks in best-block-chain from start_height on.\n"
+            "Fewer than count headers are returned if the chain ends first.\n"
+            "\nArguments:\n"
+            "1. start_height   (numeric, required) The height index of the first block\n"
+            "2. count          (numeric, required) The number of blocks, at most " + std::to_string(MAX_BLOCK_RANGE) + "\n"
+            "3. \"format\"       (string, optional, default=hex) \"hex\" for an array of serialized, hex-encoded headers,\n"
+            "                  \"raw\" for a single hex string of the headers back to back, or \"json\" for an array\n"
+            "                  of objects as returned by getblockheader\n"
+            "\nResult (for format = \"hex\"):\n"
+            "[                 (json array of string)\n"
+            "  \"data\"          (string) The serialized, hex-encoded data for the block header\n"
+            "  ,...\n"
+            "]\n"
+            "\nResult (for format = \"raw\"):\n"
+            "\"data\"            (string) The serialized, hex-encoded data for all the block headers\n"
+            "\nResult (for format = \"json\"):\n"
+            "[                 (json array of object)\n"
+            "  {...}           (json object) As returned by getblockheader\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockheaders", "1000 100")
+            + HelpExampleCli("getblockheaders", "1000 100 \"json\"")
+            + HelpExampleRpc("getblockheaders", "1000, 100")
+        );
+
+    const std::string format = request.params[2].isNull() ? "hex" : request.params[2].get_str();
+    if (format != "hex" && format != "raw" && format != "json") {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown format " + format);
+    }
+
+    LOCK(cs_main);
+
+    const std::vector<const CBlockIndex*> block_indexes = ParseHeightRange(request.params[0], request.params[1]);
+
+    if (format == "json") {
+        UniValue ret(UniValue::VARR);
+        for (const CBlockIndex* pblockindex : block_indexes) {
+            ret.push_back(blockheaderToJSON(pblockindex));
+        }
+        return ret;
+    }
+
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    if (format == "raw") {
+        for (const CBlockIndex* pblockindex : block_indexes) {
+            ssBlock << pblockindex->GetBlockHeader();
+        }
+        return HexStr(ssBlock.begin(), ssBlock.end());
+    }
+
+    UniValue ret(UniValue::VARR);
+    for (const CBlockIndex* pblockindex : block_indexes) {
+        ssBlock.clear();
+        ssBlock << pblockindex->GetBlockHeader();
+        ret.push_back(HexStr(ssBlock.begin(), ssBlock.end()));
+    }
+    return ret;
+}
+
+UniValue getblockheightbytime(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "getblockheightbytime timestamp\n"
+            "\nReturns the height of the first block in best-block-chain with a block time at or after timestamp.\n"
+            "\nArguments:\n"
+            "1. timestamp      (numeric, required) The UNIX epoch time\n"
+            "\nResult:\n"
+            "n                 (numeric) The height index of the block\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockheightbytime", "1541030400")
+            + HelpExampleRpc("getblockheightbytime", "1541030400")
+        );
+
+    const int64_t timestamp = request.params[0].get_int64();
+
+    LOCK(cs_main);
+
+    // nTimeMax is the largest block time up to each block, so the first block
+    // at or after the timestamp is found by a binary search over the chain.
+    const CBlockIndex* pblockindex = chainActive.FindEarliestAtLeast(timestamp);
+    if (!pblockindex) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Could not find block with at least the specified timestamp.");
+    }
+    return pblockindex->nHeight;
+}
+
 UniValue getblockheader(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
@@ -717,7 +963,8 @@ UniValue getblockheader(const JSONRPCRequest& request)
     return blockheaderToJSON(pblockindex);
 }
 
-UniValue getblock(const JSONRPCRequest& request)
+/** Check the arguments of getblock and read the block. Returns the verbosity. */
+static int ReadBlockForGetBlock(const JSONRPCRequest& request, CBlock& block, CBlockIndex*& pblockindex)
 {
     if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
         throw std::runtime_error(
@@ -768,7 +1015,7 @@ UniValue getblock(const JSONRPCRequest& request)
             + HelpExampleRpc("getblock", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
         );
 
-    LOCK(cs_main);
+    AssertLockHeld(cs_main);
 
     std::string strHash = request.params[0].get_str();
     uint256 hash(uint256S(strHash));
@@ -784,8 +1031,7 @@ UniValue getblock(const JSONRPCRequest& request)
     if (mapBlockIndex.count(hash) == 0)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
+    pblockindex = mapBlockIndex[hash];
 
     if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
         throw JSONRPCError(RPC_MISC_ERROR, "Block not available (pruned data)");
@@ -798,62 +1044,131 @@ UniValue getblock(const JSONRPCRequest& request)
         // block).
         throw JSONRPCError(RPC_MISC_ERROR, "Block not found on disk");
 
+    return verbosity;
+}
+
+static std::string BlockToHex(const CBlock& block)
+{
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+    ssBlock << block;
+    return HexStr(ssBlock.begin(), ssBlock.end());
+}
+
+UniValue getblock(const JSONRPCRequest& request)
+{
+    LOCK(cs_main);
+
+    CBlock block;
+    CBlockIndex* pblockindex;
+    int verbosity = ReadBlockForGetBlock(request, block, pblockindex);
+
     if (verbosity <= 0)
-    {
-        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-        ssBlock << block;
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
-        return strHex;
-    }
+        return BlockToHex(block);
 
     return blockToJSON(block, pblockindex, verbosity >= 2);
 }
 
-struct CCoinsStats
+static void getblock_stream(const JSONRPCRequest& request, JSONWriter& writer)
 {
-    int nHeight;
-    uint256 hashBlock;
-    uint64_t nTransactions;
-    uint64_t nTransactionOutputs;
-    uint64_t nBogoSize;
-    uint256 hashSerialized;
-    uint64_t nDiskSize;
-    CAmount nTotalAmount;
+    CBlock block;
+    CBlockIndex* pblockindex;
+    int verbosity;
+    {
+        LOCK(cs_main);
+        verbosity = ReadBlockForGetBlock(request, block, pblockindex);
+    }
+
+    if (verbosity <= 0)
+        writer.Value(BlockToHex(block));
+    else
+        blockToJSON(block, pblockindex, verbosity >= 2, writer);
+}
 
-    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0), nTotalAmount(0) {}
+//! How gettxoutsetinfo hashes the UTXO set
+enum class CoinStatsHashType {
+    HASH_SERIALIZED,
+    MUHASH,
+    NONE,
 };
 
-static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+static bool ParseHashType(const std::string& hash_type_input, CoinStatsHashType& hash_type)
+{
+    if (hash_type_input == "hash_serialized_2") {
+        hash_type = CoinStatsHashType::HASH_SERIALIZED;
+    } else if (hash_type_input == "muhash") {
+        hash_type = CoinStatsHashType::MUHASH;
+    } else if (hash_type_input == "none") {
+        hash_type = CoinStatsHashType::NONE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void ApplyHash(CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
 {
-    assert(!outputs.empty());
     ss << hash;
     ss << VARINT(outputs.begin()->second.nHeight * 2 + outputs.begin()->second.fCoinBase);
-    stats.nTransactions++;
-    for (const auto output : outputs) {
+    for (const auto& output : outputs) {
         ss << VARINT(output.first + 1);
         ss << output.second.out.scriptPubKey;
         ss << VARINT(output.second.out.nValue);
+    }
+    ss << VARINT(0);
+}
+
+static void ApplyHash(MuHash3072& muhash, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+{
+    for (const auto& output : outputs) {
+        muhash.Insert(SerializeCoinForMuHash(COutPoint(hash, output.first), output.second));
+    }
+}
+
+static void ApplyHash(std::nullptr_t, const uint256& hash, const std::map<uint32_t, Coin>& outputs) {}
+
+template <typename T>
+static void ApplyStats(CCoinsStats &stats, T& hash_obj, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+{
+    assert(!outputs.empty());
+    stats.nTransactions++;
+    for (const auto& output : outputs) {
         stats.nTransactionOutputs++;
         stats.nTotalAmount += output.second.out.nValue;
-        stats.nBogoSize += 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
-                           2 /* scriptPubKey len */ + output.second.out.scriptPubKey.size() /* scriptPubKey */;
+        stats.nBogoSize += GetBogoSize(output.second.out.scriptPubKey);
     }
-    ss << VARINT(0);
+    ApplyHash(hash_obj, hash, outputs);
 }
 
+static void PrepareHash(CHashWriter& ss, const CCoinsStats& stats)
+{
+    ss << stats.hashBlock;
+}
+static void PrepareHash(MuHash3072& muhash, CCoinsStats& stats) {}
+static void PrepareHash(std::nullptr_t, CCoinsStats& stats) {}
+
+static void FinalizeHash(CHashWriter& ss, CCoinsStats& stats)
+{
+    stats.hashSerialized = ss.GetHash();
+}
+static void FinalizeHash(MuHash3072& muhash, CCoinsStats& stats)
+{
+    muhash.Finalize(stats.hashMuHash);
+}
+static void FinalizeHash(std::nullptr_t, CCoinsStats& stats) {}
+
 //! Calculate statistics about the unspent transaction output set
-static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
+template <typename T>
+static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats, T hash_obj)
 {
     std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
     assert(pcursor);
 
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
     stats.hashBlock = pcursor->GetBestBlock();
     {
         LOCK(cs_main);
         stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
     }
-    ss << stats.hashBlock;
+    PrepareHash(hash_obj, stats);
     uint256 prevkey;
     std::map<uint32_t, Coin> outputs;
     while (pcursor->Valid()) {
@@ -862,7 +1177,7 @@ static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
         Coin coin;
         if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
             if (!outputs.empty() && key.hash != prevkey) {
-                ApplyStats(stats, ss, prevkey, outputs);
+                ApplyStats(stats, hash_obj, prevkey, outputs);
                 outputs.clear();
             }
             prevkey = key.hash;
@@ -873,13 +1188,31 @@ static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
         pcursor->Next();
     }
     if (!outputs.empty()) {
-        ApplyStats(stats, ss, prevkey, outputs);
+        ApplyStats(stats, hash_obj, prevkey, outputs);
     }
-    stats.hashSerialized = ss.GetHash();
+    FinalizeHash(hash_obj, stats);
     stats.nDiskSize = view->EstimateSize();
     return true;
 }
 
+static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats, CoinStatsHashType hash_type)
+{
+    switch (hash_type) {
+    case CoinStatsHashType::HASH_SERIALIZED: {
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        return GetUTXOStats<CHashWriter&>(view, stats, ss);
+    }
+    case CoinStatsHashType::MUHASH: {
+        MuHash3072 muhash;
+        return GetUTXOStats<MuHash3072&>(view, stats, muhash);
+    }
+    case CoinStatsHashType::NONE: {
+        return GetUTXOStats<std::nullptr_t>(view, stats, nullptr);
+    }
+    }
+    assert(false);
+}
+
 UniValue pruneblockchain(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -929,40 +1262,124 @@ UniValue pruneblockchain(const JSONRPCRequest& request)
     return uint64_t(height);
 }
 
+static const CBlockIndex* ParseHashOrHeight(const UniValue& param)
+{
+    LOCK(cs_main);
+    if (param.isNum()) {
+        const int height = param.get_int();
+        const int current_tip = chainActive.Height();
+        if (height < 0) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Target block height %d is negative", height));
+        }
+        if (height > current_tip) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Target block height %d after current tip %d", height, current_tip));
+        }
+        return chainActive[height];
+    }
+
+    const uint256 hash = ParseHashV(param, "hash_or_height");
+    BlockMap::const_iterator it = mapBlockIndex.find(hash);
+    if (it == mapBlockIndex.end()) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+    }
+    return it->second;
+}
+
 UniValue gettxoutsetinfo(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() != 0)
+    if (request.fHelp || request.params.size() > 3)
         throw std::runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" hash_or_height use_index )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time without -coinstatsindex.\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"      (string, optional, default=hash_serialized_2) Which UTXO set hash should be calculated. Options: 'hash_serialized_2', 'muhash', 'none'.\n"
+            "                    Only 'muhash' and 'none' are served from -coinstatsindex.\n"
+            "2. hash_or_height   (string or numeric, optional) The block hash or height of the target height (only available with -coinstatsindex)\n"
+            "3. use_index        (boolean, optional, default=true) Use coinstatsindex, if available\n"
             "\nResult:\n"
             "{\n"
-            "  \"height\":n,     (numeric) The current block height (index)\n"
-            "  \"bestblock\": \"hex\",   (string) The hash of the block at the tip of the chain\n"
-            "  \"transactions\": n,      (numeric) The number of transactions with unspent outputs\n"
+            "  \"height\":n,     (numeric) The block height (index) of the returned statistics\n"
+            "  \"bestblock\": \"hex\",   (string) The hash of the block at which these statistics are calculated\n"
+            "  \"transactions\": n,      (numeric) The number of transactions with unspent outputs (not present when coinstatsindex is used, which does not track it)\n"
             "  \"txouts\": n,            (numeric) The number of unspent transaction outputs\n"
             "  \"bogosize\": n,          (numeric) A meaningless metric for UTXO set size\n"
-            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash\n"
-            "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk\n"
+            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash (only present if 'hash_serialized_2' hash_type is chosen)\n"
+            "  \"muhash\": \"hash\",       (string) The MuHash of the UTXO set (only present if 'muhash' hash_type is chosen)\n"
+            "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk (not present for past blocks)\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"none\"")
+            + HelpExampleCli("gettxoutsetinfo", "\"muhash\" 1000")
             + HelpExampleRpc("gettxoutsetinfo", "")
+            + HelpExampleRpc("gettxoutsetinfo", "\"muhash\", 1000")
         );
 
     UniValue ret(UniValue::VOBJ);
 
+    CoinStatsHashType hash_type = CoinStatsHashType::HASH_SERIALIZED;
+    if (!request.params[0].isNull() && !ParseHashType(request.params[0].get_str(), hash_type)) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("%s is not a valid hash_type", request.params[0].get_str()));
+    }
+    const bool use_index = request.params[2].isNull() || request.params[2].get_bool();
+
     CCoinsStats stats;
+    // The index does not track hash_serialized_2, which still needs a scan
+    if (g_coin_stats_index && use_index && hash_type != CoinStatsHashType::HASH_SERIALIZED) {
+        const CBlockIndex* pindex;
+        if (request.params[1].isNull()) {
+            LOCK(cs_main);
+            pindex = chainActive.Tip();
+        } else {
+            pindex = ParseHashOrHeight(request.params[1]);
+        }
+
+        if (!g_coin_stats_index->BlockUntilSyncedToCurrentChain()) {
+            const CBlockIndex* best_block = g_coin_stats_index->GetBestBlockIndex();
+            const int best_height = best_block ? best_block->nHeight : -1;
+            if (pindex->nHeight > best_height) {
+                throw JSONRPCError(RPC_INTERNAL_ERROR, strprintf("Unable to get data because coinstatsindex is still syncing. Current height: %d", best_height));
+            }
+        }
+        if (!g_coin_stats_index->LookUpStats(pindex, stats)) {
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set statistics from coinstatsindex");
+        }
+
+        ret.push_back(Pair("height", (int64_t)stats.nHeight));
+        ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+        ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
+        ret.push_back(Pair("bogosize", (int64_t)stats.nBogoSize));
+        if (hash_type == CoinStatsHashType::MUHASH) {
+            ret.push_back(Pair("muhash", stats.hashMuHash.GetHex()));
+        }
+        if (request.params[1].isNull()) {
+            ret.push_back(Pair("disk_size", (int64_t)pcoinsdbview->EstimateSize()));
+        }
+        ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+        return ret;
+    }
+
+    if (!request.params[1].isNull()) {
+        if (g_coin_stats_index && use_index) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "hash_serialized_2 hash type cannot be queried for a specific block");
+        }
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Querying specific block heights requires coinstatsindex");
+    }
+
     FlushStateToDisk();
-    if (GetUTXOStats(pcoinsdbview.get(), stats)) {
+    if (GetUTXOStats(pcoinsdbview.get(), stats, hash_type)) {
         ret.push_back(Pair("height", (int64_t)stats.nHeight));
         ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
         ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
         ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
         ret.push_back(Pair("bogosize", (int64_t)stats.nBogoSize));
-        ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
+        if (hash_type == CoinStatsHashType::HASH_SERIALIZED) {
+            ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
+        } else if (hash_type == CoinStatsHashType::MUHASH) {
+            ret.push_back(Pair("muhash", stats.hashMuHash.GetHex()));
+        }
         ret.push_back(Pair("disk_size", stats.nDiskSize));
         ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
     } else {
@@ -971,6 +1388,228 @@ UniValue gettxoutsetinfo(const JSONRPCRequest& request)
     return ret;
 }
 
+/** Get the statistics of a block from the block stats index, or compute them from disk */
+static void GetBlockStats(const CBlockIndex* pindex, CBlockStats& stats)
+{
+    if (g_block_stats_index && g_block_stats_index->LookUpStats(pindex, stats)) {
+        return;
+    }
+
+    {
+        LOCK(cs_main);
+        if (fHavePruned && !(pindex->nStatus & BLOCK_HAVE_DATA) && pindex->nTx > 0) {
+            throw JSONRPCError(RPC_MISC_ERROR, "Block not available (pruned data)");
+        }
+    }
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex, Params().GetConsensus())) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Block not found on disk");
+    }
+    CBlockUndo block_undo;
+    if (pindex->nHeight > 0 && !UndoReadFromDisk(block_undo, pindex)) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Can't read undo data from disk");
+    }
+    ComputeBlockStats(block, block_undo, pindex->nHeight, stats);
+}
+
+static std::set<std::string> ParseSelectedStats(const UniValue& param)
+{
+    std::set<std::string> selected;
+    if (!param.isNull()) {
+        const UniValue& stats_univalue = param.get_array();
+        for (unsigned int i = 0; i < stats_univalue.size(); i++) {
+            selected.insert(stats_univalue[i].get_str());
+        }
+    }
+    return selected;
+}
+
+static UniValue BlockStatsToJSON(const CBlockIndex* pindex, const CBlockStats& stats, const std::set<std::string>& selected)
+{
+    UniValue feerates_res(UniValue::VARR);
+    for (CAmount feerate : stats.feerate_percentiles) {
+        feerates_res.push_back(feerate);
+    }
+
+    UniValue ret_all(UniValue::VOBJ);
+    ret_all.push_back(Pair("avgfee", stats.avgfee));
+    ret_all.push_back(Pair("avgfeerate", stats.avgfeerate));
+    ret_all.push_back(Pair("avgtxsize", stats.avgtxsize));
+    ret_all.push_back(Pair("blockhash", pindex->GetBlockHash().GetHex()));
+    ret_all.push_back(Pair("feerate_percentiles", feerates_res));
+    ret_all.push_back(Pair("height", (int64_t)pindex->nHeight));
+    ret_all.push_back(Pair("ins", stats.ins));
+    ret_all.push_back(Pair("maxfee", stats.maxfee));
+    ret_all.push_back(Pair("maxfeerate", stats.maxfeerate));
+    ret_all.push_back(Pair("maxtxsize", stats.maxtxsize));
+    ret_all.push_back(Pair("medianfee", stats.medianfee));
+    ret_all.push_back(Pair("mediantime", pindex->GetMedianTimePast()));
+    ret_all.push_back(Pair("mediantxsize", stats.mediantxsize));
+    ret_all.push_back(Pair("minfee", stats.minfee));
+    ret_all.push_back(Pair("minfeerate", stats.minfeerate));
+    ret_all.push_back(Pair("mintxsize", stats.mintxsize));
+    ret_all.push_back(Pair("outs", stats.outs));
+    ret_all.push_back(Pair("subsidy", stats.subsidy));
+    ret_all.push_back(Pair("swtotal_size", stats.swtotal_size));
+    ret_all.push_back(Pair("swtotal_weight", stats.swtotal_weight));
+    ret_all.push_back(Pair("swtxs", stats.swtxs));
+    ret_all.push_back(Pair("time", pindex->GetBlockTime()));
+    ret_all.push_back(Pair("total_out", stats.total_out));
+    ret_all.push_back(Pair("total_size", stats.total_size));
+    ret_all.push_back(Pair("total_weight", stats.total_weight));
+    ret_all.push_back(Pair("totalfee", stats.totalfee));
+    ret_all.push_back(Pair("txs", stats.txs));
+    ret_all.push_back(Pair("utxo_increase", stats.utxo_increase));
+    ret_all.push_back(Pair("utxo_size_inc", stats.utxo_size_inc));
+
+    if (selected.empty()) {
+        return ret_all;
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    for (const std::string& stat : selected) {
+        const UniValue& value = ret_all[stat];
+        if (value.isNull()) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Invalid selected statistic %s", stat));
+        }
+        ret.push_back(Pair(stat, value));
+    }
+    return ret;
+}
+
+static const std::string BLOCKSTATS_RESULT_HELP =
+    "{                           (json object)\n"
+    "  \"avgfee\": xxxxx,          (numeric) Average fee in the block\n"
+    "  \"avgfeerate\": xxxxx,      (numeric) Average feerate (in satoshis per virtual byte)\n"
+    "  \"avgtxsize\": xxxxx,       (numeric) Average transaction size\n"
+    "  \"blockhash\": xxxxx,       (string) The block hash (to check for potential reorgs)\n"
+    "  \"feerate_percentiles\": [  (array of numeric) Feerates at the 10th, 25th, 50th, 75th, and 90th percentile weight unit (in satoshis per virtual byte)\n"
+    "      \"10th_percentile_feerate\",\n"
+    "      \"25th_percentile_feerate\",\n"
+    "      \"50th_percentile_feerate\",\n"
+    "      \"75th_percentile_feerate\",\n"
+    "      \"90th_percentile_feerate\",\n"
+    "  ],\n"
+    "  \"height\": xxxxx,          (numeric) The height of the block\n"
+    "  \"ins\": xxxxx,             (numeric) The number of inputs (excluding coinbase)\n"
+    "  \"maxfee\": xxxxx,          (numeric) Maximum fee in the block\n"
+    "  \"maxfeerate\": xxxxx,      (numeric) Maximum feerate (in satoshis per virtual byte)\n"
+    "  \"maxtxsize\": xxxxx,       (numeric) Maximum transaction size\n"
+    "  \"medianfee\": xxxxx,       (numeric) Truncated median fee in the block\n"
+    "  \"mediantime\": xxxxx,      (numeric) The block median time past\n"
+    "  \"mediantxsize\": xxxxx,    (numeric) Truncated median transaction size\n"
+    "  \"minfee\": xxxxx,          (numeric) Minimum fee in the block\n"
+    "  \"minfeerate\": xx,         (numeric) Minimum feerate (in satoshis per virtual byte)\n"
+    "  \"mintxsize\": xxxxx,       (numeric) Minimum transaction size\n"
+    "  \"outs\": xxxxx,            (numeric) The number of outputs\n"
+    "  \"subsidy\": xxxxx,         (numeric) The block subsidy\n"
+    "  \"swtotal_size\": xxxxx,    (numeric) Total size of all segwit transactions\n"
+    "  \"swtotal_weight\": xxxxx,  (numeric) Total weight of all segwit transactions divided by segwit scale factor (4)\n"
+    "  \"swtxs\": xxxxx,           (numeric) The number of segwit transactions\n"
+    "  \"time\": xxxxx,            (numeric) The block time\n"
+    "  \"total_out\": xxxxx,       (numeric) Total amount in all outputs (excluding coinbase and thus reward [ie subsidy + totalfee])\n"
+    "  \"total_size\": xxxxx,      (numeric) Total size of all non-coinbase transactions\n"
+    "  \"total_weight\": xxxxx,    (numeric) Total weight of all non-coinbase transactions divided by segwit scale factor (4)\n"
+    "  \"totalfee\": xxxxx,        (numeric) The fee total\n"
+    "  \"txs\": xxxxx,             (numeric) The number of transactions (including coinbase)\n"
+    "  \"utxo_increase\": xxxxx,   (numeric) The increase/decrease in the number of unspent outputs\n"
+    "  \"utxo_size_inc\": xxxxx,   (numeric) The increase/decrease in size for the utxo index (not discounting op_return and similar)\n"
+    "}\n";
+
+UniValue getblockstats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2) {
+        throw std::runtime_error(
+            "getblockstats hash_or_height ( stats )\n"
+            "\nCompute per block statistics for a given window. All amounts are in satoshis.\n"
+            "The statistics are read from the block stats index if it is enabled with -blockstatsindex,\n"
+            "and computed from the block and its undo data otherwise.\n"
+            "It won't work for some heights with pruning.\n"
+            "\nArguments:\n"
+            "1. \"hash_or_height\"     (string or numeric, required) The block hash or height of the target block\n"
+            "2. \"stats\"              (array,  optional) Values to plot, by default all values (see result below)\n"
+            "    [\n"
+            "      \"height\",         (string, optional) Selected statistic\n"
+            "      \"time\",           (string, optional) Selected statistic\n"
+            "      ,...\n"
+            "    ]\n"
+            "\nResult:\n"
+            + BLOCKSTATS_RESULT_HELP +
+            "\nExamples:\n"
+            + HelpExampleCli("getblockstats", "1000 '[\"minfeerate\",\"avgfeerate\"]'")
+            + HelpExampleRpc("getblockstats", "1000 '[\"minfeerate\",\"avgfeerate\"]'")
+        );
+    }
+
+    const CBlockIndex* pindex = ParseHashOrHeight(request.params[0]);
+    const std::set<std::string> selected = ParseSelectedStats(request.params[1]);
+
+    CBlockStats stats;
+    GetBlockStats(pindex, stats);
+    return BlockStatsToJSON(pindex, stats, selected);
+}
+
+UniValue getblockstatsrange(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 2 || request.params.size() > 3) {
+        throw std::runtime_error(
+            "getblockstatsrange start_height end_height ( stats )\n"
+            "\nCompute per block statistics, as in getblockstats, for each block of the active chain from start_height\n"
+            "to end_height, both inclusive. At most " + std::to_string(MAX_BLOCK_RANGE) + " blocks can be queried at once.\n"
+            "With -blockstatsindex the range is read from the index in a single scan.\n"
+            "\nArguments:\n"
+            "1. start_height       (numeric, required) The height of the first block\n"
+            "2. end_height         (numeric, required) The height of the last block\n"
+            "3. \"stats\"            (array,  optional) Values to plot, by default all values (see getblockstats)\n"
+            "\nResult:\n"
+            "[                     (json array of objects) The statistics of each block, in height order\n"
+            "  {...}               (json object) As returned by getblockstats\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockstatsrange", "1000 2000 '[\"txs\",\"totalfee\"]'")
+            + HelpExampleRpc("getblockstatsrange", "1000, 2000, [\"txs\",\"totalfee\"]")
+        );
+    }
+
+    const int start_height = request.params[0].get_int();
+    const int end_height = request.params[1].get_int();
+    const std::set<std::string> selected = ParseSelectedStats(request.params[2]);
+
+    std::vector<const CBlockIndex*> block_indexes;
+    {
+        LOCK(cs_main);
+        if (start_height < 0 || end_height < start_height) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid range");
+        }
+        if (end_height > chainActive.Height()) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Target block height %d after current tip %d", end_height, chainActive.Height()));
+        }
+        if (end_height - start_height >= MAX_BLOCK_RANGE) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Range of more than %d blocks", MAX_BLOCK_RANGE));
+        }
+        for (int height = start_height; height <= end_height; ++height) {
+            block_indexes.push_back(chainActive[height]);
+        }
+    }
+
+    // Blocks the index has not caught up with yet are looked up one by one,
+    // and computed from disk if need be.
+    std::vector<CBlockStats> stats;
+    if (!g_block_stats_index || !g_block_stats_index->LookUpStatsRange(start_height, block_indexes.back(), stats)) {
+        stats.resize(block_indexes.size());
+        for (size_t i = 0; i < block_indexes.size(); ++i) {
+            GetBlockStats(block_indexes[i], stats[i]);
+        }
+    }
+
+    UniValue ret(UniValue::VARR);
+    for (size_t i = 0; i < block_indexes.size(); ++i) {
+        ret.push_back(BlockStatsToJSON(block_indexes[i], stats[i], selected));
+    }
+    return ret;
+}
+
 UniValue gettxout(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 2 || request.params.size() > 3)
@@ -1373,9 +2012,13 @@ UniValue getchaintips(const JSONRPCRequest& request)
 UniValue mempoolInfoToJSON()
 {
     UniValue ret(UniValue::VOBJ);
-    ret.push_back(Pair("size", (int64_t) mempool.size()));
+    LOCK(mempool.cs);
+    const size_t size = mempool.size();
+    const size_t usage = mempool.DynamicMemoryUsage();
+    ret.push_back(Pair("size", (int64_t) size));
     ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
-    ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
+    ret.push_back(Pair("usage", (int64_t) usage));
+    ret.push_back(Pair("overhead", size ? (int64_t) ((usage - mempool.GetTotalTxUsage()) / size) : 0));
     size_t maxmempool = gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
     ret.push_back(Pair("maxmempool", (int64_t) maxmempool));
     ret.push_back(Pair("mempoolminfee", ValueFromAmount(std::max(mempool.GetMinFee(maxmempool), ::minRelayTxFee).GetFeePerK())));
@@ -1395,6 +2038,7 @@ UniValue getmempoolinfo(const JSONRPCRequest& request)
             "  \"size\": xxxxx,               (numeric) Current tx count\n"
             "  \"bytes\": xxxxx,              (numeric) Sum of all virtual transaction sizes as defined in BIP 141. Differs from actual serialized size because witness data is discounted\n"
             "  \"usage\": xxxxx,              (numeric) Total memory usage for the mempool\n"
+            "  \"overhead\": xxxxx,           (numeric) Memory usage per transaction for mempool bookkeeping, beyond that of the transactions themselves\n"
             "  \"maxmempool\": xxxxx,         (numeric) Maximum memory usage for the mempool\n"
             "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee rate in " + CURRENCY_UNIT + "/kB for tx to be accepted. Is the maximum of minrelaytxfee and minimum mempool fee\n"
             "  \"minrelaytxfee\": xxxxx       (numeric) Current minimum relay fee for transactions\n"
@@ -1618,6 +2262,83 @@ UniValue savemempool(const JSONRPCRequest& request)
     return NullUniValue;
 }
 
+UniValue getblockfilter(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2) {
+        throw std::runtime_error(
+            "getblockfilter \"blockhash\" ( \"filtertype\" )\n"
+            "\nRetrieve a BIP 157 content filter for a particular block.\n"
+            "\nArguments:\n"
+            "1. \"blockhash\"    (string, required) The hash of the block\n"
+            "2. \"filtertype\"   (string, optional, default=basic) The type name of the filter\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"filter\" : (string) the hex-encoded filter data\n"
+            "  \"header\" : (string) the hex-encoded filter header\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\" \"basic\"")
+            + HelpExampleRpc("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\", \"basic\"")
+        );
+    }
+
+    uint256 block_hash = ParseHashV(request.params[0], "blockhash");
+    std::string filtertype_name = "basic";
+    if (!request.params[1].isNull()) {
+        filtertype_name = request.params[1].get_str();
+    }
+
+    BlockFilterType filtertype;
+    if (!BlockFilterTypeByName(filtertype_name, filtertype)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown filtertype");
+    }
+
+    BlockFilterIndex* index = GetBlockFilterIndex(filtertype);
+    if (!index) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Index is not enabled for filtertype " + filtertype_name);
+    }
+
+    const CBlockIndex* block_index;
+    bool block_was_connected;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(block_hash);
+        if (it == mapBlockIndex.end()) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        }
+        block_index = it->second;
+        block_was_connected = block_index->IsValid(BLOCK_VALID_SCRIPTS);
+    }
+
+    bool index_ready = index->BlockUntilSyncedToCurrentChain();
+
+    BlockFilter filter;
+    uint256 filter_header;
+    if (!index->LookupFilter(block_index, filter) ||
+        !index->LookupFilterHeader(block_index, filter_header)) {
+        int err_code;
+        std::string errmsg = "Filter not found.";
+
+        if (!block_was_connected) {
+            err_code = RPC_INVALID_ADDRESS_OR_KEY;
+            errmsg += " Block was not connected to active chain.";
+        } else if (!index_ready) {
+            err_code = RPC_MISC_ERROR;
+            errmsg += " Block filters are still in the process of being indexed.";
+        } else {
+            err_code = RPC_INTERNAL_ERROR;
+            errmsg += " This error is unexpected and indicates index corruption.";
+        }
+
+        throw JSONRPCError(err_code, errmsg);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("filter", HexStr(filter.GetEncodedFilter())));
+    ret.push_back(Pair("header", filter_header.GetHex()));
+    return ret;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         argNames
   //  --------------------- ------------------------  -----------------------  ----------
@@ -1627,7 +2348,13 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getblockcount",          &getblockcount,          {} },
     { "blockchain",         "getblock",               &getblock,               {"blockhash","verbosity|verbose"} },
     { "blockchain",         "getblockhash",           &getblockhash,           {"height"} },
+    { "blockchain",         "getblockhashes",         &getblockhashes,         {"start_height","count"} },
     { "blockchain",         "getblockheader",         &getblockheader,         {"blockhash","verbose"} },
+    { "blockchain",         "getblockheaders",        &getblockheaders,        {"start_height","count","format"} },
+    { "blockchain",         "getblockheightbytime",   &getblockheightbytime,   {"timestamp"} },
+    { "blockchain",         "getblockfilter",         &getblockfilter,         {"blockhash", "filtertype"} },
+    { "blockchain",         "getblockstats",          &getblockstats,          {"hash_or_height", "stats"} },
+    { "blockchain",         "getblockstatsrange",     &getblockstatsrange,     {"start_height", "end_height", "stats"} },
     { "blockchain",         "getchaintips",           &getchaintips,           {} },
     { "blockchain",         "getdifficulty",          &getdifficulty,          {} },
     { "blockchain",         "getmempoolancestors",    &getmempoolancestors,    {"txid","verbose"} },
@@ -1636,7 +2363,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         {} },
     { "blockchain",         "getrawmempool",          &getrawmempool,          {"verbose"} },
     { "blockchain",         "gettxout",               &gettxout,               {"txid","n","include_mempool"} },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {} },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {"hash_type", "hash_or_height", "use_index"} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        {"height"} },
     { "blockchain",         "savemempool",            &savemempool,            {} },
     { "blockchain",         "verifychain",            &verifychain,            {"checklevel","nblocks"} },
@@ -1656,4 +2383,8 @@ void RegisterBlockchainRPCCommands(CRPCTable &t)
 {
     for (unsigned int vcidx = 0; vcidx < ARRAYLEN(commands); vcidx++)
         t.appendCommand(commands[vcidx].name, &commands[vcidx]);
+
+    // Results that can be far too large to build in memory at once
+    t.appendStreamActor("getblock", &getblock_stream);
+    t.appendStreamActor("getrawmempool", &getrawmempool_stream);
 }
@@ -7,6 +7,7 @@
 
 class CBlock;
 class CBlockIndex;
+class JSONWriter;
 class UniValue;
 
 /**
@@ -24,12 +25,19 @@ void RPCNotifyBlockChange(bool ibd, const CBlockIndex *);
 /** Block description to JSON */
 UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
 
+/** Write the block description to writer, without building it as a UniValue first.
+ *  Must be called without cs_main, which is only taken to read the block index. */
+void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails, JSONWriter& writer);
+
 /** Mempool information to JSON */
 UniValue mempoolInfoToJSON();
 
 /** Mempool to JSON */
 UniValue mempoolToJSON(bool fVerbose = false);
 
+/** Write the mempool to writer, one entry at a time, without holding mempool.cs while writing */
+void mempoolToJSON(bool fVerbose, JSONWriter& writer);
+
 /** Block header to JSON */
 UniValue blockheaderToJSON(const CBlockIndex* blockindex);
 
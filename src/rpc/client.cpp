@@ -57,6 +57,10 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "move", 3, "minconf" },
     { "sendfrom", 2, "amount" },
     { "sendfrom", 3, "minconf" },
+    { "getaddresstxids", 1, "count" },
+    { "getaddresstxids", 2, "skip" },
+    { "getaddressutxos", 1, "count" },
+    { "getaddressutxos", 2, "skip" },
     { "listtransactions", 1, "count" },
     { "listtransactions", 2, "skip" },
     { "listtransactions", 3, "include_watchonly" },
@@ -84,6 +88,11 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getblock", 1, "verbosity" },
     { "getblock", 1, "verbose" },
     { "getblockheader", 1, "verbose" },
+    { "getblockhashes", 0, "start_height" },
+    { "getblockhashes", 1, "count" },
+    { "getblockheaders", 0, "start_height" },
+    { "getblockheaders", 1, "count" },
+    { "getblockheightbytime", 0, "timestamp" },
     { "getchaintxstats", 0, "nblocks" },
     { "gettransaction", 1, "include_watchonly" },
     { "getrawtransaction", 1, "verbose" },
@@ -95,12 +104,21 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "signrawtransaction", 1, "prevtxs" },
     { "signrawtransaction", 2, "privkeys" },
     { "sendrawtransaction", 1, "allowhighfees" },
+    { "sendrawtransactionbatch", 0, "hexstrings" },
+    { "sendrawtransactionbatch", 1, "allowhighfees" },
     { "combinerawtransaction", 0, "txs" },
     { "fundrawtransaction", 1, "options" },
     { "fundrawtransaction", 2, "iswitness" },
     { "gettxout", 1, "n" },
     { "gettxout", 2, "include_mempool" },
     { "gettxoutproof", 0, "txids" },
+    { "getblockstats", 0, "hash_or_height" },
+    { "getblockstats", 1, "stats" },
+    { "getblockstatsrange", 0, "start_height" },
+    { "getblockstatsrange", 1, "end_height" },
+    { "getblockstatsrange", 2, "stats" },
+    { "gettxoutsetinfo", 1, "hash_or_height" },
+    { "gettxoutsetinfo", 2, "use_index" },
     { "lockunspent", 0, "unlock" },
     { "lockunspent", 1, "transactions" },
     { "importprivkey", 2, "rescan" },
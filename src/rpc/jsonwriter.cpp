@@ -0,0 +1,157 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <rpc/jsonwriter.h>
+
+#include <assert.h>
+
+#include <univalue.h>
+
+JSONWriter::JSONWriter(Sink sink, size_t flush_size) :
+    m_sink(std::move(sink)), m_flush_size(flush_size), m_after_key(false)
+{
+    m_buffer.reserve(flush_size + 1024);
+}
+
+void JSONWriter::BeginElement()
+{
+    if (m_after_key) {
+        m_after_key = false;
+        return;
+    }
+    if (!m_empty.empty()) {
+        if (!m_empty.back()) m_buffer += ',';
+        m_empty.back() = false;
+    }
+}
+
+void JSONWriter::MaybeFlush()
+{
+    if (m_buffer.size() >= m_flush_size) Flush();
+}
+
+JSONWriter& JSONWriter::BeginObject()
+{
+    BeginElement();
+    m_buffer += '{';
+    m_empty.push_back(true);
+    return *this;
+}
+
+JSONWriter& JSONWriter::EndObject()
+{
+    assert(!m_empty.empty() && !m_after_key);
+    m_empty.pop_back();
+    m_buffer += '}';
+    MaybeFlush();
+    return *this;
+}
+
+JSONWriter& JSONWriter::BeginArray()
+{
+    BeginElement();
+    m_buffer += '[';
+    m_empty.push_back(true);
+    return *this;
+}
+
+JSONWriter& JSONWriter::EndArray()
+{
+    assert(!m_empty.empty() && !m_after_key);
+    m_empty.pop_back();
+    m_buffer += ']';
+    MaybeFlush();
+    return *this;
+}
+
+JSONWriter& JSONWriter::Key(const std::string& key)
+{
+    assert(!m_empty.empty() && !m_after_key);
+    BeginElement();
+    WriteString(key);
+    m_buffer += ':';
+    m_after_key = true;
+    return *this;
+}
+
+JSONWriter& JSONWriter::Value(const UniValue& value)
+{
+    switch (value.getType()) {
+    case UniValue::VOBJ: {
+        BeginObject();
+        const std::vector<std::string>& keys = value.getKeys();
+        const std::vector<UniValue>& values = value.getValues();
+        for (size_t i = 0; i < keys.size(); ++i) {
+            Key(keys[i]);
+            Value(values[i]);
+        }
+        return EndObject();
+    }
+    case UniValue::VARR:
+        BeginArray();
+        for (const UniValue& element : value.getValues()) {
+            Value(element);
+        }
+        return EndArray();
+    case UniValue::VSTR:
+        BeginElement();
+        WriteString(value.getValStr());
+        break;
+    case UniValue::VNUM:
+        BeginElement();
+        m_buffer += value.getValStr();
+        break;
+    case UniValue::VBOOL:
+        BeginElement();
+        m_buffer += value.isTrue() ? "true" : "false";
+        break;
+    case UniValue::VNULL:
+        BeginElement();
+        m_buffer += "null";
+        break;
+    }
+    MaybeFlush();
+    return *this;
+}
+
+void JSONWriter::WriteString(const std::string& str)
+{
+    // Escape the same characters as UniValue does
+    static const char* const hexdigits = "0123456789abcdef";
+    m_buffer += '"';
+    for (const unsigned char ch : str) {
+        switch (ch) {
+        case '"': m_buffer += "\\\""; break;
+        case '\\': m_buffer += "\\\\"; break;
+        case '\b': m_buffer += "\\b"; break;
+        case '\t': m_buffer += "\\t"; break;
+        case '\n': m_buffer += "\\n"; break;
+        case '\f': m_buffer += "\\f"; break;
+        case '\r': m_buffer += "\\r"; break;
+        default:
+            if (ch < 0x20 || ch == 0x7f) {
+                m_buffer += "\\u00";
+                m_buffer += hexdigits[ch >> 4];
+                m_buffer += hexdigits[ch & 0xf];
+            } else {
+                m_buffer += ch;
+            }
+        }
+    }
+    m_buffer += '"';
+}
+
+void JSONWriter::Flush()
+{
+    if (m_buffer.empty()) return;
+    m_sink(m_buffer);
+    m_buffer.clear();
+}
+
+std::string JSONWriter::Release()
+{
+    std::string rest;
+    rest.swap(m_buffer);
+    return rest;
+}
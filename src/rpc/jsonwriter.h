@@ -0,0 +1,70 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RPC_JSONWRITER_H
+#define BITCOIN_RPC_JSONWRITER_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+class UniValue;
+
+/** Buffered output is passed on once it reaches this many bytes */
+static const size_t DEFAULT_JSON_FLUSH_SIZE = 64 * 1024;
+
+/**
+ * Incremental writer of compact JSON, with the same output as UniValue::write().
+ *
+ * Large results, like a block with all its transactions, can be written
+ * element by element as they are generated, instead of building the whole
+ * result as a UniValue and then serializing it into one string. The output is
+ * buffered and passed to a sink in pieces of about flush_size bytes, so the
+ * memory needed does not grow with the size of the result.
+ *
+ * Commas are inserted automatically. Inside objects, every value must be
+ * preceded by a Key().
+ */
+class JSONWriter
+{
+public:
+    typedef std::function<void(const std::string& data)> Sink;
+
+    explicit JSONWriter(Sink sink, size_t flush_size = DEFAULT_JSON_FLUSH_SIZE);
+
+    JSONWriter& BeginObject();
+    JSONWriter& EndObject();
+    JSONWriter& BeginArray();
+    JSONWriter& EndArray();
+
+    /** Write the key of the next value in the current object */
+    JSONWriter& Key(const std::string& key);
+
+    /** Write a value, which may be a whole object or array */
+    JSONWriter& Value(const UniValue& value);
+
+    /** Write a key and its value */
+    JSONWriter& KV(const std::string& key, const UniValue& value) { Key(key); return Value(value); }
+
+    /** Pass all buffered output to the sink */
+    void Flush();
+
+    /** Return the output that has not been passed to the sink yet, and forget it */
+    std::string Release();
+
+private:
+    Sink m_sink;
+    size_t m_flush_size;
+    std::string m_buffer;
+    //! For every open object or array, whether it has no elements yet
+    std::vector<bool> m_empty;
+    //! Whether a key was written that still needs its value
+    bool m_after_key;
+
+    void BeginElement();
+    void WriteString(const std::string& str);
+    void MaybeFlush();
+};
+
+#endif // BITCOIN_RPC_JSONWRITER_H
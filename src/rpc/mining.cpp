@@ -124,7 +124,7 @@ UniValue generateBlocks(std::shared_ptr<CReserveScript> coinbaseScript, int nGen
         CBlock *pblock = &pblocktemplate->block;
         {
             LOCK(cs_main);
-            IncrementExtraNonce(pblock, chainActive.Tip(), nExtraNonce);
+            IncrementExtraNonce(pblock, chainActive.Tip(), nExtraNonce, &pblocktemplate->vCoinbaseMerkleBranch);
         }
         while (nMaxTries > 0 && pblock->nNonce < nInnerLoopCount && !CheckProofOfWork(pblock->GetPoWHash(), pblock->nBits, Params().GetConsensus())) {
             ++pblock->nNonce;
@@ -259,6 +259,10 @@ UniValue prioritisetransaction(const JSONRPCRequest& request)
     }
 
     mempool.PrioritiseTransaction(hash, nAmount);
+    // The mempool does not notify about fee deltas, so the cached template
+    // would otherwise keep the old selection.
+    if (g_block_template_cache)
+        g_block_template_cache->Invalidate();
     return true;
 }
 
@@ -291,6 +295,18 @@ std::string gbt_vb_name(const Consensus::DeploymentPos pos) {
     return s;
 }
 
+/** A getblocktemplate result together with everything it was derived from */
+struct BlockTemplateResultCache
+{
+    uint64_t nSequence = 0;
+    uint256 hashPrevBlock;
+    uint32_t nBits = 0;
+    bool fSupportsSegwit = false;
+    std::set<std::string> setClientRules;
+    int64_t nMaxVersionPreVB = -1;
+    UniValue result;
+};
+
 UniValue getblocktemplate(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() > 1)
@@ -502,34 +518,21 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
     bool fSupportsSegwit = setClientRules.find(segwit_info.name) != setClientRules.end();
 
     // Update block
-    static CBlockIndex* pindexPrev;
-    static int64_t nStart;
-    static std::unique_ptr<CBlockTemplate> pblocktemplate;
-    // Cache whether the last invocation was with segwit support, to avoid returning
-    // a segwit-block to a non-segwit caller.
-    static bool fLastTemplateSupportsSegwit = true;
-    if (pindexPrev != chainActive.Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5) ||
-        fLastTemplateSupportsSegwit != fSupportsSegwit)
-    {
-        // Clear pindexPrev so future calls make a new block, despite any failures from here on
-        pindexPrev = nullptr;
-
-        // Store the pindexBest used before CreateNewBlock, to avoid races
-        nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-        CBlockIndex* pindexPrevNew = chainActive.Tip();
-        nStart = GetTime();
-        fLastTemplateSupportsSegwit = fSupportsSegwit;
-
-        // Create new block
+    // Store the counter before fetching the template, to avoid races
+    nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+    const CBlockIndex* pindexPrev = chainActive.Tip();
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    uint64_t nTemplateSequence = 0;
+    if (g_block_template_cache) {
+        // The cached template may predate transactions added since, so the
+        // long poll id must carry the counter from when it was built.
+        pblocktemplate = g_block_template_cache->GetTemplate(fSupportsSegwit, &nTemplateSequence, &nTransactionsUpdatedLast);
+    } else {
         CScript scriptDummy = CScript() << OP_TRUE;
         pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy, fSupportsSegwit);
-        if (!pblocktemplate)
-            throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
-
-        // Need to update only after we know CreateNewBlock succeeded
-        pindexPrev = pindexPrevNew;
     }
+    if (!pblocktemplate)
+        throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
     CBlock* pblock = &pblocktemplate->block; // pointer for convenience
     const Consensus::Params& consensusParams = Params().GetConsensus();
 
@@ -537,6 +540,23 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
     UpdateTime(pblock, consensusParams, pindexPrev);
     pblock->nNonce = 0;
 
+    // Long-poll waiters and proxies polling the same template all get the same
+    // result, so only the fields that change per call are filled in again.
+    // Protected by cs_main.
+    static BlockTemplateResultCache cachedResult;
+    const bool fCacheResult = nTemplateSequence != 0;
+    if (fCacheResult && cachedResult.nSequence == nTemplateSequence &&
+        cachedResult.hashPrevBlock == pblock->hashPrevBlock &&
+        cachedResult.nBits == pblock->nBits &&
+        cachedResult.fSupportsSegwit == fSupportsSegwit &&
+        cachedResult.setClientRules == setClientRules &&
+        cachedResult.nMaxVersionPreVB == nMaxVersionPreVB) {
+        UniValue result = cachedResult.result;
+        result.pushKV("longpollid", chainActive.Tip()->GetBlockHash().GetHex() + i64tostr(nTransactionsUpdatedLast));
+        result.pushKV("curtime", pblock->GetBlockTime());
+        return result;
+    }
+
     // NOTE: If at some point we support pre-segwit miners post-segwit-activation, this needs to take segwit support into consideration
     const bool fPreSegWit = (THRESHOLD_ACTIVE != VersionBitsState(pindexPrev, consensusParams, Consensus::DEPLOYMENT_SEGWIT, versionbitscache));
 
@@ -678,6 +698,16 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
         result.push_back(Pair("default_witness_commitment", HexStr(pblocktemplate->vchCoinbaseCommitment.begin(), pblocktemplate->vchCoinbaseCommitment.end())));
     }
 
+    if (fCacheResult) {
+        cachedResult.nSequence = nTemplateSequence;
+        cachedResult.hashPrevBlock = pblock->hashPrevBlock;
+        cachedResult.nBits = pblock->nBits;
+        cachedResult.fSupportsSegwit = fSupportsSegwit;
+        cachedResult.setClientRules = setClientRules;
+        cachedResult.nMaxVersionPreVB = nMaxVersionPreVB;
+        cachedResult.result = result;
+    }
+
     return result;
 }
 
@@ -8,6 +8,7 @@
 #include <clientversion.h>
 #include <core_io.h>
 #include <crypto/ripemd160.h>
+#include <index/addressindex.h>
 #include <init.h>
 #include <validation.h>
 #include <httpserver.h>
@@ -477,6 +478,152 @@ static std::string RPCMallocInfo()
 }
 #endif
 
+/** The script of an address to look up in the address index, once it has caught up with the chain */
+static CScript AddressIndexScript(const UniValue& address)
+{
+    if (!g_addressindex) {
+        throw JSONRPCError(RPC_MISC_ERROR, "The address index is not enabled (start with -addressindex)");
+    }
+    if (!g_addressindex->BlockUntilSyncedToCurrentChain()) {
+        throw JSONRPCError(RPC_MISC_ERROR, "The address index is still being built");
+    }
+    CTxDestination dest = DecodeDestination(address.get_str());
+    if (!IsValidDestination(dest)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
+    }
+    return GetScriptForDestination(dest);
+}
+
+static void ParsePagination(const JSONRPCRequest& request, size_t& nCount, size_t& nSkip)
+{
+    nCount = 1000;
+    if (!request.params[1].isNull()) {
+        int64_t n = request.params[1].get_int64();
+        if (n < 0) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+        }
+        nCount = n;
+    }
+    nSkip = 0;
+    if (!request.params[2].isNull()) {
+        int64_t n = request.params[2].get_int64();
+        if (n < 0) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative skip");
+        }
+        nSkip = n;
+    }
+}
+
+UniValue getaddressbalance(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "getaddressbalance \"address\"\n"
+            "\nReturns the confirmed balance of an address. Requires -addressindex.\n"
+            "\nArguments:\n"
+            "1. \"address\"     (string, required) The address\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"balance\" : x.xxx,   (numeric) The value of the unspent outputs paying to the address in " + CURRENCY_UNIT + "\n"
+            "  \"received\" : x.xxx,  (numeric) The value of all outputs ever paid to the address in " + CURRENCY_UNIT + "\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressbalance", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"")
+            + HelpExampleRpc("getaddressbalance", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"")
+        );
+
+    const CScript script = AddressIndexScript(request.params[0]);
+    AddressBalance balance;
+    g_addressindex->FindBalance(script, balance);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("balance", ValueFromAmount(balance.nBalance)));
+    ret.push_back(Pair("received", ValueFromAmount(balance.nReceived)));
+    return ret;
+}
+
+UniValue getaddresstxids(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 3)
+        throw std::runtime_error(
+            "getaddresstxids \"address\" ( count skip )\n"
+            "\nReturns the confirmed transactions paying to or spending from an address, in block chain order. Requires -addressindex.\n"
+            "\nArguments:\n"
+            "1. \"address\"     (string, required) The address\n"
+            "2. count         (numeric, optional, default=1000) The number of transactions to return\n"
+            "3. skip          (numeric, optional, default=0) The number of transactions to skip\n"
+            "\nResult:\n"
+            "[\n"
+            "  \"txid\"         (string) The transaction id\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddresstxids", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"")
+            + HelpExampleCli("getaddresstxids", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\" 100 1000")
+            + HelpExampleRpc("getaddresstxids", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\", 100, 1000")
+        );
+
+    const CScript script = AddressIndexScript(request.params[0]);
+    size_t nCount, nSkip;
+    ParsePagination(request, nCount, nSkip);
+
+    std::vector<AddressTx> txs;
+    g_addressindex->FindTxs(script, nSkip, nCount, txs);
+
+    UniValue ret(UniValue::VARR);
+    for (const AddressTx& tx : txs) {
+        ret.push_back(tx.txid.GetHex());
+    }
+    return ret;
+}
+
+UniValue getaddressutxos(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 3)
+        throw std::runtime_error(
+            "getaddressutxos \"address\" ( count skip )\n"
+            "\nReturns the unspent outputs paying to an address, oldest first. Requires -addressindex.\n"
+            "\nArguments:\n"
+            "1. \"address\"     (string, required) The address\n"
+            "2. count         (numeric, optional, default=1000) The number of outputs to return\n"
+            "3. skip          (numeric, optional, default=0) The number of outputs to skip\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"txid\" : \"txid\",   (string) The transaction id\n"
+            "    \"vout\" : n,        (numeric) The output number\n"
+            "    \"amount\" : x.xxx,  (numeric) The output value in " + CURRENCY_UNIT + "\n"
+            "    \"height\" : n,      (numeric) The height of the block the output was confirmed in\n"
+            "    \"coinbase\" : true|false  (boolean) Whether the output is a coinbase output\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressutxos", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"")
+            + HelpExampleCli("getaddressutxos", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\" 100 1000")
+            + HelpExampleRpc("getaddressutxos", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\", 100, 1000")
+        );
+
+    const CScript script = AddressIndexScript(request.params[0]);
+    size_t nCount, nSkip;
+    ParsePagination(request, nCount, nSkip);
+
+    std::vector<AddressUnspent> unspent;
+    g_addressindex->FindUnspent(script, nSkip, nCount, unspent);
+
+    UniValue ret(UniValue::VARR);
+    for (const AddressUnspent& output : unspent) {
+        UniValue o(UniValue::VOBJ);
+        o.push_back(Pair("txid", output.outpoint.hash.GetHex()));
+        o.push_back(Pair("vout", (int)output.outpoint.n));
+        o.push_back(Pair("amount", ValueFromAmount(output.nValue)));
+        o.push_back(Pair("height", output.nHeight));
+        o.push_back(Pair("coinbase", output.fCoinBase));
+        ret.push_back(o);
+    }
+    return ret;
+}
+
 UniValue getmemoryinfo(const JSONRPCRequest& request)
 {
     /* Please, avoid using the word "pool" here in the RPC interface or help,
@@ -524,6 +671,67 @@ UniValue getmemoryinfo(const JSONRPCRequest& request)
     }
 }
 
+/** Histogram by power of two to JSON, leaving out empty buckets */
+static UniValue HistogramToJSON(const std::vector<uint64_t>& histogram)
+{
+    UniValue ret(UniValue::VARR);
+    for (size_t i = 0; i < histogram.size(); ++i) {
+        if (histogram[i] == 0) continue;
+        UniValue bucket(UniValue::VOBJ);
+        bucket.push_back(Pair("upto", i == 0 ? 0 : i >= 64 ? std::numeric_limits<uint64_t>::max() : (((uint64_t)1 << i) - 1)));
+        bucket.push_back(Pair("count", histogram[i]));
+        ret.push_back(bucket);
+    }
+    return ret;
+}
+
+UniValue getrpcworkqueueinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "getrpcworkqueueinfo\n"
+            "Returns information about the queue of RPC and REST requests waiting for a worker thread.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"depth\": n,                (numeric) Number of queued requests\n"
+            "  \"max_depth\": n,            (numeric) The -rpcworkqueue limit\n"
+            "  \"clients\": n,              (numeric) Number of clients with queued requests. Clients take turns.\n"
+            "  \"backpressure\": true|false, (boolean) Whether a full queue delays new connections (-rpcbackpressure) instead of rejecting requests\n"
+            "  \"queued\": n,               (numeric) Number of requests queued since startup\n"
+            "  \"rejected\": n,             (numeric) Number of requests rejected because the queue was full\n"
+            "  \"delayed\": n,              (numeric) Number of requests queued beyond -rpcworkqueue with -rpcbackpressure\n"
+            "  \"depth_histogram\": [       (array) Queue depths when requests were queued, including the request\n"
+            "    {\n"
+            "      \"upto\": n,             (numeric) Largest value in the bucket, after the previous bucket's\n"
+            "      \"count\": n             (numeric) Number of values in the bucket\n"
+            "    }, ...\n"
+            "  ],\n"
+            "  \"wait_histogram\": [ ... ],    (array) Microseconds requests waited in the queue, in the same format\n"
+            "  \"latency_histogram\": [ ... ], (array) Microseconds from queueing requests until they were handled, in the same format\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getrpcworkqueueinfo", "")
+            + HelpExampleRpc("getrpcworkqueueinfo", "")
+        );
+
+    HTTPWorkQueueStats stats;
+    if (!GetHTTPWorkQueueStats(stats))
+        throw JSONRPCError(RPC_MISC_ERROR, "HTTP server is not running");
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("depth", (uint64_t)stats.depth));
+    ret.push_back(Pair("max_depth", (uint64_t)stats.max_depth));
+    ret.push_back(Pair("clients", (uint64_t)stats.clients));
+    ret.push_back(Pair("backpressure", stats.backpressure));
+    ret.push_back(Pair("queued", stats.queued));
+    ret.push_back(Pair("rejected", stats.rejected));
+    ret.push_back(Pair("delayed", stats.delayed));
+    ret.push_back(Pair("depth_histogram", HistogramToJSON(stats.depth_histogram)));
+    ret.push_back(Pair("wait_histogram", HistogramToJSON(stats.wait_histogram)));
+    ret.push_back(Pair("latency_histogram", HistogramToJSON(stats.latency_histogram)));
+    return ret;
+}
+
 uint32_t getCategoryMask(UniValue cats) {
     cats = cats.get_array();
     uint32_t mask = 0;
@@ -640,10 +848,14 @@ static const CRPCCommand commands[] =
   //  --------------------- ------------------------  -----------------------  ----------
     { "control",            "getmemoryinfo",          &getmemoryinfo,          {"mode"} },
     { "control",            "logging",                &logging,                {"include", "exclude"}},
+    { "control",            "getrpcworkqueueinfo",    &getrpcworkqueueinfo,    {}},
     { "util",               "validateaddress",        &validateaddress,        {"address"} }, /* uses wallet if enabled */
     { "util",               "createmultisig",         &createmultisig,         {"nrequired","keys"} },
     { "util",               "verifymessage",          &verifymessage,          {"address","signature","message"} },
     { "util",               "signmessagewithprivkey", &signmessagewithprivkey, {"privkey","message"} },
+    { "addressindex",       "getaddressbalance",      &getaddressbalance,      {"address"} },
+    { "addressindex",       "getaddresstxids",        &getaddresstxids,        {"address","count","skip"} },
+    { "addressindex",       "getaddressutxos",        &getaddressutxos,        {"address","count","skip"} },
 
     /* Not shown in help */
     { "hidden",             "setmocktime",            &setmocktime,            {"timestamp"}},
@@ -101,6 +101,11 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
             "    ],\n"
+            "    \"inflight_limit\": n,       (numeric) The current limit on the number of blocks we ask from this peer at once\n"
+            "    \"block_latency\": n,        (numeric) Smoothed time in seconds between requesting a block and receiving it (if available)\n"
+            "    \"block_download_rate\": n,  (numeric) Smoothed block download rate from this peer in bytes per second\n"
+            "    \"blocks_downloaded\": n,    (numeric) The number of requested blocks received from this peer\n"
+            "    \"stall_reassignments\": n,  (numeric) How often blocks in flight from this peer were requested elsewhere because it stalled\n"
             "    \"whitelisted\": true|false, (boolean) Whether the peer is whitelisted\n"
             "    \"bytessent_per_msg\": {\n"
             "       \"addr\": n,              (numeric) The total bytes sent aggregated by message type\n"
@@ -167,6 +172,12 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
                 heights.push_back(height);
             }
             obj.push_back(Pair("inflight", heights));
+            obj.push_back(Pair("inflight_limit", statestats.nBlocksInFlightLimit));
+            if (statestats.nBlockDownloadLatency > 0)
+                obj.push_back(Pair("block_latency", statestats.nBlockDownloadLatency / 1e6));
+            obj.push_back(Pair("block_download_rate", statestats.nBlockDownloadRate));
+            obj.push_back(Pair("blocks_downloaded", statestats.nBlocksDownloaded));
+            obj.push_back(Pair("stall_reassignments", statestats.nStallReassignments));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
 
@@ -441,6 +452,12 @@ UniValue getnetworkinfo(const JSONRPCRequest& request)
             "  ],\n"
             "  \"relayfee\": x.xxxxxxxx,                (numeric) minimum relay fee for transactions in " + CURRENCY_UNIT + "/kB\n"
             "  \"incrementalfee\": x.xxxxxxxx,          (numeric) minimum fee increment for mempool limiting or BIP 125 replacement in " + CURRENCY_UNIT + "/kB\n"
+            "  \"blockrelay\": {                        (json object) relay of received blocks to high-bandwidth compact block peers\n"
+            "    \"fastrelay\": true|false,             (bool) whether blocks are announced before they are stored (-fastblockrelay)\n"
+            "    \"blocks_relayed\": n,                 (numeric) the number of received blocks announced onwards\n"
+            "    \"last_hop_latency\": n,               (numeric) seconds from receiving the last of these blocks to announcing it\n"
+            "    \"avg_hop_latency\": n                 (numeric) moving average of the per-hop latency in seconds\n"
+            "  },\n"
             "  \"localaddresses\": [                    (array) list of local addresses\n"
             "  {\n"
             "    \"address\": \"xxxx\",                 (string) network address\n"
@@ -472,6 +489,14 @@ UniValue getnetworkinfo(const JSONRPCRequest& request)
     obj.push_back(Pair("networks",      GetNetworksInfo()));
     obj.push_back(Pair("relayfee",      ValueFromAmount(::minRelayTxFee.GetFeePerK())));
     obj.push_back(Pair("incrementalfee", ValueFromAmount(::incrementalRelayFee.GetFeePerK())));
+    CBlockRelayStats relaystats;
+    GetBlockRelayStats(relaystats);
+    UniValue blockRelay(UniValue::VOBJ);
+    blockRelay.push_back(Pair("fastrelay", fFastBlockRelay));
+    blockRelay.push_back(Pair("blocks_relayed", relaystats.nBlocksRelayed));
+    blockRelay.push_back(Pair("last_hop_latency", ((double)relaystats.nLastHopLatency) / 1e6));
+    blockRelay.push_back(Pair("avg_hop_latency", ((double)relaystats.nAvgHopLatency) / 1e6));
+    obj.push_back(Pair("blockrelay", blockRelay));
     UniValue localAddresses(UniValue::VARR);
     {
         LOCK(cs_mapLocalHost);
@@ -8,6 +8,7 @@
 #include <coins.h>
 #include <consensus/validation.h>
 #include <core_io.h>
+#include <index/txindex.h>
 #include <init.h>
 #include <keystore.h>
 #include <validation.h>
@@ -141,8 +142,6 @@ UniValue getrawtransaction(const JSONRPCRequest& request)
             + HelpExampleCli("getrawtransaction", "\"mytxid\" true \"myblockhash\"")
         );
 
-    LOCK(cs_main);
-
     bool in_active_chain = true;
     uint256 hash = ParseHashV(request.params[0], "parameter 1");
     CBlockIndex* blockindex = nullptr;
@@ -159,6 +158,8 @@ UniValue getrawtransaction(const JSONRPCRequest& request)
     }
 
     if (!request.params[2].isNull()) {
+        LOCK(cs_main);
+
         uint256 blockhash = ParseHashV(request.params[2], "parameter 3");
         BlockMap::iterator it = mapBlockIndex.find(blockhash);
         if (it == mapBlockIndex.end()) {
@@ -168,6 +169,13 @@ UniValue getrawtransaction(const JSONRPCRequest& request)
         in_active_chain = chainActive.Contains(blockindex);
     }
 
+    // Wait for the transaction index to process the blocks already connected,
+    // which cannot happen while cs_main is held
+    bool f_txindex_ready = false;
+    if (g_txindex && !blockindex) {
+        f_txindex_ready = g_txindex->BlockUntilSyncedToCurrentChain();
+    }
+
     CTransactionRef tx;
     uint256 hash_block;
     if (!GetTransaction(hash, tx, Params().GetConsensus(), hash_block, true, blockindex)) {
@@ -178,9 +186,13 @@ UniValue getrawtransaction(const JSONRPCRequest& request)
             }
             errmsg = "No such transaction found in the provided block";
         } else {
-            errmsg = fTxIndex
-              ? "No such mempool or blockchain transaction"
-              : "No such mempool transaction. Use -txindex to enable blockchain transaction queries";
+            if (!g_txindex) {
+                errmsg = "No such mempool transaction. Use -txindex to enable blockchain transaction queries";
+            } else if (!f_txindex_ready) {
+                errmsg = "No such mempool transaction. Blockchain transactions are still in the process of being indexed";
+            } else {
+                errmsg = "No such mempool or blockchain transaction";
+            }
         }
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, errmsg + ". Use gettransaction for wallet transactions.");
     }
@@ -189,6 +201,8 @@ UniValue getrawtransaction(const JSONRPCRequest& request)
         return EncodeHexTx(*tx, RPCSerializationFlags());
     }
 
+    LOCK(cs_main);
+
     UniValue result(UniValue::VOBJ);
     if (blockindex) result.push_back(Pair("in_active_chain", in_active_chain));
     TxToJSON(*tx, hash_block, result);
@@ -230,6 +244,11 @@ UniValue gettxoutproof(const JSONRPCRequest& request)
        oneTxid = hash;
     }
 
+    // Allow txindex to catch up if we need to query it and before we acquire cs_main.
+    if (g_txindex && request.params[1].isNull()) {
+        g_txindex->BlockUntilSyncedToCurrentChain();
+    }
+
     LOCK(cs_main);
 
     CBlockIndex* pblockindex = nullptr;
@@ -1034,6 +1053,170 @@ UniValue sendrawtransaction(const JSONRPCRequest& request)
     return hashTx.GetHex();
 }
 
+/** Maximum number of transactions sendrawtransactionbatch accepts at once,
+ *  which bounds how long it holds cs_main */
+static const size_t MAX_RAWTX_BATCH_SIZE = 1000;
+
+/**
+ * Order a batch so that in-batch parents come before their children, and
+ * otherwise as given.
+ */
+static std::vector<size_t> SortBatch(const std::vector<CTransactionRef>& vTxs, const std::map<uint256, size_t>& mapIndex)
+{
+    // Depth-first over the parents, with an explicit stack of the transaction
+    // and the next input to visit
+    std::vector<size_t> vOrder;
+    std::vector<bool> vVisited(vTxs.size(), false);
+    std::vector<std::pair<size_t, size_t>> vStack;
+    for (size_t i = 0; i < vTxs.size(); ++i) {
+        if (vVisited[i]) {
+            continue;
+        }
+        vVisited[i] = true;
+        vStack.emplace_back(i, 0);
+        while (!vStack.empty()) {
+            const size_t nTx = vStack.back().first;
+            const std::vector<CTxIn>& vin = vTxs[nTx]->vin;
+            if (vStack.back().second == vin.size()) {
+                vOrder.push_back(nTx);
+                vStack.pop_back();
+                continue;
+            }
+            auto it = mapIndex.find(vin[vStack.back().second++].prevout.hash);
+            if (it != mapIndex.end() && !vVisited[it->second]) {
+                vVisited[it->second] = true;
+                vStack.emplace_back(it->second, 0);
+            }
+        }
+    }
+    return vOrder;
+}
+
+UniValue sendrawtransactionbatch(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw std::runtime_error(
+            "sendrawtransactionbatch [\"hexstring\",...] ( allowhighfees )\n"
+            "\nSubmits a batch of raw transactions (serialized, hex-encoded) to local node and network.\n"
+            "Transactions may spend each other's outputs and can be given in any order: parents are\n"
+            "submitted before their children, all under one lock, and the accepted transactions are\n"
+            "announced to peers together. Each transaction is still validated on its own, as by\n"
+            "sendrawtransaction: there is no package fee evaluation, so a child's fee does not help\n"
+            "its parent meet the mempool minimum fee (no CPFP).\n"
+            "\nArguments:\n"
+            "1. \"hexstrings\"   (array, required) The hex strings of the raw transactions, at most " + std::to_string(MAX_RAWTX_BATCH_SIZE) + "\n"
+            "2. allowhighfees    (boolean, optional, default=false) Allow high fees\n"
+            "\nResult:\n"
+            "[                   (array) One object per transaction, in the order given\n"
+            "  {\n"
+            "    \"txid\" : \"hash\",     (string) The transaction hash in hex\n"
+            "    \"accepted\" : true|false, (boolean) Whether the transaction is in the mempool\n"
+            "    \"error\" : \"text\"     (string, optional) Why the transaction was rejected\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("sendrawtransactionbatch", "\"[\\\"signedparenthex\\\",\\\"signedchildhex\\\"]\"") +
+            "\nAs a json rpc call\n"
+            + HelpExampleRpc("sendrawtransactionbatch", "[\"signedparenthex\",\"signedchildhex\"]")
+        );
+
+    ObserveSafeMode();
+
+    std::promise<void> promise;
+
+    RPCTypeCheck(request.params, {UniValue::VARR, UniValue::VBOOL});
+
+    // parse hex strings from parameter
+    const UniValue& hexstrings = request.params[0].get_array();
+    if (hexstrings.size() > MAX_RAWTX_BATCH_SIZE)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Too many transactions (%u > %u)", hexstrings.size(), MAX_RAWTX_BATCH_SIZE));
+    std::vector<CTransactionRef> vTxs;
+    std::map<uint256, size_t> mapIndex;
+    for (size_t i = 0; i < hexstrings.size(); ++i) {
+        CMutableTransaction mtx;
+        if (!DecodeHexTx(mtx, hexstrings[i].get_str()))
+            throw JSONRPCError(RPC_DESERIALIZATION_ERROR, strprintf("TX decode failed for transaction %u", i));
+        vTxs.push_back(MakeTransactionRef(std::move(mtx)));
+        if (!mapIndex.emplace(vTxs.back()->GetHash(), i).second)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Duplicate transaction %s", vTxs.back()->GetHash().GetHex()));
+    }
+
+    CAmount nMaxRawTxFee = maxTxFee;
+    if (!request.params[1].isNull() && request.params[1].get_bool())
+        nMaxRawTxFee = 0;
+
+    std::vector<UniValue> vResults(vTxs.size());
+    std::vector<CInv> vInv;
+    bool fAcceptedAny = false;
+    { // cs_main scope
+    LOCK2(cs_main, mempool.cs);
+    for (size_t i : SortBatch(vTxs, mapIndex)) {
+        const CTransactionRef& tx = vTxs[i];
+        const uint256& hashTx = tx->GetHash();
+        UniValue result(UniValue::VOBJ);
+        result.push_back(Pair("txid", hashTx.GetHex()));
+
+        bool fHaveChain = false;
+        for (size_t o = 0; !fHaveChain && o < tx->vout.size(); o++) {
+            fHaveChain = !pcoinsTip->AccessCoin(COutPoint(hashTx, o)).IsSpent();
+        }
+        std::string strError;
+        if (fHaveChain) {
+            strError = "transaction already in block chain";
+        } else if (!mempool.exists(hashTx)) {
+            CValidationState state;
+            bool fMissingInputs;
+            if (AcceptToMemoryPool(mempool, state, tx, &fMissingInputs,
+                                   nullptr /* plTxnReplaced */, false /* bypass_limits */, nMaxRawTxFee)) {
+                fAcceptedAny = true;
+            } else if (state.IsInvalid()) {
+                strError = strprintf("%i: %s", state.GetRejectCode(), state.GetRejectReason());
+            } else if (fMissingInputs) {
+                strError = "Missing inputs";
+            } else {
+                strError = state.GetRejectReason();
+            }
+        }
+        // Like sendrawtransaction, announce transactions already in the mempool again
+        result.push_back(Pair("accepted", strError.empty()));
+        if (strError.empty()) {
+            vInv.emplace_back(MSG_TX, hashTx);
+        } else {
+            result.push_back(Pair("error", strError));
+        }
+        vResults[i] = result;
+    }
+    } // cs_main
+
+    if (fAcceptedAny) {
+        // Make sure wallets have seen the accepted transactions before
+        // returning, as sendrawtransaction does
+        CallFunctionInValidationInterfaceQueue([&promise] {
+            promise.set_value();
+        });
+    } else {
+        promise.set_value();
+    }
+    promise.get_future().wait();
+
+    if(!g_connman)
+        throw JSONRPCError(RPC_CLIENT_P2P_DISABLED, "Error: Peer-to-peer functionality missing or disabled");
+
+    g_connman->ForEachNode([&vInv](CNode* pnode)
+    {
+        for (const CInv& inv : vInv) {
+            pnode->PushInventory(inv);
+        }
+    });
+
+    UniValue results(UniValue::VARR);
+    for (const UniValue& result : vResults) {
+        results.push_back(result);
+    }
+    return results;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         argNames
   //  --------------------- ------------------------  -----------------------  ----------
@@ -1042,6 +1225,7 @@ static const CRPCCommand commands[] =
     { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   {"hexstring","iswitness"} },
     { "rawtransactions",    "decodescript",           &decodescript,           {"hexstring"} },
     { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     {"hexstring","allowhighfees"} },
+    { "rawtransactions",    "sendrawtransactionbatch", &sendrawtransactionbatch, {"hexstrings","allowhighfees"} },
     { "rawtransactions",    "combinerawtransaction",  &combinerawtransaction,  {"txs"} },
     { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     {"hexstring","prevtxs","privkeys","sighashtype"} }, /* uses wallet if enabled */
 
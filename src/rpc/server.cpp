@@ -9,6 +9,7 @@
 #include <fs.h>
 #include <init.h>
 #include <random.h>
+#include <rpc/jsonwriter.h>
 #include <sync.h>
 #include <ui_interface.h>
 #include <util.h>
@@ -20,7 +21,10 @@
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/split.hpp>
 
+#include <atomic>
+#include <condition_variable>
 #include <memory> // for unique_ptr
+#include <mutex>
 #include <unordered_map>
 
 static bool fRPCRunning = false;
@@ -302,6 +306,18 @@ bool CRPCTable::appendCommand(const std::string& name, const CRPCCommand* pcmd)
     return true;
 }
 
+bool CRPCTable::appendStreamActor(const std::string& name, rpcstreamfn_type actor)
+{
+    if (IsRPCRunning())
+        return false;
+
+    if (mapCommands.count(name) == 0)
+        return false;
+
+    mapStreamActors[name] = actor;
+    return true;
+}
+
 bool StartRPC()
 {
     LogPrint(BCLog::RPC, "Starting RPC\n");
@@ -410,12 +426,66 @@ static UniValue JSONRPCExecOne(JSONRPCRequest jreq, const UniValue& req)
     return rpc_result;
 }
 
-std::string JSONRPCExecBatch(const JSONRPCRequest& jreq, const UniValue& vReq)
+/** A batch whose requests are executed by several threads */
+struct RPCParallelBatch
+{
+    const JSONRPCRequest& jreq;
+    const UniValue& vReq;
+    const size_t size;
+    std::vector<UniValue> replies;
+    //! Index of the next request to execute
+    std::atomic<size_t> next;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    //! Number of requests that were executed
+    size_t done;
+
+    RPCParallelBatch(const JSONRPCRequest& _jreq, const UniValue& _vReq) :
+        jreq(_jreq), vReq(_vReq), size(_vReq.size()), replies(_vReq.size()), next(0), done(0) {}
+
+    /** Execute requests until none are left. jreq and vReq are only used
+     *  while not all requests are done, when the caller is still waiting. */
+    void Work()
+    {
+        size_t executed = 0;
+        size_t i;
+        while ((i = next++) < size) {
+            replies[i] = JSONRPCExecOne(jreq, vReq[i]);
+            ++executed;
+        }
+        if (executed > 0) {
+            std::unique_lock<std::mutex> lock(mutex);
+            done += executed;
+            if (done == size) cond.notify_all();
+        }
+    }
+};
+
+std::string JSONRPCExecBatch(const JSONRPCRequest& jreq, const UniValue& vReq, const RPCTaskRunner& run_task, int max_parallel)
 {
     UniValue ret(UniValue::VARR);
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(jreq, vReq[reqIdx]));
+    if (!run_task || max_parallel <= 1 || vReq.size() <= 1) {
+        for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
+            ret.push_back(JSONRPCExecOne(jreq, vReq[reqIdx]));
 
+        return ret.write() + "\n";
+    }
+
+    // Tasks may only get to run after the batch is finished, so they share
+    // ownership of it.
+    auto batch = std::make_shared<RPCParallelBatch>(jreq, vReq);
+    size_t tasks = std::min<size_t>(max_parallel - 1, vReq.size() - 1);
+    for (size_t i = 0; i < tasks; ++i) {
+        if (!run_task([batch] { batch->Work(); })) break;
+    }
+    batch->Work();
+    {
+        std::unique_lock<std::mutex> lock(batch->mutex);
+        batch->cond.wait(lock, [&batch] { return batch->done == batch->size; });
+    }
+
+    ret.push_backV(batch->replies);
     return ret.write() + "\n";
 }
 
@@ -500,6 +570,41 @@ UniValue CRPCTable::execute(const JSONRPCRequest &request) const
     }
 }
 
+void CRPCTable::execute(const JSONRPCRequest &request, JSONWriter& writer) const
+{
+    auto it = mapStreamActors.find(request.strMethod);
+    if (it == mapStreamActors.end()) {
+        writer.Value(execute(request));
+        return;
+    }
+
+    // Return immediately if in warmup
+    {
+        LOCK(cs_rpcWarmup);
+        if (fRPCInWarmup)
+            throw JSONRPCError(RPC_IN_WARMUP, rpcWarmupStatus);
+    }
+
+    const CRPCCommand *pcmd = tableRPC[request.strMethod];
+    assert(pcmd);
+
+    g_rpcSignals.PreCommand(*pcmd);
+
+    try
+    {
+        // Execute, convert arguments to array if necessary
+        if (request.params.isObject()) {
+            it->second(transformNamedArguments(request, pcmd->argNames), writer);
+        } else {
+            it->second(request, writer);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        throw JSONRPCError(RPC_MISC_ERROR, e.what());
+    }
+}
+
 std::vector<std::string> CRPCTable::listCommands() const
 {
     std::vector<std::string> commandList;
@@ -10,6 +10,7 @@
 #include <rpc/protocol.h>
 #include <uint256.h>
 
+#include <functional>
 #include <list>
 #include <map>
 #include <stdint.h>
@@ -20,6 +21,7 @@
 static const unsigned int DEFAULT_RPC_SERIALIZE_VERSION = 1;
 
 class CRPCCommand;
+class JSONWriter;
 
 namespace RPCServer
 {
@@ -126,6 +128,7 @@ void RPCUnsetTimerInterface(RPCTimerInterface *iface);
 void RPCRunLater(const std::string& name, std::function<void(void)> func, int64_t nSeconds);
 
 typedef UniValue(*rpcfn_type)(const JSONRPCRequest& jsonRequest);
+typedef void(*rpcstreamfn_type)(const JSONRPCRequest& jsonRequest, JSONWriter& writer);
 
 class CRPCCommand
 {
@@ -143,6 +146,7 @@ class CRPCTable
 {
 private:
     std::map<std::string, const CRPCCommand*> mapCommands;
+    std::map<std::string, rpcstreamfn_type> mapStreamActors;
 public:
     CRPCTable();
     const CRPCCommand* operator[](const std::string& name) const;
@@ -156,6 +160,17 @@ public:
      */
     UniValue execute(const JSONRPCRequest &request) const;
 
+    /**
+     * Execute a method, writing its result to writer. Methods with a
+     * streaming actor write their result while it is generated, without
+     * building it as a UniValue first.
+     * @param request The JSONRPCRequest to execute
+     * @param writer The writer to write the result to, as a single value
+     * @throws an exception (UniValue) when an error happens. Part of the
+     * result may have been written already.
+     */
+    void execute(const JSONRPCRequest &request, JSONWriter& writer) const;
+
     /**
     * Returns a list of registered commands
     * @returns List of registered commands.
@@ -169,6 +184,14 @@ public:
      * Commands cannot be overwritten (returns false).
      */
     bool appendCommand(const std::string& name, const CRPCCommand* pcmd);
+
+    /**
+     * Sets the streaming actor of an appended command, for results that are
+     * too large to be built in memory at once. It must produce the same
+     * result as the command's actor. Returns false if RPC server is already
+     * running or the command does not exist.
+     */
+    bool appendStreamActor(const std::string& name, rpcstreamfn_type actor);
 };
 
 bool IsDeprecatedRPCEnabled(const std::string& method);
@@ -191,7 +214,18 @@ extern std::string HelpExampleRpc(const std::string& methodname, const std::stri
 bool StartRPC();
 void InterruptRPC();
 void StopRPC();
-std::string JSONRPCExecBatch(const JSONRPCRequest& jreq, const UniValue& vReq);
+
+/** Runs task in the background. Returns false if it could not be queued. */
+typedef std::function<bool(std::function<void()> task)> RPCTaskRunner;
+
+/**
+ * Execute the requests of a batch and return the replies, in request order.
+ * With a run_task, up to max_parallel requests are executed at the same
+ * time: by the calling thread, and by up to max_parallel - 1 tasks queued
+ * with run_task. The calling thread executes whatever requests the tasks
+ * have not taken, so the batch finishes even if no task ever runs.
+ */
+std::string JSONRPCExecBatch(const JSONRPCRequest& jreq, const UniValue& vReq, const RPCTaskRunner& run_task = nullptr, int max_parallel = 1);
 
 // Retrieves any serialization flags requested in command line argument
 int RPCSerializationFlags();
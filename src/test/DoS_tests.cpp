@@ -5,7 +5,9 @@
 // Unit tests for denial-of-service detection/prevention code
 
 #include <chainparams.h>
+#include <consensus/validation.h>
 #include <keystore.h>
+#include <miner.h>
 #include <net.h>
 #include <net_processing.h>
 #include <pow.h>
@@ -41,6 +43,8 @@ CService ip(uint32_t i)
 static NodeId id = 0;
 
 void UpdateLastBlockAnnounceTime(NodeId node, int64_t time_in_seconds);
+void MarkBlockAsAvailable(NodeId node, const uint256& hash);
+void MarkPeerAsStalling(NodeId node, int64_t nStallingSince);
 
 BOOST_FIXTURE_TEST_SUITE(DoS_tests, TestingSetup)
 
@@ -92,6 +96,91 @@ BOOST_AUTO_TEST_CASE(outbound_slow_chain_eviction)
     peerLogic->FinalizeNode(dummyNode1.GetId(), dummy);
 }
 
+// Test what happens to a peer that holds back the download window: its blocks
+// in flight are left with it until the reassignment timeout, then handed to
+// another peer without being asked from it again, and it is disconnected once
+// BLOCK_STALLING_TIMEOUT expires.
+BOOST_FIXTURE_TEST_CASE(stalling_peer_reassignment, TestChain100Setup)
+{
+    std::atomic<bool> interruptDummy(false);
+
+    // A block we only have the header of
+    CBlock block = BlockAssembler(Params()).CreateNewBlock(CScript() << OP_TRUE)->block;
+    {
+        LOCK(cs_main);
+        unsigned int extraNonce = 0;
+        IncrementExtraNonce(&block, chainActive.Tip(), extraNonce);
+    }
+    while (!CheckProofOfWork(block.GetPoWHash(), block.nBits, Params().GetConsensus())) ++block.nNonce;
+    CValidationState state;
+    BOOST_REQUIRE(ProcessNewBlockHeaders({block.GetBlockHeader()}, state, Params()));
+    const int nHeight = chainActive.Height() + 1;
+
+    CAddress addr1(ip(0xa0b0c001), NODE_NONE);
+    CNode dummyNode1(id++, ServiceFlags(NODE_NETWORK|NODE_WITNESS), 0, INVALID_SOCKET, addr1, 0, 0, CAddress(), "", /*fInboundIn=*/ false);
+    CAddress addr2(ip(0xa0b0c002), NODE_NONE);
+    CNode dummyNode2(id++, ServiceFlags(NODE_NETWORK|NODE_WITNESS), 0, INVALID_SOCKET, addr2, 1, 1, CAddress(), "", /*fInboundIn=*/ false);
+    for (CNode* node : {&dummyNode1, &dummyNode2}) {
+        node->SetSendVersion(PROTOCOL_VERSION);
+        peerLogic->InitializeNode(node);
+        node->nVersion = 1;
+        node->fSuccessfullyConnected = true;
+        MarkBlockAsAvailable(node->GetId(), block.GetHash());
+    }
+
+    const int64_t nStartTime = GetTime();
+    SetMockTime(nStartTime);
+    // GetNodeStateStats appends to vHeightInFlight, so read into fresh stats
+    auto HeightsInFlight = [](const CNode& node) {
+        CNodeStateStats stats;
+        BOOST_REQUIRE(GetNodeStateStats(node.GetId(), stats));
+        return stats.vHeightInFlight;
+    };
+    LOCK2(dummyNode1.cs_sendProcessing, dummyNode2.cs_sendProcessing);
+    peerLogic->SendMessages(&dummyNode1, interruptDummy);
+    BOOST_CHECK(HeightsInFlight(dummyNode1) == std::vector<int>{nHeight});
+
+    // Holding back the download window leaves the block with the peer until
+    // the reassignment timeout expires
+    MarkPeerAsStalling(dummyNode1.GetId(), nStartTime * 1000000);
+    peerLogic->SendMessages(&dummyNode1, interruptDummy);
+    CNodeStateStats stats;
+    BOOST_REQUIRE(GetNodeStateStats(dummyNode1.GetId(), stats));
+    BOOST_CHECK_EQUAL(stats.nStallReassignments, 0);
+    BOOST_CHECK(HeightsInFlight(dummyNode1) == std::vector<int>{nHeight});
+
+    // After it, but before BLOCK_STALLING_TIMEOUT, the block is taken away
+    SetMockTime(nStartTime + 1);
+    peerLogic->SendMessages(&dummyNode1, interruptDummy);
+    BOOST_CHECK(!dummyNode1.fDisconnect);
+    stats = CNodeStateStats();
+    BOOST_REQUIRE(GetNodeStateStats(dummyNode1.GetId(), stats));
+    BOOST_CHECK_EQUAL(stats.nStallReassignments, 1);
+    BOOST_CHECK(stats.vHeightInFlight.empty());
+
+    // The block is requested from the other peer and not again from the
+    // stalling one
+    peerLogic->SendMessages(&dummyNode2, interruptDummy);
+    BOOST_CHECK(HeightsInFlight(dummyNode2) == std::vector<int>{nHeight});
+    peerLogic->SendMessages(&dummyNode1, interruptDummy);
+    BOOST_CHECK(HeightsInFlight(dummyNode1).empty());
+
+    // The stalling peer is kept until BLOCK_STALLING_TIMEOUT expires, and is
+    // disconnected right after
+    SetMockTime(nStartTime + BLOCK_STALLING_TIMEOUT);
+    peerLogic->SendMessages(&dummyNode1, interruptDummy);
+    BOOST_CHECK(!dummyNode1.fDisconnect);
+    SetMockTime(nStartTime + BLOCK_STALLING_TIMEOUT + 1);
+    peerLogic->SendMessages(&dummyNode1, interruptDummy);
+    BOOST_CHECK(dummyNode1.fDisconnect);
+    BOOST_CHECK(!dummyNode2.fDisconnect);
+
+    SetMockTime(0);
+    bool dummy;
+    peerLogic->FinalizeNode(dummyNode1.GetId(), dummy);
+    peerLogic->FinalizeNode(dummyNode2.GetId(), dummy);
+}
+
 void AddRandomOutboundPeer(std::vector<CNode *> &vNodes, PeerLogicValidation &peerLogic)
 {
     CAddress addr(ip(GetRandInt(0xffffffff)), NODE_NONE);
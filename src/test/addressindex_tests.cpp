@@ -0,0 +1,140 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <consensus/validation.h>
+#include <index/addressindex.h>
+#include <script/interpreter.h>
+#include <script/standard.h>
+#include <test/test_bitcoin.h>
+#include <utiltime.h>
+#include <txmempool.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(addressindex_tests)
+
+static void WaitUntilSynced(AddressIndex& index)
+{
+    // Allow the index to catch up with the block index.
+    constexpr int64_t timeout_ms = 10 * 1000;
+    int64_t time_start = GetTimeMillis();
+    while (!index.BlockUntilSyncedToCurrentChain()) {
+        BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+        MilliSleep(100);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(addressindex_initial_sync_and_reorg, TestChain100Setup)
+{
+    AddressIndex index(1 << 20, true);
+    const CScript coinbaseScript = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    // BlockUntilSyncedToCurrentChain should return false before the index is started.
+    BOOST_CHECK(!index.BlockUntilSyncedToCurrentChain());
+
+    index.Start();
+    WaitUntilSynced(index);
+
+    // Every block of the chain pays its coinbase to coinbaseScript
+    AddressBalance balance;
+    BOOST_CHECK(index.FindBalance(coinbaseScript, balance));
+    CAmount nCoinbaseValue = 0;
+    for (const CTransaction& tx : coinbaseTxns) {
+        nCoinbaseValue += tx.vout[0].nValue;
+    }
+    BOOST_CHECK_EQUAL(balance.nBalance, nCoinbaseValue);
+    BOOST_CHECK_EQUAL(balance.nReceived, nCoinbaseValue);
+
+    std::vector<AddressTx> txs;
+    index.FindTxs(coinbaseScript, 0, 1000, txs);
+    BOOST_CHECK_EQUAL(txs.size(), 100);
+    BOOST_CHECK(txs.front().txid == coinbaseTxns.front().GetHash() && txs.front().nHeight == 1);
+    BOOST_CHECK(txs.back().txid == coinbaseTxns.back().GetHash() && txs.back().nHeight == 100);
+
+    std::vector<AddressUnspent> unspent;
+    index.FindUnspent(coinbaseScript, 10, 5, unspent);
+    BOOST_CHECK_EQUAL(unspent.size(), 5);
+    BOOST_CHECK(unspent[0].outpoint == COutPoint(coinbaseTxns[10].GetHash(), 0));
+    BOOST_CHECK_EQUAL(unspent[0].nHeight, 11);
+    BOOST_CHECK(unspent[0].fCoinBase);
+
+    // Spend the first coinbase to another key, in a block paying its
+    // coinbase to a third script
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript destScript = GetScriptForDestination(key.GetPubKey().GetID());
+    const CScript minerScript = CScript() << OP_TRUE;
+    CMutableTransaction spend;
+    spend.vin.emplace_back(COutPoint(coinbaseTxns[0].GetHash(), 0));
+    spend.vout.emplace_back(coinbaseTxns[0].vout[0].nValue - 10000, destScript);
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(coinbaseScript, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig = CScript() << vchSig;
+    CreateAndProcessBlock({spend}, minerScript);
+    WaitUntilSynced(index);
+
+    BOOST_CHECK(index.FindBalance(coinbaseScript, balance));
+    BOOST_CHECK_EQUAL(balance.nBalance, nCoinbaseValue - coinbaseTxns[0].vout[0].nValue);
+    BOOST_CHECK_EQUAL(balance.nReceived, nCoinbaseValue);
+    BOOST_CHECK(index.FindBalance(destScript, balance));
+    BOOST_CHECK_EQUAL(balance.nBalance, spend.vout[0].nValue);
+
+    txs.clear();
+    index.FindTxs(coinbaseScript, 99, 1000, txs);
+    BOOST_CHECK_EQUAL(txs.size(), 2);
+    BOOST_CHECK(txs.back().txid == spend.GetHash() && txs.back().nHeight == 101);
+    txs.clear();
+    index.FindTxs(destScript, 0, 1000, txs);
+    BOOST_CHECK_EQUAL(txs.size(), 1);
+    unspent.clear();
+    index.FindUnspent(coinbaseScript, 0, 1000, unspent);
+    BOOST_CHECK_EQUAL(unspent.size(), 99);
+    BOOST_CHECK(unspent[0].outpoint == COutPoint(coinbaseTxns[1].GetHash(), 0));
+
+    // Disconnecting the block rewinds the index past it
+    {
+        CValidationState state;
+        {
+            LOCK(cs_main);
+            BOOST_CHECK(InvalidateBlock(state, Params(), chainActive.Tip()));
+        }
+        BOOST_CHECK(ActivateBestChain(state, Params()));
+    }
+    WaitUntilSynced(index);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(index.GetBestBlockIndex() == chainActive.Tip());
+    }
+    BOOST_CHECK(!index.FindBalance(destScript, balance));
+    BOOST_CHECK(!index.FindBalance(minerScript, balance));
+
+    // Replace the block by one without the spend
+    // The spend is back in the mempool, and the template would claim its fee
+    mempool.clear();
+    CreateAndProcessBlock({}, CScript() << OP_TRUE << OP_TRUE);
+    WaitUntilSynced(index);
+
+    BOOST_CHECK(!index.FindBalance(destScript, balance));
+    BOOST_CHECK(!index.FindBalance(minerScript, balance));
+    BOOST_CHECK(index.FindBalance(coinbaseScript, balance));
+    BOOST_CHECK_EQUAL(balance.nBalance, nCoinbaseValue);
+    txs.clear();
+    index.FindTxs(coinbaseScript, 0, 1000, txs);
+    BOOST_CHECK_EQUAL(txs.size(), 100);
+    unspent.clear();
+    index.FindUnspent(coinbaseScript, 0, 1000, unspent);
+    BOOST_CHECK_EQUAL(unspent.size(), 100);
+    unspent.clear();
+    index.FindUnspent(CScript() << OP_TRUE << OP_TRUE, 0, 1000, unspent);
+    BOOST_CHECK_EQUAL(unspent.size(), 1);
+    BOOST_CHECK_EQUAL(unspent[0].nHeight, 101);
+
+    index.Stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
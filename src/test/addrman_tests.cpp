@@ -550,4 +550,76 @@ BOOST_AUTO_TEST_CASE(caddrinfo_get_new_bucket)
     //  than 64 buckets.
     BOOST_CHECK(buckets.size() > 64);
 }
+
+BOOST_AUTO_TEST_CASE(addrman_journal)
+{
+    CAddrManTest addrman;
+    CNetAddr source = ResolveIP("252.2.2.2");
+
+    for (int i = 1; i < 32; i++) {
+        addrman.Add(CAddress(ResolveService("250.1.1." + boost::to_string(i)), NODE_NONE), source);
+    }
+
+    // Test: The journal is empty after a full save.
+    std::vector<CAddrJournalEntry> vEntries;
+    BOOST_CHECK(addrman.GetJournal(vEntries));
+    vEntries.clear();
+    CDataStream ssPeers(SER_DISK, CLIENT_VERSION);
+    ssPeers << addrman;
+    BOOST_CHECK(addrman.GetJournal(vEntries));
+    BOOST_CHECK(vEntries.empty());
+
+    // Test: Changes made after the save are journaled once.
+    CService addrTried = addrman.Select();
+    CService addrNew = ResolveService("250.2.2.2");
+    addrman.Good(addrTried);
+    addrman.Add(CAddress(addrNew, NODE_NONE), source);
+    BOOST_CHECK(addrman.GetJournal(vEntries));
+    BOOST_CHECK_EQUAL(vEntries.size(), 2U);
+    std::vector<CAddrJournalEntry> vEntriesAgain;
+    BOOST_CHECK(addrman.GetJournal(vEntriesAgain));
+    BOOST_CHECK(vEntriesAgain.empty());
+
+    // Test: Changes that failed to be saved are journaled again, and a
+    //  failed full save makes the next one a full save too.
+    addrman.RestoreJournal(vEntries, true);
+    BOOST_CHECK(addrman.GetJournal(vEntriesAgain));
+    BOOST_CHECK_EQUAL(vEntriesAgain.size(), 2U);
+    vEntriesAgain.clear();
+    addrman.RestoreJournal(vEntriesAgain, false);
+    BOOST_CHECK(!addrman.GetJournal(vEntriesAgain));
+    BOOST_CHECK(addrman.GetJournal(vEntriesAgain));
+    BOOST_CHECK(vEntriesAgain.empty());
+
+    // Test: Replaying the journal on top of the saved table restores the
+    //  current one.
+    CDataStream ssJournal(SER_DISK, CLIENT_VERSION);
+    ssJournal << vEntries;
+    std::vector<CAddrJournalEntry> vEntriesRead;
+    ssJournal >> vEntriesRead;
+
+    CAddrManTest addrman2;
+    ssPeers >> addrman2;
+    addrman2.ApplyJournal(vEntriesRead);
+    BOOST_CHECK_EQUAL(addrman2.size(), addrman.size());
+    BOOST_CHECK(addrman2.Find(addrNew) != nullptr);
+    for (int i = 1; i < 32; i++) {
+        CNetAddr addr = ResolveIP("250.1.1." + boost::to_string(i));
+        CAddrInfo* info = addrman.Find(addr);
+        CAddrInfo* info2 = addrman2.Find(addr);
+        BOOST_CHECK_EQUAL(info == nullptr, info2 == nullptr);
+        if (info && info2) {
+            CDataStream ssInfo(SER_DISK, CLIENT_VERSION), ssInfo2(SER_DISK, CLIENT_VERSION);
+            ssInfo << *info;
+            ssInfo2 << *info2;
+            BOOST_CHECK(ssInfo.str() == ssInfo2.str());
+        }
+    }
+
+    // Test: Replayed changes are not journaled again.
+    vEntries.clear();
+    BOOST_CHECK(addrman2.GetJournal(vEntries));
+    BOOST_CHECK(vEntries.empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,173 @@
+// Copyright (c) 2017-2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilter.h>
+#include <chainparams.h>
+#include <consensus/validation.h>
+#include <index/blockfilterindex.h>
+#include <script/standard.h>
+#include <test/test_bitcoin.h>
+#include <txmempool.h>
+#include <undo.h>
+#include <utiltime.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockfilter_index_tests)
+
+static void WaitUntilSynced(BlockFilterIndex& index)
+{
+    // Allow the index to catch up with the block index.
+    constexpr int64_t timeout_ms = 10 * 1000;
+    int64_t time_start = GetTimeMillis();
+    while (!index.BlockUntilSyncedToCurrentChain()) {
+        BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+        MilliSleep(100);
+    }
+}
+
+static bool CheckFilterLookups(BlockFilterIndex& filter_index, const CBlockIndex* block_index,
+                               uint256& last_header)
+{
+    BlockFilter expected_filter;
+    {
+        CBlock block;
+        CBlockUndo block_undo;
+        if (!ReadBlockFromDisk(block, block_index, Params().GetConsensus())) return false;
+        if (block_index->nHeight > 0 && !UndoReadFromDisk(block_undo, block_index)) return false;
+        expected_filter = BlockFilter(filter_index.GetFilterType(), block, block_undo);
+    }
+
+    BlockFilter filter;
+    uint256 filter_header;
+    std::vector<BlockFilter> filters;
+    std::vector<uint256> filter_hashes;
+
+    BOOST_CHECK(filter_index.LookupFilter(block_index, filter));
+    BOOST_CHECK(filter_index.LookupFilterHeader(block_index, filter_header));
+    BOOST_CHECK(filter_index.LookupFilterRange(block_index->nHeight, block_index, filters));
+    BOOST_CHECK(filter_index.LookupFilterHashRange(block_index->nHeight, block_index,
+                                                   filter_hashes));
+
+    BOOST_CHECK_EQUAL(filters.size(), 1);
+    BOOST_CHECK_EQUAL(filter_hashes.size(), 1);
+
+    BOOST_CHECK_EQUAL(filter.GetHash(), expected_filter.GetHash());
+    BOOST_CHECK_EQUAL(filter_header, expected_filter.ComputeHeader(last_header));
+    BOOST_CHECK_EQUAL(filters[0].GetHash(), expected_filter.GetHash());
+    BOOST_CHECK_EQUAL(filter_hashes[0], expected_filter.GetHash());
+
+    filters.clear();
+    filter_hashes.clear();
+    last_header = filter_header;
+    return true;
+}
+
+BOOST_FIXTURE_TEST_CASE(blockfilter_index_initial_sync_and_reorg, TestChain100Setup)
+{
+    BlockFilterIndex filter_index(BlockFilterType::BASIC, 1 << 20, true);
+
+    uint256 last_header;
+
+    // Filter should not be found in the index before it is started.
+    {
+        LOCK(cs_main);
+
+        BlockFilter filter;
+        uint256 filter_header;
+        std::vector<BlockFilter> filters;
+        std::vector<uint256> filter_hashes;
+
+        for (const CBlockIndex* block_index = chainActive.Genesis();
+             block_index != nullptr;
+             block_index = chainActive.Next(block_index)) {
+            BOOST_CHECK(!filter_index.LookupFilter(block_index, filter));
+            BOOST_CHECK(!filter_index.LookupFilterHeader(block_index, filter_header));
+            BOOST_CHECK(!filter_index.LookupFilterRange(block_index->nHeight, block_index, filters));
+            BOOST_CHECK(!filter_index.LookupFilterHashRange(block_index->nHeight, block_index,
+                                                            filter_hashes));
+        }
+    }
+
+    // BlockUntilSyncedToCurrentChain should return false before index is started.
+    BOOST_CHECK(!filter_index.BlockUntilSyncedToCurrentChain());
+
+    filter_index.Start();
+    WaitUntilSynced(filter_index);
+
+    // Check that filter index has all blocks that were in the chain before it started, and that
+    // the headers chain from the genesis filter.
+    {
+        LOCK(cs_main);
+        for (const CBlockIndex* block_index = chainActive.Genesis();
+             block_index != nullptr;
+             block_index = chainActive.Next(block_index)) {
+            BOOST_CHECK(CheckFilterLookups(filter_index, block_index, last_header));
+        }
+
+        // A range request returns one filter per block, in height order
+        std::vector<BlockFilter> filters;
+        BOOST_CHECK(filter_index.LookupFilterRange(1, chainActive.Tip(), filters));
+        BOOST_CHECK_EQUAL(filters.size(), chainActive.Height());
+        BOOST_CHECK_EQUAL(filters.back().GetBlockHash(), chainActive.Tip()->GetBlockHash());
+    }
+
+    // Check that new blocks get indexed.
+    const CScript coinbase_script_pub_key = GetScriptForDestination(coinbaseKey.GetPubKey().GetID());
+    for (int i = 0; i < 10; i++) {
+        const CBlock& block = CreateAndProcessBlock({}, coinbase_script_pub_key);
+        WaitUntilSynced(filter_index);
+
+        LOCK(cs_main);
+        const CBlockIndex* block_index = mapBlockIndex.at(block.GetHash());
+        BOOST_CHECK(CheckFilterLookups(filter_index, block_index, last_header));
+    }
+
+    // Replace the tip by a block paying to another script. The filter of the stale block stays
+    // available by hash, and the height index follows the new chain.
+    const CBlockIndex* stale_index;
+    uint256 stale_filter_hash;
+    {
+        LOCK(cs_main);
+        stale_index = chainActive.Tip();
+        BlockFilter stale_filter;
+        BOOST_CHECK(filter_index.LookupFilter(stale_index, stale_filter));
+        stale_filter_hash = stale_filter.GetHash();
+    }
+    {
+        CValidationState state;
+        {
+            LOCK(cs_main);
+            BOOST_CHECK(InvalidateBlock(state, Params(), chainActive.Tip()));
+        }
+        BOOST_CHECK(ActivateBestChain(state, Params()));
+    }
+    mempool.clear();
+    const CScript other_script = CScript() << OP_TRUE;
+    const CBlock& block = CreateAndProcessBlock({}, other_script);
+    WaitUntilSynced(filter_index);
+
+    {
+        LOCK(cs_main);
+        const CBlockIndex* new_index = mapBlockIndex.at(block.GetHash());
+        BOOST_CHECK_EQUAL(new_index->nHeight, stale_index->nHeight);
+
+        BlockFilter filter;
+        BOOST_CHECK(filter_index.LookupFilter(stale_index, filter));
+        BOOST_CHECK_EQUAL(filter.GetHash(), stale_filter_hash);
+
+        BOOST_CHECK(filter_index.LookupFilter(new_index, filter));
+        BOOST_CHECK(filter.GetFilter().Match(GCSFilter::Element(other_script.begin(), other_script.end())));
+
+        uint256 prev_header, header;
+        BOOST_CHECK(filter_index.LookupFilterHeader(new_index->pprev, prev_header));
+        BOOST_CHECK(filter_index.LookupFilterHeader(new_index, header));
+        BOOST_CHECK_EQUAL(header, filter.ComputeHeader(prev_header));
+    }
+
+    filter_index.Stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
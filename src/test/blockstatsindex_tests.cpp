@@ -0,0 +1,229 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <consensus/validation.h>
+#include <index/blockstatsindex.h>
+#include <script/standard.h>
+#include <test/test_bitcoin.h>
+#include <txmempool.h>
+#include <undo.h>
+#include <utiltime.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockstatsindex_tests)
+
+static void WaitUntilSynced(BlockStatsIndex& index)
+{
+    // Allow the index to catch up with the block index.
+    constexpr int64_t timeout_ms = 10 * 1000;
+    int64_t time_start = GetTimeMillis();
+    while (!index.BlockUntilSyncedToCurrentChain()) {
+        BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+        MilliSleep(100);
+    }
+}
+
+static CBlockStats StatsFromDisk(const CBlockIndex* block_index)
+{
+    CBlock block;
+    CBlockUndo block_undo;
+    BOOST_REQUIRE(ReadBlockFromDisk(block, block_index, Params().GetConsensus()));
+    BOOST_REQUIRE(block_index->nHeight == 0 || UndoReadFromDisk(block_undo, block_index));
+    CBlockStats stats;
+    ComputeBlockStats(block, block_undo, block_index->nHeight, stats);
+    return stats;
+}
+
+static void CheckStatsEqual(const CBlockStats& a, const CBlockStats& b)
+{
+    CDataStream ss_a(SER_DISK, 0), ss_b(SER_DISK, 0);
+    ss_a << a;
+    ss_b << b;
+    BOOST_CHECK(ss_a.str() == ss_b.str());
+}
+
+BOOST_AUTO_TEST_CASE(blockstats_calculate_percentiles_by_weight)
+{
+    int64_t total_weight = 200;
+    std::vector<std::pair<CAmount, int64_t>> feerates;
+    CAmount result[NUM_GETBLOCKSTATS_PERCENTILES] = { 0 };
+
+    for (int64_t i = 0; i < 100; i++) {
+        feerates.emplace_back(std::make_pair(1 ,1));
+    }
+
+    for (int64_t i = 0; i < 100; i++) {
+        feerates.emplace_back(std::make_pair(2 ,1));
+    }
+
+    CalculatePercentilesByWeight(result, feerates, total_weight);
+    BOOST_CHECK_EQUAL(result[0], 1);
+    BOOST_CHECK_EQUAL(result[1], 1);
+    BOOST_CHECK_EQUAL(result[2], 1);
+    BOOST_CHECK_EQUAL(result[3], 2);
+    BOOST_CHECK_EQUAL(result[4], 2);
+
+    // Test with more pairs, and two pairs overlapping 2 percentiles.
+    total_weight = 100;
+    CAmount result2[NUM_GETBLOCKSTATS_PERCENTILES] = { 0 };
+    feerates.clear();
+
+    feerates.emplace_back(std::make_pair(1, 9));
+    feerates.emplace_back(std::make_pair(2 , 16)); //10th + 25th percentile
+    feerates.emplace_back(std::make_pair(4 ,50)); //50th + 75th percentile
+    feerates.emplace_back(std::make_pair(5 ,10));
+    feerates.emplace_back(std::make_pair(9 ,15));  // 90th percentile
+
+    CalculatePercentilesByWeight(result2, feerates, total_weight);
+
+    BOOST_CHECK_EQUAL(result2[0], 2);
+    BOOST_CHECK_EQUAL(result2[1], 2);
+    BOOST_CHECK_EQUAL(result2[2], 4);
+    BOOST_CHECK_EQUAL(result2[3], 4);
+    BOOST_CHECK_EQUAL(result2[4], 9);
+
+    // Same test as above, but one of the percentile-overlapping pairs is split in 2.
+    total_weight = 100;
+    CAmount result3[NUM_GETBLOCKSTATS_PERCENTILES] = { 0 };
+    feerates.clear();
+
+    feerates.emplace_back(std::make_pair(1, 9));
+    feerates.emplace_back(std::make_pair(2 , 11)); // 10th percentile
+    feerates.emplace_back(std::make_pair(2 , 5)); // 25th percentile
+    feerates.emplace_back(std::make_pair(4 ,50)); //50th + 75th percentile
+    feerates.emplace_back(std::make_pair(5 ,10));
+    feerates.emplace_back(std::make_pair(9 ,15)); // 90th percentile
+
+    CalculatePercentilesByWeight(result3, feerates, total_weight);
+
+    BOOST_CHECK_EQUAL(result3[0], 2);
+    BOOST_CHECK_EQUAL(result3[1], 2);
+    BOOST_CHECK_EQUAL(result3[2], 4);
+    BOOST_CHECK_EQUAL(result3[3], 4);
+    BOOST_CHECK_EQUAL(result3[4], 9);
+
+    // Test with one transaction spanning all percentiles.
+    total_weight = 104;
+    CAmount result4[NUM_GETBLOCKSTATS_PERCENTILES] = { 0 };
+    feerates.clear();
+
+    feerates.emplace_back(std::make_pair(1, 100));
+    feerates.emplace_back(std::make_pair(2, 1));
+    feerates.emplace_back(std::make_pair(3, 1));
+    feerates.emplace_back(std::make_pair(3, 1));
+    feerates.emplace_back(std::make_pair(999999, 1));
+
+    CalculatePercentilesByWeight(result4, feerates, total_weight);
+
+    for (size_t i = 0; i < NUM_GETBLOCKSTATS_PERCENTILES; i++) {
+        BOOST_CHECK_EQUAL(result4[i], 1);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(blockstatsindex_initial_sync_and_reorg, TestChain100Setup)
+{
+    BlockStatsIndex block_stats_index(1 << 20, true);
+
+    // Statistics should not be found in the index before it is started.
+    CBlockStats stats;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(!block_stats_index.LookUpStats(chainActive.Tip(), stats));
+    }
+
+    block_stats_index.Start();
+    WaitUntilSynced(block_stats_index);
+
+    // Check that the index has all blocks that were in the chain before it started.
+    {
+        LOCK(cs_main);
+        for (const CBlockIndex* block_index = chainActive.Genesis();
+             block_index != nullptr;
+             block_index = chainActive.Next(block_index)) {
+            BOOST_CHECK(block_stats_index.LookUpStats(block_index, stats));
+            CheckStatsEqual(stats, StatsFromDisk(block_index));
+        }
+
+        std::vector<CBlockStats> range;
+        BOOST_CHECK(block_stats_index.LookUpStatsRange(0, chainActive.Tip(), range));
+        BOOST_CHECK_EQUAL(range.size(), chainActive.Height() + 1);
+        CheckStatsEqual(range.back(), StatsFromDisk(chainActive.Tip()));
+    }
+
+    // Index a block spending a coinbase output and check its fees.
+    const CScript p2pk_script = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout.hash = coinbaseTxns[0].GetHash();
+    spend.vin[0].prevout.n = 0;
+    spend.vout.resize(2);
+    spend.vout[0].nValue = 11 * CENT;
+    spend.vout[0].scriptPubKey = p2pk_script;
+    spend.vout[1].nValue = coinbaseTxns[0].vout[0].nValue - 11 * CENT - 1000;
+    spend.vout[1].scriptPubKey = p2pk_script;
+    std::vector<unsigned char> sig;
+    uint256 hash = SignatureHash(p2pk_script, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, sig));
+    sig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << sig;
+
+    const CBlock& block = CreateAndProcessBlock({spend}, p2pk_script);
+    WaitUntilSynced(block_stats_index);
+    const CBlockIndex* stale_index;
+    {
+        LOCK(cs_main);
+        stale_index = mapBlockIndex.at(block.GetHash());
+    }
+    BOOST_CHECK(block_stats_index.LookUpStats(stale_index, stats));
+    CheckStatsEqual(stats, StatsFromDisk(stale_index));
+    BOOST_CHECK_EQUAL(stats.txs, 2);
+    BOOST_CHECK_EQUAL(stats.ins, 1);
+    BOOST_CHECK_EQUAL(stats.outs, (int64_t)block.vtx[0]->vout.size() + 2);
+    BOOST_CHECK_EQUAL(stats.utxo_increase, stats.outs - 1);
+    BOOST_CHECK_EQUAL(stats.totalfee, 1000);
+    BOOST_CHECK_EQUAL(stats.minfee, 1000);
+    BOOST_CHECK_EQUAL(stats.maxfee, 1000);
+    BOOST_CHECK_EQUAL(stats.total_size, (int64_t)CTransaction(spend).GetTotalSize());
+    BOOST_CHECK_EQUAL(stats.subsidy, GetBlockSubsidy(stale_index->nHeight, Params().GetConsensus()));
+
+    // Replace the tip by an empty block. The statistics of the stale block
+    // stay available by hash, and the height index follows the new chain.
+    {
+        CValidationState state;
+        {
+            LOCK(cs_main);
+            BOOST_CHECK(InvalidateBlock(state, Params(), chainActive.Tip()));
+        }
+        BOOST_CHECK(ActivateBestChain(state, Params()));
+    }
+    mempool.clear();
+    const CBlock& new_block = CreateAndProcessBlock({}, p2pk_script);
+    WaitUntilSynced(block_stats_index);
+
+    {
+        LOCK(cs_main);
+        const CBlockIndex* new_index = mapBlockIndex.at(new_block.GetHash());
+        BOOST_CHECK_EQUAL(new_index->nHeight, stale_index->nHeight);
+
+        BOOST_CHECK(block_stats_index.LookUpStats(stale_index, stats));
+        BOOST_CHECK_EQUAL(stats.totalfee, 1000);
+
+        BOOST_CHECK(block_stats_index.LookUpStats(new_index, stats));
+        BOOST_CHECK_EQUAL(stats.txs, 1);
+        BOOST_CHECK_EQUAL(stats.totalfee, 0);
+
+        std::vector<CBlockStats> range;
+        BOOST_CHECK(block_stats_index.LookUpStatsRange(new_index->nHeight - 1, new_index, range));
+        BOOST_CHECK_EQUAL(range.size(), 2U);
+        CheckStatsEqual(range[1], stats);
+    }
+
+    block_stats_index.Stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,144 @@
+// Copyright (c) 2020-2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <consensus/validation.h>
+#include <index/coinstatsindex.h>
+#include <script/standard.h>
+#include <test/test_bitcoin.h>
+#include <txdb.h>
+#include <txmempool.h>
+#include <utiltime.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(coinstatsindex_tests)
+
+static void WaitUntilSynced(CoinStatsIndex& index)
+{
+    // Allow the index to catch up with the block index.
+    constexpr int64_t timeout_ms = 10 * 1000;
+    int64_t time_start = GetTimeMillis();
+    while (!index.BlockUntilSyncedToCurrentChain()) {
+        BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+        MilliSleep(100);
+    }
+}
+
+//! Compute the statistics of the chainstate at the tip by scanning it
+static void ScanUTXOSet(CCoinsStats& stats)
+{
+    FlushStateToDisk();
+    std::unique_ptr<CCoinsViewCursor> pcursor(pcoinsdbview->Cursor());
+    MuHash3072 muhash;
+    stats.hashBlock = pcursor->GetBestBlock();
+    for (; pcursor->Valid(); pcursor->Next()) {
+        COutPoint key;
+        Coin coin;
+        BOOST_REQUIRE(pcursor->GetKey(key) && pcursor->GetValue(coin));
+        muhash.Insert(SerializeCoinForMuHash(key, coin));
+        stats.nTransactionOutputs++;
+        stats.nTotalAmount += coin.out.nValue;
+        stats.nBogoSize += GetBogoSize(coin.out.scriptPubKey);
+    }
+    muhash.Finalize(stats.hashMuHash);
+}
+
+static void CheckStatsAtTip(CoinStatsIndex& index)
+{
+    CCoinsStats expected;
+    ScanUTXOSet(expected);
+
+    CCoinsStats stats;
+    LOCK(cs_main);
+    BOOST_CHECK(index.LookUpStats(chainActive.Tip(), stats));
+    BOOST_CHECK_EQUAL(stats.nHeight, chainActive.Height());
+    BOOST_CHECK_EQUAL(stats.hashBlock, expected.hashBlock);
+    BOOST_CHECK_EQUAL(stats.hashMuHash, expected.hashMuHash);
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, expected.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(stats.nBogoSize, expected.nBogoSize);
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, expected.nTotalAmount);
+}
+
+BOOST_FIXTURE_TEST_CASE(coinstatsindex_initial_sync_and_reorg, TestChain100Setup)
+{
+    CoinStatsIndex coin_stats_index(1 << 20, true);
+
+    // Statistics should not be found in the index before it is started.
+    CCoinsStats stats;
+    const CBlockIndex* genesis_index;
+    {
+        LOCK(cs_main);
+        genesis_index = chainActive.Genesis();
+        BOOST_CHECK(!coin_stats_index.LookUpStats(chainActive.Tip(), stats));
+    }
+
+    // BlockUntilSyncedToCurrentChain should return false before index is started.
+    BOOST_CHECK(!coin_stats_index.BlockUntilSyncedToCurrentChain());
+
+    coin_stats_index.Start();
+    WaitUntilSynced(coin_stats_index);
+
+    // The genesis block's outputs are not spendable, so the set starts out empty.
+    BOOST_CHECK(coin_stats_index.LookUpStats(genesis_index, stats));
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, 0U);
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, 0);
+    uint256 empty_muhash;
+    MuHash3072().Finalize(empty_muhash);
+    BOOST_CHECK_EQUAL(stats.hashMuHash, empty_muhash);
+
+    CheckStatsAtTip(coin_stats_index);
+
+    // Check that new blocks get indexed, including ones spending earlier outputs.
+    const CScript coinbase_script_pub_key = GetScriptForDestination(coinbaseKey.GetPubKey().GetID());
+    for (int i = 0; i < 5; i++) {
+        CreateAndProcessBlock({}, coinbase_script_pub_key);
+        WaitUntilSynced(coin_stats_index);
+        CheckStatsAtTip(coin_stats_index);
+    }
+
+    // Past statistics remain available by block.
+    const CBlockIndex* old_index;
+    CCoinsStats old_stats;
+    {
+        LOCK(cs_main);
+        old_index = chainActive[chainActive.Height() - 3];
+    }
+    BOOST_CHECK(coin_stats_index.LookUpStats(old_index, old_stats));
+    BOOST_CHECK_EQUAL(old_stats.nHeight, old_index->nHeight);
+    BOOST_CHECK_EQUAL(old_stats.hashBlock, old_index->GetBlockHash());
+
+    // Replace the tip by a block paying to another script; the statistics are
+    // rewound from the undo data and follow the new chain.
+    const CBlockIndex* stale_index;
+    CCoinsStats stale_stats;
+    {
+        LOCK(cs_main);
+        stale_index = chainActive.Tip();
+    }
+    BOOST_CHECK(coin_stats_index.LookUpStats(stale_index, stale_stats));
+    {
+        CValidationState state;
+        {
+            LOCK(cs_main);
+            BOOST_CHECK(InvalidateBlock(state, Params(), chainActive.Tip()));
+        }
+        BOOST_CHECK(ActivateBestChain(state, Params()));
+    }
+    mempool.clear();
+    CreateAndProcessBlock({}, CScript() << OP_TRUE);
+    WaitUntilSynced(coin_stats_index);
+    CheckStatsAtTip(coin_stats_index);
+
+    // The stale block's statistics stay available by hash.
+    BOOST_CHECK(coin_stats_index.LookUpStats(stale_index, stats));
+    BOOST_CHECK_EQUAL(stats.hashMuHash, stale_stats.hashMuHash);
+    BOOST_CHECK(coin_stats_index.LookUpStats(old_index, stats));
+    BOOST_CHECK_EQUAL(stats.hashMuHash, old_stats.hashMuHash);
+
+    coin_stats_index.Stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,82 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <indirectmap.h>
+
+#include <coins.h>
+#include <random.h>
+
+#include <test/test_bitcoin.h>
+
+#include <map>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(indirectmap_tests, BasicTestingSetup)
+
+/** Hashes outpoints into a handful of values, so probe runs are long */
+struct CollidingOutpointHasher
+{
+    size_t operator()(const COutPoint& id) const { return id.n % 7; }
+};
+
+template <typename Hasher>
+static void RandomOperations(FastRandomContext& rand)
+{
+    std::vector<COutPoint> keys;
+    for (uint32_t i = 0; i < 300; ++i) {
+        keys.emplace_back(uint256(), i);
+    }
+    indirecthashmap<COutPoint, int, Hasher> map;
+    std::map<COutPoint, int> expected;
+
+    for (int step = 0; step < 20000; ++step) {
+        const COutPoint& key = keys[rand.randrange(keys.size())];
+        // Drift between filling up and draining, so the table grows and shrinks
+        const bool fInsert = rand.randrange(4) < ((step / 2000) % 2 ? 1 : 3);
+        if (fInsert) {
+            const int value = rand.randrange(1000);
+            const auto result = map.insert(std::make_pair(&key, value));
+            const bool fNew = expected.emplace(key, value).second;
+            BOOST_CHECK_EQUAL(result.second, fNew);
+            BOOST_CHECK(*result.first->first == key);
+            BOOST_CHECK_EQUAL(result.first->second, expected[key]);
+        } else {
+            BOOST_CHECK_EQUAL(map.erase(key), expected.erase(key));
+        }
+        BOOST_CHECK_EQUAL(map.size(), expected.size());
+        BOOST_CHECK(map.capacity() * 3 >= map.size() * 4);
+    }
+
+    for (const COutPoint& key : keys) {
+        auto it = map.find(key);
+        BOOST_CHECK_EQUAL(map.count(key), expected.count(key));
+        if (expected.count(key)) {
+            BOOST_CHECK(it != map.end() && it->first == &keys[key.n]);
+            BOOST_CHECK_EQUAL(it->second, expected[key]);
+        } else {
+            BOOST_CHECK(it == map.end());
+        }
+    }
+    size_t nIterated = 0;
+    for (const auto& value : map) {
+        BOOST_CHECK_EQUAL(value.second, expected[*value.first]);
+        ++nIterated;
+    }
+    BOOST_CHECK_EQUAL(nIterated, expected.size());
+
+    map.clear();
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(map.begin() == map.end());
+}
+
+BOOST_AUTO_TEST_CASE(indirecthashmap_random)
+{
+    FastRandomContext rand(true);
+    RandomOperations<SaltedOutpointHasher>(rand);
+    RandomOperations<CollidingOutpointHasher>(rand);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,277 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <core_io.h>
+#include <key.h>
+#include <rpc/blockchain.h>
+#include <rpc/jsonwriter.h>
+#include <rpc/server.h>
+#include <script/interpreter.h>
+#include <test/test_bitcoin.h>
+#include <txmempool.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+#include <univalue.h>
+
+BOOST_FIXTURE_TEST_SUITE(jsonwriter_tests, BasicTestingSetup)
+
+//! Write with write_json, passing output on every flush_size bytes, and return all output
+static std::string WriteAll(const std::function<void(JSONWriter&)>& write_json, size_t flush_size)
+{
+    std::string out;
+    JSONWriter writer([&](const std::string& data) {
+        BOOST_CHECK(data.size() >= flush_size);
+        out += data;
+    }, flush_size);
+    write_json(writer);
+    std::string rest = writer.Release();
+    BOOST_CHECK(rest.size() < flush_size);
+    return out + rest;
+}
+
+static void CheckSameAsUniValue(const UniValue& value)
+{
+    for (size_t flush_size : {(size_t)1, (size_t)7, DEFAULT_JSON_FLUSH_SIZE}) {
+        BOOST_CHECK_EQUAL(WriteAll([&](JSONWriter& writer) { writer.Value(value); }, flush_size), value.write());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(jsonwriter_univalue)
+{
+    CheckSameAsUniValue(NullUniValue);
+    CheckSameAsUniValue(UniValue(true));
+    CheckSameAsUniValue(UniValue(false));
+    CheckSameAsUniValue(UniValue(-42));
+    CheckSameAsUniValue(UniValue(0.125));
+    CheckSameAsUniValue(UniValue(std::numeric_limits<uint64_t>::max()));
+    CheckSameAsUniValue(UniValue(UniValue::VOBJ));
+    CheckSameAsUniValue(UniValue(UniValue::VARR));
+
+    // Every byte value, to cover escaping
+    std::string all_bytes;
+    for (int i = 0; i < 256; ++i) all_bytes += (char)i;
+    CheckSameAsUniValue(UniValue(all_bytes));
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair(all_bytes, all_bytes));
+    obj.push_back(Pair("empty", UniValue(UniValue::VARR)));
+    UniValue arr(UniValue::VARR);
+    arr.push_back(NullUniValue);
+    arr.push_back(obj);
+    arr.push_back(UniValue(UniValue::VOBJ));
+    arr.push_back("a\"b\\c");
+    obj.push_back(Pair("nested", arr));
+    obj.push_back(Pair("n", 1));
+    CheckSameAsUniValue(obj);
+    CheckSameAsUniValue(arr);
+}
+
+BOOST_AUTO_TEST_CASE(jsonwriter_incremental)
+{
+    UniValue expected(UniValue::VOBJ);
+    UniValue list(UniValue::VARR);
+    list.push_back(1);
+    list.push_back("two");
+    UniValue inner(UniValue::VOBJ);
+    inner.push_back(Pair("three", 3));
+    list.push_back(inner);
+    list.push_back(UniValue(UniValue::VARR));
+    expected.push_back(Pair("list", list));
+    expected.push_back(Pair("empty", UniValue(UniValue::VOBJ)));
+    expected.push_back(Pair("last", NullUniValue));
+
+    for (size_t flush_size : {(size_t)1, (size_t)5, DEFAULT_JSON_FLUSH_SIZE}) {
+        std::string out = WriteAll([](JSONWriter& writer) {
+            writer.BeginObject();
+            writer.Key("list").BeginArray().Value(1).Value("two");
+            writer.BeginObject().KV("three", 3).EndObject();
+            writer.BeginArray().EndArray();
+            writer.EndArray();
+            writer.Key("empty").BeginObject().EndObject();
+            writer.KV("last", NullUniValue);
+            writer.EndObject();
+        }, flush_size);
+        BOOST_CHECK_EQUAL(out, expected.write());
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(jsonwriter_block_and_mempool, TestChain100Setup)
+{
+    CBlock block;
+    const CBlockIndex* pindex = chainActive[50];
+    BOOST_REQUIRE(ReadBlockFromDisk(block, pindex, Params().GetConsensus()));
+
+    for (bool tx_details : {false, true}) {
+        std::string streamed = WriteAll([&](JSONWriter& writer) {
+            blockToJSON(block, pindex, tx_details, writer);
+        }, 100);
+        LOCK(cs_main);
+        BOOST_CHECK_EQUAL(streamed, blockToJSON(block, pindex, tx_details).write());
+    }
+
+    // A transaction spending a coinbase output, and one spending it in turn
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 10 * COIN;
+    spend.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    CMutableTransaction child;
+    child.vin.resize(1);
+    child.vin[0].prevout = COutPoint(spend.GetHash(), 0);
+    child.vout = spend.vout;
+
+    TestMemPoolEntryHelper entry;
+    {
+        LOCK(mempool.cs);
+        mempool.addUnchecked(spend.GetHash(), entry.Fee(1000).FromTx(spend));
+        mempool.addUnchecked(child.GetHash(), entry.Fee(2000).FromTx(child));
+    }
+    for (bool verbose : {false, true}) {
+        std::string streamed = WriteAll([&](JSONWriter& writer) {
+            mempoolToJSON(verbose, writer);
+        }, 100);
+        BOOST_CHECK_EQUAL(streamed, mempoolToJSON(verbose).write());
+    }
+    mempool.clear();
+}
+
+/** A client that stops reading once the reply contains a marker, until resumed */
+class PausedReader
+{
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::string m_marker;
+    std::string m_received;
+    bool m_paused = false;
+    bool m_resumed = false;
+
+public:
+    explicit PausedReader(const std::string& marker) : m_marker(marker) {}
+
+    void Read(const std::string& data)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_received += data;
+        if (m_received.find(m_marker) == std::string::npos)
+            return;
+        m_paused = true;
+        m_cond.notify_all();
+        m_cond.wait(lock, [this] { return m_resumed; });
+    }
+
+    bool WaitPaused()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        return m_cond.wait_for(lock, std::chrono::seconds(10), [this] { return m_paused; });
+    }
+
+    void Resume()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_resumed = true;
+        m_cond.notify_all();
+    }
+};
+
+static UniValue CallRPC(const std::string& method, const UniValue& params)
+{
+    JSONRPCRequest request;
+    request.strMethod = method;
+    request.params = params;
+    request.fHelp = false;
+    return tableRPC.execute(request);
+}
+
+/** Check that other_calls completes while the reply of request is paused at marker */
+static void CheckPausedReaderDoesNotBlock(const JSONRPCRequest& request, const std::string& marker, const std::function<void()>& other_calls)
+{
+    PausedReader reader(marker);
+    std::thread writer_thread([&] {
+        JSONWriter writer([&reader](const std::string& data) { reader.Read(data); }, 1);
+        tableRPC.execute(request, writer);
+        reader.Read(writer.Release());
+    });
+    BOOST_CHECK(reader.WaitPaused());
+
+    std::future<void> other = std::async(std::launch::async, other_calls);
+    BOOST_CHECK(other.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+    reader.Resume();
+    writer_thread.join();
+    other.get();
+}
+
+/** Spend the first output of prev, paying to key */
+static CMutableTransaction SpendToKey(const CTransaction& prev, const CKey& key)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(prev.GetHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = prev.vout[0].nValue - 100000;
+    tx.vout[0].scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(prev.vout[0].scriptPubKey, tx, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig << vchSig;
+    return tx;
+}
+
+BOOST_FIXTURE_TEST_CASE(jsonwriter_paused_reader, TestChain100Setup)
+{
+    SetRPCWarmupFinished();
+    int height;
+    std::string tip_hash;
+    {
+        LOCK(cs_main);
+        height = chainActive.Height();
+        tip_hash = chainActive.Tip()->GetBlockHash().GetHex();
+    }
+
+    // Neither cs_main nor mempool.cs may stay held while a client that stopped
+    // reading holds up the writer.
+    const CMutableTransaction spend = SpendToKey(coinbaseTxns[0], coinbaseKey);
+    const CMutableTransaction child = SpendToKey(CTransaction(spend), coinbaseKey);
+    auto other_calls = [height](const CMutableTransaction& tx) {
+        BOOST_CHECK_EQUAL(CallRPC("getblockcount", UniValue(UniValue::VARR)).get_int(), height);
+        UniValue params(UniValue::VARR);
+        params.push_back(EncodeHexTx(CTransaction(tx)));
+        try {
+            CallRPC("sendrawtransaction", params);
+        } catch (const UniValue& objError) {
+            // Only relaying fails, as there is no connection manager
+            BOOST_CHECK_EQUAL(find_value(objError, "code").get_int(), RPC_CLIENT_P2P_DISABLED);
+        }
+        BOOST_CHECK(mempool.exists(tx.GetHash()));
+    };
+
+    JSONRPCRequest getblock;
+    getblock.strMethod = "getblock";
+    getblock.params = UniValue(UniValue::VARR);
+    getblock.params.push_back(tip_hash);
+    getblock.params.push_back(2);
+    CheckPausedReaderDoesNotBlock(getblock, "\"txid\"", [&] { other_calls(spend); });
+
+    JSONRPCRequest getrawmempool;
+    getrawmempool.strMethod = "getrawmempool";
+    getrawmempool.params = UniValue(UniValue::VARR);
+    getrawmempool.params.push_back(UniValue(true));
+    CheckPausedReaderDoesNotBlock(getrawmempool, "\"fee\"", [&] { other_calls(child); });
+
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
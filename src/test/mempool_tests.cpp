@@ -105,14 +105,99 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     BOOST_CHECK_EQUAL(testPool.size(), 0);
 }
 
-template<typename name>
+// The mempool no longer keeps entries sorted by these, but the ancestor and
+// descendant aggregates they read are still maintained (and reported by
+// getmempoolentry), so sorting by them checks the aggregates.
+
+/** Sort an entry by max(score/size of entry's tx, score/size with all descendants). */
+class CompareTxMemPoolEntryByDescendantScore
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        double a_mod_fee, a_size, b_mod_fee, b_size;
+
+        GetModFeeAndSize(a, a_mod_fee, a_size);
+        GetModFeeAndSize(b, b_mod_fee, b_size);
+
+        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b).
+        double f1 = a_mod_fee * b_size;
+        double f2 = a_size * b_mod_fee;
+
+        if (f1 == f2) {
+            return a.GetTime() >= b.GetTime();
+        }
+        return f1 < f2;
+    }
+
+    // Return the fee/size we're using for sorting this entry.
+    void GetModFeeAndSize(const CTxMemPoolEntry &a, double &mod_fee, double &size) const
+    {
+        // Compare feerate with descendants to feerate of the transaction, and
+        // return the fee/size for the max.
+        double f1 = (double)a.GetModifiedFee() * a.GetSizeWithDescendants();
+        double f2 = (double)a.GetModFeesWithDescendants() * a.GetTxSize();
+
+        if (f2 > f1) {
+            mod_fee = a.GetModFeesWithDescendants();
+            size = a.GetSizeWithDescendants();
+        } else {
+            mod_fee = a.GetModifiedFee();
+            size = a.GetTxSize();
+        }
+    }
+};
+
+/** Sort an entry by min(score/size of entry's tx, score/size with all ancestors). */
+class CompareTxMemPoolEntryByAncestorFee
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        double a_mod_fee, a_size, b_mod_fee, b_size;
+
+        GetModFeeAndSize(a, a_mod_fee, a_size);
+        GetModFeeAndSize(b, b_mod_fee, b_size);
+
+        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b).
+        double f1 = a_mod_fee * b_size;
+        double f2 = a_size * b_mod_fee;
+
+        if (f1 == f2) {
+            return a.GetTx().GetHash() < b.GetTx().GetHash();
+        }
+        return f1 > f2;
+    }
+
+    // Return the fee/size we're using for sorting this entry.
+    void GetModFeeAndSize(const CTxMemPoolEntry &a, double &mod_fee, double &size) const
+    {
+        // Compare feerate with ancestors to feerate of the transaction, and
+        // return the fee/size for the min.
+        double f1 = (double)a.GetModifiedFee() * a.GetSizeWithAncestors();
+        double f2 = (double)a.GetModFeesWithAncestors() * a.GetTxSize();
+
+        if (f1 > f2) {
+            mod_fee = a.GetModFeesWithAncestors();
+            size = a.GetSizeWithAncestors();
+        } else {
+            mod_fee = a.GetModifiedFee();
+            size = a.GetTxSize();
+        }
+    }
+};
+
+template<typename Compare>
 void CheckSort(CTxMemPool &pool, std::vector<std::string> &sortedOrder)
 {
     BOOST_CHECK_EQUAL(pool.size(), sortedOrder.size());
-    typename CTxMemPool::indexed_transaction_set::index<name>::type::iterator it = pool.mapTx.get<name>().begin();
-    int count=0;
-    for (; it != pool.mapTx.get<name>().end(); ++it, ++count) {
-        BOOST_CHECK_EQUAL(it->GetTx().GetHash().ToString(), sortedOrder[count]);
+    std::vector<const CTxMemPoolEntry*> entries;
+    for (const CTxMemPoolEntry& entry : pool.mapTx) {
+        entries.push_back(&entry);
+    }
+    std::sort(entries.begin(), entries.end(), [](const CTxMemPoolEntry* a, const CTxMemPoolEntry* b) { return Compare()(*a, *b); });
+    for (size_t count = 0; count < entries.size(); ++count) {
+        BOOST_CHECK_EQUAL(entries[count]->GetTx().GetHash().ToString(), sortedOrder[count]);
     }
 }
 
@@ -166,7 +251,7 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
     sortedOrder[3] = tx4.GetHash().ToString(); // 15000
     sortedOrder[4] = tx2.GetHash().ToString(); // 20000
     LOCK(pool.cs);
-    CheckSort<descendant_score>(pool, sortedOrder);
+    CheckSort<CompareTxMemPoolEntryByDescendantScore>(pool, sortedOrder);
 
     /* low fee but with high fee child */
     /* tx6 -> tx7 -> tx8, tx9 -> tx10 */
@@ -178,7 +263,7 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
     BOOST_CHECK_EQUAL(pool.size(), 6);
     // Check that at this point, tx6 is sorted low
     sortedOrder.insert(sortedOrder.begin(), tx6.GetHash().ToString());
-    CheckSort<descendant_score>(pool, sortedOrder);
+    CheckSort<CompareTxMemPoolEntryByDescendantScore>(pool, sortedOrder);
 
     CTxMemPool::setEntries setAncestors;
     setAncestors.insert(pool.mapTx.find(tx6.GetHash()));
@@ -204,7 +289,7 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
     sortedOrder.erase(sortedOrder.begin());
     sortedOrder.push_back(tx6.GetHash().ToString());
     sortedOrder.push_back(tx7.GetHash().ToString());
-    CheckSort<descendant_score>(pool, sortedOrder);
+    CheckSort<CompareTxMemPoolEntryByDescendantScore>(pool, sortedOrder);
 
     /* low fee child of tx7 */
     CMutableTransaction tx8 = CMutableTransaction();
@@ -219,7 +304,7 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
 
     // Now tx8 should be sorted low, but tx6/tx both high
     sortedOrder.insert(sortedOrder.begin(), tx8.GetHash().ToString());
-    CheckSort<descendant_score>(pool, sortedOrder);
+    CheckSort<CompareTxMemPoolEntryByDescendantScore>(pool, sortedOrder);
 
     /* low fee child of tx7 */
     CMutableTransaction tx9 = CMutableTransaction();
@@ -234,7 +319,7 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
     // tx9 should be sorted low
     BOOST_CHECK_EQUAL(pool.size(), 9);
     sortedOrder.insert(sortedOrder.begin(), tx9.GetHash().ToString());
-    CheckSort<descendant_score>(pool, sortedOrder);
+    CheckSort<CompareTxMemPoolEntryByDescendantScore>(pool, sortedOrder);
 
     std::vector<std::string> snapshotOrder = sortedOrder;
 
@@ -276,14 +361,14 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
     sortedOrder.insert(sortedOrder.begin()+5, tx9.GetHash().ToString());
     sortedOrder.insert(sortedOrder.begin()+6, tx8.GetHash().ToString());
     sortedOrder.insert(sortedOrder.begin()+7, tx10.GetHash().ToString()); // tx10 is just before tx6
-    CheckSort<descendant_score>(pool, sortedOrder);
+    CheckSort<CompareTxMemPoolEntryByDescendantScore>(pool, sortedOrder);
 
     // there should be 10 transactions in the mempool
     BOOST_CHECK_EQUAL(pool.size(), 10);
 
     // Now try removing tx10 and verify the sort order returns to normal
     pool.removeRecursive(pool.mapTx.find(tx10.GetHash())->GetTx());
-    CheckSort<descendant_score>(pool, snapshotOrder);
+    CheckSort<CompareTxMemPoolEntryByDescendantScore>(pool, snapshotOrder);
 
     pool.removeRecursive(pool.mapTx.find(tx9.GetHash())->GetTx());
     pool.removeRecursive(pool.mapTx.find(tx8.GetHash())->GetTx());
@@ -348,7 +433,7 @@ BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
     sortedOrder[4] = tx3.GetHash().ToString(); // 0
 
     LOCK(pool.cs);
-    CheckSort<ancestor_score>(pool, sortedOrder);
+    CheckSort<CompareTxMemPoolEntryByAncestorFee>(pool, sortedOrder);
 
     /* low fee parent with high fee child */
     /* tx6 (0) -> tx7 (high) */
@@ -366,7 +451,7 @@ BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
     else
         sortedOrder.insert(sortedOrder.end()-1,tx6.GetHash().ToString());
 
-    CheckSort<ancestor_score>(pool, sortedOrder);
+    CheckSort<CompareTxMemPoolEntryByAncestorFee>(pool, sortedOrder);
 
     CMutableTransaction tx7 = CMutableTransaction();
     tx7.vin.resize(1);
@@ -383,7 +468,7 @@ BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
     pool.addUnchecked(tx7.GetHash(), entry.Fee(fee).FromTx(tx7));
     BOOST_CHECK_EQUAL(pool.size(), 7);
     sortedOrder.insert(sortedOrder.begin()+1, tx7.GetHash().ToString());
-    CheckSort<ancestor_score>(pool, sortedOrder);
+    CheckSort<CompareTxMemPoolEntryByAncestorFee>(pool, sortedOrder);
 
     /* after tx6 is mined, tx7 should move up in the sort */
     std::vector<CTransactionRef> vtx;
@@ -397,7 +482,7 @@ BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
     else
         sortedOrder.erase(sortedOrder.end()-2);
     sortedOrder.insert(sortedOrder.begin(), tx7.GetHash().ToString());
-    CheckSort<ancestor_score>(pool, sortedOrder);
+    CheckSort<CompareTxMemPoolEntryByAncestorFee>(pool, sortedOrder);
 
     // High-fee parent, low-fee child
     // tx7 -> tx8
@@ -414,7 +499,7 @@ BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
     // but the transaction's own feerate is lower
     pool.addUnchecked(tx8.GetHash(), entry.Fee(5000LL).FromTx(tx8));
     sortedOrder.insert(sortedOrder.end()-1, tx8.GetHash().ToString());
-    CheckSort<ancestor_score>(pool, sortedOrder);
+    CheckSort<CompareTxMemPoolEntryByAncestorFee>(pool, sortedOrder);
 }
 
 
@@ -523,17 +608,25 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     pool.addUnchecked(tx6.GetHash(), entry.Fee(1100LL).FromTx(tx6));
     pool.addUnchecked(tx7.GetHash(), entry.Fee(9000LL).FromTx(tx7));
 
-    // we only require this remove, at max, 2 txn, because its not clear what we're really optimizing for aside from that
+    // tx4 alone outbids everything else, and tx7 pays for tx5 and tx6, so the
+    // cluster is chunked as {tx4}, {tx5, tx6, tx7} and the second chunk goes
+    // as a whole
     pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
     BOOST_CHECK(pool.exists(tx4.GetHash()));
-    BOOST_CHECK(pool.exists(tx6.GetHash()));
+    BOOST_CHECK(!pool.exists(tx5.GetHash()));
+    BOOST_CHECK(!pool.exists(tx6.GetHash()));
     BOOST_CHECK(!pool.exists(tx7.GetHash()));
 
-    if (!pool.exists(tx5.GetHash()))
-        pool.addUnchecked(tx5.GetHash(), entry.Fee(1000LL).FromTx(tx5));
+    // Once tx6 is worth more than tx4 on its own, the chunks become
+    // {tx4, tx6}, {tx5, tx7}
+    pool.PrioritiseTransaction(tx6.GetHash(), 20000LL);
+    pool.addUnchecked(tx5.GetHash(), entry.Fee(1000LL).FromTx(tx5));
+    pool.addUnchecked(tx6.GetHash(), entry.Fee(1100LL).FromTx(tx6));
     pool.addUnchecked(tx7.GetHash(), entry.Fee(9000LL).FromTx(tx7));
 
-    pool.TrimToSize(pool.DynamicMemoryUsage() / 2); // should maximize mempool size by only removing 5/7
+    // The cluster arena keeps its capacity, so going just below the current
+    // usage is what removes the lowest chunk only
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
     BOOST_CHECK(pool.exists(tx4.GetHash()));
     BOOST_CHECK(!pool.exists(tx5.GetHash()));
     BOOST_CHECK(pool.exists(tx6.GetHash()));
@@ -571,4 +664,202 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolUpdateFromBlockTest)
+{
+    // A disconnected block with a parent/child pair, re-added under
+    // in-mempool descendants that spend both of them, must end up in the
+    // same state as if everything had been added in order.
+    TestMemPoolEntryHelper entry;
+    CMutableTransaction txA;
+    txA.vin.resize(1);
+    txA.vin[0].scriptSig = CScript() << OP_1;
+    txA.vout.resize(2);
+    for (CTxOut& out : txA.vout) {
+        out.scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        out.nValue = 10 * COIN;
+    }
+    CMutableTransaction txB;
+    txB.vin.resize(1);
+    txB.vin[0].prevout = COutPoint(txA.GetHash(), 0);
+    txB.vin[0].scriptSig = CScript() << OP_2;
+    txB.vout.resize(1);
+    txB.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+    txB.vout[0].nValue = 10 * COIN;
+    CMutableTransaction txC;
+    txC.vin.resize(2);
+    txC.vin[0].prevout = COutPoint(txA.GetHash(), 1);
+    txC.vin[0].scriptSig = CScript() << OP_3;
+    txC.vin[1].prevout = COutPoint(txB.GetHash(), 0);
+    txC.vin[1].scriptSig = CScript() << OP_3;
+    txC.vout.resize(2);
+    for (CTxOut& out : txC.vout) {
+        out.scriptPubKey = CScript() << OP_3 << OP_EQUAL;
+        out.nValue = 10 * COIN;
+    }
+    CMutableTransaction txD;
+    txD.vin.resize(1);
+    txD.vin[0].prevout = COutPoint(txC.GetHash(), 0);
+    txD.vin[0].scriptSig = CScript() << OP_4;
+    txD.vout.resize(1);
+    txD.vout[0].scriptPubKey = CScript() << OP_4 << OP_EQUAL;
+    txD.vout[0].nValue = 10 * COIN;
+    CMutableTransaction txE;
+    txE.vin.resize(2);
+    txE.vin[0].prevout = COutPoint(txC.GetHash(), 1);
+    txE.vin[0].scriptSig = CScript() << OP_5;
+    txE.vin[1].prevout = COutPoint(txD.GetHash(), 0);
+    txE.vin[1].scriptSig = CScript() << OP_5;
+    txE.vout.resize(1);
+    txE.vout[0].scriptPubKey = CScript() << OP_5 << OP_EQUAL;
+    txE.vout[0].nValue = 10 * COIN;
+
+    std::vector<CMutableTransaction> vBlock = {txA, txB};
+    std::vector<CMutableTransaction> vDescendants = {txC, txD, txE};
+
+    CTxMemPool poolInOrder;
+    CTxMemPool poolReorg;
+    CAmount nFee = 1000;
+    for (const CMutableTransaction& tx : vBlock) {
+        poolInOrder.addUnchecked(tx.GetHash(), entry.Fee(nFee += 1000).FromTx(tx));
+    }
+    for (const CMutableTransaction& tx : vDescendants) {
+        poolInOrder.addUnchecked(tx.GetHash(), entry.Fee(nFee += 1000).FromTx(tx));
+        poolReorg.addUnchecked(tx.GetHash(), entry.Fee(nFee).FromTx(tx));
+    }
+    nFee = 1000;
+    std::vector<uint256> vHashes;
+    for (const CMutableTransaction& tx : vBlock) {
+        poolReorg.addUnchecked(tx.GetHash(), entry.Fee(nFee += 1000).FromTx(tx));
+        vHashes.push_back(tx.GetHash());
+    }
+    poolReorg.UpdateTransactionsFromBlock(vHashes);
+
+    for (const CMutableTransaction& tx : {txA, txB, txC, txD, txE}) {
+        const CTxMemPoolEntry& expected = *poolInOrder.mapTx.find(tx.GetHash());
+        const CTxMemPoolEntry& actual = *poolReorg.mapTx.find(tx.GetHash());
+        BOOST_CHECK_EQUAL(actual.GetCountWithAncestors(), expected.GetCountWithAncestors());
+        BOOST_CHECK_EQUAL(actual.GetSizeWithAncestors(), expected.GetSizeWithAncestors());
+        BOOST_CHECK_EQUAL(actual.GetModFeesWithAncestors(), expected.GetModFeesWithAncestors());
+        BOOST_CHECK_EQUAL(actual.GetSigOpCostWithAncestors(), expected.GetSigOpCostWithAncestors());
+        BOOST_CHECK_EQUAL(actual.GetCountWithDescendants(), expected.GetCountWithDescendants());
+        BOOST_CHECK_EQUAL(actual.GetSizeWithDescendants(), expected.GetSizeWithDescendants());
+        BOOST_CHECK_EQUAL(actual.GetModFeesWithDescendants(), expected.GetModFeesWithDescendants());
+    }
+    BOOST_CHECK_EQUAL(poolReorg.mapTx.find(txA.GetHash())->GetCountWithDescendants(), 5);
+    BOOST_CHECK_EQUAL(poolReorg.mapTx.find(txE.GetHash())->GetCountWithAncestors(), 5);
+    LOCK(poolReorg.cs);
+    poolReorg.LinearizeClusters();
+    BOOST_CHECK_EQUAL(poolReorg.GetClusterTails().size(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolClusterSizeTest)
+{
+    // A parent with two children, and an unrelated transaction
+    TestMemPoolEntryHelper entry;
+    CTxMemPool pool;
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_1;
+    txParent.vout.resize(3);
+    for (CTxOut& out : txParent.vout) {
+        out.scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        out.nValue = 10 * COIN;
+    }
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(10000).FromTx(txParent));
+    std::vector<CMutableTransaction> vChildren(2);
+    for (size_t i = 0; i < vChildren.size(); i++) {
+        vChildren[i].vin.resize(1);
+        vChildren[i].vin[0].prevout = COutPoint(txParent.GetHash(), i);
+        vChildren[i].vin[0].scriptSig = CScript() << OP_2;
+        vChildren[i].vout.resize(1);
+        vChildren[i].vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+        vChildren[i].vout[0].nValue = 10 * COIN;
+        pool.addUnchecked(vChildren[i].GetHash(), entry.Fee(10000).FromTx(vChildren[i]));
+    }
+    CMutableTransaction txOther;
+    txOther.vin.resize(1);
+    txOther.vin[0].scriptSig = CScript() << OP_3;
+    txOther.vout.resize(1);
+    txOther.vout[0].scriptPubKey = CScript() << OP_3 << OP_EQUAL;
+    txOther.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txOther.GetHash(), entry.Fee(10000).FromTx(txOther));
+
+    LOCK(pool.cs);
+    const CTxMemPool::txiter itParent = pool.mapTx.find(txParent.GetHash());
+    const CTxMemPool::txiter itChild = pool.mapTx.find(vChildren[0].GetHash());
+    const CTxMemPool::txiter itOther = pool.mapTx.find(txOther.GetHash());
+    BOOST_CHECK_EQUAL(pool.CalculateClusterSize({}, {}), 1U);
+    BOOST_CHECK_EQUAL(pool.CalculateClusterSize({itParent}, {}), 4U);
+    BOOST_CHECK_EQUAL(pool.CalculateClusterSize({itParent, itOther}, {}), 5U);
+
+    // Transactions a replacement evicts do not count
+    BOOST_CHECK_EQUAL(pool.CalculateClusterSize({itParent}, {itChild}), 3U);
+    BOOST_CHECK_EQUAL(pool.CalculateClusterSize({itParent}, {itOther}), 4U);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolClusterEvictionTest)
+{
+    // Two parents, and three children of the first of which the last also
+    // spends the second, chunked {p1}, {p2}, {c3}, {c1}, {c12} by falling fee
+    TestMemPoolEntryHelper entry;
+    CTxMemPool pool;
+    std::vector<CMutableTransaction> vParents(2);
+    for (size_t i = 0; i < vParents.size(); i++) {
+        vParents[i].vin.resize(1);
+        vParents[i].vin[0].scriptSig = CScript() << OP_1 << CScriptNum(i);
+        vParents[i].vout.resize(3);
+        for (CTxOut& out : vParents[i].vout) {
+            out.scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+            out.nValue = 10 * COIN;
+        }
+        pool.addUnchecked(vParents[i].GetHash(), entry.Fee(20000 - 5000 * i).FromTx(vParents[i]));
+    }
+    std::vector<CMutableTransaction> vChildren(3);
+    const CAmount nChildFees[] = {1000, 5000, 100};
+    for (size_t i = 0; i < vChildren.size(); i++) {
+        vChildren[i].vin.resize(1);
+        vChildren[i].vin[0].prevout = COutPoint(vParents[0].GetHash(), i);
+        vChildren[i].vin[0].scriptSig = CScript() << OP_2;
+        vChildren[i].vout.resize(1);
+        vChildren[i].vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+        vChildren[i].vout[0].nValue = 10 * COIN;
+    }
+    vChildren[2].vin.resize(2);
+    vChildren[2].vin[1].prevout = COutPoint(vParents[1].GetHash(), 0);
+    vChildren[2].vin[1].scriptSig = CScript() << OP_2;
+    for (size_t i = 0; i < vChildren.size(); i++) {
+        pool.addUnchecked(vChildren[i].GetHash(), entry.Fee(nChildFees[i]).FromTx(vChildren[i]));
+    }
+
+    LOCK(pool.cs);
+    pool.LinearizeClusters();
+    BOOST_CHECK_EQUAL(pool.GetClusterTails().size(), 1U);
+    const CTxMemPool::txiter itParent = pool.mapTx.find(vParents[0].GetHash());
+    const CTxMemPool::txiter itOther = pool.mapTx.find(vParents[1].GetHash());
+    BOOST_CHECK_EQUAL(pool.GetCluster(itParent->nClusterId).vChunks.size(), 5U);
+
+    // Evicting the child that joined the parents leaves them apart, so the
+    // rest of the cluster waits to be split and relinearized
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!pool.exists(vChildren[2].GetHash()));
+    BOOST_CHECK_EQUAL(pool.size(), 4U);
+    BOOST_CHECK(pool.GetCluster(itParent->nClusterId).vChunks.empty());
+    pool.LinearizeClusters();
+    BOOST_CHECK_EQUAL(itOther->nClusterId, 0U);
+    BOOST_CHECK_EQUAL(pool.GetCluster(itParent->nClusterId).vTxs.size(), 3U);
+    BOOST_CHECK_EQUAL(pool.GetClusterTails().size(), 2U);
+
+    // Evicting the cheapest child leaves the parent and the other child
+    // linked, and they keep their chunks without being relinearized
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!pool.exists(vChildren[0].GetHash()));
+    BOOST_CHECK_EQUAL(pool.size(), 3U);
+    const CTxMemPool::TxCluster& cluster = pool.GetCluster(itParent->nClusterId);
+    BOOST_CHECK_EQUAL(cluster.vChunks.size(), 2U);
+    BOOST_CHECK_EQUAL(cluster.vTxs.size(), 2U);
+    BOOST_CHECK(cluster.vTxs.front() == itParent);
+    BOOST_CHECK(cluster.vTxs.back() == pool.mapTx.find(vChildren[1].GetHash()));
+    BOOST_CHECK_EQUAL(pool.GetClusterTails().size(), 2U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -522,4 +522,69 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     */ // END - TESTS_DISABLED
 }
 
+BOOST_FIXTURE_TEST_CASE(block_template_cache_longpoll_counter, TestChain100Setup)
+{
+    BlockTemplateCache cache(Params());
+    LOCK(cs_main);
+
+    uint64_t nSequence = 0;
+    unsigned int nTransactionsUpdated = 0;
+    cache.GetTemplate(true, &nSequence, &nTransactionsUpdated);
+    BOOST_CHECK_EQUAL(nTransactionsUpdated, mempool.GetTransactionsUpdated());
+
+    // A cached template reports the counter from when it was built, not the
+    // current one, so long pollers still see the mempool as changed.
+    const unsigned int nBuilt = nTransactionsUpdated;
+    mempool.AddTransactionsUpdated(1);
+    uint64_t nSequenceCached = 0;
+    cache.GetTemplate(true, &nSequenceCached, &nTransactionsUpdated);
+    BOOST_CHECK_EQUAL(nSequenceCached, nSequence);
+    BOOST_CHECK_EQUAL(nTransactionsUpdated, nBuilt);
+    BOOST_CHECK(nTransactionsUpdated != mempool.GetTransactionsUpdated());
+}
+
+BOOST_FIXTURE_TEST_CASE(block_template_cache_prioritise, TestChain100Setup)
+{
+    // The transactions below spend made-up outputs
+    gArgs.ForceSetArg("-testblockvalidity", "0");
+    BlockTemplateCache cache(Params());
+    TestMemPoolEntryHelper entry;
+    LOCK(cs_main);
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vin[0].prevout.hash = coinbaseTxns[0].GetHash();
+    tx.vin[0].prevout.n = 0;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1000000;
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    const uint256 hashHighFeeTx = tx.GetHash();
+    mempool.addUnchecked(hashHighFeeTx, entry.Fee(10000).Time(GetTime()).FromTx(tx));
+    tx.vin[0].prevout.hash = coinbaseTxns[1].GetHash();
+    const uint256 hashLowFeeTx = tx.GetHash();
+    mempool.addUnchecked(hashLowFeeTx, entry.Fee(1000).Time(GetTime()).FromTx(tx));
+
+    uint64_t nSequence = 0;
+    std::unique_ptr<CBlockTemplate> pblocktemplate = cache.GetTemplate(true, &nSequence);
+    BOOST_REQUIRE_EQUAL(pblocktemplate->block.vtx.size(), 3);
+    BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHash() == hashHighFeeTx);
+    BOOST_CHECK(pblocktemplate->block.vtx[2]->GetHash() == hashLowFeeTx);
+
+    // A fee delta changes the selection order as soon as the cache is told
+    // about it, without waiting for the rebuild interval.
+    mempool.PrioritiseTransaction(hashLowFeeTx, 100000);
+    cache.Invalidate();
+    uint64_t nSequenceNew = 0;
+    pblocktemplate = cache.GetTemplate(true, &nSequenceNew);
+    BOOST_CHECK(nSequenceNew != nSequence);
+    BOOST_REQUIRE_EQUAL(pblocktemplate->block.vtx.size(), 3);
+    BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHash() == hashLowFeeTx);
+    BOOST_CHECK(pblocktemplate->block.vtx[2]->GetHash() == hashHighFeeTx);
+
+    mempool.ClearPrioritisation(hashLowFeeTx);
+    mempool.clear();
+    gArgs.ForceSetArg("-testblockvalidity", std::to_string(DEFAULT_TEST_BLOCK_VALIDITY));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,21 +2,27 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <chainparams.h>
+#include <clientversion.h>
 #include <policy/policy.h>
 #include <policy/fees.h>
+#include <streams.h>
 #include <txmempool.h>
 #include <uint256.h>
 #include <util.h>
 
 #include <test/test_bitcoin.h>
 
+#include <cstdio>
+
 #include <boost/test/unit_test.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(policyestimator_tests, BasicTestingSetup)
 
 BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
 {
-    CBlockPolicyEstimator feeEst;
+    // 10 minute blocks, at which the decays below follow from the horizons' half-lives
+    CBlockPolicyEstimator feeEst(10 * 60);
     CTxMemPool mpool(&feeEst);
     TestMemPoolEntryHelper entry;
     CAmount basefee(2000);
@@ -179,4 +185,75 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
     }
 }
 
+BOOST_AUTO_TEST_CASE(BlockPolicyEstimatesPersistence)
+{
+    CBlockPolicyEstimator feeEst(Params().GetConsensus().nPowTargetSpacing);
+    CTxMemPool mpool(&feeEst);
+    TestMemPoolEntryHelper entry;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_TRUE;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 0LL;
+
+    std::vector<uint256> txHashes[10];
+    std::vector<CTransactionRef> block;
+    int blocknum = 0;
+    // Add 2 transactions at each of 10 feerates every block, and mine the
+    // transactions at the j-th feerate every 10 - j blocks
+    auto mineBlocks = [&](int nBlocks) {
+        for (int n = 0; n < nBlocks; n++) {
+            for (int j = 0; j < 10; j++) {
+                for (int k = 0; k < 2; k++) {
+                    tx.vin[0].prevout.n = 10000 * blocknum + 100 * j + k;
+                    uint256 hash = tx.GetHash();
+                    mpool.addUnchecked(hash, entry.Fee(2000 * (j + 1)).Time(GetTime()).Height(blocknum).FromTx(tx));
+                    txHashes[j].push_back(hash);
+                }
+                if (blocknum % (10 - j) == 0) {
+                    for (const uint256& hash : txHashes[j]) {
+                        block.push_back(mpool.get(hash));
+                    }
+                    txHashes[j].clear();
+                }
+            }
+            mpool.removeForBlock(block, ++blocknum);
+            block.clear();
+        }
+    };
+
+    CAutoFile file(std::tmpfile(), SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK(feeEst.NeedsFullWrite());
+    mineBlocks(200);
+    BOOST_CHECK(feeEst.Write(file));
+    BOOST_CHECK(!feeEst.NeedsFullWrite());
+    mineBlocks(100);
+    BOOST_CHECK(feeEst.WriteChanges(file));
+    mineBlocks(1000);
+    // Transactions still in the mempool are only recorded as failures when flushed
+    feeEst.FlushUnconfirmed(mpool);
+    BOOST_CHECK(feeEst.WriteChanges(file));
+    // A record cut short by a crash is ignored
+    file << (unsigned char)100 << (unsigned char)0;
+
+    rewind(file.Get());
+    CBlockPolicyEstimator feeEstRead(Params().GetConsensus().nPowTargetSpacing);
+    BOOST_CHECK(feeEstRead.Read(file));
+    BOOST_CHECK(feeEstRead.NeedsFullWrite());
+
+    // The estimates read back match the ones they were written from
+    for (int horizon = FeeEstimateHorizon::SHORT_HALFLIFE; horizon <= FeeEstimateHorizon::LONG_HALFLIFE; horizon++) {
+        for (unsigned int target = 1; target <= feeEst.HighestTargetTracked((FeeEstimateHorizon)horizon); target++) {
+            EstimationResult result, resultRead;
+            CFeeRate feeRate = feeEst.estimateRawFee(target, 0.85, (FeeEstimateHorizon)horizon, &result);
+            BOOST_CHECK(feeRate == feeEstRead.estimateRawFee(target, 0.85, (FeeEstimateHorizon)horizon, &resultRead));
+            BOOST_CHECK_CLOSE(result.pass.totalConfirmed, resultRead.pass.totalConfirmed, 1e-6);
+            BOOST_CHECK_CLOSE(result.fail.leftMempool, resultRead.fail.leftMempool, 1e-6);
+        }
+    }
+    CFeeRate smartFee = feeEst.estimateSmartFee(6, nullptr, false);
+    BOOST_CHECK(smartFee != CFeeRate(0));
+    BOOST_CHECK(smartFee == feeEstRead.estimateSmartFee(6, nullptr, false));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
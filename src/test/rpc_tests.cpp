@@ -4,6 +4,7 @@
 
 #include <rpc/server.h>
 #include <rpc/client.h>
+#include <rpc/register.h>
 
 #include <base58.h>
 #include <core_io.h>
@@ -14,6 +15,8 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/test/unit_test.hpp>
 
+#include <thread>
+
 #include <univalue.h>
 
 UniValue CallRPC(std::string args)
@@ -345,4 +348,56 @@ BOOST_AUTO_TEST_CASE(rpc_convert_values_generatetoaddress)
     BOOST_CHECK_EQUAL(result[2].get_int(), 9);
 }
 
+BOOST_FIXTURE_TEST_CASE(rpc_batch_parallel, BasicTestingSetup)
+{
+    RegisterAllCoreRPCCommands(tableRPC);
+    if (RPCIsInWarmup(nullptr))
+        SetRPCWarmupFinished();
+
+    UniValue batch(UniValue::VARR);
+    for (int i = 0; i < 100; ++i) {
+        UniValue request(UniValue::VOBJ);
+        request.push_back(Pair("id", i));
+        request.push_back(Pair("method", i % 10 == 0 ? "nosuchmethod" : "echo"));
+        UniValue params(UniValue::VARR);
+        params.push_back(i);
+        request.push_back(Pair("params", params));
+        batch.push_back(request);
+    }
+    JSONRPCRequest jreq;
+
+    const std::string serial = JSONRPCExecBatch(jreq, batch);
+    UniValue replies;
+    BOOST_REQUIRE(replies.read(serial));
+    BOOST_REQUIRE_EQUAL(replies.size(), 100U);
+    for (int i = 0; i < 100; ++i) {
+        BOOST_CHECK_EQUAL(find_value(replies[i], "id").get_int(), i);
+        BOOST_CHECK_EQUAL(find_value(replies[i], "error").isNull(), i % 10 != 0);
+    }
+
+    // Requests spread over the calling thread and up to three more
+    std::vector<std::thread> threads;
+    RPCTaskRunner run_in_thread = [&threads](std::function<void()> task) {
+        threads.emplace_back(task);
+        return true;
+    };
+    BOOST_CHECK_EQUAL(JSONRPCExecBatch(jreq, batch, run_in_thread, 4), serial);
+    BOOST_CHECK_EQUAL(threads.size(), 3U);
+    for (std::thread& thread : threads)
+        thread.join();
+
+    // Tasks that only run after the batch is finished
+    std::vector<std::function<void()>> tasks;
+    BOOST_CHECK_EQUAL(JSONRPCExecBatch(jreq, batch, [&tasks](std::function<void()> task) {
+        tasks.push_back(task);
+        return true;
+    }, 8), serial);
+    BOOST_CHECK_EQUAL(tasks.size(), 7U);
+    for (const auto& task : tasks)
+        task();
+
+    // Tasks that can not be queued
+    BOOST_CHECK_EQUAL(JSONRPCExecBatch(jreq, batch, [](std::function<void()>) { return false; }, 8), serial);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -11,6 +11,7 @@
 #include <validation.h>
 #include <miner.h>
 #include <net_processing.h>
+#include <policy/fees.h>
 #include <ui_interface.h>
 #include <streams.h>
 #include <rpc/server.h>
@@ -55,6 +56,7 @@ BasicTestingSetup::BasicTestingSetup(const std::string& chainName)
         fPrintToDebugLog = false; // don't want to write to debug.log file
         fCheckBlockIndex = true;
         SelectParams(chainName);
+        ::feeEstimator.SetBlockSpacing(Params().GetConsensus().nPowTargetSpacing);
         noui_connect();
 }
 
@@ -7,8 +7,10 @@
 #include <amount.h>
 #include <consensus/validation.h>
 #include <primitives/transaction.h>
+#include <script/interpreter.h>
 #include <script/script.h>
 #include <test/test_bitcoin.h>
+#include <util.h>
 
 #include <boost/test/unit_test.hpp>
 
@@ -58,4 +60,77 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_reject_coinbase, TestChain100Setup)
     BOOST_CHECK_EQUAL(nDoS, 100);
 }
 
+/**
+ * Ensure that a dumped mempool loads back whole, children after their
+ * parents, and that a damaged file is refused.
+ */
+BOOST_FIXTURE_TEST_CASE(mempool_dump_load, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    auto spend = [&](const std::vector<COutPoint>& prevouts, const std::vector<CAmount>& vInValues, int nOutputs) {
+        CMutableTransaction tx;
+        CAmount nValueIn = 0;
+        for (size_t i = 0; i < prevouts.size(); i++) {
+            tx.vin.emplace_back(prevouts[i]);
+            nValueIn += vInValues[i];
+        }
+        for (int i = 0; i < nOutputs; i++) {
+            tx.vout.emplace_back((nValueIn - 10000) / nOutputs, scriptPubKey);
+        }
+        for (size_t i = 0; i < tx.vin.size(); i++) {
+            std::vector<unsigned char> vchSig;
+            uint256 hash = SignatureHash(scriptPubKey, tx, i, SIGHASH_ALL, 0, SIGVERSION_BASE);
+            BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+            vchSig.push_back((unsigned char)SIGHASH_ALL);
+            tx.vin[i].scriptSig = CScript() << vchSig;
+        }
+        return MakeTransactionRef(tx);
+    };
+
+    // A parent with three children, two of which have a child together
+    std::vector<CTransactionRef> vTxs;
+    vTxs.push_back(spend({COutPoint(coinbaseTxns[0].GetHash(), 0)}, {coinbaseTxns[0].vout[0].nValue}, 3));
+    for (uint32_t n = 0; n < 3; n++) {
+        vTxs.push_back(spend({COutPoint(vTxs[0]->GetHash(), n)}, {vTxs[0]->vout[n].nValue}, 1));
+    }
+    vTxs.push_back(spend({COutPoint(vTxs[1]->GetHash(), 0), COutPoint(vTxs[2]->GetHash(), 0)}, {vTxs[1]->vout[0].nValue, vTxs[2]->vout[0].nValue}, 1));
+    for (const CTransactionRef& tx : vTxs) {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, tx, nullptr /* pfMissingInputs */,
+                                       nullptr /* plTxnReplaced */, false /* bypass_limits */, 0 /* nAbsurdFee */));
+    }
+    mempool.PrioritiseTransaction(vTxs[3]->GetHash(), 5000);
+    mempool.PrioritiseTransaction(uint256S("0x1"), 7000);
+
+    BOOST_CHECK(DumpMempool());
+    mempool.clear();
+    mempool.ClearPrioritisation(vTxs[3]->GetHash());
+    mempool.ClearPrioritisation(uint256S("0x1"));
+    BOOST_CHECK(LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), vTxs.size());
+    for (const CTransactionRef& tx : vTxs) {
+        BOOST_CHECK(mempool.exists(tx->GetHash()));
+    }
+    {
+        LOCK(mempool.cs);
+        BOOST_CHECK_EQUAL(mempool.mapTx.find(vTxs[3]->GetHash())->GetModifiedFee(), 10000 + 5000);
+        BOOST_CHECK_EQUAL(mempool.mapDeltas.count(uint256S("0x1")), 1);
+    }
+
+    // Flip a byte of the last chunk, which holds the fee deltas
+    fs::path path = GetDataDir() / "mempool.dat";
+    {
+        FILE* file = fsbridge::fopen(path, "r+b");
+        BOOST_CHECK(file);
+        fseek(file, -40, SEEK_END);
+        int c = fgetc(file);
+        fseek(file, -40, SEEK_END);
+        fputc(c ^ 1, file);
+        fclose(file);
+    }
+    mempool.clear();
+    BOOST_CHECK(!LoadMempool());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
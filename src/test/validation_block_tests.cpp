@@ -10,7 +10,9 @@
 #include <miner.h>
 #include <pow.h>
 #include <random.h>
+#include <streams.h>
 #include <test/test_bitcoin.h>
+#include <undo.h>
 #include <validation.h>
 #include <validationinterface.h>
 
@@ -181,4 +183,110 @@ BOOST_AUTO_TEST_CASE(processnewblock_signals_ordering)
     BOOST_CHECK_EQUAL(sub.m_expected_tip, chainActive.Tip()->GetBlockHash());
 }
 
+BOOST_FIXTURE_TEST_CASE(read_raw_block_and_undo, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    std::vector<unsigned char> raw;
+
+    for (int height : {0, 1, 50, 100}) {
+        const CBlockIndex* pindex;
+        {
+            LOCK(cs_main);
+            pindex = chainActive[height];
+        }
+
+        // Raw blocks are stored in the network serialization, with witness data
+        CBlock block;
+        BOOST_REQUIRE(ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()));
+        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+        ssBlock << block;
+        BOOST_REQUIRE(ReadRawBlockFromDisk(raw, pindex, chainparams.MessageStart()));
+        BOOST_CHECK(std::string(raw.begin(), raw.end()) == ssBlock.str());
+
+        if (height == 0) {
+            // The genesis block has no undo data
+            BOOST_CHECK(!ReadRawUndoFromDisk(raw, pindex, chainparams.MessageStart()));
+            continue;
+        }
+        CBlockUndo blockundo;
+        BOOST_REQUIRE(UndoReadFromDisk(blockundo, pindex));
+        CDataStream ssUndo(SER_DISK, CLIENT_VERSION);
+        ssUndo << blockundo;
+        BOOST_REQUIRE(ReadRawUndoFromDisk(raw, pindex, chainparams.MessageStart()));
+        BOOST_CHECK(std::string(raw.begin(), raw.end()) == ssUndo.str());
+    }
+
+    // The records on disk are checked against the block index
+    CMessageHeader::MessageStartChars wrongStart = {0, 0, 0, 0};
+    const CBlockIndex* tip;
+    {
+        LOCK(cs_main);
+        tip = chainActive.Tip();
+    }
+    BOOST_CHECK(!ReadRawBlockFromDisk(raw, tip, wrongStart));
+    BOOST_CHECK(!ReadRawUndoFromDisk(raw, tip, wrongStart));
+}
+
+struct AnnouncementSubscriber : public CValidationInterface {
+    std::vector<uint256> m_announced;
+
+    void NewPoWValidBlock(const CBlockIndex* pindex, const std::shared_ptr<const CBlock>& block)
+    {
+        m_announced.push_back(block->GetHash());
+    }
+};
+
+static std::shared_ptr<const CBlock> WitnessBlock(bool fBadCommitment)
+{
+    auto ptemplate = BlockAssembler(Params()).CreateNewBlock(CScript() << OP_TRUE, true);
+    auto pblock = std::make_shared<CBlock>(ptemplate->block);
+    if (fBadCommitment) {
+        CMutableTransaction txCoinbase(*pblock->vtx[0]);
+        CScript& commitment = txCoinbase.vout.back().scriptPubKey;
+        BOOST_REQUIRE(commitment.size() >= 38 && commitment[0] == OP_RETURN && commitment[2] == 0xaa);
+        commitment[6] ^= 1;
+        pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
+    }
+    return FinalizeBlock(pblock);
+}
+
+BOOST_FIXTURE_TEST_CASE(fast_relay_checks_witness_commitment, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    UpdateVersionBitsParameters(Consensus::DEPLOYMENT_SEGWIT, Consensus::BIP9Deployment::ALWAYS_ACTIVE, Consensus::BIP9Deployment::NO_TIMEOUT);
+    {
+        LOCK(cs_main);
+        versionbitscache.Clear();
+    }
+    BOOST_REQUIRE(fFastBlockRelay);
+
+    AnnouncementSubscriber sub;
+    RegisterValidationInterface(&sub);
+    CValidationState state;
+
+    // Accept the headers first, as for a block reconstructed from a cmpctblock,
+    // so ProcessNewBlock takes the early announcement path.
+    auto good = WitnessBlock(false);
+    BOOST_CHECK(ProcessNewBlockHeaders({good->GetBlockHeader()}, state, chainparams));
+    BOOST_CHECK(ProcessNewBlock(chainparams, good, true, nullptr));
+    BOOST_CHECK(std::find(sub.m_announced.begin(), sub.m_announced.end(), good->GetHash()) != sub.m_announced.end());
+    // It was announced from ProcessNewBlock, which checked the witness
+    // commitment without cs_main for AcceptBlock.
+    BOOST_CHECK(good->fWitnessChecked);
+
+    // A block whose witness commitment does not match is neither announced
+    // nor connected.
+    auto bad = WitnessBlock(true);
+    BOOST_CHECK(ProcessNewBlockHeaders({bad->GetBlockHeader()}, state, chainparams));
+    BOOST_CHECK(!ProcessNewBlock(chainparams, bad, true, nullptr));
+    BOOST_CHECK(std::find(sub.m_announced.begin(), sub.m_announced.end(), bad->GetHash()) == sub.m_announced.end());
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(chainActive.Tip()->GetBlockHash() == good->GetHash());
+    }
+
+    UnregisterValidationInterface(&sub);
+    SyncWithValidationInterfaceQueue();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
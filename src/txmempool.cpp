@@ -11,18 +11,34 @@
 #include <validation.h>
 #include <policy/policy.h>
 #include <policy/fees.h>
-#include <reverse_iterator.h>
 #include <streams.h>
 #include <timedata.h>
 #include <util.h>
 #include <utilmoneystr.h>
 #include <utiltime.h>
 
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+// Grow a flat array by a quarter at a time rather than doubling it, so little
+// more than the elements themselves is allocated.
+template<typename T>
+static void ReserveOneMore(std::vector<T>& v)
+{
+    if (v.size() == v.capacity()) {
+        v.reserve(v.size() + v.size() / 4 + 16);
+    }
+}
+
+// nTailPos of an entry that is not in vTailHeap
+static const uint32_t NOT_IN_TAIL_HEAP = std::numeric_limits<uint32_t>::max();
+
 CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee,
                                  int64_t _nTime, unsigned int _entryHeight,
                                  bool _spendsCoinbase, int64_t _sigOpsCost, LockPoints lp):
     tx(_tx), nFee(_nFee), nTime(_nTime), entryHeight(_entryHeight),
-    spendsCoinbase(_spendsCoinbase), sigOpCost(_sigOpsCost), lockPoints(lp)
+    sigOpCost(_sigOpsCost), lockPoints(lp), spendsCoinbase(_spendsCoinbase)
 {
     nTxWeight = GetTransactionWeight(*tx);
     nUsageSize = RecursiveDynamicUsage(tx);
@@ -37,6 +53,9 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFe
     nSizeWithAncestors = GetTxSize();
     nModFeesWithAncestors = nFee;
     nSigOpCostWithAncestors = sigOpCost;
+
+    nClusterId = 0;
+    nTailPos = NOT_IN_TAIL_HEAP;
 }
 
 void CTxMemPoolEntry::UpdateFeeDelta(int64_t newFeeDelta)
@@ -56,96 +75,138 @@ size_t CTxMemPoolEntry::GetTxSize() const
     return GetVirtualTransactionSize(nTxWeight, sigOpCost);
 }
 
-// Update the given tx for any in-mempool descendants.
-// Assumes that setMemPoolChildren is correct for the given tx and all
-// descendants.
-void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendants, const std::set<uint256> &setExclude)
-{
-    setEntries stageEntries, setAllDescendants;
-    stageEntries = GetMemPoolChildren(updateIt);
-
-    while (!stageEntries.empty()) {
-        const txiter cit = *stageEntries.begin();
-        setAllDescendants.insert(cit);
-        stageEntries.erase(cit);
-        const setEntries &setChildren = GetMemPoolChildren(cit);
-        for (const txiter childEntry : setChildren) {
-            cacheMap::iterator cacheIt = cachedDescendants.find(childEntry);
-            if (cacheIt != cachedDescendants.end()) {
-                // We've already calculated this one, just add the entries for this set
-                // but don't traverse again.
-                for (const txiter cacheEntry : cacheIt->second) {
-                    setAllDescendants.insert(cacheEntry);
-                }
-            } else if (!setAllDescendants.count(childEntry)) {
-                // Schedule for later processing
-                stageEntries.insert(childEntry);
-            }
-        }
-    }
-    // setAllDescendants now contains all in-mempool descendants of updateIt.
-    // Update and add to cached descendant map
-    int64_t modifySize = 0;
-    CAmount modifyFee = 0;
-    int64_t modifyCount = 0;
-    for (txiter cit : setAllDescendants) {
-        if (!setExclude.count(cit->GetTx().GetHash())) {
-            modifySize += cit->GetTxSize();
-            modifyFee += cit->GetModifiedFee();
-            modifyCount++;
-            cachedDescendants[updateIt].insert(cit);
-            // Update ancestor state for each descendant
-            mapTx.modify(cit, update_ancestor_state(updateIt->GetTxSize(), updateIt->GetModifiedFee(), 1, updateIt->GetSigOpCost()));
-        }
-    }
-    mapTx.modify(updateIt, update_descendant_state(modifySize, modifyFee, modifyCount));
-}
-
 // vHashesToUpdate is the set of transaction hashes from a disconnected block
 // which has been re-added to the mempool.
-// for each entry, look for descendants that are outside vHashesToUpdate, and
-// add fee/size information for such descendants to the parent.
-// for each such descendant, also update the ancestor state to include the parent.
+// These were added back in block order, so their state with respect to each
+// other (and to any in-mempool ancestors, which can only be among them) is
+// already correct. What is missing is the in-mempool descendants outside
+// vHashesToUpdate, which were added while the block was connected:
+// - each re-added tx must count them as descendants, and
+// - each of them must count its re-added ancestors.
+// All of that is done in one topological pass over those descendants, each
+// of which inherits the re-added ancestors of its parents.
 void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashesToUpdate)
 {
     LOCK(cs);
-    // For each entry in vHashesToUpdate, store the set of in-mempool, but not
-    // in-vHashesToUpdate transactions, so that we don't have to recalculate
-    // descendants when we come across a previously seen entry.
-    cacheMap mapMemPoolDescendantsToUpdate;
-
-    // Use a set for lookups into vHashesToUpdate (these entries are already
-    // accounted for in the state of their ancestors)
-    std::set<uint256> setAlreadyIncluded(vHashesToUpdate.begin(), vHashesToUpdate.end());
-
-    // Iterate in reverse, so that whenever we are looking at a transaction
-    // we are sure that all in-mempool descendants have already been processed.
-    // This maximizes the benefit of the descendant cache and guarantees that
-    // setMemPoolChildren will be updated, an assumption made in
-    // UpdateForDescendants.
-    for (const uint256 &hash : reverse_iterate(vHashesToUpdate)) {
-        // we cache the in-mempool children to avoid duplicate updates
-        setEntries setChildren;
-        // calculate children from mapNextTx
+    // These lookups are by entry address; hashing a txid for every visit
+    // would dominate the update.
+    std::vector<txiter> vUpdated;
+    std::unordered_set<const CTxMemPoolEntry*> setUpdated;
+    for (const uint256 &hash : vHashesToUpdate) {
         txiter it = mapTx.find(hash);
-        if (it == mapTx.end()) {
-            continue;
+        if (it != mapTx.end() && setUpdated.insert(&*it).second) {
+            vUpdated.push_back(it);
         }
-        auto iter = mapNextTx.lower_bound(COutPoint(hash, 0));
-        // First calculate the children, and update setMemPoolChildren to
-        // include them, and update their setMemPoolParents to include this tx.
-        for (; iter != mapNextTx.end() && iter->first->hash == hash; ++iter) {
-            const uint256 &childHash = iter->second->GetHash();
-            txiter childIter = mapTx.find(childHash);
+    }
+
+    // First link every re-added tx to its children outside the set, found
+    // through mapNextTx. Those children and all their descendants are the
+    // transactions whose state is affected.
+    std::vector<txiter> vDescendants;
+    std::unordered_set<const CTxMemPoolEntry*> setDescendants;
+    for (txiter it : vUpdated) {
+        const CTransaction& tx = it->GetTx();
+        setEntries setChildren;
+        for (uint32_t n = 0; n < tx.vout.size(); ++n) {
+            auto iter = mapNextTx.find(COutPoint(tx.GetHash(), n));
+            if (iter == mapNextTx.end()) continue;
+            txiter childIter = mapTx.find(iter->second->GetHash());
             assert(childIter != mapTx.end());
-            // We can skip updating entries we've encountered before or that
-            // are in the block (which are already accounted for).
-            if (setChildren.insert(childIter).second && !setAlreadyIncluded.count(childHash)) {
+            // Children in the set are already linked by addUnchecked
+            if (!setUpdated.count(&*childIter) && setChildren.insert(childIter).second) {
                 UpdateChild(it, childIter, true);
                 UpdateParent(childIter, it, true);
             }
         }
-        UpdateForDescendants(it, mapMemPoolDescendantsToUpdate, setAlreadyIncluded);
+        if (setChildren.empty()) {
+            continue;
+        }
+        MergeClusters(it);
+        // Block transactions cannot spend mempool-only outputs, so this walk
+        // never reaches back into the re-added set.
+        size_t nWalked = vDescendants.size();
+        for (txiter childIter : setChildren) {
+            if (setDescendants.insert(&*childIter).second) {
+                vDescendants.push_back(childIter);
+            }
+        }
+        for (; nWalked < vDescendants.size(); ++nWalked) {
+            for (txiter childIter : GetMemPoolChildren(vDescendants[nWalked])) {
+                if (setDescendants.insert(&*childIter).second) {
+                    vDescendants.push_back(childIter);
+                }
+            }
+        }
+    }
+    if (vDescendants.empty()) {
+        return;
+    }
+
+    // None of the descendants count any re-added ancestors yet, so their
+    // ancestor counts still order them topologically among themselves.
+    std::sort(vDescendants.begin(), vDescendants.end(), [](const txiter& a, const txiter& b) {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CompareIteratorByAddress()(a, b);
+    });
+
+    // For each descendant, the re-added ancestors it is missing: those of its
+    // parents, plus any re-added parents and their own in-mempool ancestors
+    // (all of which were re-added too). Descendant state changes are summed
+    // per re-added tx and applied once at the end.
+    std::unordered_map<const CTxMemPoolEntry*, size_t> mapIndex;
+    mapIndex.reserve(vDescendants.size());
+    std::vector<std::vector<txiter>> vMissing(vDescendants.size());
+    std::map<txiter, setEntries, CompareIteratorByAddress> mapUpdatedAncestors;
+    struct DescendantDelta {
+        int64_t nSize = 0;
+        CAmount nFee = 0;
+        int64_t nCount = 0;
+    };
+    std::map<txiter, DescendantDelta, CompareIteratorByAddress> mapDescendantDeltas;
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+    for (size_t i = 0; i < vDescendants.size(); ++i) {
+        const txiter it = vDescendants[i];
+        mapIndex.emplace(&*it, i);
+        std::vector<txiter>& vAncestors = vMissing[i];
+        for (txiter parentIt : GetMemPoolParents(it)) {
+            if (setUpdated.count(&*parentIt)) {
+                auto cached = mapUpdatedAncestors.find(parentIt);
+                if (cached == mapUpdatedAncestors.end()) {
+                    cached = mapUpdatedAncestors.emplace(parentIt, setEntries()).first;
+                    CalculateMemPoolAncestors(*parentIt, cached->second, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+                }
+                vAncestors.push_back(parentIt);
+                vAncestors.insert(vAncestors.end(), cached->second.begin(), cached->second.end());
+            } else {
+                auto inherited = mapIndex.find(&*parentIt);
+                if (inherited != mapIndex.end()) {
+                    vAncestors.insert(vAncestors.end(), vMissing[inherited->second].begin(), vMissing[inherited->second].end());
+                }
+            }
+        }
+        std::sort(vAncestors.begin(), vAncestors.end(), CompareIteratorByAddress());
+        vAncestors.erase(std::unique(vAncestors.begin(), vAncestors.end()), vAncestors.end());
+
+        int64_t modifySize = 0;
+        CAmount modifyFee = 0;
+        int64_t modifySigOpCost = 0;
+        for (txiter ancestorIt : vAncestors) {
+            modifySize += ancestorIt->GetTxSize();
+            modifyFee += ancestorIt->GetModifiedFee();
+            modifySigOpCost += ancestorIt->GetSigOpCost();
+            DescendantDelta& delta = mapDescendantDeltas[ancestorIt];
+            delta.nSize += it->GetTxSize();
+            delta.nFee += it->GetModifiedFee();
+            ++delta.nCount;
+        }
+        if (!vAncestors.empty()) {
+            mapTx.modify(it, update_ancestor_state(modifySize, modifyFee, vAncestors.size(), modifySigOpCost));
+        }
+    }
+    for (const auto& entry : mapDescendantDeltas) {
+        mapTx.modify(entry.first, update_descendant_state(entry.second.nSize, entry.second.nFee, entry.second.nCount));
     }
 }
 
@@ -174,7 +235,9 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         // If we're not searching for parents, we require this to be an
         // entry in the mempool already.
         txiter it = mapTx.iterator_to(entry);
-        parentHashes = GetMemPoolParents(it);
+        for (txiter parentIt : GetMemPoolParents(it)) {
+            parentHashes.insert(parentIt);
+        }
     }
 
     size_t totalSizeWithAncestors = entry.GetTxSize();
@@ -197,8 +260,7 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
             return false;
         }
 
-        const setEntries & setMemPoolParents = GetMemPoolParents(stageit);
-        for (const txiter &phash : setMemPoolParents) {
+        for (txiter phash : GetMemPoolParents(stageit)) {
             // If this is a new ancestor, add it.
             if (setAncestors.count(phash) == 0) {
                 parentHashes.insert(phash);
@@ -215,9 +277,8 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
 
 void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, setEntries &setAncestors)
 {
-    setEntries parentIters = GetMemPoolParents(it);
     // add or remove this tx as a child of each parent
-    for (txiter piter : parentIters) {
+    for (txiter piter : GetMemPoolParents(it)) {
         UpdateChild(piter, it, add);
     }
     const int64_t updateCount = (add ? 1 : -1);
@@ -244,8 +305,7 @@ void CTxMemPool::UpdateEntryForAncestors(txiter it, const setEntries &setAncesto
 
 void CTxMemPool::UpdateChildrenForRemoval(txiter it)
 {
-    const setEntries &setMemPoolChildren = GetMemPoolChildren(it);
-    for (txiter updateIt : setMemPoolChildren) {
+    for (txiter updateIt : GetMemPoolChildren(it)) {
         UpdateParent(updateIt, it, false);
     }
 }
@@ -259,7 +319,7 @@ void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove, b
         // updateDescendants should be true whenever we're not recursively
         // removing a tx and all its descendants, eg when a transaction is
         // confirmed in a block.
-        // Here we only update statistics and not data in mapLinks (which
+        // Here we only update statistics and not the entries' links (which
         // we need to preserve until we're finished with all operations that
         // need to traverse the mempool).
         for (txiter removeIt : entriesToRemove) {
@@ -284,16 +344,16 @@ void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove, b
         // should be a bit faster.
         // However, if we happen to be in the middle of processing a reorg, then
         // the mempool can be in an inconsistent state.  In this case, the set
-        // of ancestors reachable via mapLinks will be the same as the set of 
+        // of ancestors reachable via vParents will be the same as the set of 
         // ancestors whose packages include this transaction, because when we
         // add a new transaction to the mempool in addUnchecked(), we assume it
         // has no children, and in the case of a reorg where that assumption is
         // false, the in-mempool children aren't linked to the in-block tx's
         // until UpdateTransactionsFromBlock() is called.
         // So if we're being called during a reorg, ie before
-        // UpdateTransactionsFromBlock() has been called, then mapLinks[] will
+        // UpdateTransactionsFromBlock() has been called, then vParents will
         // differ from the set of mempool parents we'd calculate by searching,
-        // and it's important that we use the mapLinks[] notion of ancestor
+        // and it's important that we use the vParents notion of ancestor
         // transactions as the set of things to update for removal.
         CalculateMemPoolAncestors(entry, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
         // Note that UpdateAncestorsOf severs the child links that point to
@@ -301,7 +361,7 @@ void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove, b
         UpdateAncestorsOf(false, removeIt, setAncestors);
     }
     // After updating all the ancestor sizes, we can now sever the link between each
-    // transaction being removed and any mempool children (ie, update setMemPoolParents
+    // transaction being removed and any mempool children (ie, update vParents
     // for each direct child of a transaction being removed).
     for (txiter removeIt : entriesToRemove) {
         UpdateChildrenForRemoval(removeIt);
@@ -365,7 +425,6 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     // all the appropriate checks.
     LOCK(cs);
     indexed_transaction_set::iterator newit = mapTx.insert(entry).first;
-    mapLinks.insert(make_pair(newit, TxLinks()));
 
     // Update transaction for any feeDelta created by PrioritiseTransaction
     // TODO: refactor so that the fee delta is calculated before inserting
@@ -382,6 +441,7 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     // (When we update the entry for in-mempool parents, memory usage will be
     // further updated.)
     cachedInnerUsage += entry.DynamicMemoryUsage();
+    totalTxUsage += entry.DynamicMemoryUsage();
 
     const CTransaction& tx = newit->GetTx();
     std::set<uint256> setParentTransactions;
@@ -403,6 +463,8 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
             UpdateParent(newit, pit, true);
         }
     }
+    // Join (and merge) the clusters of all in-mempool parents
+    MergeClusters(newit);
     UpdateAncestorsOf(true, newit, setAncestors);
     UpdateEntryForAncestors(newit, setAncestors);
 
@@ -410,6 +472,7 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     totalTxSize += entry.GetTxSize();
     if (minerPolicyEstimator) {minerPolicyEstimator->processTransaction(entry, validFeeEstimate);}
 
+    ReserveOneMore(vTxHashes);
     vTxHashes.emplace_back(tx.GetWitnessHash(), newit);
     newit->vTxHashesIdx = vTxHashes.size() - 1;
 
@@ -432,10 +495,25 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
     } else
         vTxHashes.clear();
 
+    // Drop it from its cluster, which may now fall apart into several;
+    // LinearizeClusters() sorts that out.
+    if (it->nClusterId == 0) {
+        TailHeapErase(it);
+    } else {
+        MarkClusterDirty(it);
+        TxCluster& cluster = vClusters[it->nClusterId];
+        cachedInnerUsage -= ClusterUsage(cluster);
+        cluster.vTxs.erase(std::find(cluster.vTxs.begin(), cluster.vTxs.end(), it));
+        cachedInnerUsage += ClusterUsage(cluster);
+        if (cluster.vTxs.empty()) {
+            FreeCluster(it->nClusterId);
+        }
+    }
+
     totalTxSize -= it->GetTxSize();
     cachedInnerUsage -= it->DynamicMemoryUsage();
-    cachedInnerUsage -= memusage::DynamicUsage(mapLinks[it].parents) + memusage::DynamicUsage(mapLinks[it].children);
-    mapLinks.erase(it);
+    totalTxUsage -= it->DynamicMemoryUsage();
+    cachedInnerUsage -= memusage::DynamicUsage(it->vParents) + memusage::DynamicUsage(it->vChildren);
     mapTx.erase(it);
     nTransactionsUpdated++;
     if (minerPolicyEstimator) {minerPolicyEstimator->removeTx(hash, false);}
@@ -461,8 +539,7 @@ void CTxMemPool::CalculateDescendants(txiter entryit, setEntries &setDescendants
         setDescendants.insert(it);
         stage.erase(it);
 
-        const setEntries &setChildren = GetMemPoolChildren(it);
-        for (const txiter &childiter : setChildren) {
+        for (txiter childiter : GetMemPoolChildren(it)) {
             if (!setDescendants.count(childiter)) {
                 stage.insert(childiter);
             }
@@ -590,11 +667,16 @@ void CTxMemPool::removeForBlock(const std::vector<CTransactionRef>& vtx, unsigne
 
 void CTxMemPool::_clear()
 {
-    mapLinks.clear();
     mapTx.clear();
     mapNextTx.clear();
+    vTxHashes.clear();
+    vClusters.assign(1, TxCluster());
+    vFreeClusterIds.clear();
+    vDirtyClusters.clear();
+    vTailHeap.clear();
     totalTxSize = 0;
     cachedInnerUsage = 0;
+    totalTxUsage = 0;
     lastRollingFeeUpdate = GetTime();
     blockSinceLastRollingFeeBump = false;
     rollingMinimumFeeRate = 0;
@@ -628,6 +710,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
 
     uint64_t checkTotal = 0;
     uint64_t innerUsage = 0;
+    uint64_t txUsage = 0;
 
     CCoinsViewCache mempoolDuplicate(const_cast<CCoinsViewCache*>(pcoins));
     const int64_t spendheight = GetSpendHeight(mempoolDuplicate);
@@ -638,11 +721,11 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
         unsigned int i = 0;
         checkTotal += it->GetTxSize();
         innerUsage += it->DynamicMemoryUsage();
+        txUsage += it->DynamicMemoryUsage();
         const CTransaction& tx = it->GetTx();
-        txlinksMap::const_iterator linksiter = mapLinks.find(it);
-        assert(linksiter != mapLinks.end());
-        const TxLinks &links = linksiter->second;
-        innerUsage += memusage::DynamicUsage(links.parents) + memusage::DynamicUsage(links.children);
+        innerUsage += memusage::DynamicUsage(it->vParents) + memusage::DynamicUsage(it->vChildren);
+        assert(std::is_sorted(it->vParents.begin(), it->vParents.end()));
+        assert(std::is_sorted(it->vChildren.begin(), it->vChildren.end()));
         bool fDependsWait = false;
         setEntries setParentCheck;
         int64_t parentSizes = 0;
@@ -668,7 +751,11 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             assert(it3->second == &tx);
             i++;
         }
-        assert(setParentCheck == GetMemPoolParents(it));
+        const LinkedEntries parents = GetMemPoolParents(it);
+        assert(setParentCheck == setEntries(parents.begin(), parents.end()));
+        for (txiter parentIt : setParentCheck) {
+            assert(parentIt->nClusterId == it->nClusterId);
+        }
         // Verify ancestor state is correct.
         setEntries setAncestors;
         uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
@@ -692,16 +779,18 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
 
         // Check children against mapNextTx
         CTxMemPool::setEntries setChildrenCheck;
-        auto iter = mapNextTx.lower_bound(COutPoint(it->GetTx().GetHash(), 0));
         int64_t childSizes = 0;
-        for (; iter != mapNextTx.end() && iter->first->hash == it->GetTx().GetHash(); ++iter) {
+        for (uint32_t n = 0; n < tx.vout.size(); ++n) {
+            auto iter = mapNextTx.find(COutPoint(tx.GetHash(), n));
+            if (iter == mapNextTx.end()) continue;
             txiter childit = mapTx.find(iter->second->GetHash());
             assert(childit != mapTx.end()); // mapNextTx points to in-mempool transactions
             if (setChildrenCheck.insert(childit).second) {
                 childSizes += childit->GetTxSize();
             }
         }
-        assert(setChildrenCheck == GetMemPoolChildren(it));
+        const LinkedEntries children = GetMemPoolChildren(it);
+        assert(setChildrenCheck == setEntries(children.begin(), children.end()));
         // Also check to make sure size is greater than sum with immediate children.
         // just a sanity check, not definitive that this calc is correct...
         assert(it->GetSizeWithDescendants() >= childSizes + it->GetTxSize());
@@ -734,8 +823,71 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
         assert(&tx == it->second);
     }
 
+    // Clusters cover the whole mempool; clean ones are in topological order
+    // and split into chunks of non-increasing feerate, with their last
+    // transaction in vTailHeap.
+    size_t nClusterTxs = 0;
+    size_t nFreeClusters = 0;
+    size_t nTails = 0;
+    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
+        if (it->nClusterId == 0) {
+            ++nClusterTxs;
+            ++nTails;
+            assert(it->nTailPos < vTailHeap.size() && vTailHeap[it->nTailPos] == it);
+        }
+    }
+    for (uint32_t nClusterId = 1; nClusterId < vClusters.size(); ++nClusterId) {
+        const TxCluster& cluster = vClusters[nClusterId];
+        innerUsage += ClusterUsage(cluster);
+        if (cluster.vTxs.empty()) {
+            ++nFreeClusters;
+            continue;
+        }
+        nClusterTxs += cluster.vTxs.size();
+        for (txiter clusterIt : cluster.vTxs) {
+            assert(clusterIt->nClusterId == nClusterId);
+        }
+        if (cluster.vChunks.empty()) {
+            assert(std::count(vDirtyClusters.begin(), vDirtyClusters.end(), nClusterId));
+            continue;
+        }
+        ++nTails;
+        setEntries setEarlier;
+        size_t nChunkBegin = 0;
+        for (size_t i = 0; i < cluster.vChunks.size(); ++i) {
+            const TxChunk& chunk = cluster.vChunks[i];
+            assert(chunk.nBegin == nChunkBegin && chunk.nEnd > chunk.nBegin);
+            CAmount nFeeCheck = 0;
+            uint64_t nSizeCheck = 0;
+            for (size_t j = chunk.nBegin; j < chunk.nEnd; ++j) {
+                for (txiter parentIt : GetMemPoolParents(cluster.vTxs[j])) {
+                    assert(setEarlier.count(parentIt));
+                }
+                setEarlier.insert(cluster.vTxs[j]);
+                nFeeCheck += cluster.vTxs[j]->GetModifiedFee();
+                nSizeCheck += cluster.vTxs[j]->GetTxSize();
+            }
+            assert(chunk.nFee == nFeeCheck && chunk.nSize == nSizeCheck);
+            if (i > 0) {
+                const TxChunk& prev = cluster.vChunks[i - 1];
+                assert((double)chunk.nFee * prev.nSize <= (double)prev.nFee * chunk.nSize);
+            }
+            nChunkBegin = chunk.nEnd;
+        }
+        assert(nChunkBegin == cluster.vTxs.size());
+        const txiter tail = cluster.vTxs.back();
+        assert(tail->nTailPos < vTailHeap.size() && vTailHeap[tail->nTailPos] == tail);
+    }
+    assert(nClusterTxs == mapTx.size());
+    assert(nFreeClusters == vFreeClusterIds.size());
+    assert(nTails == vTailHeap.size());
+    for (size_t nPos = 1; nPos < vTailHeap.size(); ++nPos) {
+        assert(!CompareTail(vTailHeap[nPos], vTailHeap[(nPos - 1) / 2]));
+    }
+
     assert(totalTxSize == checkTotal);
     assert(innerUsage == cachedInnerUsage);
+    assert(txUsage == totalTxUsage);
 }
 
 bool CTxMemPool::CompareDepthAndScore(const uint256& hasha, const uint256& hashb)
@@ -856,6 +1008,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256& hash, const CAmount& nFeeD
             for (txiter descendantIt : setDescendants) {
                 mapTx.modify(descendantIt, update_ancestor_state(0, nFeeDelta, 0, 0));
             }
+            MarkClusterDirty(it);
             ++nTransactionsUpdated;
         }
     }
@@ -906,8 +1059,12 @@ bool CCoinsViewMemPool::GetCoin(const COutPoint &outpoint, Coin &coin) const {
 
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
-    // Estimate the overhead of mapTx to be 12 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 12 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
+    // Each mapTx node is an entry plus two pointers for the txid index and
+    // three for the entry time index, and the txid index has an array of
+    // one pointer per bucket.
+    size_t nMapTxUsage = memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 5 * sizeof(void*)) * mapTx.size() + memusage::MallocUsage(sizeof(void*) * (mapTx.bucket_count() + 1));
+    size_t nClusterUsage = memusage::DynamicUsage(vClusters) + memusage::DynamicUsage(vFreeClusterIds) + memusage::DynamicUsage(vDirtyClusters) + memusage::DynamicUsage(vTailHeap);
+    return nMapTxUsage + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(vTxHashes) + nClusterUsage + cachedInnerUsage;
 }
 
 void CTxMemPool::RemoveStaged(setEntries &stage, bool updateDescendants, MemPoolRemovalReason reason) {
@@ -944,40 +1101,42 @@ bool CTxMemPool::addUnchecked(const uint256&hash, const CTxMemPoolEntry &entry,
     return addUnchecked(hash, entry, setAncestors, validFeeEstimate);
 }
 
-void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
+void CTxMemPool::UpdateLinks(CTxMemPoolEntry::Links& links, const CTxMemPoolEntry* linked, bool add)
 {
-    setEntries s;
-    if (add && mapLinks[entry].children.insert(child).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && mapLinks[entry].children.erase(child)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+    auto pos = std::lower_bound(links.begin(), links.end(), linked);
+    const bool fLinked = pos != links.end() && *pos == linked;
+    if (add == fLinked) {
+        return;
     }
+    cachedInnerUsage -= memusage::DynamicUsage(links);
+    if (add) {
+        links.insert(pos, linked);
+    } else {
+        links.erase(pos);
+    }
+    cachedInnerUsage += memusage::DynamicUsage(links);
+}
+
+void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
+{
+    UpdateLinks(entry->vChildren, &*child, add);
 }
 
 void CTxMemPool::UpdateParent(txiter entry, txiter parent, bool add)
 {
-    setEntries s;
-    if (add && mapLinks[entry].parents.insert(parent).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && mapLinks[entry].parents.erase(parent)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
-    }
+    UpdateLinks(entry->vParents, &*parent, add);
 }
 
-const CTxMemPool::setEntries & CTxMemPool::GetMemPoolParents(txiter entry) const
+CTxMemPool::LinkedEntries CTxMemPool::GetMemPoolParents(txiter entry) const
 {
     assert (entry != mapTx.end());
-    txlinksMap::const_iterator it = mapLinks.find(entry);
-    assert(it != mapLinks.end());
-    return it->second.parents;
+    return LinkedEntries(mapTx, entry->vParents);
 }
 
-const CTxMemPool::setEntries & CTxMemPool::GetMemPoolChildren(txiter entry) const
+CTxMemPool::LinkedEntries CTxMemPool::GetMemPoolChildren(txiter entry) const
 {
     assert (entry != mapTx.end());
-    txlinksMap::const_iterator it = mapLinks.find(entry);
-    assert(it != mapLinks.end());
-    return it->second.children;
+    return LinkedEntries(mapTx, entry->vChildren);
 }
 
 CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const {
@@ -1018,19 +1177,35 @@ void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpends
     unsigned nTxnRemoved = 0;
     CFeeRate maxFeeRateRemoved(0);
     while (!mapTx.empty() && DynamicMemoryUsage() > sizelimit) {
-        indexed_transaction_set::index<descendant_score>::type::iterator it = mapTx.get<descendant_score>().begin();
+        // Evict the lowest feerate last chunk of any cluster: it is what block
+        // assembly would take last, and nothing outside it depends on it.
+        LinearizeClusters();
+        assert(!vTailHeap.empty());
+        const txiter worst = vTailHeap.front();
+        CAmount nFee;
+        uint64_t nSize;
+        GetTailChunk(worst, nFee, nSize);
 
         // We set the new mempool min fee to the feerate of the removed set, plus the
         // "minimum reasonable fee rate" (ie some value under which we consider txn
         // to have 0 fee). This way, we don't allow txn to enter mempool with feerate
         // equal to txn which were removed with no block in between.
-        CFeeRate removed(it->GetModFeesWithDescendants(), it->GetSizeWithDescendants());
+        CFeeRate removed(nFee, nSize);
         removed += incrementalRelayFee;
         trackPackageRemoved(removed);
         maxFeeRateRemoved = std::max(maxFeeRateRemoved, removed);
 
         setEntries stage;
-        CalculateDescendants(mapTx.project<0>(it), stage);
+        const uint32_t nClusterId = worst->nClusterId;
+        prevector<2, TxChunk> vChunksLeft;
+        if (nClusterId == 0) {
+            stage.insert(worst);
+        } else {
+            const TxCluster& cluster = vClusters[nClusterId];
+            const TxChunk& chunk = cluster.vChunks.back();
+            stage.insert(cluster.vTxs.begin() + chunk.nBegin, cluster.vTxs.begin() + chunk.nEnd);
+            vChunksLeft.assign(cluster.vChunks.begin(), cluster.vChunks.end() - 1);
+        }
         nTxnRemoved += stage.size();
 
         std::vector<CTransaction> txn;
@@ -1040,6 +1215,15 @@ void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpends
                 txn.push_back(iter->GetTx());
         }
         RemoveStaged(stage, false, MemPoolRemovalReason::SIZELIMIT);
+        // The transactions before the evicted chunk keep their order and
+        // chunks, so unless they fell apart they need no relinearization.
+        if (nClusterId != 0 && vClusters[nClusterId].vTxs.size() > 1 && IsClusterConnected(nClusterId)) {
+            TxCluster& cluster = vClusters[nClusterId];
+            cachedInnerUsage -= ClusterUsage(cluster);
+            cluster.vChunks = vChunksLeft;
+            cachedInnerUsage += ClusterUsage(cluster);
+            TailHeapPush(cluster.vTxs.back());
+        }
         if (pvNoSpendsRemaining) {
             for (const CTransaction& tx : txn) {
                 for (const CTxIn& txin : tx.vin) {
@@ -1055,6 +1239,376 @@ void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpends
     }
 }
 
+uint32_t CTxMemPool::NewCluster()
+{
+    if (!vFreeClusterIds.empty()) {
+        const uint32_t nClusterId = vFreeClusterIds.back();
+        vFreeClusterIds.pop_back();
+        return nClusterId;
+    }
+    ReserveOneMore(vClusters);
+    vClusters.emplace_back();
+    return vClusters.size() - 1;
+}
+
+void CTxMemPool::FreeCluster(uint32_t nClusterId)
+{
+    cachedInnerUsage -= ClusterUsage(vClusters[nClusterId]);
+    vClusters[nClusterId] = TxCluster();
+    vFreeClusterIds.push_back(nClusterId);
+}
+
+size_t CTxMemPool::ClusterUsage(const TxCluster& cluster) const
+{
+    return memusage::DynamicUsage(cluster.vTxs) + memusage::DynamicUsage(cluster.vChunks);
+}
+
+void CTxMemPool::GetTailChunk(txiter entry, CAmount& nFee, uint64_t& nSize) const
+{
+    if (entry->nClusterId == 0) {
+        nFee = entry->GetModifiedFee();
+        nSize = entry->GetTxSize();
+    } else {
+        const TxChunk& tail = vClusters[entry->nClusterId].vChunks.back();
+        nFee = tail.nFee;
+        nSize = tail.nSize;
+    }
+}
+
+// Orders vTailHeap by the feerate of the last chunk, lowest first
+bool CTxMemPool::CompareTail(txiter a, txiter b) const
+{
+    CAmount a_fee, b_fee;
+    uint64_t a_size, b_size;
+    GetTailChunk(a, a_fee, a_size);
+    GetTailChunk(b, b_fee, b_size);
+    // Avoid division by rewriting (a/b < c/d) as (a*d < c*b).
+    double f1 = (double)a_fee * b_size;
+    double f2 = (double)b_fee * a_size;
+    if (f1 == f2) {
+        return CompareIteratorByHash()(a, b);
+    }
+    return f1 < f2;
+}
+
+void CTxMemPool::TailHeapPush(txiter entry)
+{
+    ReserveOneMore(vTailHeap);
+    entry->nTailPos = vTailHeap.size();
+    vTailHeap.push_back(entry);
+    TailHeapSift(entry->nTailPos);
+}
+
+void CTxMemPool::TailHeapErase(txiter entry)
+{
+    const size_t nPos = entry->nTailPos;
+    assert(nPos < vTailHeap.size() && vTailHeap[nPos] == entry);
+    entry->nTailPos = NOT_IN_TAIL_HEAP;
+    const txiter last = vTailHeap.back();
+    vTailHeap.pop_back();
+    if (last != entry) {
+        vTailHeap[nPos] = last;
+        last->nTailPos = nPos;
+        TailHeapSift(nPos);
+    }
+}
+
+// Restore the heap order after the element at nPos was placed or changed
+void CTxMemPool::TailHeapSift(size_t nPos)
+{
+    const txiter entry = vTailHeap[nPos];
+    while (nPos > 0 && CompareTail(entry, vTailHeap[(nPos - 1) / 2])) {
+        vTailHeap[nPos] = vTailHeap[(nPos - 1) / 2];
+        vTailHeap[nPos]->nTailPos = nPos;
+        nPos = (nPos - 1) / 2;
+    }
+    while (true) {
+        size_t nChild = 2 * nPos + 1;
+        if (nChild >= vTailHeap.size()) break;
+        if (nChild + 1 < vTailHeap.size() && CompareTail(vTailHeap[nChild + 1], vTailHeap[nChild])) {
+            ++nChild;
+        }
+        if (!CompareTail(vTailHeap[nChild], entry)) break;
+        vTailHeap[nPos] = vTailHeap[nChild];
+        vTailHeap[nPos]->nTailPos = nPos;
+        nPos = nChild;
+    }
+    vTailHeap[nPos] = entry;
+    entry->nTailPos = nPos;
+}
+
+void CTxMemPool::MarkClusterDirty(txiter entry)
+{
+    if (entry->nClusterId == 0) {
+        TailHeapSift(entry->nTailPos);
+        return;
+    }
+    TxCluster& cluster = vClusters[entry->nClusterId];
+    if (cluster.vChunks.empty()) return;
+    // A clean cluster's last transaction is in vTailHeap; its chunks are stale now
+    TailHeapErase(cluster.vTxs.back());
+    cachedInnerUsage -= ClusterUsage(cluster);
+    cluster.vChunks = prevector<2, TxChunk>();
+    cachedInnerUsage += ClusterUsage(cluster);
+    vDirtyClusters.push_back(entry->nClusterId);
+}
+
+void CTxMemPool::MergeClusters(txiter entry)
+{
+    // Move everything into the largest of the clusters involved, so the work
+    // done is proportional to the size of the smaller ones. Linked entries
+    // with no cluster record join it one by one.
+    std::vector<uint32_t> vMerge;
+    std::vector<txiter> vAlone;
+    auto add = [&](txiter it) {
+        if (it->nClusterId == 0) {
+            vAlone.push_back(it);
+        } else if (std::find(vMerge.begin(), vMerge.end(), it->nClusterId) == vMerge.end()) {
+            vMerge.push_back(it->nClusterId);
+        }
+    };
+    add(entry);
+    for (txiter it : GetMemPoolParents(entry)) add(it);
+    for (txiter it : GetMemPoolChildren(entry)) add(it);
+    if (vMerge.empty() && vAlone.size() == 1) {
+        // Still a cluster of its own
+        if (entry->nTailPos == NOT_IN_TAIL_HEAP) {
+            TailHeapPush(entry);
+        }
+        return;
+    }
+
+    uint32_t nTarget = 0;
+    for (uint32_t nClusterId : vMerge) {
+        if (nTarget == 0 || vClusters[nClusterId].vTxs.size() > vClusters[nTarget].vTxs.size()) {
+            nTarget = nClusterId;
+        }
+    }
+    if (nTarget == 0) {
+        nTarget = NewCluster();
+        vDirtyClusters.push_back(nTarget);
+    } else {
+        MarkClusterDirty(vClusters[nTarget].vTxs.front());
+    }
+
+    TxCluster& target = vClusters[nTarget];
+    cachedInnerUsage -= ClusterUsage(target);
+    for (uint32_t nClusterId : vMerge) {
+        if (nClusterId == nTarget) continue;
+        MarkClusterDirty(vClusters[nClusterId].vTxs.front());
+        for (txiter it : vClusters[nClusterId].vTxs) {
+            it->nClusterId = nTarget;
+            target.vTxs.push_back(it);
+        }
+        FreeCluster(nClusterId);
+    }
+    for (txiter it : vAlone) {
+        if (it->nTailPos != NOT_IN_TAIL_HEAP) {
+            TailHeapErase(it);
+        }
+        it->nClusterId = nTarget;
+        target.vTxs.push_back(it);
+    }
+    cachedInnerUsage += ClusterUsage(target);
+}
+
+// Whether the transactions of a cluster are still all linked to one another.
+// Those reached from the first are marked with an id no cluster has.
+bool CTxMemPool::IsClusterConnected(uint32_t nClusterId) const
+{
+    const uint32_t nReached = std::numeric_limits<uint32_t>::max();
+    const TxCluster& cluster = vClusters[nClusterId];
+    std::vector<txiter> vReached(1, cluster.vTxs.front());
+    cluster.vTxs.front()->nClusterId = nReached;
+    for (size_t i = 0; i < vReached.size(); ++i) {
+        for (const LinkedEntries& linked : {GetMemPoolParents(vReached[i]), GetMemPoolChildren(vReached[i])}) {
+            for (txiter it : linked) {
+                if (it->nClusterId == nClusterId) {
+                    it->nClusterId = nReached;
+                    vReached.push_back(it);
+                }
+            }
+        }
+    }
+    for (txiter it : vReached) {
+        it->nClusterId = nClusterId;
+    }
+    return vReached.size() == cluster.vTxs.size();
+}
+
+// Find a good order for the transactions of a cluster and split it into chunks.
+//
+// Clusters of up to 64 transactions are linearized by repeatedly picking the
+// remaining transaction whose remaining ancestor set has the highest feerate,
+// and emitting that ancestor set. Ancestor sets are kept as bitmasks over a
+// topological order, and their fees and sizes are updated as transactions are
+// picked, so this is quadratic in the cluster size. Larger clusters (only
+// possible with a raised -limitclustercount, or during a reorg) keep a plain
+// topological order.
+//
+// The chunks are then found by merging each transaction into the chunk before
+// it for as long as it raises that chunk's feerate, which leaves chunks of
+// non-increasing feerate.
+void CTxMemPool::LinearizeCluster(TxCluster& cluster) const
+{
+    prevector<2, txiter>& vTxs = cluster.vTxs;
+    // A transaction has more ancestors than any of its ancestors, so this is
+    // a topological order.
+    std::sort(vTxs.begin(), vTxs.end(), [](const txiter& a, const txiter& b) {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CompareIteratorByHash()(a, b);
+    });
+
+    const size_t n = vTxs.size();
+    if (n > 1 && n <= 64) {
+        std::vector<uint64_t> vAncestors(n);
+        std::vector<CAmount> vFee(n);
+        std::vector<uint64_t> vSize(n);
+        for (size_t i = 0; i < n; ++i) {
+            vAncestors[i] = uint64_t{1} << i;
+            for (txiter parent : GetMemPoolParents(vTxs[i])) {
+                // Parents come first in topological order
+                vAncestors[i] |= vAncestors[std::find(vTxs.begin(), vTxs.begin() + i, parent) - vTxs.begin()];
+            }
+            for (size_t j = 0; j <= i; ++j) {
+                if ((vAncestors[i] >> j) & 1) {
+                    vFee[i] += vTxs[j]->GetModifiedFee();
+                    vSize[i] += vTxs[j]->GetTxSize();
+                }
+            }
+        }
+
+        std::vector<txiter> vOrder;
+        vOrder.reserve(n);
+        uint64_t nRemaining = n == 64 ? ~uint64_t{0} : (uint64_t{1} << n) - 1;
+        while (nRemaining) {
+            size_t nBest = n;
+            for (size_t i = 0; i < n; ++i) {
+                if (!((nRemaining >> i) & 1)) continue;
+                if (nBest == n || (double)vFee[i] * vSize[nBest] > (double)vFee[nBest] * vSize[i]) {
+                    nBest = i;
+                }
+            }
+            const uint64_t nPicked = vAncestors[nBest] & nRemaining;
+            nRemaining &= ~nPicked;
+            for (size_t i = 0; i < n; ++i) {
+                if ((nPicked >> i) & 1) {
+                    vOrder.push_back(vTxs[i]);
+                } else if ((nRemaining >> i) & 1) {
+                    const uint64_t nOverlap = vAncestors[i] & nPicked;
+                    for (size_t j = 0; j < i; ++j) {
+                        if ((nOverlap >> j) & 1) {
+                            vFee[i] -= vTxs[j]->GetModifiedFee();
+                            vSize[i] -= vTxs[j]->GetTxSize();
+                        }
+                    }
+                }
+            }
+        }
+        vTxs.assign(vOrder.begin(), vOrder.end());
+    }
+
+    cluster.vChunks.clear();
+    for (uint32_t i = 0; i < n; ++i) {
+        TxChunk chunk{i, i + 1, vTxs[i]->GetModifiedFee(), vTxs[i]->GetTxSize()};
+        while (!cluster.vChunks.empty() &&
+                (double)chunk.nFee * cluster.vChunks.back().nSize > (double)cluster.vChunks.back().nFee * chunk.nSize) {
+            const TxChunk& prev = cluster.vChunks.back();
+            chunk.nBegin = prev.nBegin;
+            chunk.nFee += prev.nFee;
+            chunk.nSize += prev.nSize;
+            cluster.vChunks.pop_back();
+        }
+        cluster.vChunks.push_back(chunk);
+    }
+}
+
+void CTxMemPool::LinearizeClusters()
+{
+    AssertLockHeld(cs);
+    const uint32_t nUnassigned = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> vDirty;
+    vDirty.swap(vDirtyClusters);
+    for (uint32_t nClusterId : vDirty) {
+        // Skip clusters freed, or already relinearized, since being queued
+        if (vClusters[nClusterId].vTxs.empty() || !vClusters[nClusterId].vChunks.empty()) continue;
+
+        // Removals may have split the cluster. The first connected component
+        // of several transactions keeps the id, any others get new clusters,
+        // and transactions left on their own get none. Entries are marked
+        // unassigned first.
+        cachedInnerUsage -= ClusterUsage(vClusters[nClusterId]);
+        std::vector<txiter> vTxs(vClusters[nClusterId].vTxs.begin(), vClusters[nClusterId].vTxs.end());
+        vClusters[nClusterId].vTxs = prevector<2, txiter>();
+        cachedInnerUsage += ClusterUsage(vClusters[nClusterId]);
+        for (txiter it : vTxs) {
+            it->nClusterId = nUnassigned;
+        }
+        bool fReused = false;
+        std::vector<txiter> vComponent;
+        for (txiter root : vTxs) {
+            if (root->nClusterId != nUnassigned) continue;
+            root->nClusterId = 0;
+            vComponent.assign(1, root);
+            for (size_t i = 0; i < vComponent.size(); ++i) {
+                for (const LinkedEntries& linked : {GetMemPoolParents(vComponent[i]), GetMemPoolChildren(vComponent[i])}) {
+                    for (txiter it : linked) {
+                        if (it->nClusterId == nUnassigned) {
+                            it->nClusterId = 0;
+                            vComponent.push_back(it);
+                        }
+                    }
+                }
+            }
+            if (vComponent.size() == 1) {
+                TailHeapPush(root);
+                continue;
+            }
+            const uint32_t nComponentId = fReused ? NewCluster() : nClusterId;
+            fReused = true;
+            TxCluster& cluster = vClusters[nComponentId];
+            for (txiter it : vComponent) {
+                it->nClusterId = nComponentId;
+            }
+            cluster.vTxs.assign(vComponent.begin(), vComponent.end());
+            LinearizeCluster(cluster);
+            cachedInnerUsage += ClusterUsage(cluster);
+            TailHeapPush(cluster.vTxs.back());
+        }
+        if (!fReused) {
+            FreeCluster(nClusterId);
+        }
+    }
+}
+
+uint64_t CTxMemPool::CalculateClusterSize(const setEntries& setAncestors, const setEntries& setReplaced)
+{
+    // Dirty clusters may really be several; split them first
+    LinearizeClusters();
+    std::map<uint32_t, uint64_t> mapClusterCount;
+    uint64_t nCount = 1;
+    for (txiter it : setAncestors) {
+        if (it->nClusterId == 0) {
+            ++nCount;
+        } else {
+            mapClusterCount.emplace(it->nClusterId, vClusters[it->nClusterId].vTxs.size());
+        }
+    }
+    // Removing the replaced transactions may also split a cluster, so this
+    // is still an upper bound.
+    for (txiter it : setReplaced) {
+        auto mi = mapClusterCount.find(it->nClusterId);
+        if (mi != mapClusterCount.end()) {
+            --mi->second;
+        }
+    }
+    for (const auto& entry : mapClusterCount) {
+        nCount += entry.second;
+    }
+    return nCount;
+}
+
 bool CTxMemPool::TransactionWithinChainLimit(const uint256& txid, size_t chainLimit) const {
     LOCK(cs);
     auto it = mapTx.find(txid);
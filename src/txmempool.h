@@ -6,6 +6,7 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <iterator>
 #include <memory>
 #include <set>
 #include <map>
@@ -17,6 +18,7 @@
 #include <coins.h>
 #include <indirectmap.h>
 #include <policy/feerate.h>
+#include <prevector.h>
 #include <primitives/transaction.h>
 #include <sync.h>
 #include <random.h>
@@ -59,19 +61,25 @@ class CTxMemPool;
  * (nCountWithDescendants, nSizeWithDescendants, and nModFeesWithDescendants) for
  * all ancestors of the newly added transaction.
  *
+ * Every entry is a node of CTxMemPool::mapTx, so the members are ordered and
+ * sized to keep it small.
  */
 
 class CTxMemPoolEntry
 {
+public:
+    /** In-mempool parents or children of an entry, ordered by address. Most
+     *  transactions have at most one of each, which is stored inline. */
+    typedef prevector<1, const CTxMemPoolEntry*> Links;
+
 private:
     CTransactionRef tx;
     CAmount nFee;              //!< Cached to avoid expensive parent-transaction lookups
-    size_t nTxWeight;          //!< ... and avoid recomputing tx weight (also used for GetTxSize())
-    size_t nUsageSize;         //!< ... and total memory usage
+    int32_t nTxWeight;         //!< ... and avoid recomputing tx weight (also used for GetTxSize())
+    uint32_t nUsageSize;       //!< ... and total memory usage
     int64_t nTime;             //!< Local time when entering the mempool
     unsigned int entryHeight;  //!< Chain height when entering the mempool
-    bool spendsCoinbase;       //!< keep track of transactions that spend a coinbase
-    int64_t sigOpCost;         //!< Total sigop cost
+    int32_t sigOpCost;         //!< Total sigop cost
     int64_t feeDelta;          //!< Used for determining the priority of the transaction for mining in a block
     LockPoints lockPoints;     //!< Track the height and time at which tx was final
 
@@ -88,6 +96,8 @@ private:
     CAmount nModFeesWithAncestors;
     int64_t nSigOpCostWithAncestors;
 
+    bool spendsCoinbase;       //!< keep track of transactions that spend a coinbase
+
 public:
     CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee,
                     int64_t _nTime, unsigned int _entryHeight,
@@ -127,7 +137,11 @@ public:
     CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
     int64_t GetSigOpCostWithAncestors() const { return nSigOpCostWithAncestors; }
 
-    mutable size_t vTxHashesIdx; //!< Index in mempool's vTxHashes
+    mutable uint32_t vTxHashesIdx; //!< Index in mempool's vTxHashes
+    mutable uint32_t nClusterId;   //!< Id of the mempool cluster containing this entry, or 0 if it is linked to no other
+    mutable uint32_t nTailPos;     //!< Position in the mempool's vTailHeap while this entry ends a clean cluster
+    mutable Links vParents;        //!< In-mempool parents
+    mutable Links vChildren;       //!< In-mempool children
 };
 
 // Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
@@ -197,48 +211,6 @@ struct mempoolentry_txid
     }
 };
 
-/** \class CompareTxMemPoolEntryByDescendantScore
- *
- *  Sort an entry by max(score/size of entry's tx, score/size with all descendants).
- */
-class CompareTxMemPoolEntryByDescendantScore
-{
-public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
-    {
-        double a_mod_fee, a_size, b_mod_fee, b_size;
-
-        GetModFeeAndSize(a, a_mod_fee, a_size);
-        GetModFeeAndSize(b, b_mod_fee, b_size);
-
-        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b).
-        double f1 = a_mod_fee * b_size;
-        double f2 = a_size * b_mod_fee;
-
-        if (f1 == f2) {
-            return a.GetTime() >= b.GetTime();
-        }
-        return f1 < f2;
-    }
-
-    // Return the fee/size we're using for sorting this entry.
-    void GetModFeeAndSize(const CTxMemPoolEntry &a, double &mod_fee, double &size) const
-    {
-        // Compare feerate with descendants to feerate of the transaction, and
-        // return the fee/size for the max.
-        double f1 = (double)a.GetModifiedFee() * a.GetSizeWithDescendants();
-        double f2 = (double)a.GetModFeesWithDescendants() * a.GetTxSize();
-
-        if (f2 > f1) {
-            mod_fee = a.GetModFeesWithDescendants();
-            size = a.GetSizeWithDescendants();
-        } else {
-            mod_fee = a.GetModifiedFee();
-            size = a.GetTxSize();
-        }
-    }
-};
-
 /** \class CompareTxMemPoolEntryByScore
  *
  *  Sort by score of entry ((fee+delta)/size) in descending order
@@ -266,54 +238,8 @@ public:
     }
 };
 
-/** \class CompareTxMemPoolEntryByAncestorScore
- *
- *  Sort an entry by min(score/size of entry's tx, score/size with all ancestors).
- */
-class CompareTxMemPoolEntryByAncestorFee
-{
-public:
-    template<typename T>
-    bool operator()(const T& a, const T& b) const
-    {
-        double a_mod_fee, a_size, b_mod_fee, b_size;
-
-        GetModFeeAndSize(a, a_mod_fee, a_size);
-        GetModFeeAndSize(b, b_mod_fee, b_size);
-
-        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b).
-        double f1 = a_mod_fee * b_size;
-        double f2 = a_size * b_mod_fee;
-
-        if (f1 == f2) {
-            return a.GetTx().GetHash() < b.GetTx().GetHash();
-        }
-        return f1 > f2;
-    }
-
-    // Return the fee/size we're using for sorting this entry.
-    template <typename T>
-    void GetModFeeAndSize(const T &a, double &mod_fee, double &size) const
-    {
-        // Compare feerate with ancestors to feerate of the transaction, and
-        // return the fee/size for the min.
-        double f1 = (double)a.GetModifiedFee() * a.GetSizeWithAncestors();
-        double f2 = (double)a.GetModFeesWithAncestors() * a.GetTxSize();
-
-        if (f1 > f2) {
-            mod_fee = a.GetModFeesWithAncestors();
-            size = a.GetSizeWithAncestors();
-        } else {
-            mod_fee = a.GetModifiedFee();
-            size = a.GetTxSize();
-        }
-    }
-};
-
 // Multi_index tag names
-struct descendant_score {};
 struct entry_time {};
-struct ancestor_score {};
 
 class CBlockPolicyEstimator;
 
@@ -377,9 +303,8 @@ public:
  *
  * CTxMemPool::mapTx, and CTxMemPoolEntry bookkeeping:
  *
- * mapTx is a boost::multi_index that sorts the mempool on 4 criteria:
+ * mapTx is a boost::multi_index that sorts the mempool on 2 criteria:
  * - transaction hash
- * - feerate [we use max(feerate of tx, feerate of tx with all descendants)]
  * - time in mempool
  *
  * Note: the term "descendant" refers to in-mempool transactions that depend on
@@ -388,18 +313,19 @@ public:
  *
  * In order for the feerate sort to remain correct, we must update transactions
  * in the mempool when new descendants arrive.  To facilitate this, we track
- * the set of in-mempool direct parents and direct children in mapLinks.  Within
- * each CTxMemPoolEntry, we track the size and fees of all descendants.
+ * the in-mempool direct parents and direct children of each CTxMemPoolEntry.
+ * Within each CTxMemPoolEntry, we also track the size and fees of all
+ * descendants.
  *
  * Usually when a new transaction is added to the mempool, it has no in-mempool
  * children (because any such children would be an orphan).  So in
  * addUnchecked(), we:
- * - update a new entry's setMemPoolParents to include all in-mempool parents
+ * - update a new entry's vParents to include all in-mempool parents
  * - update the new entry's direct parents to include the new tx as a child
  * - update all ancestors of the transaction to include the new tx's size/fee
  *
  * When a transaction is removed from the mempool, we must:
- * - update all in-mempool parents to not track the tx in setMemPoolChildren
+ * - update all in-mempool parents to not track the tx in vChildren
  * - update all ancestors to not include the tx's size/fees in descendant state
  * - update all in-mempool children to not include it as a parent
  *
@@ -421,10 +347,23 @@ public:
  * state, to account for in-mempool, out-of-block descendants for all the
  * in-block transactions by calling UpdateTransactionsFromBlock().  Note that
  * until this is called, the mempool state is not consistent, and in particular
- * mapLinks may not be correct (and therefore functions like
+ * the entries' links may not be correct (and therefore functions like
  * CalculateMemPoolAncestors() and CalculateDescendants() that rely
  * on them to walk the mempool are not generally safe to use).
  *
+ * Clusters:
+ *
+ * Transactions connected through in-mempool parent/child links form a
+ * cluster. Each cluster is linearized into a topologically valid order that
+ * puts high feerate ancestor sets first, and that order is split into chunks
+ * of non-increasing feerate. Block assembly takes the best next chunk of any
+ * cluster, and TrimToSize() evicts the worst last chunk of any cluster, so
+ * both agree on which transactions are most valuable. Clusters are merged
+ * in addUnchecked() and UpdateTransactionsFromBlock(), marked dirty whenever
+ * they change, and split and relinearized lazily by LinearizeClusters().
+ * Clusters live in one flat array, and most transactions are not linked to
+ * any other, so those get no cluster record at all.
+ *
  * Computational limits:
  *
  * Updating all in-mempool ancestors of a newly added transaction can be slow,
@@ -442,6 +381,7 @@ private:
 
     uint64_t totalTxSize;      //!< sum of all mempool tx's virtual sizes. Differs from serialized tx size since witness data is discounted. Defined in BIP 141.
     uint64_t cachedInnerUsage; //!< sum of dynamic memory usage of all the map elements (NOT the maps themselves)
+    uint64_t totalTxUsage;     //!< sum of dynamic memory usage of all mempool tx's, the part of cachedInnerUsage that is not bookkeeping
 
     mutable int64_t lastRollingFeeUpdate;
     mutable bool blockSinceLastRollingFeeBump;
@@ -450,6 +390,14 @@ private:
     void trackPackageRemoved(const CFeeRate& rate);
 
 public:
+    /** A run of consecutive transactions in a cluster's linearization that is
+     *  mined or evicted as a unit. Chunks are in non-increasing feerate order. */
+    struct TxChunk {
+        uint32_t nBegin; //!< Index of the chunk's first transaction in vTxs
+        uint32_t nEnd;   //!< One past the chunk's last transaction
+        CAmount nFee;   //!< Sum of modified fees
+        uint64_t nSize; //!< Sum of virtual sizes
+    };
 
     static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12; // public only for testing
 
@@ -458,23 +406,11 @@ public:
         boost::multi_index::indexed_by<
             // sorted by txid
             boost::multi_index::hashed_unique<mempoolentry_txid, SaltedTxidHasher>,
-            // sorted by fee rate
-            boost::multi_index::ordered_non_unique<
-                boost::multi_index::tag<descendant_score>,
-                boost::multi_index::identity<CTxMemPoolEntry>,
-                CompareTxMemPoolEntryByDescendantScore
-            >,
             // sorted by entry time
             boost::multi_index::ordered_non_unique<
                 boost::multi_index::tag<entry_time>,
                 boost::multi_index::identity<CTxMemPoolEntry>,
                 CompareTxMemPoolEntryByEntryTime
-            >,
-            // sorted by fee rate with ancestors
-            boost::multi_index::ordered_non_unique<
-                boost::multi_index::tag<ancestor_score>,
-                boost::multi_index::identity<CTxMemPoolEntry>,
-                CompareTxMemPoolEntryByAncestorFee
             >
         >
     > indexed_transaction_set;
@@ -492,26 +428,101 @@ public:
     };
     typedef std::set<txiter, CompareIteratorByHash> setEntries;
 
-    const setEntries & GetMemPoolParents(txiter entry) const;
-    const setEntries & GetMemPoolChildren(txiter entry) const;
+    /** A connected component of the mempool's dependency graph with more
+     *  than one transaction. Unless vChunks is empty, which marks the cluster
+     *  as waiting for LinearizeClusters(), vTxs holds its transactions in a
+     *  topologically valid order that front-loads fees, and vChunks
+     *  partitions that order into chunks. A free slot has no vTxs. */
+    struct TxCluster {
+        prevector<2, txiter> vTxs;
+        prevector<2, TxChunk> vChunks;
+    };
+
+    /** The in-mempool parents or children of an entry, as iterators into
+     *  mapTx. Only valid until the links of the entry change. */
+    class LinkedEntries
+    {
+    public:
+        class const_iterator
+        {
+        public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef txiter value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef const txiter* pointer;
+            typedef txiter reference;
+
+            const_iterator(const indexed_transaction_set& mapTxIn, CTxMemPoolEntry::Links::const_iterator itIn) : pmapTx(&mapTxIn), it(itIn) {}
+            txiter operator*() const { return pmapTx->iterator_to(**it); }
+            const_iterator& operator++() { ++it; return *this; }
+            bool operator==(const const_iterator& other) const { return it == other.it; }
+            bool operator!=(const const_iterator& other) const { return it != other.it; }
+        private:
+            const indexed_transaction_set* pmapTx;
+            CTxMemPoolEntry::Links::const_iterator it;
+        };
+
+        LinkedEntries(const indexed_transaction_set& mapTxIn, const CTxMemPoolEntry::Links& linksIn) : mapTx(mapTxIn), links(linksIn) {}
+        const_iterator begin() const { return const_iterator(mapTx, links.begin()); }
+        const_iterator end() const { return const_iterator(mapTx, links.end()); }
+        size_t size() const { return links.size(); }
+        bool empty() const { return links.empty(); }
+
+    private:
+        const indexed_transaction_set& mapTx;
+        const CTxMemPoolEntry::Links& links;
+    };
+
+    LinkedEntries GetMemPoolParents(txiter entry) const;
+    LinkedEntries GetMemPoolChildren(txiter entry) const;
 private:
     typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
 
-    struct TxLinks {
-        setEntries parents;
-        setEntries children;
+    /** For lookups only, where the order does not matter, compare entries by
+     *  address rather than paying for a txid comparison. */
+    struct CompareIteratorByAddress {
+        bool operator()(const txiter &a, const txiter &b) const {
+            return &*a < &*b;
+        }
     };
 
-    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
-    txlinksMap mapLinks;
+    std::vector<TxCluster> vClusters;      //!< Clusters by id; slot 0 is unused
+    std::vector<uint32_t> vFreeClusterIds; //!< Free slots of vClusters
+    std::vector<uint32_t> vDirtyClusters;  //!< Clusters that need to be split and linearized, possibly repeated or freed since
+    /** The last transaction of every clean cluster, including those of a
+     *  single transaction, as a binary heap with the lowest last chunk
+     *  feerate on top. Each entry knows its position (nTailPos). */
+    std::vector<txiter> vTailHeap;
+
+    /** Queue the cluster of entry for LinearizeClusters() after it changed.
+     *  An entry with no cluster record just moves to its new place in
+     *  vTailHeap. */
+    void MarkClusterDirty(txiter entry);
+    /** Merge the cluster of entry with those of all its linked entries */
+    void MergeClusters(txiter entry);
+    /** Compute the linearization and chunks of one connected cluster */
+    void LinearizeCluster(TxCluster& cluster) const;
+    /** Whether a cluster is still one connected component */
+    bool IsClusterConnected(uint32_t nClusterId) const;
+    uint32_t NewCluster();
+    void FreeCluster(uint32_t nClusterId);
+    size_t ClusterUsage(const TxCluster& cluster) const;
+
+    /** Feerate of the last chunk of the clean cluster ending in entry */
+    void GetTailChunk(txiter entry, CAmount& nFee, uint64_t& nSize) const;
+    bool CompareTail(txiter a, txiter b) const;
+    void TailHeapPush(txiter entry);
+    void TailHeapErase(txiter entry);
+    void TailHeapSift(size_t nPos);
 
     void UpdateParent(txiter entry, txiter parent, bool add);
     void UpdateChild(txiter entry, txiter child, bool add);
+    void UpdateLinks(CTxMemPoolEntry::Links& links, const CTxMemPoolEntry* linked, bool add);
 
     std::vector<indexed_transaction_set::const_iterator> GetSortedDepthAndScore() const;
 
 public:
-    indirectmap<COutPoint, const CTransaction*> mapNextTx;
+    indirecthashmap<COutPoint, const CTransaction*, SaltedOutpointHasher> mapNextTx;
     std::map<uint256, CAmount> mapDeltas;
 
     /** Create a new CTxMemPool.
@@ -589,7 +600,7 @@ public:
      *  limitDescendantSize = max size of descendants any ancestor can have
      *  errString = populated with error reason if any limits are hit
      *  fSearchForParents = whether to search a tx's vin for in-mempool parents, or
-     *    look up parents from mapLinks. Must be true for entries not in the mempool
+     *    look up the entry's vParents. Must be true for entries not in the mempool
      */
     bool CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents = true) const;
 
@@ -615,6 +626,22 @@ public:
     /** Expire all transaction (and their dependencies) in the mempool older than time. Return the number of removed transactions. */
     int Expire(int64_t time);
 
+    /** Split and relinearize every cluster that changed since the last call,
+      * so GetClusterTails() and the eviction order are up to date. */
+    void LinearizeClusters();
+
+    /** The last transaction of every cluster, in no particular order. Its
+      * nClusterId is 0 if it is the whole cluster, or otherwise the id to
+      * pass to GetCluster(). Only complete after LinearizeClusters(); requires
+      * cs. */
+    const std::vector<txiter>& GetClusterTails() const { return vTailHeap; }
+    const TxCluster& GetCluster(uint32_t nClusterId) const { return vClusters[nClusterId]; }
+
+    /** Number of transactions in the cluster a new transaction with the given
+      * in-mempool ancestors would join, including itself, not counting those
+      * in setReplaced that it evicts. */
+    uint64_t CalculateClusterSize(const setEntries& setAncestors, const setEntries& setReplaced);
+
     /** Returns false if the transaction is in the mempool and not within the chain limit specified. */
     bool TransactionWithinChainLimit(const uint256& txid, size_t chainLimit) const;
 
@@ -630,6 +657,12 @@ public:
         return totalTxSize;
     }
 
+    uint64_t GetTotalTxUsage() const
+    {
+        LOCK(cs);
+        return totalTxUsage;
+    }
+
     bool exists(uint256 hash) const
     {
         LOCK(cs);
@@ -646,22 +679,6 @@ public:
     boost::signals2::signal<void (CTransactionRef, MemPoolRemovalReason)> NotifyEntryRemoved;
 
 private:
-    /** UpdateForDescendants is used by UpdateTransactionsFromBlock to update
-     *  the descendants for a single transaction that has been added to the
-     *  mempool but may have child transactions in the mempool, eg during a
-     *  chain reorg.  setExclude is the set of descendant transactions in the
-     *  mempool that must not be accounted for (because any descendants in
-     *  setExclude were added to the mempool after the transaction being
-     *  updated and hence their state is already reflected in the parent
-     *  state).
-     *
-     *  cachedDescendants will be updated with the descendants of the transaction
-     *  being updated, so that future invocations don't need to walk the
-     *  same transaction again, if encountered in another transaction chain.
-     */
-    void UpdateForDescendants(txiter updateIt,
-            cacheMap &cachedDescendants,
-            const std::set<uint256> &setExclude);
     /** Update ancestors of hash to add/remove it as a descendant transaction. */
     void UpdateAncestorsOf(bool add, txiter hash, setEntries &setAncestors);
     /** Set ancestor state for an entry */
@@ -676,7 +693,7 @@ private:
     /** Before calling removeUnchecked for a given transaction,
      *  UpdateForRemoveFromMempool must be called on the entire (dependent) set
      *  of transactions being removed at the same time.  We use each
-     *  CTxMemPoolEntry's setMemPoolParents in order to walk ancestors of a
+     *  CTxMemPoolEntry's vParents in order to walk ancestors of a
      *  given transaction that is removed, so we can't remove intermediate
      *  transactions in a chain before we've updated all the state for the
      *  removal.
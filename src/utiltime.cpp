@@ -57,6 +57,13 @@ int64_t GetSystemTimeInSeconds()
     return GetTimeMicros()/1000000;
 }
 
+int64_t GetMockableTimeMicros()
+{
+    int64_t mocktime = nMockTime.load(std::memory_order_relaxed);
+    if (mocktime) return mocktime * 1000000;
+    return GetTimeMicros();
+}
+
 void MilliSleep(int64_t n)
 {
 
@@ -18,6 +18,7 @@
 #include <consensus/validation.h>
 #include <cuckoocache.h>
 #include <hash.h>
+#include <index/txindex.h>
 #include <init.h>
 #include <policy/fees.h>
 #include <policy/policy.h>
@@ -216,13 +217,13 @@ uint256 hashBestBlock;
 int nScriptCheckThreads = 0;
 std::atomic_bool fImporting(false);
 std::atomic_bool fReindex(false);
-bool fTxIndex = false;
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
+bool fFastBlockRelay = DEFAULT_FAST_BLOCK_RELAY;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
@@ -301,6 +302,7 @@ static bool FlushStateToDisk(const CChainParams& chainParams, CValidationState &
 static void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPruneHeight);
 static void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight);
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = nullptr);
+static void CacheScriptExecution(const CTransaction& tx, unsigned int flags);
 static FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 
 bool CheckFinalTx(const CTransaction &tx, int flags)
@@ -477,6 +479,9 @@ static bool IsCurrentForFeeEstimation()
 void UpdateMempoolForReorg(DisconnectedBlockTransactions &disconnectpool, bool fAddToMempool)
 {
     AssertLockHeld(cs_main);
+    // Re-add the whole batch under one lock, so nobody sees the mempool
+    // before UpdateTransactionsFromBlock has linked it back together.
+    LOCK(mempool.cs);
     std::vector<uint256> vHashUpdate;
     // disconnectpool's insertion_order index sorts the entries from
     // oldest to newest, but the oldest entry will be the last tx from the
@@ -516,7 +521,7 @@ void UpdateMempoolForReorg(DisconnectedBlockTransactions &disconnectpool, bool f
 // Used to avoid mempool polluting consensus critical paths if CCoinsViewMempool
 // were somehow broken and returning the wrong scriptPubKeys
 static bool CheckInputsFromMempoolAndCache(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, CTxMemPool& pool,
-                 unsigned int flags, bool cacheSigStore, PrecomputedTransactionData& txdata) {
+                 unsigned int flags, bool cacheSigStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = nullptr) {
     AssertLockHeld(cs_main);
 
     // pool.cs should be locked already, but go ahead and re-take the lock here
@@ -546,27 +551,62 @@ static bool CheckInputsFromMempoolAndCache(const CTransaction& tx, CValidationSt
         }
     }
 
-    return CheckInputs(tx, state, view, true, flags, cacheSigStore, true, txdata);
+    return CheckInputs(tx, state, view, true, flags, cacheSigStore, true, txdata, pvChecks);
 }
 
-static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx,
-                              bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
-                              bool bypass_limits, const CAmount& nAbsurdFee, std::vector<COutPoint>& coins_to_uncache)
+namespace {
+
+/**
+ * What PreChecks works out about a transaction, for the script checks and
+ * the insertion that follow under the same locks.
+ */
+struct MemPoolAcceptWorkspace
 {
-    const CTransaction& tx = *ptx;
-    const uint256 hash = tx.GetHash();
-    AssertLockHeld(cs_main);
-    LOCK(pool.cs); // mempool "read lock" (held through GetMainSignals().TransactionAddedToMempool())
-    if (pfMissingInputs) {
-        *pfMissingInputs = false;
-    }
+    explicit MemPoolAcceptWorkspace(const CTransactionRef& ptxIn) : ptx(ptxIn), txdata(*ptxIn) {}
 
-    if (!CheckTransaction(tx, state))
-        return false; // state filled in by CheckTransaction
+    const CTransactionRef ptx;
+    PrecomputedTransactionData txdata;
 
-    // Coinbase is only valid in a block, not as a loose transaction
-    if (tx.IsCoinBase())
-        return state.DoS(100, false, REJECT_INVALID, "coinbase");
+    // Filled in by PreChecks
+    CCoinsView dummy;
+    std::unique_ptr<CCoinsViewCache> view;
+    std::unique_ptr<CTxMemPoolEntry> entry;
+    std::set<uint256> setConflicts;
+    CTxMemPool::setEntries setAncestors;
+    CTxMemPool::setEntries allConflicting;
+    CAmount nModifiedFees;
+    CAmount nConflictingFees;
+    size_t nConflictingSize;
+    unsigned int scriptVerifyFlags;
+
+    // Script checks taken by LoadMempoolBatch, for the script check threads
+    std::vector<CScriptCheck> vPolicyChecks;
+    std::vector<CScriptCheck> vConsensusChecks;
+};
+
+} // namespace
+
+// Everything but script verification, against the current chain and mempool
+static bool PreChecks(const CChainParams& chainparams, CTxMemPool& pool, CValidationState& state, MemPoolAcceptWorkspace& ws,
+                      bool* pfMissingInputs, int64_t nAcceptTime, bool bypass_limits, const CAmount& nAbsurdFee,
+                      std::vector<COutPoint>& coins_to_uncache)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(pool.cs);
+    const CTransaction& tx = *ws.ptx;
+    const uint256& hash = tx.GetHash();
+
+    std::set<uint256>& setConflicts = ws.setConflicts;
+    CTxMemPool::setEntries& setAncestors = ws.setAncestors;
+    CTxMemPool::setEntries& allConflicting = ws.allConflicting;
+    CAmount& nModifiedFees = ws.nModifiedFees;
+    CAmount& nConflictingFees = ws.nConflictingFees;
+    size_t& nConflictingSize = ws.nConflictingSize;
+    setConflicts.clear();
+    setAncestors.clear();
+    allConflicting.clear();
+    nConflictingFees = 0;
+    nConflictingSize = 0;
 
     // Reject transactions with witness before segregated witness activates (override with -prematurewitness)
     bool witnessEnabled = IsWitnessEnabled(chainActive.Tip(), chainparams.GetConsensus());
@@ -597,7 +637,6 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
     }
 
     // Check for conflicts with in-memory transactions
-    std::set<uint256> setConflicts;
     for (const CTxIn &txin : tx.vin)
     {
         auto itConflicting = pool.mapNextTx.find(txin.prevout);
@@ -639,345 +678,420 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
         }
     }
 
-    {
-        CCoinsView dummy;
-        CCoinsViewCache view(&dummy);
-
-        LockPoints lp;
-        CCoinsViewMemPool viewMemPool(pcoinsTip.get(), pool);
-        view.SetBackend(viewMemPool);
+    LockPoints lp;
+    CCoinsViewMemPool viewMemPool(pcoinsTip.get(), pool);
+    ws.view.reset(new CCoinsViewCache(&ws.dummy));
+    CCoinsViewCache& view = *ws.view;
+    view.SetBackend(viewMemPool);
 
-        // do all inputs exist?
-        for (const CTxIn txin : tx.vin) {
-            if (!pcoinsTip->HaveCoinInCache(txin.prevout)) {
-                coins_to_uncache.push_back(txin.prevout);
-            }
-            if (!view.HaveCoin(txin.prevout)) {
-                // Are inputs missing because we already have the tx?
-                for (size_t out = 0; out < tx.vout.size(); out++) {
-                    // Optimistically just do efficient check of cache for outputs
-                    if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out))) {
-                        return state.Invalid(false, REJECT_DUPLICATE, "txn-already-known");
-                    }
-                }
-                // Otherwise assume this might be an orphan tx for which we just haven't seen parents yet
-                if (pfMissingInputs) {
-                    *pfMissingInputs = true;
+    // do all inputs exist?
+    for (const CTxIn txin : tx.vin) {
+        if (!pcoinsTip->HaveCoinInCache(txin.prevout)) {
+            coins_to_uncache.push_back(txin.prevout);
+        }
+        if (!view.HaveCoin(txin.prevout)) {
+            // Are inputs missing because we already have the tx?
+            for (size_t out = 0; out < tx.vout.size(); out++) {
+                // Optimistically just do efficient check of cache for outputs
+                if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out))) {
+                    return state.Invalid(false, REJECT_DUPLICATE, "txn-already-known");
                 }
-                return false; // fMissingInputs and !state.IsInvalid() is used to detect this condition, don't set state.Invalid()
             }
+            // Otherwise assume this might be an orphan tx for which we just haven't seen parents yet
+            if (pfMissingInputs) {
+                *pfMissingInputs = true;
+            }
+            return false; // fMissingInputs and !state.IsInvalid() is used to detect this condition, don't set state.Invalid()
         }
+    }
 
-        // Bring the best block into scope
-        view.GetBestBlock();
+    // Bring the best block into scope
+    view.GetBestBlock();
 
-        // we have all inputs cached now, so switch back to dummy, so we don't need to keep lock on mempool
-        view.SetBackend(dummy);
+    // we have all inputs cached now, so switch back to dummy, so we don't need to keep lock on mempool
+    view.SetBackend(ws.dummy);
 
-        // Only accept BIP68 sequence locked transactions that can be mined in the next
-        // block; we don't want our mempool filled up with transactions that can't
-        // be mined yet.
-        // Must keep pool.cs for this unless we change CheckSequenceLocks to take a
-        // CoinsViewCache instead of create its own
-        if (!CheckSequenceLocks(tx, STANDARD_LOCKTIME_VERIFY_FLAGS, &lp))
-            return state.DoS(0, false, REJECT_NONSTANDARD, "non-BIP68-final");
+    // Only accept BIP68 sequence locked transactions that can be mined in the next
+    // block; we don't want our mempool filled up with transactions that can't
+    // be mined yet.
+    // Must keep pool.cs for this unless we change CheckSequenceLocks to take a
+    // CoinsViewCache instead of create its own
+    if (!CheckSequenceLocks(tx, STANDARD_LOCKTIME_VERIFY_FLAGS, &lp))
+        return state.DoS(0, false, REJECT_NONSTANDARD, "non-BIP68-final");
 
-        CAmount nFees = 0;
-        if (!Consensus::CheckTxInputs(tx, state, view, GetSpendHeight(view), nFees)) {
-            return error("%s: Consensus::CheckTxInputs: %s, %s", __func__, tx.GetHash().ToString(), FormatStateMessage(state));
-        }
+    CAmount nFees = 0;
+    if (!Consensus::CheckTxInputs(tx, state, view, GetSpendHeight(view), nFees)) {
+        return error("%s: Consensus::CheckTxInputs: %s, %s", __func__, tx.GetHash().ToString(), FormatStateMessage(state));
+    }
 
-        // Check for non-standard pay-to-script-hash in inputs
-        if (fRequireStandard && !AreInputsStandard(tx, view))
-            return state.Invalid(false, REJECT_NONSTANDARD, "bad-txns-nonstandard-inputs");
+    // Check for non-standard pay-to-script-hash in inputs
+    if (fRequireStandard && !AreInputsStandard(tx, view))
+        return state.Invalid(false, REJECT_NONSTANDARD, "bad-txns-nonstandard-inputs");
 
-        // Check for non-standard witness in P2WSH
-        if (tx.HasWitness() && fRequireStandard && !IsWitnessStandard(tx, view))
-            return state.DoS(0, false, REJECT_NONSTANDARD, "bad-witness-nonstandard", true);
+    // Check for non-standard witness in P2WSH
+    if (tx.HasWitness() && fRequireStandard && !IsWitnessStandard(tx, view))
+        return state.DoS(0, false, REJECT_NONSTANDARD, "bad-witness-nonstandard", true);
 
-        int64_t nSigOpsCost = GetTransactionSigOpCost(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
+    int64_t nSigOpsCost = GetTransactionSigOpCost(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
 
-        // nModifiedFees includes any fee deltas from PrioritiseTransaction
-        CAmount nModifiedFees = nFees;
-        pool.ApplyDelta(hash, nModifiedFees);
+    // nModifiedFees includes any fee deltas from PrioritiseTransaction
+    nModifiedFees = nFees;
+    pool.ApplyDelta(hash, nModifiedFees);
 
-        // Keep track of transactions that spend a coinbase, which we re-scan
-        // during reorgs to ensure COINBASE_MATURITY is still met.
-        bool fSpendsCoinbase = false;
-        for (const CTxIn &txin : tx.vin) {
-            const Coin &coin = view.AccessCoin(txin.prevout);
-            if (coin.IsCoinBase()) {
-                fSpendsCoinbase = true;
-                break;
-            }
+    // Keep track of transactions that spend a coinbase, which we re-scan
+    // during reorgs to ensure COINBASE_MATURITY is still met.
+    bool fSpendsCoinbase = false;
+    for (const CTxIn &txin : tx.vin) {
+        const Coin &coin = view.AccessCoin(txin.prevout);
+        if (coin.IsCoinBase()) {
+            fSpendsCoinbase = true;
+            break;
         }
+    }
 
-        CTxMemPoolEntry entry(ptx, nFees, nAcceptTime, chainActive.Height(),
-                              fSpendsCoinbase, nSigOpsCost, lp);
-        unsigned int nSize = entry.GetTxSize();
+    ws.entry.reset(new CTxMemPoolEntry(ws.ptx, nFees, nAcceptTime, chainActive.Height(),
+                                       fSpendsCoinbase, nSigOpsCost, lp));
+    const CTxMemPoolEntry& entry = *ws.entry;
+    unsigned int nSize = entry.GetTxSize();
 
-        // Check that the transaction doesn't have an excessive number of
-        // sigops, making it impossible to mine. Since the coinbase transaction
-        // itself can contain sigops MAX_STANDARD_TX_SIGOPS is less than
-        // MAX_BLOCK_SIGOPS; we still consider this an invalid rather than
-        // merely non-standard transaction.
-        if (nSigOpsCost > MAX_STANDARD_TX_SIGOPS_COST)
-            return state.DoS(0, false, REJECT_NONSTANDARD, "bad-txns-too-many-sigops", false,
-                strprintf("%d", nSigOpsCost));
+    // Check that the transaction doesn't have an excessive number of
+    // sigops, making it impossible to mine. Since the coinbase transaction
+    // itself can contain sigops MAX_STANDARD_TX_SIGOPS is less than
+    // MAX_BLOCK_SIGOPS; we still consider this an invalid rather than
+    // merely non-standard transaction.
+    if (nSigOpsCost > MAX_STANDARD_TX_SIGOPS_COST)
+        return state.DoS(0, false, REJECT_NONSTANDARD, "bad-txns-too-many-sigops", false,
+            strprintf("%d", nSigOpsCost));
 
-        CAmount mempoolRejectFee = pool.GetMinFee(gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
-        if (!bypass_limits && mempoolRejectFee > 0 && nModifiedFees < mempoolRejectFee) {
-            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool min fee not met", false, strprintf("%d < %d", nFees, mempoolRejectFee));
-        }
+    CAmount mempoolRejectFee = pool.GetMinFee(gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+    if (!bypass_limits && mempoolRejectFee > 0 && nModifiedFees < mempoolRejectFee) {
+        return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool min fee not met", false, strprintf("%d < %d", nFees, mempoolRejectFee));
+    }
 
-        // No transactions are allowed below minRelayTxFee except from disconnected blocks
-        if (!bypass_limits && nModifiedFees < ::minRelayTxFee.GetFee(nSize)) {
-            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "min relay fee not met");
-        }
+    // No transactions are allowed below minRelayTxFee except from disconnected blocks
+    if (!bypass_limits && nModifiedFees < ::minRelayTxFee.GetFee(nSize)) {
+        return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "min relay fee not met");
+    }
 
-        if (nAbsurdFee && nFees > nAbsurdFee)
-            return state.Invalid(false,
-                REJECT_HIGHFEE, "absurdly-high-fee",
-                strprintf("%d > %d", nFees, nAbsurdFee));
+    if (nAbsurdFee && nFees > nAbsurdFee)
+        return state.Invalid(false,
+            REJECT_HIGHFEE, "absurdly-high-fee",
+            strprintf("%d > %d", nFees, nAbsurdFee));
 
-        // Calculate in-mempool ancestors, up to a limit.
-        CTxMemPool::setEntries setAncestors;
-        size_t nLimitAncestors = gArgs.GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
-        size_t nLimitAncestorSize = gArgs.GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
-        size_t nLimitDescendants = gArgs.GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
-        size_t nLimitDescendantSize = gArgs.GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000;
-        std::string errString;
-        if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
-            return state.DoS(0, false, REJECT_NONSTANDARD, "too-long-mempool-chain", false, errString);
-        }
+    // Calculate in-mempool ancestors, up to a limit.
+    size_t nLimitAncestors = gArgs.GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+    size_t nLimitAncestorSize = gArgs.GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
+    size_t nLimitDescendants = gArgs.GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+    size_t nLimitDescendantSize = gArgs.GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000;
+    std::string errString;
+    if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
+        return state.DoS(0, false, REJECT_NONSTANDARD, "too-long-mempool-chain", false, errString);
+    }
 
-        // A transaction that spends outputs that would be replaced by it is invalid. Now
-        // that we have the set of all ancestors we can detect this
-        // pathological case by making sure setConflicts and setAncestors don't
-        // intersect.
-        for (CTxMemPool::txiter ancestorIt : setAncestors)
+    // A transaction that spends outputs that would be replaced by it is invalid. Now
+    // that we have the set of all ancestors we can detect this
+    // pathological case by making sure setConflicts and setAncestors don't
+    // intersect.
+    for (CTxMemPool::txiter ancestorIt : setAncestors)
+    {
+        const uint256 &hashAncestor = ancestorIt->GetTx().GetHash();
+        if (setConflicts.count(hashAncestor))
         {
-            const uint256 &hashAncestor = ancestorIt->GetTx().GetHash();
-            if (setConflicts.count(hashAncestor))
-            {
-                return state.DoS(10, false,
-                                 REJECT_INVALID, "bad-txns-spends-conflicting-tx", false,
-                                 strprintf("%s spends conflicting transaction %s",
-                                           hash.ToString(),
-                                           hashAncestor.ToString()));
-            }
+            return state.DoS(10, false,
+                             REJECT_INVALID, "bad-txns-spends-conflicting-tx", false,
+                             strprintf("%s spends conflicting transaction %s",
+                                       hash.ToString(),
+                                       hashAncestor.ToString()));
         }
+    }
 
-        // Check if it's economically rational to mine this transaction rather
-        // than the ones it replaces.
-        CAmount nConflictingFees = 0;
-        size_t nConflictingSize = 0;
-        uint64_t nConflictingCount = 0;
-        CTxMemPool::setEntries allConflicting;
+    // Check if it's economically rational to mine this transaction rather
+    // than the ones it replaces.
+    uint64_t nConflictingCount = 0;
 
-        // If we don't hold the lock allConflicting might be incomplete; the
-        // subsequent RemoveStaged() and addUnchecked() calls don't guarantee
-        // mempool consistency for us.
-        const bool fReplacementTransaction = setConflicts.size();
-        if (fReplacementTransaction)
+    // If we don't hold the lock allConflicting might be incomplete; the
+    // subsequent RemoveStaged() and addUnchecked() calls don't guarantee
+    // mempool consistency for us.
+    const bool fReplacementTransaction = setConflicts.size();
+    if (fReplacementTransaction)
+    {
+        CFeeRate newFeeRate(nModifiedFees, nSize);
+        std::set<uint256> setConflictsParents;
+        const int maxDescendantsToVisit = 100;
+        CTxMemPool::setEntries setIterConflicting;
+        for (const uint256 &hashConflicting : setConflicts)
         {
-            CFeeRate newFeeRate(nModifiedFees, nSize);
-            std::set<uint256> setConflictsParents;
-            const int maxDescendantsToVisit = 100;
-            CTxMemPool::setEntries setIterConflicting;
-            for (const uint256 &hashConflicting : setConflicts)
-            {
-                CTxMemPool::txiter mi = pool.mapTx.find(hashConflicting);
-                if (mi == pool.mapTx.end())
-                    continue;
-
-                // Save these to avoid repeated lookups
-                setIterConflicting.insert(mi);
-
-                // Don't allow the replacement to reduce the feerate of the
-                // mempool.
-                //
-                // We usually don't want to accept replacements with lower
-                // feerates than what they replaced as that would lower the
-                // feerate of the next block. Requiring that the feerate always
-                // be increased is also an easy-to-reason about way to prevent
-                // DoS attacks via replacements.
-                //
-                // The mining code doesn't (currently) take children into
-                // account (CPFP) so we only consider the feerates of
-                // transactions being directly replaced, not their indirect
-                // descendants. While that does mean high feerate children are
-                // ignored when deciding whether or not to replace, we do
-                // require the replacement to pay more overall fees too,
-                // mitigating most cases.
-                CFeeRate oldFeeRate(mi->GetModifiedFee(), mi->GetTxSize());
-                if (newFeeRate <= oldFeeRate)
-                {
-                    return state.DoS(0, false,
-                            REJECT_INSUFFICIENTFEE, "insufficient fee", false,
-                            strprintf("rejecting replacement %s; new feerate %s <= old feerate %s",
-                                  hash.ToString(),
-                                  newFeeRate.ToString(),
-                                  oldFeeRate.ToString()));
-                }
-
-                for (const CTxIn &txin : mi->GetTx().vin)
-                {
-                    setConflictsParents.insert(txin.prevout.hash);
-                }
+            CTxMemPool::txiter mi = pool.mapTx.find(hashConflicting);
+            if (mi == pool.mapTx.end())
+                continue;
 
-                nConflictingCount += mi->GetCountWithDescendants();
-            }
-            // This potentially overestimates the number of actual descendants
-            // but we just want to be conservative to avoid doing too much
-            // work.
-            if (nConflictingCount <= maxDescendantsToVisit) {
-                // If not too many to replace, then calculate the set of
-                // transactions that would have to be evicted
-                for (CTxMemPool::txiter it : setIterConflicting) {
-                    pool.CalculateDescendants(it, allConflicting);
-                }
-                for (CTxMemPool::txiter it : allConflicting) {
-                    nConflictingFees += it->GetModifiedFee();
-                    nConflictingSize += it->GetTxSize();
-                }
-            } else {
+            // Save these to avoid repeated lookups
+            setIterConflicting.insert(mi);
+
+            // Don't allow the replacement to reduce the feerate of the
+            // mempool.
+            //
+            // We usually don't want to accept replacements with lower
+            // feerates than what they replaced as that would lower the
+            // feerate of the next block. Requiring that the feerate always
+            // be increased is also an easy-to-reason about way to prevent
+            // DoS attacks via replacements.
+            //
+            // The mining code doesn't (currently) take children into
+            // account (CPFP) so we only consider the feerates of
+            // transactions being directly replaced, not their indirect
+            // descendants. While that does mean high feerate children are
+            // ignored when deciding whether or not to replace, we do
+            // require the replacement to pay more overall fees too,
+            // mitigating most cases.
+            CFeeRate oldFeeRate(mi->GetModifiedFee(), mi->GetTxSize());
+            if (newFeeRate <= oldFeeRate)
+            {
                 return state.DoS(0, false,
-                        REJECT_NONSTANDARD, "too many potential replacements", false,
-                        strprintf("rejecting replacement %s; too many potential replacements (%d > %d)\n",
-                            hash.ToString(),
-                            nConflictingCount,
-                            maxDescendantsToVisit));
+                        REJECT_INSUFFICIENTFEE, "insufficient fee", false,
+                        strprintf("rejecting replacement %s; new feerate %s <= old feerate %s",
+                              hash.ToString(),
+                              newFeeRate.ToString(),
+                              oldFeeRate.ToString()));
             }
 
-            for (unsigned int j = 0; j < tx.vin.size(); j++)
+            for (const CTxIn &txin : mi->GetTx().vin)
             {
-                // We don't want to accept replacements that require low
-                // feerate junk to be mined first. Ideally we'd keep track of
-                // the ancestor feerates and make the decision based on that,
-                // but for now requiring all new inputs to be confirmed works.
-                if (!setConflictsParents.count(tx.vin[j].prevout.hash))
-                {
-                    // Rather than check the UTXO set - potentially expensive -
-                    // it's cheaper to just check if the new input refers to a
-                    // tx that's in the mempool.
-                    if (pool.mapTx.find(tx.vin[j].prevout.hash) != pool.mapTx.end())
-                        return state.DoS(0, false,
-                                         REJECT_NONSTANDARD, "replacement-adds-unconfirmed", false,
-                                         strprintf("replacement %s adds unconfirmed input, idx %d",
-                                                  hash.ToString(), j));
-                }
+                setConflictsParents.insert(txin.prevout.hash);
             }
 
-            // The replacement must pay greater fees than the transactions it
-            // replaces - if we did the bandwidth used by those conflicting
-            // transactions would not be paid for.
-            if (nModifiedFees < nConflictingFees)
-            {
-                return state.DoS(0, false,
-                                 REJECT_INSUFFICIENTFEE, "insufficient fee", false,
-                                 strprintf("rejecting replacement %s, less fees than conflicting txs; %s < %s",
-                                          hash.ToString(), FormatMoney(nModifiedFees), FormatMoney(nConflictingFees)));
+            nConflictingCount += mi->GetCountWithDescendants();
+        }
+        // This potentially overestimates the number of actual descendants
+        // but we just want to be conservative to avoid doing too much
+        // work.
+        if (nConflictingCount <= maxDescendantsToVisit) {
+            // If not too many to replace, then calculate the set of
+            // transactions that would have to be evicted
+            for (CTxMemPool::txiter it : setIterConflicting) {
+                pool.CalculateDescendants(it, allConflicting);
+            }
+            for (CTxMemPool::txiter it : allConflicting) {
+                nConflictingFees += it->GetModifiedFee();
+                nConflictingSize += it->GetTxSize();
             }
+        } else {
+            return state.DoS(0, false,
+                    REJECT_NONSTANDARD, "too many potential replacements", false,
+                    strprintf("rejecting replacement %s; too many potential replacements (%d > %d)\n",
+                        hash.ToString(),
+                        nConflictingCount,
+                        maxDescendantsToVisit));
+        }
 
-            // Finally in addition to paying more fees than the conflicts the
-            // new transaction must pay for its own bandwidth.
-            CAmount nDeltaFees = nModifiedFees - nConflictingFees;
-            if (nDeltaFees < ::incrementalRelayFee.GetFee(nSize))
+        for (unsigned int j = 0; j < tx.vin.size(); j++)
+        {
+            // We don't want to accept replacements that require low
+            // feerate junk to be mined first. Ideally we'd keep track of
+            // the ancestor feerates and make the decision based on that,
+            // but for now requiring all new inputs to be confirmed works.
+            if (!setConflictsParents.count(tx.vin[j].prevout.hash))
             {
-                return state.DoS(0, false,
-                        REJECT_INSUFFICIENTFEE, "insufficient fee", false,
-                        strprintf("rejecting replacement %s, not enough additional fees to relay; %s < %s",
-                              hash.ToString(),
-                              FormatMoney(nDeltaFees),
-                              FormatMoney(::incrementalRelayFee.GetFee(nSize))));
+                // Rather than check the UTXO set - potentially expensive -
+                // it's cheaper to just check if the new input refers to a
+                // tx that's in the mempool.
+                if (pool.mapTx.find(tx.vin[j].prevout.hash) != pool.mapTx.end())
+                    return state.DoS(0, false,
+                                     REJECT_NONSTANDARD, "replacement-adds-unconfirmed", false,
+                                     strprintf("replacement %s adds unconfirmed input, idx %d",
+                                              hash.ToString(), j));
             }
         }
 
-        unsigned int scriptVerifyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
-        if (!chainparams.RequireStandard()) {
-            scriptVerifyFlags = gArgs.GetArg("-promiscuousmempoolflags", scriptVerifyFlags);
+        // The replacement must pay greater fees than the transactions it
+        // replaces - if we did the bandwidth used by those conflicting
+        // transactions would not be paid for.
+        if (nModifiedFees < nConflictingFees)
+        {
+            return state.DoS(0, false,
+                             REJECT_INSUFFICIENTFEE, "insufficient fee", false,
+                             strprintf("rejecting replacement %s, less fees than conflicting txs; %s < %s",
+                                      hash.ToString(), FormatMoney(nModifiedFees), FormatMoney(nConflictingFees)));
         }
 
-        // Check against previous transactions
-        // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        PrecomputedTransactionData txdata(tx);
-        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, false, txdata)) {
-            // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
-            // need to turn both off, and compare against just turning off CLEANSTACK
-            // to see if the failure is specifically due to witness validation.
-            CValidationState stateDummy; // Want reported failures to be from first CheckInputs
-            if (!tx.HasWitness() && CheckInputs(tx, stateDummy, view, true, scriptVerifyFlags & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK), true, false, txdata) &&
-                !CheckInputs(tx, stateDummy, view, true, scriptVerifyFlags & ~SCRIPT_VERIFY_CLEANSTACK, true, false, txdata)) {
-                // Only the witness is missing, so the transaction itself may be fine.
-                state.SetCorruptionPossible();
-            }
-            return false; // state filled in by CheckInputs
-        }
-
-        // Check again against the current block tip's script verification
-        // flags to cache our script execution flags. This is, of course,
-        // useless if the next block has different script flags from the
-        // previous one, but because the cache tracks script flags for us it
-        // will auto-invalidate and we'll just have a few blocks of extra
-        // misses on soft-fork activation.
-        //
-        // This is also useful in case of bugs in the standard flags that cause
-        // transactions to pass as valid when they're actually invalid. For
-        // instance the STRICTENC flag was incorrectly allowing certain
-        // CHECKSIG NOT scripts to pass, even though they were invalid.
-        //
-        // There is a similar check in CreateNewBlock() to prevent creating
-        // invalid blocks (using TestBlockValidity), however allowing such
-        // transactions into the mempool can be exploited as a DoS attack.
-        unsigned int currentBlockScriptVerifyFlags = GetBlockScriptFlags(chainActive.Tip(), Params().GetConsensus());
-        if (!CheckInputsFromMempoolAndCache(tx, state, view, pool, currentBlockScriptVerifyFlags, true, txdata))
+        // Finally in addition to paying more fees than the conflicts the
+        // new transaction must pay for its own bandwidth.
+        CAmount nDeltaFees = nModifiedFees - nConflictingFees;
+        if (nDeltaFees < ::incrementalRelayFee.GetFee(nSize))
         {
-            // If we're using promiscuousmempoolflags, we may hit this normally
-            // Check if current block has some flags that scriptVerifyFlags
-            // does not before printing an ominous warning
-            if (!(~scriptVerifyFlags & currentBlockScriptVerifyFlags)) {
-                return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against latest-block but not STANDARD flags %s, %s",
+            return state.DoS(0, false,
+                    REJECT_INSUFFICIENTFEE, "insufficient fee", false,
+                    strprintf("rejecting replacement %s, not enough additional fees to relay; %s < %s",
+                          hash.ToString(),
+                          FormatMoney(nDeltaFees),
+                          FormatMoney(::incrementalRelayFee.GetFee(nSize))));
+        }
+    }
+
+    // Clusters are linearized exactly only up to 64 transactions. This is
+    // checked after the replacement rules, so that the transactions this one
+    // replaces do not count towards it. It is not checked for transactions
+    // from disconnected blocks: clusters are incomplete until
+    // UpdateTransactionsFromBlock() links their in-mempool children, and
+    // splitting them per transaction would make every reorg relinearize the
+    // same clusters over and over.
+    if (!bypass_limits) {
+        size_t nLimitCluster = gArgs.GetArg("-limitclustercount", DEFAULT_CLUSTER_LIMIT);
+        uint64_t nClusterSize = pool.CalculateClusterSize(setAncestors, allConflicting);
+        if (nClusterSize > nLimitCluster) {
+            return state.DoS(0, false, REJECT_NONSTANDARD, "too-large-cluster", false,
+                strprintf("cluster would have %u transactions [limit: %u]", nClusterSize, nLimitCluster));
+        }
+    }
+
+    ws.scriptVerifyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
+    if (!chainparams.RequireStandard()) {
+        ws.scriptVerifyFlags = gArgs.GetArg("-promiscuousmempoolflags", ws.scriptVerifyFlags);
+    }
+
+    return true;
+}
+
+// Script verification with the locks held, reporting exactly why it failed
+static bool ScriptChecks(const CChainParams& chainparams, CTxMemPool& pool, CValidationState& state, MemPoolAcceptWorkspace& ws)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(pool.cs);
+    const CTransaction& tx = *ws.ptx;
+    const uint256& hash = tx.GetHash();
+
+    // Check against previous transactions
+    // This is done last to help prevent CPU exhaustion denial-of-service attacks.
+    if (!CheckInputs(tx, state, *ws.view, true, ws.scriptVerifyFlags, true, false, ws.txdata)) {
+        // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
+        // need to turn both off, and compare against just turning off CLEANSTACK
+        // to see if the failure is specifically due to witness validation.
+        CValidationState stateDummy; // Want reported failures to be from first CheckInputs
+        if (!tx.HasWitness() && CheckInputs(tx, stateDummy, *ws.view, true, ws.scriptVerifyFlags & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK), true, false, ws.txdata) &&
+            !CheckInputs(tx, stateDummy, *ws.view, true, ws.scriptVerifyFlags & ~SCRIPT_VERIFY_CLEANSTACK, true, false, ws.txdata)) {
+            // Only the witness is missing, so the transaction itself may be fine.
+            state.SetCorruptionPossible();
+        }
+        return false; // state filled in by CheckInputs
+    }
+
+    // Check again against the current block tip's script verification
+    // flags to cache our script execution flags. This is, of course,
+    // useless if the next block has different script flags from the
+    // previous one, but because the cache tracks script flags for us it
+    // will auto-invalidate and we'll just have a few blocks of extra
+    // misses on soft-fork activation.
+    //
+    // This is also useful in case of bugs in the standard flags that cause
+    // transactions to pass as valid when they're actually invalid. For
+    // instance the STRICTENC flag was incorrectly allowing certain
+    // CHECKSIG NOT scripts to pass, even though they were invalid.
+    //
+    // There is a similar check in CreateNewBlock() to prevent creating
+    // invalid blocks (using TestBlockValidity), however allowing such
+    // transactions into the mempool can be exploited as a DoS attack.
+    unsigned int currentBlockScriptVerifyFlags = GetBlockScriptFlags(chainActive.Tip(), chainparams.GetConsensus());
+    if (!CheckInputsFromMempoolAndCache(tx, state, *ws.view, pool, currentBlockScriptVerifyFlags, true, ws.txdata))
+    {
+        // If we're using promiscuousmempoolflags, we may hit this normally
+        // Check if current block has some flags that ws.scriptVerifyFlags
+        // does not before printing an ominous warning
+        if (!(~ws.scriptVerifyFlags & currentBlockScriptVerifyFlags)) {
+            return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against latest-block but not STANDARD flags %s, %s",
+                __func__, hash.ToString(), FormatStateMessage(state));
+        } else {
+            if (!CheckInputs(tx, state, *ws.view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, false, ws.txdata)) {
+                return error("%s: ConnectInputs failed against MANDATORY but not STANDARD flags due to promiscuous mempool %s, %s",
                     __func__, hash.ToString(), FormatStateMessage(state));
             } else {
-                if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, false, txdata)) {
-                    return error("%s: ConnectInputs failed against MANDATORY but not STANDARD flags due to promiscuous mempool %s, %s",
-                        __func__, hash.ToString(), FormatStateMessage(state));
-                } else {
-                    LogPrintf("Warning: -promiscuousmempool flags set to not include currently enforced soft forks, this may break mining or otherwise cause instability!\n");
-                }
+                LogPrintf("Warning: -promiscuousmempool flags set to not include currently enforced soft forks, this may break mining or otherwise cause instability!\n");
             }
         }
+    }
 
-        // Remove conflicting transactions from the mempool
-        for (const CTxMemPool::txiter it : allConflicting)
-        {
-            LogPrint(BCLog::MEMPOOL, "replacing tx %s with %s for %s SUGAR additional fees, %d delta bytes\n",
-                    it->GetTx().GetHash().ToString(),
-                    hash.ToString(),
-                    FormatMoney(nModifiedFees - nConflictingFees),
-                    (int)nSize - (int)nConflictingSize);
-            if (plTxnReplaced)
-                plTxnReplaced->push_back(it->GetSharedTx());
+    return true;
+}
+
+static bool RunScriptChecks(std::vector<CScriptCheck>& vChecks)
+{
+    for (CScriptCheck& check : vChecks) {
+        if (!check()) {
+            return false;
         }
-        pool.RemoveStaged(allConflicting, false, MemPoolRemovalReason::REPLACED);
+    }
+    return true;
+}
 
-        // This transaction should only count for fee estimation if:
-        // - it isn't a BIP 125 replacement transaction (may not be widely supported)
-        // - it's not being readded during a reorg which bypasses typical mempool fee limits
-        // - the node is not behind
-        // - the transaction is not dependent on any other transactions in the mempool
-        bool validForFeeEstimation = !fReplacementTransaction && !bypass_limits && IsCurrentForFeeEstimation() && pool.HasNoInputsOf(tx);
+static bool Finalize(CTxMemPool& pool, CValidationState& state, MemPoolAcceptWorkspace& ws,
+                     std::list<CTransactionRef>* plTxnReplaced, bool bypass_limits)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(pool.cs);
+    const CTransaction& tx = *ws.ptx;
+    const uint256& hash = tx.GetHash();
 
-        // Store transaction in memory
-        pool.addUnchecked(hash, entry, setAncestors, validForFeeEstimation);
+    // Remove conflicting transactions from the mempool
+    for (const CTxMemPool::txiter it : ws.allConflicting)
+    {
+        LogPrint(BCLog::MEMPOOL, "replacing tx %s with %s for %s SUGAR additional fees, %d delta bytes\n",
+                it->GetTx().GetHash().ToString(),
+                hash.ToString(),
+                FormatMoney(ws.nModifiedFees - ws.nConflictingFees),
+                (int)ws.entry->GetTxSize() - (int)ws.nConflictingSize);
+        if (plTxnReplaced)
+            plTxnReplaced->push_back(it->GetSharedTx());
+    }
+    pool.RemoveStaged(ws.allConflicting, false, MemPoolRemovalReason::REPLACED);
 
-        // trim mempool and check if tx was trimmed
-        if (!bypass_limits) {
-            LimitMempoolSize(pool, gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
-            if (!pool.exists(hash))
-                return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
-        }
+    // This transaction should only count for fee estimation if:
+    // - it isn't a BIP 125 replacement transaction (may not be widely supported)
+    // - it's not being readded during a reorg which bypasses typical mempool fee limits
+    // - the node is not behind
+    // - the transaction is not dependent on any other transactions in the mempool
+    bool validForFeeEstimation = ws.setConflicts.empty() && !bypass_limits && IsCurrentForFeeEstimation() && pool.HasNoInputsOf(tx);
+
+    // Store transaction in memory
+    pool.addUnchecked(hash, *ws.entry, ws.setAncestors, validForFeeEstimation);
+
+    // trim mempool and check if tx was trimmed
+    if (!bypass_limits) {
+        LimitMempoolSize(pool, gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        if (!pool.exists(hash))
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
+    }
+
+    return true;
+}
+
+static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx,
+                              bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
+                              bool bypass_limits, const CAmount& nAbsurdFee, std::vector<COutPoint>& coins_to_uncache)
+{
+    const CTransaction& tx = *ptx;
+    AssertLockHeld(cs_main);
+    LOCK(pool.cs); // mempool "read lock" (held through GetMainSignals().TransactionAddedToMempool())
+    if (pfMissingInputs) {
+        *pfMissingInputs = false;
+    }
+
+    if (!CheckTransaction(tx, state))
+        return false; // state filled in by CheckTransaction
+
+    // Coinbase is only valid in a block, not as a loose transaction
+    if (tx.IsCoinBase())
+        return state.DoS(100, false, REJECT_INVALID, "coinbase");
+
+    MemPoolAcceptWorkspace ws(ptx);
+    if (!PreChecks(chainparams, pool, state, ws, pfMissingInputs, nAcceptTime, bypass_limits, nAbsurdFee, coins_to_uncache)) {
+        return false;
+    }
+
+    if (!ScriptChecks(chainparams, pool, state, ws)) {
+        return false;
+    }
+
+    if (!Finalize(pool, state, ws, plTxnReplaced, bypass_limits)) {
+        return false;
     }
 
     GetMainSignals().TransactionAddedToMempool(ptx);
@@ -1027,28 +1141,8 @@ bool GetTransaction(const uint256& hash, CTransactionRef& txOut, const Consensus
             return true;
         }
 
-        if (fTxIndex) {
-            CDiskTxPos postx;
-            if (pblocktree->ReadTxIndex(hash, postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-                if (file.IsNull())
-                    return error("%s: OpenBlockFile failed", __func__);
-                CBlockHeader header;
-                try {
-                    file >> header;
-                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                    file >> txOut;
-                } catch (const std::exception& e) {
-                    return error("%s: Deserialize or I/O error - %s", __func__, e.what());
-                }
-                hashBlock = header.GetHash();
-                if (txOut->GetHash() != hash)
-                    return error("%s: txid mismatch", __func__);
-                return true;
-            }
-
-            // transaction not found in index, nothing more can be done
-            return false;
+        if (g_txindex) {
+            return g_txindex->FindTx(hash, hashBlock, txOut);
         }
 
         if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
@@ -1144,6 +1238,61 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+/** Size of the index header in front of every block and undo record on disk */
+static const unsigned int DISK_RECORD_HEADER_SIZE = CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int);
+
+/** Read the data of a block or undo record from filein, positioned at its index header */
+static bool ReadRawRecord(std::vector<unsigned char>& data, CAutoFile& filein, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    try {
+        CMessageHeader::MessageStartChars recordStart;
+        unsigned int nSize;
+        filein >> FLATDATA(recordStart) >> nSize;
+        if (memcmp(recordStart, messageStart, CMessageHeader::MESSAGE_START_SIZE) != 0)
+            return error("%s: magic mismatch at %s", __func__, pos.ToString());
+        if (nSize > MAX_SIZE)
+            return error("%s: size %u too large at %s", __func__, nSize, pos.ToString());
+        data.resize(nSize);
+        filein.read((char*)data.data(), nSize);
+    }
+    catch (const std::exception& e) {
+        return error("%s: I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart)
+{
+    CDiskBlockPos blockPos;
+    {
+        LOCK(cs_main);
+        blockPos = pindex->GetBlockPos();
+    }
+
+    if (blockPos.IsNull() || blockPos.nPos < DISK_RECORD_HEADER_SIZE)
+        return error("%s: no block data available for %s", __func__, pindex->ToString());
+
+    // Start at the index header in front of the block
+    CDiskBlockPos headerPos(blockPos.nFile, blockPos.nPos - DISK_RECORD_HEADER_SIZE);
+    CAutoFile filein(OpenBlockFile(headerPos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: OpenBlockFile failed for %s", __func__, headerPos.ToString());
+    if (!ReadRawRecord(block, filein, headerPos, messageStart))
+        return false;
+
+    CBlockHeaderUncached header;
+    try {
+        VectorReader(SER_NETWORK, PROTOCOL_VERSION, block, 0) >> header;
+    }
+    catch (const std::exception& e) {
+        return error("%s: Deserialize error - %s at %s", __func__, e.what(), blockPos.ToString());
+    }
+    if (header.GetHash() != pindex->GetBlockHash())
+        return error("%s: GetHash() doesn't match index for %s at %s", __func__,
+                pindex->ToString(), blockPos.ToString());
+    return true;
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     int halvings = nHeight / consensusParams.nSubsidyHalvingInterval;
@@ -1406,6 +1555,24 @@ void InitScriptExecutionCache() {
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
 }
 
+static uint256 ScriptExecutionCacheKey(const CTransaction& tx, unsigned int flags)
+{
+    uint256 hashCacheEntry;
+    // We only use the first 19 bytes of nonce to avoid a second SHA
+    // round - giving us 19 + 32 + 4 = 55 bytes (+ 8 + 1 = 64)
+    static_assert(55 - sizeof(flags) - 32 >= 128/8, "Want at least 128 bits of nonce for script execution cache");
+    CSHA256().Write(scriptExecutionCacheNonce.begin(), 55 - sizeof(flags) - 32).Write(tx.GetWitnessHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
+    return hashCacheEntry;
+}
+
+/** Record that all of tx's scripts passed with flags, as CheckInputs does when
+ * it runs them itself with cacheFullScriptStore set. */
+static void CacheScriptExecution(const CTransaction& tx, unsigned int flags)
+{
+    AssertLockHeld(cs_main);
+    scriptExecutionCache.insert(ScriptExecutionCacheKey(tx, flags));
+}
+
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set.
@@ -1442,11 +1609,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
             // correct (ie that the transaction hash which is in tx's prevouts
             // properly commits to the scriptPubKey in the inputs view of that
             // transaction).
-            uint256 hashCacheEntry;
-            // We only use the first 19 bytes of nonce to avoid a second SHA
-            // round - giving us 19 + 32 + 4 = 55 bytes (+ 8 + 1 = 64)
-            static_assert(55 - sizeof(flags) - 32 >= 128/8, "Want at least 128 bits of nonce for script execution cache");
-            CSHA256().Write(scriptExecutionCacheNonce.begin(), 55 - sizeof(flags) - 32).Write(tx.GetWitnessHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
+            uint256 hashCacheEntry = ScriptExecutionCacheKey(tx, flags);
             AssertLockHeld(cs_main); //TODO: Remove this requirement by making CuckooCache not require external locks
             if (scriptExecutionCache.contains(hashCacheEntry, !cacheFullScriptStore)) {
                 return true;
@@ -1532,9 +1695,16 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     return true;
 }
 
-static bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
+} // namespace
+
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
 {
-    CDiskBlockPos pos = pindex->GetUndoPos();
+    // Indexes read undo data from their own threads
+    CDiskBlockPos pos;
+    {
+        LOCK(cs_main);
+        pos = pindex->GetUndoPos();
+    }
     if (pos.IsNull()) {
         return error("%s: no undo data available", __func__);
     }
@@ -1563,6 +1733,45 @@ static bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
     return true;
 }
 
+bool ReadRawUndoFromDisk(std::vector<unsigned char>& undo, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart)
+{
+    CDiskBlockPos pos;
+    {
+        LOCK(cs_main);
+        pos = pindex->GetUndoPos();
+    }
+    if (pos.IsNull() || !pindex->pprev || pos.nPos < DISK_RECORD_HEADER_SIZE) {
+        return error("%s: no undo data available", __func__);
+    }
+
+    // Start at the index header in front of the undo data
+    CDiskBlockPos headerPos(pos.nFile, pos.nPos - DISK_RECORD_HEADER_SIZE);
+    CAutoFile filein(OpenUndoFile(headerPos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: OpenUndoFile failed", __func__);
+    if (!ReadRawRecord(undo, filein, headerPos, messageStart))
+        return false;
+
+    // The checksum follows the undo data
+    uint256 hashChecksum;
+    try {
+        filein >> hashChecksum;
+    }
+    catch (const std::exception& e) {
+        return error("%s: I/O error - %s", __func__, e.what());
+    }
+
+    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    hasher << pindex->pprev->GetBlockHash();
+    hasher.write((const char*)undo.data(), undo.size());
+    if (hashChecksum != hasher.GetHash())
+        return error("%s: Checksum mismatch", __func__);
+
+    return true;
+}
+
+namespace {
+
 /** Abort with a message */
 bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
 {
@@ -1720,26 +1929,6 @@ static bool WriteUndoDataForBlock(const CBlockUndo& blockundo, CValidationState&
     return true;
 }
 
-static bool WriteTxIndexDataForBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex)
-{
-    if (!fTxIndex) return true;
-
-    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
-    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
-    vPos.reserve(block.vtx.size());
-    for (const CTransactionRef& tx : block.vtx)
-    {
-        vPos.push_back(std::make_pair(tx->GetHash(), pos));
-        pos.nTxOffset += ::GetSerializeSize(*tx, SER_DISK, CLIENT_VERSION);
-    }
-
-    if (!pblocktree->WriteTxIndex(vPos)) {
-        return AbortNode(state, "Failed to write transaction index");
-    }
-
-    return true;
-}
-
 static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
 
 void ThreadScriptCheck() {
@@ -2057,9 +2246,6 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         setDirtyBlockIndex.insert(pindex);
     }
 
-    if (!WriteTxIndexDataForBlock(block, state, pindex))
-        return false;
-
     assert(pindex->phashBlock);
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
@@ -3228,42 +3414,14 @@ static bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationSta
     return true;
 }
 
-/** NOTE: This function is not currently invoked by ConnectBlock(), so we
- *  should consider upgrade issues if we change which consensus rules are
- *  enforced in this function (eg by adding a new consensus rule). See comment
- *  in ConnectBlock().
- *  Note that -reindex-chainstate skips the validation that happens here!
- */
-static bool ContextualCheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
+/** Check the witness commitment of a block, or that it has no witness data
+ *  if fWitnessEnabled is false. Needs no lock, as the caller determines
+ *  whether segwit is active for the block's parent. Skipped for blocks that
+ *  ProcessNewBlock already checked. */
+static bool CheckWitnessCommitment(const CBlock& block, CValidationState& state, bool fWitnessEnabled)
 {
-    const int nHeight = pindexPrev == nullptr ? 0 : pindexPrev->nHeight + 1;
-
-    // Start enforcing BIP113 (Median Time Past) using versionbits logic.
-    int nLockTimeFlags = 0;
-    if (VersionBitsState(pindexPrev, consensusParams, Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
-        nLockTimeFlags |= LOCKTIME_MEDIAN_TIME_PAST;
-    }
-
-    int64_t nLockTimeCutoff = (nLockTimeFlags & LOCKTIME_MEDIAN_TIME_PAST)
-                              ? pindexPrev->GetMedianTimePast()
-                              : block.GetBlockTime();
-
-    // Check that all transactions are finalized
-    for (const auto& tx : block.vtx) {
-        if (!IsFinalTx(*tx, nHeight, nLockTimeCutoff)) {
-            return state.DoS(10, false, REJECT_INVALID, "bad-txns-nonfinal", false, "non-final transaction");
-        }
-    }
-
-    // Enforce rule that the coinbase starts with serialized block height
-    if (nHeight >= consensusParams.BIP34Height)
-    {
-        CScript expect = CScript() << nHeight;
-        if (block.vtx[0]->vin[0].scriptSig.size() < expect.size() ||
-            !std::equal(expect.begin(), expect.end(), block.vtx[0]->vin[0].scriptSig.begin())) {
-            return state.DoS(100, false, REJECT_INVALID, "bad-cb-height", false, "block height mismatch in coinbase");
-        }
-    }
+    if (block.fWitnessChecked)
+        return true;
 
     // Validation for witness commitments.
     // * We compute the witness hash (which is the hash including witnesses) of all the block's transactions, except the
@@ -3274,7 +3432,7 @@ static bool ContextualCheckBlock(const CBlock& block, CValidationState& state, c
     //   {0xaa, 0x21, 0xa9, 0xed}, and the following 32 bytes are SHA256^2(witness root, witness nonce). In case there are
     //   multiple, the last one is used.
     bool fHaveWitness = false;
-    if (VersionBitsState(pindexPrev, consensusParams, Consensus::DEPLOYMENT_SEGWIT, versionbitscache) == THRESHOLD_ACTIVE) {
+    if (fWitnessEnabled) {
         int commitpos = GetWitnessCommitmentIndex(block);
         if (commitpos != -1) {
             bool malleated = false;
@@ -3302,6 +3460,49 @@ static bool ContextualCheckBlock(const CBlock& block, CValidationState& state, c
         }
     }
 
+    return true;
+}
+
+/** NOTE: This function is not currently invoked by ConnectBlock(), so we
+ *  should consider upgrade issues if we change which consensus rules are
+ *  enforced in this function (eg by adding a new consensus rule). See comment
+ *  in ConnectBlock().
+ *  Note that -reindex-chainstate skips the validation that happens here!
+ */
+static bool ContextualCheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
+{
+    const int nHeight = pindexPrev == nullptr ? 0 : pindexPrev->nHeight + 1;
+
+    // Start enforcing BIP113 (Median Time Past) using versionbits logic.
+    int nLockTimeFlags = 0;
+    if (VersionBitsState(pindexPrev, consensusParams, Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
+        nLockTimeFlags |= LOCKTIME_MEDIAN_TIME_PAST;
+    }
+
+    int64_t nLockTimeCutoff = (nLockTimeFlags & LOCKTIME_MEDIAN_TIME_PAST)
+                              ? pindexPrev->GetMedianTimePast()
+                              : block.GetBlockTime();
+
+    // Check that all transactions are finalized
+    for (const auto& tx : block.vtx) {
+        if (!IsFinalTx(*tx, nHeight, nLockTimeCutoff)) {
+            return state.DoS(10, false, REJECT_INVALID, "bad-txns-nonfinal", false, "non-final transaction");
+        }
+    }
+
+    // Enforce rule that the coinbase starts with serialized block height
+    if (nHeight >= consensusParams.BIP34Height)
+    {
+        CScript expect = CScript() << nHeight;
+        if (block.vtx[0]->vin[0].scriptSig.size() < expect.size() ||
+            !std::equal(expect.begin(), expect.end(), block.vtx[0]->vin[0].scriptSig.begin())) {
+            return state.DoS(100, false, REJECT_INVALID, "bad-cb-height", false, "block height mismatch in coinbase");
+        }
+    }
+
+    if (!CheckWitnessCommitment(block, state, VersionBitsState(pindexPrev, consensusParams, Consensus::DEPLOYMENT_SEGWIT, versionbitscache) == THRESHOLD_ACTIVE))
+        return false;
+
     // After the coinbase witness nonce and commitment are verified,
     // we can check if the block weight passes (before we've checked the
     // coinbase witness, it would be possible for the weight to be too
@@ -3502,6 +3703,8 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
 
     // Look for this block's header in the index like AcceptBlock() will
     uint256 hash = pblock->GetHash();
+    CBlockIndex *pindexAnnounce = nullptr;
+    bool fWitnessEnabled = false;
 
     {
         LOCK(cs_main);
@@ -3517,6 +3720,17 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
                 pblock->cache_block_hash = pindex->cache_block_hash;
                 pblock->cache_PoW_hash = pindex->cache_PoW_hash;
             }
+
+            // The header of a block reconstructed from a cmpctblock is already
+            // connected with its proof of work checked. If it extends our tip,
+            // it can be announced to high-bandwidth peers as soon as its
+            // merkle root and witness commitment are checked below, rather
+            // than after AcceptBlock's remaining checks and disk write.
+            if (fFastBlockRelay && pindex->pprev == chainActive.Tip() && pindex->IsValid(BLOCK_VALID_TREE) &&
+                    !(pindex->nStatus & (BLOCK_HAVE_DATA | BLOCK_FAILED_MASK)) && !IsInitialBlockDownload()) {
+                pindexAnnounce = pindex;
+                fWitnessEnabled = IsWitnessEnabled(pindex->pprev, chainparams.GetConsensus());
+            }
         }
     }
 
@@ -3528,8 +3742,23 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
         // belt-and-suspenders.
         bool ret = CheckBlock(*pblock, state, chainparams.GetConsensus());
 
+        // For a block to announce, check the witness commitment without
+        // cs_main too, so AcceptBlock can skip it. Failures are left for
+        // AcceptBlock to record.
+        if (ret && pindexAnnounce) {
+            CValidationState stateDummy;
+            if (CheckWitnessCommitment(*pblock, stateDummy, fWitnessEnabled))
+                pblock->fWitnessChecked = true;
+            else
+                pindexAnnounce = nullptr;
+        }
+
         LOCK(cs_main);
 
+        if (ret && pindexAnnounce && pindexAnnounce->pprev == chainActive.Tip() &&
+                !(pindexAnnounce->nStatus & (BLOCK_HAVE_DATA | BLOCK_FAILED_MASK)))
+            GetMainSignals().NewPoWValidBlock(pindexAnnounce, pblock);
+
         if (ret) {
             // Store to disk
             ret = g_chainstate.AcceptBlock(pblock, state, chainparams, &pindex, fForceProcessing, nullptr, fNewBlock);
@@ -3549,6 +3778,69 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
     return true;
 }
 
+bool ProcessNewBlocks(const CChainParams& chainparams, const std::vector<std::shared_ptr<const CBlock>>& vBlocks, bool fForceProcessing, std::vector<bool>* vNewBlock)
+{
+    AssertLockNotHeld(cs_main);
+
+    if (vNewBlock) vNewBlock->assign(vBlocks.size(), false);
+    if (vBlocks.empty()) return true;
+
+    {
+        LOCK(cs_main);
+
+        // Reuse yespower hashes computed while accepting the headers
+        for (const std::shared_ptr<const CBlock>& pblock : vBlocks) {
+            BlockMap::iterator miSelf = mapBlockIndex.find(pblock->GetHash());
+            if (miSelf != mapBlockIndex.end() && !pblock->cache_init && miSelf->second->cache_init) {
+                LOCK(pblock->cache_lock);
+                pblock->cache_init = true;
+                pblock->cache_block_hash = miSelf->second->cache_block_hash;
+                pblock->cache_PoW_hash = miSelf->second->cache_PoW_hash;
+            }
+        }
+    }
+
+    // Ensure that CheckBlock() passes before calling AcceptBlock, as
+    // belt-and-suspenders. This does not need cs_main.
+    std::vector<CValidationState> vState(vBlocks.size());
+    std::vector<bool> vChecked(vBlocks.size());
+    for (size_t i = 0; i < vBlocks.size(); i++) {
+        vChecked[i] = CheckBlock(*vBlocks[i], vState[i], chainparams.GetConsensus());
+    }
+
+    bool fAllAccepted = true;
+    std::shared_ptr<const CBlock> pblockLast;
+    {
+        LOCK(cs_main);
+
+        for (size_t i = 0; i < vBlocks.size(); i++) {
+            CBlockIndex *pindex = nullptr;
+            bool fNew = false;
+            bool ret = vChecked[i];
+            if (ret) {
+                // Store to disk
+                ret = g_chainstate.AcceptBlock(vBlocks[i], vState[i], chainparams, &pindex, fForceProcessing, nullptr, &fNew);
+            }
+            if (!ret) {
+                GetMainSignals().BlockChecked(*vBlocks[i], vState[i]);
+                error("%s: AcceptBlock FAILED (%s)", __func__, vState[i].GetDebugMessage());
+                fAllAccepted = false;
+                continue;
+            }
+            if (vNewBlock) (*vNewBlock)[i] = fNew;
+            pblockLast = vBlocks[i];
+        }
+    }
+
+    NotifyHeaderTip();
+
+    CValidationState state; // Only used to report errors, not invalidity - ignore it
+    if (!g_chainstate.ActivateBestChain(state, chainparams, pblockLast))
+        return error("%s: ActivateBestChain failed", __func__);
+
+    return fAllAccepted;
+}
+
 bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW, bool fCheckMerkleRoot)
 {
     AssertLockHeld(cs_main);
@@ -3893,10 +4185,6 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
     pblocktree->ReadReindexing(fReindexing);
     if(fReindexing) fReindex = true;
 
-    // Check whether we have a transaction index
-    pblocktree->ReadFlag("txindex", fTxIndex);
-    LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
-
     return true;
 }
 
@@ -4280,9 +4568,6 @@ bool LoadBlockIndex(const CChainParams& chainparams)
         // needs_init.
 
         LogPrintf("Initializing databases...\n");
-        // Use the provided setting for -txindex in the new database
-        fTxIndex = gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX);
-        pblocktree->WriteFlag("txindex", fTxIndex);
     }
     return true;
 }
@@ -4650,7 +4935,179 @@ int VersionBitsTipStateSinceHeight(const Consensus::Params& params, Consensus::D
     return VersionBitsStateSinceHeight(chainActive.Tip(), params, pos, versionbitscache);
 }
 
-static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+/**
+ * mempool.dat, version 2: the version, then chunks of serialized data each
+ * followed by its hash, so that every chunk is verified before it is used.
+ * The first chunk holds the number of transactions, the ones after it up to
+ * MEMPOOL_DUMP_CHUNK_TXS transactions each, parents before their children, and
+ * the last one the fee deltas of transactions not in the mempool. Version 1 was the transactions and fee
+ * deltas without chunks or hashes.
+ */
+static const uint64_t MEMPOOL_DUMP_VERSION = 2;
+static const uint64_t MEMPOOL_DUMP_VERSION_UNCHECKED = 1;
+static const size_t MEMPOOL_DUMP_CHUNK_TXS = 1000;
+/** Transactions loaded together, their scripts verified at once on the script check threads */
+static const size_t MEMPOOL_LOAD_BATCH_TXS = 100;
+
+namespace {
+
+/** A transaction read from mempool.dat */
+struct MempoolLoadEntry
+{
+    CTransactionRef tx;
+    int64_t nTime;
+    CAmount nFeeDelta;
+};
+
+/** Outcome counts of LoadMempool */
+struct MempoolLoadStats
+{
+    int64_t count = 0;
+    int64_t expired = 0;
+    int64_t failed = 0;
+    int64_t already_there = 0;
+};
+
+} // namespace
+
+static void WriteMempoolChunk(CAutoFile& file, const CDataStream& ssChunk)
+{
+    std::vector<unsigned char> vChunk(ssChunk.begin(), ssChunk.end());
+    file << vChunk << Hash(vChunk.begin(), vChunk.end());
+}
+
+static void ReadMempoolChunk(CAutoFile& file, CDataStream& ssChunk)
+{
+    std::vector<unsigned char> vChunk;
+    uint256 hashChunk;
+    file >> vChunk >> hashChunk;
+    if (hashChunk != Hash(vChunk.begin(), vChunk.end())) {
+        throw std::runtime_error("mempool chunk checksum mismatch");
+    }
+    ssChunk.clear();
+    ssChunk.write((const char*)vChunk.data(), vChunk.size());
+}
+
+/**
+ * Accept transactions of which none spends another's outputs as
+ * AcceptToMemoryPoolWorker does, under one cs_main acquisition, verifying
+ * their scripts together on the script check threads as ConnectBlock does.
+ */
+static void LoadMempoolBatch(const CChainParams& chainparams, CTxMemPool& pool, const std::vector<MempoolLoadEntry>& batch, MempoolLoadStats& stats)
+{
+    std::vector<std::unique_ptr<MemPoolAcceptWorkspace>> vws;
+    std::vector<CValidationState> vstate(batch.size());
+    std::vector<std::vector<COutPoint>> vcoins_to_uncache(batch.size());
+    std::vector<bool> vChecksTaken(batch.size(), false);
+    for (const MempoolLoadEntry& entry : batch) {
+        vws.emplace_back(new MemPoolAcceptWorkspace(entry.tx));
+    }
+
+    {
+        LOCK2(cs_main, pool.cs);
+        unsigned int currentBlockScriptVerifyFlags = GetBlockScriptFlags(chainActive.Tip(), chainparams.GetConsensus());
+        for (size_t i = 0; i < batch.size(); i++) {
+            MemPoolAcceptWorkspace& ws = *vws[i];
+            const CTransaction& tx = *ws.ptx;
+            if (!CheckTransaction(tx, vstate[i]) || tx.IsCoinBase()) continue;
+            if (!PreChecks(chainparams, pool, vstate[i], ws, nullptr /* pfMissingInputs */, batch[i].nTime, false /* bypass_limits */, 0 /* nAbsurdFee */, vcoins_to_uncache[i])) continue;
+            vChecksTaken[i] = CheckInputs(tx, vstate[i], *ws.view, true, ws.scriptVerifyFlags, true, false, ws.txdata, &ws.vPolicyChecks) &&
+                              CheckInputsFromMempoolAndCache(tx, vstate[i], *ws.view, pool, currentBlockScriptVerifyFlags, true, ws.txdata, &ws.vConsensusChecks);
+        }
+        const unsigned int nPoolUpdatedChecked = pool.GetTransactionsUpdated();
+
+        // Any failure sends every transaction of the batch back to
+        // ScriptChecks, which finds the one at fault
+        bool fScriptsOk = true;
+        if (nScriptCheckThreads) {
+            CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+            for (size_t i = 0; i < batch.size(); i++) {
+                if (!vChecksTaken[i]) continue;
+                control.Add(vws[i]->vPolicyChecks);
+                control.Add(vws[i]->vConsensusChecks);
+            }
+            fScriptsOk = control.Wait();
+        } else {
+            for (size_t i = 0; i < batch.size() && fScriptsOk; i++) {
+                if (!vChecksTaken[i]) continue;
+                fScriptsOk = RunScriptChecks(vws[i]->vPolicyChecks) && RunScriptChecks(vws[i]->vConsensusChecks);
+            }
+        }
+
+        unsigned int nAdded = 0;
+        for (size_t i = 0; i < batch.size(); i++) {
+            MemPoolAcceptWorkspace& ws = *vws[i];
+            CValidationState& state = vstate[i];
+            bool fAccepted = false;
+            if (vChecksTaken[i]) {
+                // Adding the batch's earlier transactions, none of them this
+                // one's parent, leaves PreChecks' results as they were unless
+                // it also has ancestors, which they may share, they spend the
+                // same coins, or they replaced or trimmed something.
+                bool fRecheck = pool.GetTransactionsUpdated() != nPoolUpdatedChecked + nAdded ||
+                                !ws.setAncestors.empty() || !ws.setConflicts.empty();
+                for (size_t n = 0; n < ws.ptx->vin.size() && !fRecheck && nAdded; n++) {
+                    fRecheck = pool.isSpent(ws.ptx->vin[n].prevout);
+                }
+                if (!fRecheck || PreChecks(chainparams, pool, state, ws, nullptr /* pfMissingInputs */, batch[i].nTime, false /* bypass_limits */, 0 /* nAbsurdFee */, vcoins_to_uncache[i])) {
+                    if (fScriptsOk) {
+                        if (!ws.vConsensusChecks.empty()) {
+                            CacheScriptExecution(*ws.ptx, currentBlockScriptVerifyFlags);
+                        }
+                        fAccepted = Finalize(pool, state, ws, nullptr /* plTxnReplaced */, false /* bypass_limits */);
+                    } else {
+                        fAccepted = ScriptChecks(chainparams, pool, state, ws) && Finalize(pool, state, ws, nullptr /* plTxnReplaced */, false /* bypass_limits */);
+                    }
+                }
+            }
+            if (fAccepted) {
+                GetMainSignals().TransactionAddedToMempool(batch[i].tx);
+                ++stats.count;
+                ++nAdded;
+            } else {
+                for (const COutPoint& hashTx : vcoins_to_uncache[i])
+                    pcoinsTip->Uncache(hashTx);
+                // mempool may contain the transaction already, e.g. from
+                // wallet(s) having loaded it while we were processing
+                // mempool transactions; consider these as valid, instead of
+                // failed, but mark them as 'already there'
+                if (pool.exists(batch[i].tx->GetHash())) {
+                    ++stats.already_there;
+                } else {
+                    ++stats.failed;
+                }
+            }
+        }
+    }
+
+    // After we've (potentially) uncached entries, ensure our coins cache is still within its size limits
+    CValidationState stateDummy;
+    FlushStateToDisk(chainparams, stateDummy, FLUSH_STATE_PERIODIC);
+}
+
+/**
+ * Queue a transaction read from mempool.dat, loading the queued ones first
+ * when it spends one of them or the batch is full. The file lists parents
+ * before their children, so every batch can be verified at once.
+ */
+static void QueueMempoolLoad(const CChainParams& chainparams, CTxMemPool& pool, std::vector<MempoolLoadEntry>& batch,
+                             std::set<uint256>& setBatchTxids, MempoolLoadEntry&& entry, MempoolLoadStats& stats)
+{
+    bool fSpendsBatch = false;
+    for (const CTxIn& txin : entry.tx->vin) {
+        fSpendsBatch |= setBatchTxids.count(txin.prevout.hash) > 0;
+    }
+    if (fSpendsBatch || batch.size() >= MEMPOOL_LOAD_BATCH_TXS) {
+        LoadMempoolBatch(chainparams, pool, batch, stats);
+        batch.clear();
+        setBatchTxids.clear();
+    }
+    if (entry.nFeeDelta) {
+        pool.PrioritiseTransaction(entry.tx->GetHash(), entry.nFeeDelta);
+    }
+    setBatchTxids.insert(entry.tx->GetHash());
+    batch.push_back(std::move(entry));
+}
 
 bool LoadMempool(void)
 {
@@ -4663,58 +5120,56 @@ bool LoadMempool(void)
         return false;
     }
 
-    int64_t count = 0;
-    int64_t expired = 0;
-    int64_t failed = 0;
-    int64_t already_there = 0;
+    MempoolLoadStats stats;
     int64_t nNow = GetTime();
+    int64_t nStart = GetTimeMicros();
 
     try {
         uint64_t version;
         file >> version;
-        if (version != MEMPOOL_DUMP_VERSION) {
+        if (version != MEMPOOL_DUMP_VERSION && version != MEMPOOL_DUMP_VERSION_UNCHECKED) {
             return false;
         }
+        CDataStream ssChunk(SER_DISK, CLIENT_VERSION);
         uint64_t num;
-        file >> num;
-        while (num--) {
-            CTransactionRef tx;
-            int64_t nTime;
-            int64_t nFeeDelta;
-            file >> tx;
-            file >> nTime;
-            file >> nFeeDelta;
-
-            CAmount amountdelta = nFeeDelta;
-            if (amountdelta) {
-                mempool.PrioritiseTransaction(tx->GetHash(), amountdelta);
+        if (version == MEMPOOL_DUMP_VERSION) {
+            ReadMempoolChunk(file, ssChunk);
+            ssChunk >> num;
+        } else {
+            file >> num;
+        }
+
+        std::vector<MempoolLoadEntry> batch;
+        std::set<uint256> setBatchTxids;
+        for (uint64_t n = 0; n < num; n++) {
+            MempoolLoadEntry entry;
+            if (version == MEMPOOL_DUMP_VERSION) {
+                if (n % MEMPOOL_DUMP_CHUNK_TXS == 0) ReadMempoolChunk(file, ssChunk);
+                ssChunk >> entry.tx >> entry.nTime >> entry.nFeeDelta;
+            } else {
+                file >> entry.tx >> entry.nTime >> entry.nFeeDelta;
             }
-            CValidationState state;
-            if (nTime + nExpiryTimeout > nNow) {
-                LOCK(cs_main);
-                AcceptToMemoryPoolWithTime(chainparams, mempool, state, tx, nullptr /* pfMissingInputs */, nTime,
-                                           nullptr /* plTxnReplaced */, false /* bypass_limits */, 0 /* nAbsurdFee */);
-                if (state.IsValid()) {
-                    ++count;
-                } else {
-                    // mempool may contain the transaction already, e.g. from
-                    // wallet(s) having loaded it while we were processing
-                    // mempool transactions; consider these as valid, instead of
-                    // failed, but mark them as 'already there'
-                    if (mempool.exists(tx->GetHash())) {
-                        ++already_there;
-                    } else {
-                        ++failed;
-                    }
-                }
+
+            if (entry.nTime + nExpiryTimeout > nNow) {
+                QueueMempoolLoad(chainparams, mempool, batch, setBatchTxids, std::move(entry), stats);
             } else {
-                ++expired;
+                if (entry.nFeeDelta) {
+                    mempool.PrioritiseTransaction(entry.tx->GetHash(), entry.nFeeDelta);
+                }
+                ++stats.expired;
             }
             if (ShutdownRequested())
                 return false;
         }
+        LoadMempoolBatch(chainparams, mempool, batch, stats);
+
         std::map<uint256, CAmount> mapDeltas;
-        file >> mapDeltas;
+        if (version == MEMPOOL_DUMP_VERSION) {
+            ReadMempoolChunk(file, ssChunk);
+            ssChunk >> mapDeltas;
+        } else {
+            file >> mapDeltas;
+        }
 
         for (const auto& i : mapDeltas) {
             mempool.PrioritiseTransaction(i.first, i.second);
@@ -4724,7 +5179,8 @@ bool LoadMempool(void)
         return false;
     }
 
-    LogPrintf("Imported mempool transactions from disk: %i succeeded, %i failed, %i expired, %i already there\n", count, failed, expired, already_there);
+    LogPrintf("Imported mempool transactions from disk: %i succeeded, %i failed, %i expired, %i already there, in %gs\n",
+              stats.count, stats.failed, stats.expired, stats.already_there, (GetTimeMicros() - nStart) * MICRO);
     return true;
 }
 
@@ -4732,19 +5188,33 @@ bool DumpMempool(void)
 {
     int64_t start = GetTimeMicros();
 
+    struct DumpEntry {
+        CTransactionRef tx;
+        int64_t nTime;
+        CAmount nFeeDelta;
+        uint64_t nCountWithAncestors;
+    };
     std::map<uint256, CAmount> mapDeltas;
-    std::vector<TxMempoolInfo> vinfo;
+    std::vector<DumpEntry> vEntries;
 
     {
         LOCK(mempool.cs);
         for (const auto &i : mempool.mapDeltas) {
             mapDeltas[i.first] = i.second;
         }
-        vinfo = mempool.infoAll();
+        vEntries.reserve(mempool.mapTx.size());
+        for (const CTxMemPoolEntry& e : mempool.mapTx) {
+            vEntries.push_back(DumpEntry{e.GetSharedTx(), e.GetTime(), e.GetModifiedFee() - e.GetFee(), e.GetCountWithAncestors()});
+        }
     }
 
     int64_t mid = GetTimeMicros();
 
+    // A transaction has more ancestors than any of its parents, so this puts parents first
+    std::stable_sort(vEntries.begin(), vEntries.end(), [](const DumpEntry& a, const DumpEntry& b) {
+        return a.nCountWithAncestors < b.nCountWithAncestors;
+    });
+
     try {
         FILE* filestr = fsbridge::fopen(GetDataDir() / "mempool.dat.new", "wb");
         if (!filestr) {
@@ -4756,15 +5226,25 @@ bool DumpMempool(void)
         uint64_t version = MEMPOOL_DUMP_VERSION;
         file << version;
 
-        file << (uint64_t)vinfo.size();
-        for (const auto& i : vinfo) {
-            file << *(i.tx);
-            file << (int64_t)i.nTime;
-            file << (int64_t)i.nFeeDelta;
+        CDataStream ssChunk(SER_DISK, CLIENT_VERSION);
+        ssChunk << (uint64_t)vEntries.size();
+        WriteMempoolChunk(file, ssChunk);
+        ssChunk.clear();
+
+        for (size_t n = 0; n < vEntries.size(); n++) {
+            const DumpEntry& i = vEntries[n];
+            ssChunk << *(i.tx);
+            ssChunk << i.nTime;
+            ssChunk << i.nFeeDelta;
             mapDeltas.erase(i.tx->GetHash());
+            if ((n + 1) % MEMPOOL_DUMP_CHUNK_TXS == 0 || n + 1 == vEntries.size()) {
+                WriteMempoolChunk(file, ssChunk);
+                ssChunk.clear();
+            }
         }
 
-        file << mapDeltas;
+        ssChunk << mapDeltas;
+        WriteMempoolChunk(file, ssChunk);
         FileCommit(file.Get());
         file.fclose();
         RenameOver(GetDataDir() / "mempool.dat.new", GetDataDir() / "mempool.dat");
@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Sugarchain developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the address index and the getaddress* RPCs.
+
+Test that:
+    - the RPCs fail on a node without -addressindex
+    - balances, transactions and unspent outputs of an address follow the chain
+    - count and skip page through the results
+    - a reorg removes the entries of the disconnected blocks
+    - the index resumes where it stopped after a restart
+"""
+
+from decimal import Decimal
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, assert_raises_rpc_error, connect_nodes, disconnect_nodes, sync_blocks
+
+class AddressIndexTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [["-addressindex"], []]
+
+    def run_test(self):
+        node = self.nodes[0]
+        assert_raises_rpc_error(-1, "The address index is not enabled", self.nodes[1].getaddressbalance, node.getnewaddress())
+
+        miner = node.getnewaddress()
+        node.generatetoaddress(101, miner)
+        reward = node.getblock(node.getblockhash(1), 2)['tx'][0]['vout'][0]['value']
+        assert_equal(node.getaddressbalance(miner), {'balance': reward * 101, 'received': reward * 101})
+        assert_equal(len(node.getaddresstxids(miner)), 101)
+        utxos = node.getaddressutxos(miner, 2, 10)
+        assert_equal([u['height'] for u in utxos], [11, 12])
+        assert all(u['coinbase'] for u in utxos)
+        assert_raises_rpc_error(-5, "Invalid address", node.getaddressutxos, "notanaddress")
+        assert_raises_rpc_error(-8, "Negative skip", node.getaddresstxids, miner, 10, -1)
+
+        self.log.info("Send to a new address and check both sides of the transaction")
+        sync_blocks(self.nodes)
+        disconnect_nodes(self.nodes[0], 1)
+        dest = self.nodes[1].getnewaddress()
+        txid = node.sendtoaddress(dest, 10)
+        node.generatetoaddress(1, node.getnewaddress())
+        assert_equal(node.getaddressbalance(dest), {'balance': Decimal('10'), 'received': Decimal('10')})
+        assert_equal(node.getaddresstxids(dest), [txid])
+        assert_equal(node.getaddresstxids(miner, 1000, 101), [txid])
+        assert_equal(node.getaddressutxos(dest)[0]['txid'], txid)
+        assert_equal(len(node.getaddressutxos(miner)), 100)
+
+        self.log.info("Reorg the spend out and check it is removed")
+        self.nodes[1].generatetoaddress(3, self.nodes[1].getnewaddress())
+        connect_nodes(self.nodes[0], 1)
+        sync_blocks(self.nodes)
+        assert_equal(node.getaddressbalance(dest), {'balance': 0, 'received': 0})
+        assert_equal(node.getaddresstxids(dest), [])
+        assert_equal(len(node.getaddressutxos(miner)), 101)
+
+        self.log.info("Restart and check the index picks up new blocks")
+        self.restart_node(0, ["-addressindex"])
+        node = self.nodes[0]
+        other = node.getnewaddress()
+        node.generatetoaddress(1, other)
+        assert_equal(len(node.getaddressutxos(other)), 1)
+
+if __name__ == '__main__':
+    AddressIndexTest().main()
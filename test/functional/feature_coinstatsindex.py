@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+# Copyright (c) 2020-2021 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the coin stats index and gettxoutsetinfo.
+
+Test that:
+    - the index returns the same statistics as a scan of the UTXO set
+    - statistics of past blocks can be queried by height or hash
+    - querying past blocks requires -coinstatsindex
+    - a reorg rewinds the statistics
+    - the index resumes where it stopped after a restart
+"""
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, assert_raises_rpc_error, wait_until
+
+class CoinStatsIndexTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [["-coinstatsindex"], []]
+
+    def sync_index(self, node):
+        wait_until(lambda: 'muhash' in self.try_gettxoutsetinfo(node), timeout=60)
+
+    def try_gettxoutsetinfo(self, node):
+        try:
+            return node.gettxoutsetinfo('muhash')
+        except Exception:
+            return {}
+
+    def check_matches_scan(self, node):
+        res_index = node.gettxoutsetinfo('muhash')
+        res_scan = node.gettxoutsetinfo('muhash', None, False)
+        for key in ['height', 'bestblock', 'txouts', 'bogosize', 'muhash', 'total_amount']:
+            assert_equal(res_index[key], res_scan[key])
+        # The index does not track the number of transactions
+        assert 'transactions' not in res_index
+        return res_index
+
+    def run_test(self):
+        node = self.nodes[0]
+        node.generatetoaddress(101, node.getnewaddress())
+        self.sync_index(node)
+
+        self.log.info("Compare the index with a scan of the UTXO set")
+        res = self.check_matches_scan(node)
+        assert_equal(res['height'], 101)
+        assert_raises_rpc_error(-8, "foo is not a valid hash_type", node.gettxoutsetinfo, "foo")
+        assert_raises_rpc_error(-8, "Querying specific block heights requires coinstatsindex", self.nodes[1].gettxoutsetinfo, "muhash", 10)
+        assert 'muhash' not in self.nodes[1].gettxoutsetinfo()
+        res_default = node.gettxoutsetinfo()
+        assert 'hash_serialized_2' in res_default
+        assert 'muhash' not in res_default
+        assert res_default['transactions'] > 0
+        assert_raises_rpc_error(-8, "hash_serialized_2 hash type cannot be queried for a specific block", node.gettxoutsetinfo, "hash_serialized_2", 10)
+
+        self.log.info("Query past blocks by height and hash")
+        res_50 = node.gettxoutsetinfo('muhash', 50)
+        assert_equal(res_50['height'], 50)
+        assert_equal(res_50['bestblock'], node.getblockhash(50))
+        assert 'disk_size' not in res_50
+        assert_equal(node.gettxoutsetinfo('muhash', node.getblockhash(50)), res_50)
+        assert_raises_rpc_error(-8, "Target block height 200 after current tip 101", node.gettxoutsetinfo, "muhash", 200)
+
+        self.log.info("Spend an output and check the statistics follow")
+        node.sendtoaddress(node.getnewaddress(), 10)
+        node.generatetoaddress(1, node.getnewaddress())
+        res_102 = self.check_matches_scan(node)
+
+        self.log.info("Reorg out the spend and check the statistics are rewound")
+        node.invalidateblock(node.getblockhash(102))
+        assert_equal(self.check_matches_scan(node)['muhash'], res['muhash'])
+        node.generatetoaddress(2, node.getnewaddress())
+        self.check_matches_scan(node)
+        assert_equal(node.gettxoutsetinfo('muhash', 50), res_50)
+        assert_equal(node.gettxoutsetinfo('muhash', res_102['bestblock'])['muhash'], res_102['muhash'])
+
+        self.log.info("Restart and check the index picks up new blocks")
+        self.restart_node(0, ["-coinstatsindex"])
+        node = self.nodes[0]
+        node.generatetoaddress(1, node.getnewaddress())
+        self.sync_index(node)
+        self.check_matches_scan(node)
+
+if __name__ == '__main__':
+    CoinStatsIndexTest().main()
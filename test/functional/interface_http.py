@@ -103,6 +103,30 @@ class HTTPBasicsTest (BitcoinTestFramework):
         out1 = conn.getresponse()
         assert_equal(out1.status, http.client.BAD_REQUEST)
 
+        # Check the work queue statistics
+        info = self.nodes[0].getrpcworkqueueinfo()
+        assert_equal(info['backpressure'], False)
+        assert_equal(info['rejected'], 0)
+        assert(info['queued'] > 0)
+        assert_equal(sum(bucket['count'] for bucket in info['depth_histogram']), info['queued'])
+
+        # With backpressure, requests beyond the work queue depth wait instead of being rejected
+        self.restart_node(1, ["-rpcbackpressure", "-rpcworkqueue=1", "-rpcthreads=1"])
+        url = urllib.parse.urlparse(self.nodes[1].url)
+        headers = {"Authorization": "Basic " + str_to_b64str(url.username + ':' + url.password)}
+        conns = []
+        for i in range(10):
+            conn = http.client.HTTPConnection(url.hostname, url.port)
+            conn.request('POST', '/', '{"method": "getblockcount"}', headers)
+            conns.append(conn)
+        for conn in conns:
+            assert_equal(conn.getresponse().status, http.client.OK)
+            conn.close()
+        info = self.nodes[1].getrpcworkqueueinfo()
+        assert_equal(info['backpressure'], True)
+        assert_equal(info['max_depth'], 1)
+        assert_equal(info['rejected'], 0)
+
 
 if __name__ == '__main__':
     HTTPBasicsTest ().main ()
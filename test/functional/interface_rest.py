@@ -322,5 +322,52 @@ class RESTTest (BitcoinTestFramework):
         json_obj = json.loads(json_string)
         assert_equal(json_obj['bestblockhash'], bb_hash)
 
+        ###############################
+        # /rest/blockhashbyheight/    #
+        ###############################
+        height = self.nodes[0].getblockcount()
+        response = http_get_call(url.hostname, url.port, '/rest/blockhashbyheight/'+str(height)+self.FORMAT_SEPARATOR+'hex', True)
+        assert_equal(response.status, 200)
+        assert_equal(response.read().decode('utf-8').rstrip(), bb_hash)
+        json_obj = json.loads(http_get_call(url.hostname, url.port, '/rest/blockhashbyheight/1'+self.FORMAT_SEPARATOR+'json'))
+        assert_equal(json_obj['blockhash'], self.nodes[0].getblockhash(1))
+        response = http_get_call(url.hostname, url.port, '/rest/blockhashbyheight/'+str(height + 1)+self.FORMAT_SEPARATOR+'hex', True)
+        assert_equal(response.status, 404)
+        response = http_get_call(url.hostname, url.port, '/rest/blockhashbyheight/-1'+self.FORMAT_SEPARATOR+'hex', True)
+        assert_equal(response.status, 400)
+
+        ######################
+        # /rest/blockrange/  #
+        ######################
+        # every block is preceded by its size, and its undo data by its size too
+        def read_sized(f):
+            return f.read(unpack(b"<I", f.read(4))[0])
+
+        response = http_get_call(url.hostname, url.port, '/rest/blockrange/0/'+str(height + 1)+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 200)
+        f = BytesIO(response.read())
+        for h in range(height + 1):
+            block_hash = self.nodes[0].getblockhash(h)
+            response_block = http_get_call(url.hostname, url.port, '/rest/block/'+block_hash+self.FORMAT_SEPARATOR+'bin', True)
+            assert_equal(read_sized(f), response_block.read())
+        assert_equal(f.read(), b'')
+
+        response = http_get_call(url.hostname, url.port, '/rest/blockrange/withundo/'+str(height - 1)+'/5'+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 200)
+        f = BytesIO(response.read())
+        for h in range(height - 1, height + 1):
+            block_hash = self.nodes[0].getblockhash(h)
+            response_block = http_get_call(url.hostname, url.port, '/rest/block/'+block_hash+self.FORMAT_SEPARATOR+'bin', True)
+            assert_equal(read_sized(f), response_block.read())
+            assert_greater_than(len(read_sized(f)), 0)
+        assert_equal(f.read(), b'')
+
+        response = http_get_call(url.hostname, url.port, '/rest/blockrange/'+str(height + 1)+'/1'+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 404)
+        response = http_get_call(url.hostname, url.port, '/rest/blockrange/0/2001'+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 400)
+        response = http_get_call(url.hostname, url.port, '/rest/blockrange/0/1'+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 404)
+
 if __name__ == '__main__':
     RESTTest ().main ()
@@ -20,6 +20,7 @@ class MempoolLimitTest(BitcoinTestFramework):
         self.log.info('Check that mempoolminfee is minrelytxfee')
         assert_equal(self.nodes[0].getmempoolinfo()['minrelaytxfee'], Decimal('0.00001000'))
         assert_equal(self.nodes[0].getmempoolinfo()['mempoolminfee'], Decimal('0.00001000'))
+        assert_equal(self.nodes[0].getmempoolinfo()['overhead'], 0)
 
         txids = []
         utxos = create_confirmed_utxos(relayfee, self.nodes[0], 91)
@@ -50,5 +51,10 @@ class MempoolLimitTest(BitcoinTestFramework):
         assert_equal(self.nodes[0].getmempoolinfo()['minrelaytxfee'], Decimal('0.00001000'))
         assert_greater_than(self.nodes[0].getmempoolinfo()['mempoolminfee'], Decimal('0.00001000'))
 
+        self.log.info('Check that the bookkeeping overhead per transaction is reported')
+        mempoolinfo = self.nodes[0].getmempoolinfo()
+        assert_greater_than(mempoolinfo['overhead'], 0)
+        assert_greater_than(mempoolinfo['usage'], mempoolinfo['overhead'] * mempoolinfo['size'])
+
 if __name__ == '__main__':
     MempoolLimitTest().main()
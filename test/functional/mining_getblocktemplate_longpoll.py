@@ -66,6 +66,15 @@ class GetBlockTemplateLPTest(BitcoinTestFramework):
         thr.join(60 + 20)
         assert(not thr.is_alive())
 
+        # Test 5: the new transaction is added to the cached template without
+        # waiting for a rebuild, and repeated calls return the same template
+        wait_until(lambda: txid in [tx['txid'] for tx in self.nodes[0].getblocktemplate()['transactions']], timeout=10)
+        templat = self.nodes[0].getblocktemplate()
+        templat2 = self.nodes[0].getblocktemplate()
+        assert_equal(templat['transactions'], templat2['transactions'])
+        assert_equal(templat['coinbasevalue'], templat2['coinbasevalue'])
+        assert(templat2['curtime'] >= templat['curtime'])
+
 if __name__ == '__main__':
     GetBlockTemplateLPTest().main()
 
@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Sugarchain developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test BIP 157 compact block filter serving.
+
+Test that:
+    - nodes started with -peerblockfilters signal NODE_COMPACT_FILTERS
+    - getcfcheckpt, getcfheaders and getcfilters are answered from the
+      filter index and agree with the getblockfilter RPC
+    - peers sending filter requests to a node without
+      NODE_COMPACT_FILTERS, or requests that are too large, are disconnected
+"""
+
+from test_framework.messages import (
+    NODE_COMPACT_FILTERS,
+    hash256,
+    msg_getcfcheckpt,
+    msg_getcfheaders,
+    msg_getcfilters,
+    ser_uint256,
+    uint256_from_str,
+)
+from test_framework.mininode import P2PInterface, network_thread_start
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal
+
+FILTER_TYPE_BASIC = 0
+
+class CFiltersClient(P2PInterface):
+    def __init__(self):
+        super().__init__()
+        # Store the cfilters received.
+        self.cfilters = []
+
+    def pop_cfilters(self):
+        cfilters = self.cfilters
+        self.cfilters = []
+        return cfilters
+
+    def on_cfilter(self, message):
+        """Store cfilters received in a list."""
+        self.cfilters.append(message)
+
+class CompactFiltersTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [
+            ["-blockfilterindex", "-peerblockfilters"],
+            ["-blockfilterindex"],
+        ]
+
+    def run_test(self):
+        self.log.info("Check NODE_COMPACT_FILTERS signalling")
+        assert int(self.nodes[0].getnetworkinfo()['localservices'], 16) & NODE_COMPACT_FILTERS
+        assert not int(self.nodes[1].getnetworkinfo()['localservices'], 16) & NODE_COMPACT_FILTERS
+
+        self.nodes[0].generate(1005)
+        self.sync_all()
+        stop_height = self.nodes[0].getblockcount()
+        stop_hash = int(self.nodes[0].getbestblockhash(), 16)
+
+        node0 = self.nodes[0].add_p2p_connection(CFiltersClient())
+        node1 = self.nodes[1].add_p2p_connection(P2PInterface())
+        network_thread_start()
+        node0.wait_for_verack()
+        node1.wait_for_verack()
+
+        self.log.info("Check that getcfcheckpt returns the header of every 1000th block")
+        node0.send_and_ping(msg_getcfcheckpt(filter_type=FILTER_TYPE_BASIC, stop_hash=stop_hash))
+        response = node0.last_message['cfcheckpt']
+        assert_equal(response.filter_type, FILTER_TYPE_BASIC)
+        assert_equal(response.stop_hash, stop_hash)
+        assert_equal(len(response.headers), 1)
+        checkpoint = self.nodes[0].getblockfilter(self.nodes[0].getblockhash(1000))
+        assert_equal(response.headers[0], int(checkpoint['header'], 16))
+
+        self.log.info("Check that getcfheaders chains from the previous filter header")
+        start_height = stop_height - 10
+        node0.send_and_ping(msg_getcfheaders(filter_type=FILTER_TYPE_BASIC, start_height=start_height, stop_hash=stop_hash))
+        response = node0.last_message['cfheaders']
+        assert_equal(len(response.hashes), 11)
+        prev_filter = self.nodes[0].getblockfilter(self.nodes[0].getblockhash(start_height - 1))
+        assert_equal(response.prev_header, int(prev_filter['header'], 16))
+        header = response.prev_header
+        for filter_hash in response.hashes:
+            header = uint256_from_str(hash256(ser_uint256(filter_hash) + ser_uint256(header)))
+        tip_filter = self.nodes[0].getblockfilter(self.nodes[0].getbestblockhash())
+        assert_equal(header, int(tip_filter['header'], 16))
+
+        self.log.info("Check that getcfilters returns one filter per block")
+        node0.send_and_ping(msg_getcfilters(filter_type=FILTER_TYPE_BASIC, start_height=start_height, stop_hash=stop_hash))
+        cfilters = node0.pop_cfilters()
+        assert_equal(len(cfilters), 11)
+        for height, cfilter in zip(range(start_height, stop_height + 1), cfilters):
+            block_hash = self.nodes[0].getblockhash(height)
+            assert_equal(cfilter.block_hash, int(block_hash, 16))
+            assert_equal(cfilter.filter_data.hex(), self.nodes[0].getblockfilter(block_hash)['filter'])
+
+        self.log.info("Check that a too large getcfilters request disconnects the peer")
+        node0.send_message(msg_getcfilters(filter_type=FILTER_TYPE_BASIC, start_height=0, stop_hash=stop_hash))
+        node0.wait_for_disconnect()
+
+        self.log.info("Check that filter requests are refused by a node without NODE_COMPACT_FILTERS")
+        node1.send_message(msg_getcfcheckpt(filter_type=FILTER_TYPE_BASIC, stop_hash=stop_hash))
+        node1.wait_for_disconnect()
+
+if __name__ == '__main__':
+    CompactFiltersTest().main()
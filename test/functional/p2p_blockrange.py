@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Sugarchain developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test block download with getblkrange/blkrange.
+
+Test that:
+    - nodes signal NODE_BLOCKRANGE unless started with -peerblockrange=0
+    - a syncing node fetches runs of consecutive blocks with getblkrange and
+      receives them in blkrange messages
+    - a node that doesn't signal NODE_BLOCKRANGE is synced with plain getdata
+    - peers sending getblkrange to a node without NODE_BLOCKRANGE are
+      disconnected
+    - a getblkrange whose last height would overflow is refused
+"""
+
+from test_framework.messages import NODE_BLOCKRANGE, msg_generic
+from test_framework.mininode import P2PInterface, network_thread_start
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, connect_nodes, sync_blocks
+
+import struct
+
+class msg_getblkrange(msg_generic):
+    def __init__(self, height, count, hash_stop):
+        super().__init__(b"getblkrange", struct.pack("<iI", height, count) + hash_stop.to_bytes(32, 'little'))
+
+class BlockRangeTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 3
+        self.extra_args = [[], [], ["-peerblockrange=0"]]
+
+    def setup_network(self):
+        self.setup_nodes()
+
+    def run_test(self):
+        self.log.info("Check NODE_BLOCKRANGE signalling")
+        assert int(self.nodes[0].getnetworkinfo()['localservices'], 16) & NODE_BLOCKRANGE
+        assert not int(self.nodes[2].getnetworkinfo()['localservices'], 16) & NODE_BLOCKRANGE
+
+        self.nodes[0].generate(300)
+
+        self.log.info("Sync node2 from node0 with block ranges")
+        connect_nodes(self.nodes[2], 0)
+        sync_blocks([self.nodes[0], self.nodes[2]])
+        peer = self.nodes[2].getpeerinfo()[0]
+        assert peer['bytesrecv_per_msg'].get('blkrange', 0) > 0
+        assert_equal(peer['bytesrecv_per_msg'].get('block', 0), 0)
+        assert self.nodes[0].getpeerinfo()[0]['bytesrecv_per_msg'].get('getblkrange', 0) > 0
+
+        self.log.info("Sync node1 from node2 without block ranges")
+        connect_nodes(self.nodes[1], 2)
+        sync_blocks(self.nodes)
+        peer = self.nodes[1].getpeerinfo()[0]
+        assert peer['bytesrecv_per_msg'].get('block', 0) > 0
+        assert_equal(peer['bytesrecv_per_msg'].get('blkrange', 0), 0)
+
+        self.log.info("Check getblkrange is refused by a node without NODE_BLOCKRANGE")
+        self.nodes[2].add_p2p_connection(P2PInterface())
+        network_thread_start()
+        self.nodes[2].p2p.wait_for_verack()
+        tip = int(self.nodes[2].getbestblockhash(), 16)
+        self.nodes[2].p2p.send_message(msg_getblkrange(self.nodes[2].getblockcount() - 1, 2, tip))
+        self.nodes[2].p2p.wait_for_disconnect()
+
+        self.log.info("Check getblkrange with an overflowing height is refused")
+        self.nodes[0].add_p2p_connection(P2PInterface())
+        self.nodes[0].p2p.wait_for_verack()
+        self.nodes[0].p2p.send_message(msg_getblkrange(2**31 - 1, 2, tip))
+        self.nodes[0].p2p.sync_with_ping()
+        assert_equal(self.nodes[0].getpeerinfo()[-1]['banscore'], 20)
+        assert_equal(self.nodes[0].p2p.message_count['blkrange'], 0)
+
+if __name__ == '__main__':
+    BlockRangeTest().main()
@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Sugarchain developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test relay of new blocks to high-bandwidth compact block peers.
+
+Nodes are connected in a line 0 - 1 - 2 and blocks are mined on node 0.
+Check that node 1 announces them onwards to node 2 and reports its per-hop
+latency in getnetworkinfo, with and without -fastblockrelay.
+"""
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, connect_nodes_bi, sync_blocks
+
+class FastBlockRelayTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 3
+
+    def setup_network(self):
+        self.setup_nodes()
+        connect_nodes_bi(self.nodes, 0, 1)
+        connect_nodes_bi(self.nodes, 1, 2)
+
+    def relay_blocks(self, count):
+        for _ in range(count):
+            self.nodes[0].generate(1)
+            sync_blocks(self.nodes)
+
+    def run_test(self):
+        # Leave IBD and let the nodes select each other as high-bandwidth peers
+        self.relay_blocks(5)
+
+        for fast_relay in [True, False]:
+            self.log.info("Relay blocks with -fastblockrelay=%d" % fast_relay)
+            self.restart_node(1, ["-fastblockrelay=%d" % fast_relay])
+            connect_nodes_bi(self.nodes, 0, 1)
+            connect_nodes_bi(self.nodes, 1, 2)
+            self.relay_blocks(5)
+            blockrelay = self.nodes[1].getnetworkinfo()['blockrelay']
+            assert_equal(blockrelay['fastrelay'], fast_relay)
+            assert blockrelay['blocks_relayed'] > 0
+            assert blockrelay['last_hop_latency'] >= 0
+            assert blockrelay['avg_hop_latency'] >= 0
+            self.log.info("Average per-hop latency: %.3fms" % (blockrelay['avg_hop_latency'] * 1000))
+
+        # Node 0 only relays blocks it mined itself
+        assert_equal(self.nodes[0].getnetworkinfo()['blockrelay']['blocks_relayed'], 0)
+
+if __name__ == '__main__':
+    FastBlockRelayTest().main()
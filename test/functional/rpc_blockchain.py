@@ -10,7 +10,10 @@ Test the following RPCs:
     - getdifficulty
     - getbestblockhash
     - getblockhash
+    - getblockhashes
     - getblockheader
+    - getblockheaders
+    - getblockheightbytime
     - getchaintxstats
     - getnetworkhashps
     - verifychain
@@ -43,6 +46,7 @@ class BlockchainTest(BitcoinTestFramework):
         self._test_getchaintxstats()
         self._test_gettxoutsetinfo()
         self._test_getblockheader()
+        self._test_getblockranges()
         self._test_getdifficulty()
         self._test_getnetworkhashps()
         self._test_stopatheight()
@@ -197,6 +201,28 @@ class BlockchainTest(BitcoinTestFramework):
         assert isinstance(int(header['versionHex'], 16), int)
         assert isinstance(header['difficulty'], Decimal)
 
+    def _test_getblockranges(self):
+        self.log.info("Test getblockhashes, getblockheaders and getblockheightbytime")
+        node = self.nodes[0]
+
+        hashes = node.getblockhashes(195, 10)
+        assert_equal(hashes, [node.getblockhash(h) for h in range(195, 201)])
+        headers = node.getblockheaders(195, 10)
+        assert_equal(headers, [node.getblockheader(h, False) for h in hashes])
+        assert_equal(node.getblockheaders(195, 10, "raw"), "".join(headers))
+        assert_equal(node.getblockheaders(195, 10, "json"), [node.getblockheader(h) for h in hashes])
+        assert_raises_rpc_error(-8, "Block height out of range", node.getblockhashes, 201, 1)
+        assert_raises_rpc_error(-8, "Count must be between 1 and 17280", node.getblockheaders, 0, 0)
+        assert_raises_rpc_error(-8, "Unknown format foo", node.getblockheaders, 0, 1, "foo")
+
+        time_100 = node.getblockheader(node.getblockhash(100))['time']
+        height = node.getblockheightbytime(time_100)
+        assert height <= 100
+        assert_equal(node.getblockheader(node.getblockhash(height))['time'], time_100)
+        assert_equal(node.getblockheightbytime(0), 0)
+        tip_time = node.getblockheader(node.getbestblockhash())['time']
+        assert_raises_rpc_error(-8, "Could not find block with at least the specified timestamp", node.getblockheightbytime, tip_time + 1)
+
     def _test_getdifficulty(self):
         difficulty = self.nodes[0].getdifficulty()
         # 1 hash in 2 should be valid, so difficulty should be 1/2**31
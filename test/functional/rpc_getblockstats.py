@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017-2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test getblockstats and getblockstatsrange.
+
+Test that:
+    - the statistics of a block with transactions add up
+    - a node with -blockstatsindex returns the same statistics as one without
+    - a range returns the statistics of each block in height order
+    - invalid arguments are rejected
+"""
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, assert_raises_rpc_error, sync_blocks
+
+class GetblockstatsTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [["-blockstatsindex"], []]
+
+    def run_test(self):
+        node = self.nodes[0]
+        node.generate(101)
+        node.sendtoaddress(node.getnewaddress(), 10)
+        node.sendtoaddress(node.getnewaddress(), 20)
+        node.generate(1)
+        sync_blocks(self.nodes)
+        node.syncwithvalidationinterfacequeue()
+
+        self.log.info("Check the statistics of a block with transactions")
+        stats = node.getblockstats(102)
+        assert_equal(stats['height'], 102)
+        assert_equal(stats['blockhash'], node.getblockhash(102))
+        assert_equal(stats['txs'], 3)
+        assert_equal(stats['utxo_increase'], stats['outs'] - stats['ins'])
+        assert stats['totalfee'] > 0
+        assert stats['minfee'] <= stats['medianfee'] <= stats['maxfee']
+        assert stats['minfeerate'] <= stats['feerate_percentiles'][2] <= stats['maxfeerate']
+        coinbase = node.getblock(node.getblockhash(102), 2)['tx'][0]
+        assert_equal(int(sum(out['value'] for out in coinbase['vout']) * 100000000), stats['subsidy'] + stats['totalfee'])
+
+        self.log.info("Compare the index with statistics computed from disk")
+        for height in [0, 1, 101, 102]:
+            assert_equal(node.getblockstats(height), self.nodes[1].getblockstats(height))
+        assert_equal(node.getblockstats(node.getblockhash(102)), stats)
+        assert_equal(node.getblockstats(102, ['txs', 'totalfee']), {'txs': 3, 'totalfee': stats['totalfee']})
+
+        self.log.info("Check a range of blocks")
+        res = node.getblockstatsrange(0, 102)
+        assert_equal(len(res), 103)
+        assert_equal([s['height'] for s in res], list(range(103)))
+        assert_equal(res[102], stats)
+        assert_equal(res, self.nodes[1].getblockstatsrange(0, 102))
+        assert_equal(node.getblockstatsrange(101, 102, ['txs']), [{'txs': 1}, {'txs': 3}])
+
+        self.log.info("Check invalid arguments")
+        assert_raises_rpc_error(-8, "Target block height 103 after current tip 102", node.getblockstats, 103)
+        assert_raises_rpc_error(-8, "Target block height -1 is negative", node.getblockstats, -1)
+        assert_raises_rpc_error(-5, "Block not found", node.getblockstats, "00" * 32)
+        assert_raises_rpc_error(-8, "Invalid selected statistic foo", node.getblockstats, 1, ['txs', 'foo'])
+        assert_raises_rpc_error(-8, "Invalid range", node.getblockstatsrange, 5, 4)
+        assert_raises_rpc_error(-8, "Target block height 103 after current tip 102", node.getblockstatsrange, 0, 103)
+
+if __name__ == '__main__':
+    GetblockstatsTest().main()
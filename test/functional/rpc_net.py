@@ -95,6 +95,12 @@ class NetTest(BitcoinTestFramework):
         # the address bound to on one side will be the source address for the other node
         assert_equal(peer_info[0][0]['addrbind'], peer_info[1][0]['addr'])
         assert_equal(peer_info[1][0]['addrbind'], peer_info[0][0]['addr'])
+        # check the adaptive block download statistics
+        for info in peer_info:
+            assert_greater_than_or_equal(info[0]['inflight_limit'], 16)
+            assert_greater_than_or_equal(info[0]['blocks_downloaded'], 0)
+            assert_greater_than_or_equal(info[0]['block_download_rate'], 0)
+            assert_equal(info[0]['stall_reassignments'], 0)
 
 if __name__ == '__main__':
     NetTest().main()
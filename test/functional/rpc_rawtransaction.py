@@ -8,6 +8,7 @@ Test the following RPCs:
    - createrawtransaction
    - signrawtransaction
    - sendrawtransaction
+   - sendrawtransactionbatch
    - decoderawtransaction
    - getrawtransaction
 """
@@ -160,6 +161,33 @@ class RawTransactionsTest(BitcoinTestFramework):
         # This will raise an exception since there are missing inputs
         assert_raises_rpc_error(-25, "Missing inputs", self.nodes[2].sendrawtransaction, rawtx['hex'])
 
+        ##########################################################
+        # sendrawtransactionbatch with a child before its parent #
+        ##########################################################
+        utxo = self.nodes[2].listunspent()[0]
+        inputs  = [ {'txid' : utxo['txid'], 'vout' : utxo['vout']}]
+        outputs = { self.nodes[2].getnewaddress() : utxo['amount'] - Decimal('0.001') }
+        parent  = self.nodes[2].signrawtransaction(self.nodes[2].createrawtransaction(inputs, outputs))['hex']
+        parentTx = self.nodes[2].decoderawtransaction(parent)
+        inputs  = [ {'txid' : parentTx['txid'], 'vout' : 0, 'scriptPubKey' : parentTx['vout'][0]['scriptPubKey']['hex'], 'amount' : parentTx['vout'][0]['value']}]
+        outputs = { self.nodes[0].getnewaddress() : parentTx['vout'][0]['value'] - Decimal('0.001') }
+        child   = self.nodes[2].signrawtransaction(self.nodes[2].createrawtransaction(inputs, outputs), inputs)['hex']
+
+        # Results come back in the order given, whatever order they were validated in
+        results = self.nodes[2].sendrawtransactionbatch([child, parent, rawtx['hex']])
+        assert_equal([r['accepted'] for r in results], [True, True, False])
+        assert_equal(results[1]['txid'], parentTx['txid'])
+        assert_equal(results[2]['error'], "Missing inputs")
+        assert 'error' not in results[0]
+        self.sync_all()
+        assert parentTx['txid'] in self.nodes[0].getrawmempool()
+        assert results[0]['txid'] in self.nodes[0].getrawmempool()
+
+        # Resending is harmless, and duplicates within a batch are refused
+        assert_equal(self.nodes[2].sendrawtransactionbatch([parent])[0]['accepted'], True)
+        assert_raises_rpc_error(-8, "Duplicate transaction", self.nodes[2].sendrawtransactionbatch, [parent, parent])
+        assert_raises_rpc_error(-8, "Too many transactions", self.nodes[2].sendrawtransactionbatch, [parent] * 1001)
+
         #####################################
         # getrawtransaction with block hash #
         #####################################
@@ -80,6 +80,8 @@ BASE_SCRIPTS= [
     'rpc_rawtransaction.py',
     'wallet_address_types.py',
     'feature_reindex.py',
+    'feature_addressindex.py',
+    'feature_coinstatsindex.py',
     # vv Tests less than 30s vv
     'wallet_keypool_topup.py',
     'interface_zmq.py',
@@ -102,9 +104,13 @@ BASE_SCRIPTS= [
     'p2p_disconnect_ban.py',
     'rpc_decodescript.py',
     'rpc_blockchain.py',
+    'rpc_getblockstats.py',
     'rpc_deprecated.py',
     'wallet_disable.py',
     'rpc_net.py',
+    'p2p_blockrange.py',
+    'p2p_blockfilters.py',
+    'p2p_fastblockrelay.py',
     'wallet_keypool.py',
     'p2p_mempool.py',
     'mining_prioritisetransaction.py',